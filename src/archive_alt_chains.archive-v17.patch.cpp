@@ -0,0 +1,160 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_alt_chains.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include "archive_alt_chains.h"
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  archive_alt_chain_cache::archive_alt_chain_cache():
+    m_valid(false),
+    m_version(0),
+    m_next_chain_id(1)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::add_block(const crypto::hash &id, const crypto::hash &prev_id, uint64_t height, const difficulty_type &cumulative_difficulty)
+  {
+    if (m_nodes.find(id) != m_nodes.end())
+      return;
+
+    node n;
+    n.prev_id = prev_id;
+    n.height = height;
+    n.cumulative_difficulty = cumulative_difficulty;
+    n.length = 1;
+    n.n_children = 0;
+    n.chain_id = 0;
+
+    auto parent = m_nodes.find(prev_id);
+    if (parent != m_nodes.end())
+    {
+      n.length = parent->second.length + 1;
+      // the parent no longer ends a chain, which this block continues
+      if (parent->second.n_children++ == 0)
+      {
+        m_tips.erase(prev_id);
+        n.chain_id = parent->second.chain_id;
+      }
+    }
+    if (n.chain_id == 0)
+      n.chain_id = m_next_chain_id++;
+
+    auto inserted = m_nodes.emplace(id, n).first;
+    m_tips.emplace(id, &inserted->second);
+    ++m_version;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::remove_blocks(const std::vector<crypto::hash> &ids)
+  {
+    size_t removed = 0;
+    for (const crypto::hash &id: ids)
+      removed += m_nodes.erase(id);
+    if (removed > 0)
+    {
+      recompute();
+      ++m_version;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::clear()
+  {
+    m_nodes.clear();
+    m_tips.clear();
+    m_valid = true;
+    ++m_version;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::invalidate()
+  {
+    m_nodes.clear();
+    m_tips.clear();
+    m_valid = false;
+    ++m_version;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::get_chains(std::vector<archive_alt_chain> &chains) const
+  {
+    chains.clear();
+    chains.reserve(m_tips.size());
+    for (const auto &tip: m_tips)
+    {
+      archive_alt_chain chain;
+      chain.length = tip.second->length;
+      chain.height = tip.second->height;
+      chain.cumulative_difficulty = tip.second->cumulative_difficulty;
+      chain.hash = tip.first;
+      chain.id = tip.second->chain_id;
+      chains.push_back(chain);
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_cache::recompute()
+  {
+    // children and tips
+    for (auto &n: m_nodes)
+    {
+      n.second.n_children = 0;
+      n.second.length = 0;
+    }
+    for (const auto &n: m_nodes)
+    {
+      auto parent = m_nodes.find(n.second.prev_id);
+      if (parent != m_nodes.end())
+        ++parent->second.n_children;
+    }
+    m_tips.clear();
+    for (const auto &n: m_nodes)
+      if (n.second.n_children == 0)
+        m_tips.emplace(n.first, &n.second);
+
+    // lengths: walk up to the first node with a known length, then fill in
+    // on the way back down, so every node is visited a bounded number of times
+    std::vector<node*> path;
+    for (auto &n: m_nodes)
+    {
+      node *cur = &n.second;
+      while (cur && cur->length == 0)
+      {
+        path.push_back(cur);
+        auto parent = m_nodes.find(cur->prev_id);
+        cur = parent != m_nodes.end() ? &parent->second : nullptr;
+      }
+      uint64_t length = cur ? cur->length : 0;
+      while (!path.empty())
+      {
+        path.back()->length = ++length;
+        path.pop_back();
+      }
+    }
+  }
+}
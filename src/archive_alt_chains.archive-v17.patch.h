@@ -0,0 +1,127 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_alt_chains.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto/hash.h"
+#include "cryptonote_basic/difficulty.h"
+#include "archive_record.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief summary of the daemon's alternate blockchains for the archive
+   *
+   * Holds one small node per alt block (parent, height, cumulative difficulty
+   * and the number of alt blocks below it) and the set of chain tips, i.e.
+   * alt blocks no other alt block builds on.  This is exactly the view
+   * Blockchain::get_alternative_chains() computes, without copying blocks
+   * or rehashing them.
+   *
+   * Every chain has an id that stays the same while it is extended or cut
+   * back, so consecutive views can be delta-encoded (archive_alt_delta.h).
+   * A block on a tip continues the tip's chain; any other new block, and
+   * every chain after a rebuild, starts a chain with a new id.
+   *
+   * The Block Handler keeps it current as alt blocks are added and removed.
+   * Anything that changes alt blocks behind its back must invalidate() it;
+   * the next reader then rebuilds it once from the database.
+   *
+   * Not thread safe: callers hold the blockchain lock.
+   */
+  class archive_alt_chain_cache
+  {
+  public:
+    archive_alt_chain_cache();
+
+    /**
+     * @brief records a new alt block; O(1)
+     */
+    void add_block(const crypto::hash &id, const crypto::hash &prev_id, uint64_t height, const difficulty_type &cumulative_difficulty);
+
+    /**
+     * @brief forgets alt blocks that joined the mainchain or were discarded
+     *
+     * Chains built on a removed block become shorter, so lengths are
+     * recomputed from the remaining nodes.
+     */
+    void remove_blocks(const std::vector<crypto::hash> &ids);
+
+    /**
+     * @brief marks the cache as empty and valid
+     */
+    void clear();
+
+    /**
+     * @brief marks the cache as out of date with the database
+     */
+    void invalidate();
+
+    bool is_valid() const { return m_valid; }
+
+    /**
+     * @brief changes whenever the chains get_chains() returns may have changed
+     */
+    uint64_t version() const { return m_version; }
+
+    /**
+     * @brief one entry per alt chain; O(number of chains)
+     */
+    void get_chains(std::vector<archive_alt_chain> &chains) const;
+
+    size_t num_blocks() const { return m_nodes.size(); }
+    size_t num_chains() const { return m_tips.size(); }
+
+  private:
+    struct node
+    {
+      crypto::hash prev_id;
+      uint64_t height;
+      difficulty_type cumulative_difficulty;
+      uint64_t length;       //!< this block plus its alt ancestors
+      uint64_t n_children;   //!< alt blocks building on this one
+      uint64_t chain_id;     //!< id of the chain this block was added to
+    };
+
+    void recompute();
+
+    std::unordered_map<crypto::hash, node> m_nodes;
+    std::unordered_map<crypto::hash, const node*> m_tips;
+    bool m_valid;
+    uint64_t m_version;
+    uint64_t m_next_chain_id;  //!< never reused, not even after clear()
+  };
+}
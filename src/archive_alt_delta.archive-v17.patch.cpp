@@ -0,0 +1,351 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_alt_delta.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cstring>
+
+#include "archive_alt_delta.h"
+#include "archive_json.h"
+
+namespace cryptonote
+{
+  namespace
+  {
+    bool same_chain(const archive_alt_chain &a, const archive_alt_chain &b)
+    {
+      return a.id == b.id && a.length == b.length && a.height == b.height && a.hash == b.hash && a.cumulative_difficulty == b.cumulative_difficulty;
+    }
+
+    archive_alt_chain chain_from_entry(const archive_tsv_alt_chain_entry &entry)
+    {
+      archive_alt_chain chain;
+      chain.length = entry.length;
+      chain.height = entry.top_height;
+      chain.cumulative_difficulty = difficulty_type(std::string(entry.diff, entry.diff_end));
+      chain.hash = entry.hash;
+      chain.id = entry.id;
+      return chain;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_alt_chain_is_snapshot(const char *p, const char *end)
+  {
+    static const char prefix[] = "{\"chain_height\":";
+    static const char snapshot[] = ",\"snapshot\":[";
+    if (end - p < (ptrdiff_t)(sizeof(prefix) - 1) || memcmp(p, prefix, sizeof(prefix) - 1) != 0)
+      return false;
+    p = std::find(p + sizeof(prefix) - 1, end, ',');
+    return end - p >= (ptrdiff_t)(sizeof(snapshot) - 1) && memcmp(p, snapshot, sizeof(snapshot) - 1) == 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_alt_chain_encoder::archive_alt_chain_encoder(uint64_t snapshot_interval):
+    m_snapshot_interval(snapshot_interval),
+    m_since_snapshot(0),
+    m_has_state(false)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_encoder::reset()
+  {
+    m_has_state = false;
+    m_chains.clear();
+    m_positions.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_encoder::append_chain(const archive_alt_chain &chain, std::string &out) const
+  {
+    out += "{\"id\":";
+    archive_append_uint(out, chain.id);
+    out += ",\"length\":";
+    archive_append_uint(out, chain.length);
+    out += ",\"top\":";
+    archive_append_uint(out, chain.height);
+    out += ",\"diff\":";
+    archive_append_difficulty(out, chain.cumulative_difficulty);
+    out += ",\"hash\":\"";
+    archive_append_hex(out, chain.hash.data, sizeof(chain.hash.data));
+    out += "\"}";
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_alt_chain_encoder::encode(const archive_record &record, std::string &out)
+  {
+    // header-only records read no alt chains, and leave those of the previous line as they were
+    if (record.policy == archive_record_policy::header)
+      return archive_alt_chain_info_json(record, out);
+
+    const std::vector<archive_alt_chain> &chains = record.alt_chains;
+    const bool snapshot = !m_has_state || (m_snapshot_interval != 0 && m_since_snapshot >= m_snapshot_interval);
+
+    // usual case: nothing changed since the previous line
+    if (!snapshot && chains.size() == m_chains.size() && std::equal(chains.begin(), chains.end(), m_chains.begin(), same_chain))
+    {
+      out += "{\"chain_height\":";
+      archive_append_uint(out, record.chain_height);
+      out += "}";
+      ++m_since_snapshot;
+      return out;
+    }
+
+    // chains are matched by id; without distinct ids only the array can be written
+    std::unordered_map<uint64_t, size_t> positions;
+    positions.reserve(chains.size());
+    for (size_t i = 0; i < chains.size(); ++i)
+    {
+      if (chains[i].id == 0 || !positions.emplace(chains[i].id, i).second)
+      {
+        reset();
+        return archive_alt_chain_info_json(record, out);
+      }
+    }
+
+    out += "{\"chain_height\":";
+    archive_append_uint(out, record.chain_height);
+    if (snapshot)
+    {
+      out += ",\"snapshot\":[";
+      for (size_t i = 0; i < chains.size(); ++i)
+      {
+        if (i > 0)
+          out += ",";
+        append_chain(chains[i], out);
+      }
+      out += "]";
+      m_since_snapshot = 0;
+    }
+    else
+    {
+      bool any = false;
+      for (const archive_alt_chain &chain: m_chains)
+      {
+        if (positions.find(chain.id) != positions.end())
+          continue;
+        out += any ? "," : ",\"remove\":[";
+        archive_append_uint(out, chain.id);
+        any = true;
+      }
+      if (any)
+        out += "]";
+
+      any = false;
+      for (const archive_alt_chain &chain: chains)
+      {
+        if (m_positions.find(chain.id) != m_positions.end())
+          continue;
+        out += any ? "," : ",\"add\":[";
+        append_chain(chain, out);
+        any = true;
+      }
+      if (any)
+        out += "]";
+
+      any = false;
+      for (const archive_alt_chain &chain: chains)
+      {
+        const auto previous = m_positions.find(chain.id);
+        if (previous == m_positions.end() || same_chain(chain, m_chains[previous->second]))
+          continue;
+        out += any ? "," : ",\"extend\":[";
+        append_chain(chain, out);
+        any = true;
+      }
+      if (any)
+        out += "]";
+
+      // kept chains in their previous order, then the added ones
+      bool in_order = true;
+      size_t k = 0;
+      for (const archive_alt_chain &chain: m_chains)
+      {
+        if (positions.find(chain.id) == positions.end())
+          continue;
+        if (chains[k++].id != chain.id)
+        {
+          in_order = false;
+          break;
+        }
+      }
+      if (!in_order)
+      {
+        out += ",\"order\":[";
+        for (size_t i = 0; i < chains.size(); ++i)
+        {
+          if (i > 0)
+            out += ",";
+          archive_append_uint(out, chains[i].id);
+        }
+        out += "]";
+      }
+    }
+    out += "}";
+
+    m_chains = chains;
+    m_positions.swap(positions);
+    m_has_state = true;
+    ++m_since_snapshot;
+    return out;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_alt_chain_decoder::archive_alt_chain_decoder():
+    m_has_state(false),
+    m_delta(false),
+    m_chain_height(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_alt_chain_decoder::reset()
+  {
+    m_has_state = false;
+    m_delta = false;
+    m_chain_height = 0;
+    m_chains.clear();
+    m_array.clear();
+    m_positions.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_parse_result archive_alt_chain_decoder::decode(const char *p, const char *end, uint64_t n_alt_chains)
+  {
+    // the array: this line only, delta-encoded lines before and after are unaffected
+    if (p < end && *p == '[')
+    {
+      m_delta = false;
+      uint64_t n_chains;
+      if (!archive_tsv_parse_alt_chains(p, end, &m_parsed_array, n_chains))
+        return archive_parse_result::corrupt;
+      m_array.clear();
+      for (const archive_tsv_alt_chain &parsed: m_parsed_array)
+      {
+        archive_alt_chain chain;
+        chain.length = parsed.length;
+        chain.height = parsed.height + parsed.length - 1;
+        chain.cumulative_difficulty = difficulty_type(std::string(parsed.diff, parsed.diff_end));
+        chain.hash = parsed.hash;
+        m_array.push_back(chain);
+      }
+      // deep = chain_height - start height - 1; unknown without chains
+      m_chain_height = m_parsed_array.empty() ? 0 : m_parsed_array[0].deep + m_parsed_array[0].height + 1;
+      return archive_parse_result::ok;
+    }
+
+    m_delta = true;
+    if (!archive_tsv_parse_alt_chain_delta(p, end, m_parsed))
+    {
+      m_has_state = false;
+      return archive_parse_result::corrupt;
+    }
+    if (!m_parsed.snapshot && !m_has_state)
+      return archive_parse_result::incomplete;
+    const archive_parse_result r = apply(m_parsed, n_alt_chains);
+    if (r != archive_parse_result::ok)
+      m_has_state = false;
+    return r;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_parse_result archive_alt_chain_decoder::apply(const archive_tsv_alt_chain_delta &delta, uint64_t n_alt_chains)
+  {
+    m_next.clear();
+    if (!delta.snapshot)
+    {
+      // previous chains without the removed ones, extended in place
+      std::vector<bool> kept(m_chains.size(), true);
+      for (uint64_t id: delta.removed)
+      {
+        const auto position = m_positions.find(id);
+        if (position == m_positions.end() || !kept[position->second])
+          return archive_parse_result::corrupt;
+        kept[position->second] = false;
+      }
+      m_next.reserve(m_chains.size() + delta.added.size());
+      for (size_t i = 0; i < m_chains.size(); ++i)
+        if (kept[i])
+          m_next.push_back(m_chains[i]);
+      for (const archive_tsv_alt_chain_entry &entry: delta.extended)
+      {
+        const auto position = m_positions.find(entry.id);
+        if (position == m_positions.end() || !kept[position->second])
+          return archive_parse_result::corrupt;
+        const uint64_t id = entry.id;
+        const auto next = std::find_if(m_next.begin(), m_next.end(), [id](const archive_alt_chain &chain) { return chain.id == id; });
+        *next = chain_from_entry(entry);
+      }
+      for (const archive_tsv_alt_chain_entry &entry: delta.added)
+      {
+        // ids are never reused
+        if (m_positions.find(entry.id) != m_positions.end())
+          return archive_parse_result::corrupt;
+      }
+    }
+    for (const archive_tsv_alt_chain_entry &entry: delta.added)
+      m_next.push_back(chain_from_entry(entry));
+
+    std::unordered_map<uint64_t, size_t> positions;
+    positions.reserve(m_next.size());
+    for (size_t i = 0; i < m_next.size(); ++i)
+      if (!positions.emplace(m_next[i].id, i).second)
+        return archive_parse_result::corrupt;
+
+    if (delta.has_order)
+    {
+      if (delta.order.size() != m_next.size())
+        return archive_parse_result::corrupt;
+      std::vector<archive_alt_chain> ordered;
+      ordered.reserve(m_next.size());
+      for (uint64_t id: delta.order)
+      {
+        const auto position = positions.find(id);
+        if (position == positions.end())
+          return archive_parse_result::corrupt;
+        ordered.push_back(m_next[position->second]);
+        position->second = ordered.size() - 1;
+      }
+      // a repeated id would have left another one out
+      for (size_t i = 0; i < ordered.size(); ++i)
+        if (positions[ordered[i].id] != i)
+          return archive_parse_result::corrupt;
+      m_next.swap(ordered);
+    }
+
+    // lines lost in between show here
+    if (m_next.size() != n_alt_chains)
+      return archive_parse_result::corrupt;
+
+    m_chains.swap(m_next);
+    m_positions.swap(positions);
+    m_chain_height = delta.chain_height;
+    m_has_state = true;
+    return archive_parse_result::ok;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_alt_chain_decoder::json(std::string &out) const
+  {
+    return archive_alt_chain_info_json(m_chain_height, chains(), out);
+  }
+}
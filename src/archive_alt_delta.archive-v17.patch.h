@@ -0,0 +1,161 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_alt_delta.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "archive_format.h"
+#include "archive_record.h"
+#include "archive_tsv.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief delta-encoded Alt Chains Info (output field 6)
+   *
+   * The alt chains rarely change between blocks, yet the full array is
+   * repeated on every line.  Delta-encoded, field 6 is a JSON object
+   * instead of the array:
+   *
+   *   {"chain_height":N,"snapshot":[CHAIN,...]}
+   *   {"chain_height":N,"remove":[ID,...],"add":[CHAIN,...],"extend":[CHAIN,...],"order":[ID,...]}
+   *   CHAIN = {"id":ID,"length":L,"top":H,"diff":D,"hash":"..."}
+   *
+   * A snapshot lists every chain; a delta lists only the chains that
+   * appeared, changed or went away since the previous line, and "order"
+   * only if the chains are not in the previous order with removed ones
+   * taken out and added ones appended.  Empty members are left out, so a
+   * line whose chains did not change holds only chain_height.  Ids come
+   * from archive_alt_chain_cache.  "extend" also covers a chain that was
+   * cut back.
+   *
+   * A snapshot is written first and then every snapshot_interval lines, so
+   * a reader starting anywhere needs to go back at most that far; the
+   * archive writer also starts every segment with one.  Lines of
+   * header-only records keep the "[]" array and do not count.
+   */
+  struct archive_alt_delta_config
+  {
+    bool enabled = false;
+    uint64_t snapshot_interval = 1000;  //!< lines between snapshots; 0 for only the first of each segment
+  };
+
+  /**
+   * @brief whether output field 6 is a snapshot, as archive_alt_chain_encoder writes them
+   *
+   * Only looks for "snapshot" right after chain_height, so a reader can
+   * find a place to start decoding without parsing each line.
+   */
+  bool archive_alt_chain_is_snapshot(const char *p, const char *end);
+
+  /**
+   * @brief writes output field 6 delta-encoded; one per archive, fed every line in order
+   */
+  class archive_alt_chain_encoder
+  {
+  public:
+    explicit archive_alt_chain_encoder(uint64_t snapshot_interval = 1000);
+
+    /**
+     * @brief appends output field 6 for record
+     */
+    std::string &encode(const archive_record &record, std::string &out);
+
+    /**
+     * @brief makes the next line a snapshot, e.g. after lines were lost
+     */
+    void reset();
+
+  private:
+    void append_chain(const archive_alt_chain &chain, std::string &out) const;
+
+    uint64_t m_snapshot_interval;
+    uint64_t m_since_snapshot;
+    bool m_has_state;
+    std::vector<archive_alt_chain> m_chains;  //!< of the previous line
+    std::unordered_map<uint64_t, size_t> m_positions;  //!< id to position in m_chains
+  };
+
+  /**
+   * @brief reconstructs the alt chains of each line, as archive_alt_chain_info() read them
+   *
+   * Takes output field 6 of every line in order, delta-encoded or not, so
+   * json() gives exactly the field a writer without delta encoding would
+   * have written.
+   */
+  class archive_alt_chain_decoder
+  {
+  public:
+    archive_alt_chain_decoder();
+
+    /**
+     * @param n_alt_chains output field 5, checked against a delta-encoded line
+     *
+     * @return incomplete before the first snapshot; corrupt if the line does
+     * not parse or does not fit the previous lines, after which lines are
+     * incomplete again until the next snapshot
+     */
+    archive_parse_result decode(const char *p, const char *end, uint64_t n_alt_chains);
+
+    void reset();
+
+    /**
+     * @brief whether the last line decoded was delta-encoded
+     */
+    bool delta() const { return m_delta; }
+
+    uint64_t chain_height() const { return m_chain_height; }
+    const std::vector<archive_alt_chain> &chains() const { return m_delta ? m_chains : m_array; }
+
+    /**
+     * @brief appends the Alt Chains Info JSON array of the last line decoded
+     */
+    std::string &json(std::string &out) const;
+
+  private:
+    archive_parse_result apply(const archive_tsv_alt_chain_delta &delta, uint64_t n_alt_chains);
+
+    bool m_has_state;
+    bool m_delta;
+    uint64_t m_chain_height;
+    std::vector<archive_alt_chain> m_chains;  //!< delta-encoded lines
+    std::vector<archive_alt_chain> m_array;   //!< lines with the array
+    std::unordered_map<uint64_t, size_t> m_positions;
+    archive_tsv_alt_chain_delta m_parsed;
+    std::vector<archive_tsv_alt_chain> m_parsed_array;
+    std::vector<archive_alt_chain> m_next;
+  };
+}
@@ -0,0 +1,288 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_arrivals.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+
+#include <boost/thread/lock_guard.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include "misc_log_ex.h"
+#include "archive_arrivals.h"
+#include "archive_json.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace cryptonote
+{
+  namespace
+  {
+    uint64_t now_steady_us()
+    {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const char *arrival_type_name(archive_arrival_type type)
+    {
+      return type == archive_arrival_type::fluffy ? "fluffy" : "full";
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_arrivals::archive_arrivals():
+    m_enabled(false),
+    m_n_blocks(0),
+    m_last_tick_us(0),
+    m_arrivals(0),
+    m_written(0),
+    m_late(0),
+    m_dropped_blocks(0),
+    m_dropped_peers(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_arrivals::~archive_arrivals()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::open(const archive_arrivals_config &config)
+  {
+    close();
+    m_config = config;
+    if (!m_config.enabled)
+      return;
+    // announcements recorded while closing
+    for (shard &s: m_shards)
+    {
+      boost::lock_guard<boost::mutex> lock(s.mutex);
+      s.blocks.clear();
+    }
+    m_n_blocks = 0;
+    m_file.open(m_config.file);
+    m_enabled = true;
+    MINFO("Archive block arrivals recorded to " << m_config.file.filename << ", window " << m_config.window_ms << " ms");
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::close()
+  {
+    if (!m_enabled)
+      return;
+    m_enabled = false;
+    flush(true);
+    m_file.close();
+
+    const stats s = get_stats();
+    MINFO("Archive block arrivals stopped, " << s.blocks << " blocks, " << s.arrivals << " arrivals, " << s.late << " late, "
+      << s.dropped_blocks << " blocks and " << s.dropped_peers << " peers not tracked");
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::record(const crypto::hash &id, uint64_t height, archive_arrival_type type,
+    const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &address,
+    const archive_receive_time &received)
+  {
+    if (!enabled())
+      return;
+
+    // block hashes are uniformly distributed, so any byte picks a shard
+    shard &s = m_shards[(uint8_t)id.data[0] % n_shards];
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+
+    auto it = s.blocks.find(id);
+    if (it == s.blocks.end())
+    {
+      if (m_n_blocks.load(std::memory_order_relaxed) >= m_config.max_blocks)
+      {
+        ++m_dropped_blocks;
+        return;
+      }
+      it = s.blocks.emplace(id, block_arrivals()).first;
+      it->second.height = height;
+      it->second.first = received;
+      it->second.closed = false;
+      it->second.dropped_peers = 0;
+      ++m_n_blocks;
+    }
+
+    block_arrivals &arrivals = it->second;
+    if (arrivals.closed)
+    {
+      ++m_late;
+      return;
+    }
+    for (const peer_arrival &peer: arrivals.peers)
+    {
+      if (peer.connection_id == connection_id)
+        return;
+    }
+    if (arrivals.peers.size() >= m_config.max_peers)
+    {
+      ++arrivals.dropped_peers;
+      ++m_dropped_peers;
+      return;
+    }
+
+    // receive times are taken before the shard lock, so an earlier one can come second
+    if (received.steady_us < arrivals.first.steady_us)
+    {
+      const uint64_t shift = arrivals.first.steady_us - received.steady_us;
+      for (peer_arrival &peer: arrivals.peers)
+        peer.delay_us += shift;
+      arrivals.first = received;
+    }
+    arrivals.peers.push_back({ received.steady_us - arrivals.first.steady_us, connection_id, address.str(), type });
+    ++m_arrivals;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::tick()
+  {
+    if (!enabled())
+      return;
+    const uint64_t now = now_steady_us();
+    if (now - m_last_tick_us < 250000)
+      return;
+    m_last_tick_us = now;
+    flush(false);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::flush(bool all)
+  {
+    const uint64_t now = now_steady_us();
+    const uint64_t window_us = m_config.window_ms * 1000;
+
+    // lines ordered by first announcement across shards
+    std::vector<std::pair<uint64_t, std::string>> closed;
+    for (shard &s: m_shards)
+    {
+      boost::lock_guard<boost::mutex> lock(s.mutex);
+      for (auto it = s.blocks.begin(); it != s.blocks.end(); )
+      {
+        block_arrivals &arrivals = it->second;
+        const uint64_t age_us = now > arrivals.first.steady_us ? now - arrivals.first.steady_us : 0;
+        if (!arrivals.closed && (all || age_us >= window_us))
+        {
+          closed.emplace_back(arrivals.first.steady_us, std::string());
+          format_line(it->first, arrivals, closed.back().second);
+          arrivals.closed = true;
+          // the peer list is no longer needed, only the entry
+          std::vector<peer_arrival>().swap(arrivals.peers);
+        }
+        // evicted a window after closing
+        if (arrivals.closed && (all || age_us >= 2 * window_us))
+        {
+          it = s.blocks.erase(it);
+          --m_n_blocks;
+        }
+        else
+          ++it;
+      }
+    }
+    if (closed.empty())
+      return;
+
+    std::sort(closed.begin(), closed.end(), [](const std::pair<uint64_t, std::string> &a, const std::pair<uint64_t, std::string> &b) { return a.first < b.first; });
+    std::vector<std::string> lines;
+    lines.reserve(closed.size());
+    for (std::pair<uint64_t, std::string> &c: closed)
+      lines.push_back(std::move(c.second));
+    if (m_file.write(lines.data(), lines.size()))
+      m_written += lines.size();
+    else
+      MERROR("Failed to write " << lines.size() << " block arrival lines to " << m_config.file.filename);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_arrivals::format_line(const crypto::hash &id, const block_arrivals &arrivals, std::string &line)
+  {
+    const char output_field_delimiter = '\t';
+
+    archive_append_hex(line, id.data, sizeof(id.data)); // 1
+    line += output_field_delimiter;
+    archive_append_uint(line, arrivals.height); // 2
+    line += output_field_delimiter;
+    archive_append_uint(line, arrivals.first.system_ms); // 3
+    line += output_field_delimiter;
+    archive_append_uint(line, arrivals.peers.size()); // 4
+    line += output_field_delimiter;
+    archive_append_uint(line, arrivals.dropped_peers); // 5
+    line += output_field_delimiter;
+    line += '['; // 6
+    for (size_t i = 0; i < arrivals.peers.size(); ++i)
+    {
+      const peer_arrival &peer = arrivals.peers[i];
+      if (i > 0)
+        line += ',';
+      line += '[';
+      archive_append_uint(line, peer.delay_us);
+      line += ",\"";
+      line += arrival_type_name(peer.type);
+      line += "\",\"";
+      line += peer.address;
+      line += "\",\"";
+      line += boost::uuids::to_string(peer.connection_id);
+      line += "\"]";
+    }
+    line += ']';
+    line += '\n';
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_arrivals::stats archive_arrivals::get_stats() const
+  {
+    stats s;
+    s.arrivals = m_arrivals;
+    s.blocks = m_written;
+    s.late = m_late;
+    s.dropped_blocks = m_dropped_blocks;
+    s.dropped_peers = m_dropped_peers;
+    return s;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_first_seen::archive_first_seen(size_t max_blocks):
+    m_max_blocks(std::max<size_t>(1, max_blocks))
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_receive_time archive_first_seen::first_seen(const crypto::hash &id, const archive_receive_time &received)
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    const auto inserted = m_blocks.emplace(id, received);
+    if (!inserted.second)
+      return inserted.first->second;
+
+    m_order.push_back(id);
+    if (m_order.size() > m_max_blocks)
+    {
+      m_blocks.erase(m_order.front());
+      m_order.pop_front();
+    }
+    return received;
+  }
+}
@@ -0,0 +1,193 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_arrivals.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/uuid/uuid.hpp>
+
+#include "crypto/hash.h"
+#include "net/net_utils_base.h"
+#include "archive_file.h"
+#include "archive_record.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief how a peer announced a block
+   */
+  enum class archive_arrival_type : uint8_t
+  {
+    fluffy,  //!< NOTIFY_NEW_FLUFFY_BLOCK
+    full     //!< NOTIFY_NEW_BLOCK
+  };
+
+  struct archive_arrivals_config
+  {
+    bool enabled = false;
+    archive_file_config file;   //!< one line per block, see README "Block Arrivals"
+    uint64_t window_ms = 10000;  //!< peers are recorded for this long after the first announcement
+    size_t max_peers = 256;      //!< most peers recorded per block; later ones are only counted
+    size_t max_blocks = 4096;    //!< most blocks tracked at once; new blocks beyond are ignored
+  };
+
+  /**
+   * @brief first announcement of each block by each peer
+   *
+   * The Block Handler sees a block once; later announcements of it are
+   * dropped before they reach it.  The protocol handler records every
+   * announcement here instead, keyed by block hash in a map split into
+   * shards with one mutex each, so connection threads rarely contend.
+   *
+   * A block's window opens at its first announcement.  Once it closes, the
+   * archive writer thread writes one line for the block with every peer's
+   * delay, and keeps the entry a while longer so late announcements are
+   * counted rather than starting a new window.  Entries are then evicted.
+   */
+  class archive_arrivals
+  {
+  public:
+    struct stats
+    {
+      uint64_t arrivals;       //!< announcements recorded
+      uint64_t blocks;         //!< block lines written
+      uint64_t late;           //!< announcements after a block's window closed
+      uint64_t dropped_blocks; //!< blocks not tracked because max_blocks were
+      uint64_t dropped_peers;  //!< announcements beyond max_peers of a block
+    };
+
+    archive_arrivals();
+    ~archive_arrivals();
+
+    void open(const archive_arrivals_config &config);
+
+    /**
+     * @brief writes the blocks still open and stops recording
+     */
+    void close();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief records a peer's announcement of a block; any thread
+     *
+     * A peer's repeated announcements of one block, such as the second
+     * fluffy block after missing transactions were requested, are ignored.
+     */
+    void record(const crypto::hash &id, uint64_t height, archive_arrival_type type,
+      const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &address,
+      const archive_receive_time &received);
+
+    /**
+     * @brief writes blocks whose window closed and evicts old entries; archive writer thread
+     */
+    void tick();
+
+    stats get_stats() const;
+
+  private:
+    struct peer_arrival
+    {
+      uint64_t delay_us;  //!< since the block's first announcement
+      boost::uuids::uuid connection_id;
+      std::string address;
+      archive_arrival_type type;
+    };
+
+    struct block_arrivals
+    {
+      uint64_t height;
+      archive_receive_time first;
+      bool closed;
+      uint32_t dropped_peers;
+      std::vector<peer_arrival> peers;
+    };
+
+    struct shard
+    {
+      boost::mutex mutex;
+      std::unordered_map<crypto::hash, block_arrivals> blocks;
+    };
+
+    static const size_t n_shards = 32;
+
+    void flush(bool all);
+    void format_line(const crypto::hash &id, const block_arrivals &arrivals, std::string &line);
+
+    archive_arrivals_config m_config;
+    std::atomic<bool> m_enabled;
+    shard m_shards[n_shards];
+    std::atomic<size_t> m_n_blocks;
+    archive_file m_file;
+    uint64_t m_last_tick_us;
+
+    std::atomic<uint64_t> m_arrivals;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_late;
+    std::atomic<uint64_t> m_dropped_blocks;
+    std::atomic<uint64_t> m_dropped_peers;
+  };
+
+  /**
+   * @brief when the node first received each recent block, for NRT
+   *
+   * A fluffy block with transactions missing from the pool comes in twice:
+   * the announcement, then the same block again once the missing
+   * transactions were requested and sent.  Only the second message reaches
+   * the Block Handler, so the protocol handler looks up the time of the
+   * first here.  Always on, unlike archive_arrivals, and bounded to the
+   * most recent max_blocks blocks.
+   */
+  class archive_first_seen
+  {
+  public:
+    explicit archive_first_seen(size_t max_blocks = 256);
+
+    /**
+     * @brief the first time id was seen, recording received if it was not; any thread
+     */
+    archive_receive_time first_seen(const crypto::hash &id, const archive_receive_time &received);
+
+  private:
+    boost::mutex m_mutex;
+    size_t m_max_blocks;
+    std::unordered_map<crypto::hash, archive_receive_time> m_blocks;
+    std::deque<crypto::hash> m_order;  //!< oldest first, for eviction
+  };
+}
@@ -0,0 +1,189 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_compress.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#ifdef ARCHIVE_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "archive_compress.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  archive_zstd_codec::archive_zstd_codec():
+    m_level(3),
+    m_cctx(nullptr),
+    m_dctx(nullptr),
+    m_cdict(nullptr),
+    m_ddict(nullptr)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_zstd_codec::~archive_zstd_codec()
+  {
+    reset();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_zstd_codec::available()
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_zstd_codec::reset()
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    ZSTD_freeCCtx(m_cctx);
+    ZSTD_freeDCtx(m_dctx);
+    ZSTD_freeCDict(m_cdict);
+    ZSTD_freeDDict(m_ddict);
+#endif
+    m_cctx = nullptr;
+    m_dctx = nullptr;
+    m_cdict = nullptr;
+    m_ddict = nullptr;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_zstd_codec::init(int level, const std::string &dictionary)
+  {
+    reset();
+#ifdef ARCHIVE_HAVE_ZSTD
+    m_level = level;
+    m_cctx = ZSTD_createCCtx();
+    m_dctx = ZSTD_createDCtx();
+    if (!m_cctx || !m_dctx)
+      return false;
+    if (!dictionary.empty())
+    {
+      m_cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+      m_ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+      if (!m_cdict || !m_ddict)
+      {
+        MERROR("Failed to load archive compression dictionary");
+        return false;
+      }
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_zstd_codec::compress(const std::string &in, std::string &out)
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    if (!m_cctx)
+      return false;
+    const size_t start = out.size();
+    out.resize(start + ZSTD_compressBound(in.size()));
+    const size_t r = m_cdict ?
+        ZSTD_compress_usingCDict(m_cctx, &out[start], out.size() - start, in.data(), in.size(), m_cdict) :
+        ZSTD_compressCCtx(m_cctx, &out[start], out.size() - start, in.data(), in.size(), m_level);
+    if (ZSTD_isError(r))
+    {
+      MERROR("Failed to compress archive frame: " << ZSTD_getErrorName(r));
+      out.resize(start);
+      return false;
+    }
+    out.resize(start + r);
+    return true;
+#else
+    return false;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_zstd_codec::decompress(const char *data, size_t size, std::string &out)
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    if (!m_dctx)
+      return false;
+    const unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN)
+      return false;
+    out.resize(content_size);
+    const size_t r = m_ddict ?
+        ZSTD_decompress_usingDDict(m_dctx, &out[0], out.size(), data, size, m_ddict) :
+        ZSTD_decompressDCtx(m_dctx, &out[0], out.size(), data, size);
+    if (ZSTD_isError(r) || r != content_size)
+    {
+      MERROR("Failed to decompress archive frame: " << (ZSTD_isError(r) ? ZSTD_getErrorName(r) : "size mismatch"));
+      return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  size_t archive_zstd_codec::frame_size(const char *data, size_t size)
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    const size_t r = ZSTD_findFrameCompressedSize(data, size);
+    return ZSTD_isError(r) ? 0 : r;
+#else
+    return 0;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_train_dictionary(const std::vector<std::string> &samples, size_t dictionary_size, std::string &dictionary)
+  {
+#ifdef ARCHIVE_HAVE_ZSTD
+    std::string buffer;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (const std::string &sample: samples)
+    {
+      buffer += sample;
+      sizes.push_back(sample.size());
+    }
+    dictionary.resize(dictionary_size);
+    const size_t r = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(), buffer.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(r))
+    {
+      MERROR("Failed to train archive compression dictionary: " << ZDICT_getErrorName(r));
+      return false;
+    }
+    dictionary.resize(r);
+    return true;
+#else
+    return false;
+#endif
+  }
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_compress.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace cryptonote
+{
+  /**
+   * @brief compression of archive segments
+   *
+   * Records are grouped into zstd frames of up to frame_records records.
+   * Each frame is decodable on its own, so a reader can start at any frame
+   * the segment index points at.
+   */
+  struct archive_compression_config
+  {
+    bool enabled = false;
+    int level = 3;
+    size_t frame_records = 64;       //!< most records in one frame
+    uint64_t frame_flush_ms = 0;     //!< longest a record waits for its frame to fill; 0 closes the frame at every group commit
+    std::string dictionary_filename; //!< optional trained dictionary, also needed to decode
+  };
+
+  /**
+   * @brief zstd frame compressor and decompressor with an optional dictionary
+   *
+   * Only functional when built with zstd (ARCHIVE_HAVE_ZSTD); otherwise
+   * available() is false and every call fails.
+   */
+  class archive_zstd_codec
+  {
+  public:
+    archive_zstd_codec();
+    ~archive_zstd_codec();
+
+    archive_zstd_codec(const archive_zstd_codec&) = delete;
+    archive_zstd_codec& operator=(const archive_zstd_codec&) = delete;
+
+    static bool available();
+
+    /**
+     * @param dictionary raw dictionary contents, may be empty
+     */
+    bool init(int level, const std::string &dictionary);
+
+    /**
+     * @brief appends in as one frame to out
+     */
+    bool compress(const std::string &in, std::string &out);
+
+    /**
+     * @brief replaces out with the contents of the frame at data
+     */
+    bool decompress(const char *data, size_t size, std::string &out);
+
+    /**
+     * @brief size of the frame starting at data, 0 if it is not a complete frame
+     */
+    static size_t frame_size(const char *data, size_t size);
+
+  private:
+    void reset();
+
+    int m_level;
+    ZSTD_CCtx_s *m_cctx;
+    ZSTD_DCtx_s *m_dctx;
+    ZSTD_CDict_s *m_cdict;
+    ZSTD_DDict_s *m_ddict;
+  };
+
+  /**
+   * @brief trains a zstd dictionary on sample records
+   */
+  bool archive_train_dictionary(const std::vector<std::string> &samples, size_t dictionary_size, std::string &dictionary);
+}
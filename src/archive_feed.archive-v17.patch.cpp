@@ -0,0 +1,495 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_feed.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "archive_feed.h"
+#include "archive_format.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace
+{
+  uint64_t system_now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  uint64_t steady_now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  uint64_t padded_size(uint64_t size)
+  {
+    return (size + 7) & ~(uint64_t)7;
+  }
+
+  // positions live in the mapping; 64-bit lock-free atomics are address-free, so this works across processes
+  std::atomic<uint64_t> *write_pos(const char *shm)
+  {
+    return reinterpret_cast<std::atomic<uint64_t>*>(const_cast<char*>(shm) + cryptonote::ARCHIVE_FEED_WRITE_POS_OFFSET);
+  }
+
+  std::atomic<uint64_t> *reserve_pos(const char *shm)
+  {
+    return reinterpret_cast<std::atomic<uint64_t>*>(const_cast<char*>(shm) + cryptonote::ARCHIVE_FEED_WRITE_POS_OFFSET + 8);
+  }
+
+  uint64_t header_epoch(const char *shm)
+  {
+    return cryptonote::archive_get_le(shm + 16, 8);
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  archive_feed::archive_feed():
+    m_format(0),
+    m_counter(0),
+    m_client_drops(0),
+    m_shm(nullptr),
+    m_shm_size(0),
+    m_ring_size(0),
+    m_write_pos(0),
+    m_listen_fd(-1)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_feed::~archive_feed()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed::open(const archive_feed_config &config, uint16_t format)
+  {
+    close();
+    m_config = config;
+    m_format = format;
+    m_counter = 0;
+    if (!m_config.enabled)
+      return true;
+#ifdef _WIN32
+    MWARNING("The archive feed is not available on Windows");
+    return false;
+#else
+    bool r = true;
+    if (!m_config.shm_name.empty())
+      r = open_shm() && r;
+    if (!m_config.socket_path.empty())
+      r = open_socket() && r;
+    return r;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed::open_shm()
+  {
+#ifdef _WIN32
+    return false;
+#else
+    m_ring_size = 4096;
+    while (m_ring_size < m_config.shm_bytes)
+      m_ring_size <<= 1;
+    m_shm_size = ARCHIVE_FEED_HEADER_SIZE + m_ring_size;
+
+    int fd = shm_open(m_config.shm_name.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size != m_shm_size)
+    {
+      // a different size: replace the object rather than resize it under mapped readers
+      ::close(fd);
+      shm_unlink(m_config.shm_name.c_str());
+      fd = shm_open(m_config.shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      if (fd >= 0 && ftruncate(fd, m_shm_size) != 0)
+      {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    if (fd < 0)
+    {
+      MERROR("Failed to create archive feed " << m_config.shm_name << ": " << strerror(errno));
+      return false;
+    }
+    void *p = mmap(NULL, m_shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+      MERROR("Failed to map archive feed " << m_config.shm_name << ": " << strerror(errno));
+      return false;
+    }
+    m_shm = static_cast<char*>(p);
+
+    // positions carry on from an earlier producer, so its readers only see a new epoch
+    const bool valid = archive_get_le(m_shm, 4) == ARCHIVE_FEED_MAGIC && archive_get_le(m_shm + 4, 2) == ARCHIVE_FEED_VERSION &&
+        archive_get_le(m_shm + 6, 2) == ARCHIVE_FEED_HEADER_SIZE && archive_get_le(m_shm + 8, 8) == m_ring_size;
+    m_write_pos = valid ? reserve_pos(m_shm)->load(std::memory_order_relaxed) : 0;
+
+    std::string header;
+    archive_put_le(header, ARCHIVE_FEED_MAGIC, 4);
+    archive_put_le(header, ARCHIVE_FEED_VERSION, 2);
+    archive_put_le(header, ARCHIVE_FEED_HEADER_SIZE, 2);
+    archive_put_le(header, m_ring_size, 8);
+    archive_put_le(header, system_now_ms(), 8);
+    archive_put_le(header, m_format, 2);
+    memcpy(m_shm, header.data(), header.size());
+    reserve_pos(m_shm)->store(m_write_pos, std::memory_order_relaxed);
+    write_pos(m_shm)->store(m_write_pos, std::memory_order_release);
+
+    MINFO("Archive feed publishing to shared memory " << m_config.shm_name << ", " << m_ring_size << " bytes");
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed::open_socket()
+  {
+#ifdef _WIN32
+    return false;
+#else
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (m_config.socket_path.size() >= sizeof(addr.sun_path))
+    {
+      MERROR("Archive feed socket path is too long: " << m_config.socket_path);
+      return false;
+    }
+    memcpy(addr.sun_path, m_config.socket_path.c_str(), m_config.socket_path.size());
+
+    // left behind by an earlier producer
+    unlink(m_config.socket_path.c_str());
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_fd < 0 || fcntl(m_listen_fd, F_SETFL, O_NONBLOCK) != 0 ||
+        bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen_fd, 16) != 0)
+    {
+      MERROR("Failed to listen on archive feed socket " << m_config.socket_path << ": " << strerror(errno));
+      if (m_listen_fd >= 0)
+        ::close(m_listen_fd);
+      m_listen_fd = -1;
+      return false;
+    }
+    MINFO("Archive feed listening on " << m_config.socket_path);
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed::close()
+  {
+#ifndef _WIN32
+    // the ring stays for readers to drain; a restarted producer carries on in it
+    if (m_shm)
+      munmap(m_shm, m_shm_size);
+    for (client &c: m_clients)
+      ::close(c.fd);
+    if (m_listen_fd >= 0)
+    {
+      ::close(m_listen_fd);
+      unlink(m_config.socket_path.c_str());
+    }
+#endif
+    m_shm = nullptr;
+    m_clients.clear();
+    m_listen_fd = -1;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed::ring_write(uint64_t pos, const char *data, size_t size)
+  {
+    const uint64_t offset = pos & (m_ring_size - 1);
+    const size_t first = std::min<uint64_t>(size, m_ring_size - offset);
+    memcpy(m_shm + ARCHIVE_FEED_HEADER_SIZE + offset, data, first);
+    memcpy(m_shm + ARCHIVE_FEED_HEADER_SIZE, data + first, size - first);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed::publish(uint64_t sequence, const std::string &record)
+  {
+    if (!m_shm && m_listen_fd < 0)
+      return;
+
+    m_message.clear();
+    archive_put_le(m_message, record.size(), 4);
+    archive_put_le(m_message, 0, 4);
+    archive_put_le(m_message, m_counter++, 8);
+    archive_put_le(m_message, sequence, 8);
+    m_message += record;
+
+    if (m_shm)
+    {
+      // too large for the ring: readers see the counter jump and resync
+      const uint64_t size = padded_size(m_message.size());
+      if (size <= m_ring_size / 2)
+      {
+        reserve_pos(m_shm)->store(m_write_pos + size, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        ring_write(m_write_pos, m_message.data(), m_message.size());
+        m_write_pos += size;
+        write_pos(m_shm)->store(m_write_pos, std::memory_order_release);
+      }
+    }
+
+    for (client &c: m_clients)
+    {
+      // a slow client misses records instead of holding up the writer
+      if (c.pending.size() - c.sent + m_message.size() > m_config.client_buffer_bytes)
+      {
+        ++m_client_drops;
+        continue;
+      }
+      c.pending += m_message;
+      flush_client(c);
+    }
+    m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](const client &c) { return c.fd < 0; }), m_clients.end());
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed::tick()
+  {
+#ifndef _WIN32
+    if (m_listen_fd < 0)
+      return;
+    while (true)
+    {
+      const int fd = accept(m_listen_fd, NULL, NULL);
+      if (fd < 0)
+        break;
+      if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+      {
+        ::close(fd);
+        continue;
+      }
+#ifdef SO_NOSIGPIPE
+      const int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+      MDEBUG("Archive feed client connected");
+      m_clients.push_back(client{fd, std::string(), 0});
+    }
+    for (client &c: m_clients)
+      flush_client(c);
+    m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](const client &c) { return c.fd < 0; }), m_clients.end());
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed::flush_client(client &c)
+  {
+#ifndef _WIN32
+    while (c.sent < c.pending.size())
+    {
+      const ssize_t n = send(c.fd, c.pending.data() + c.sent, c.pending.size() - c.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0)
+        c.sent += n;
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      else
+      {
+        MDEBUG("Archive feed client disconnected");
+        ::close(c.fd);
+        c.fd = -1;
+        return;
+      }
+    }
+    if (c.sent == c.pending.size())
+    {
+      c.pending.clear();
+      c.sent = 0;
+    }
+    else if (c.sent >= 1024 * 1024)
+    {
+      c.pending.erase(0, c.sent);
+      c.sent = 0;
+    }
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_feed_reader::archive_feed_reader():
+    m_shm(nullptr),
+    m_shm_size(0),
+    m_ring_size(0),
+    m_read_pos(0),
+    m_epoch(0),
+    m_format(0),
+    m_inode(0),
+    m_checked_ms(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_feed_reader::~archive_feed_reader()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed_reader::open(const std::string &shm_name)
+  {
+    close();
+    m_name = shm_name;
+#ifdef _WIN32
+    return false;
+#else
+    const int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < ARCHIVE_FEED_HEADER_SIZE)
+    {
+      ::close(fd);
+      return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    m_shm = static_cast<const char*>(p);
+    m_shm_size = st.st_size;
+    m_inode = st.st_ino;
+    m_checked_ms = steady_now_ms();
+
+    m_ring_size = archive_get_le(m_shm + 8, 8);
+    if (archive_get_le(m_shm, 4) != ARCHIVE_FEED_MAGIC || archive_get_le(m_shm + 4, 2) != ARCHIVE_FEED_VERSION ||
+        archive_get_le(m_shm + 6, 2) != ARCHIVE_FEED_HEADER_SIZE || ARCHIVE_FEED_HEADER_SIZE + m_ring_size != m_shm_size)
+    {
+      MERROR("Shared memory " << m_name << " is not an archive feed");
+      close();
+      return false;
+    }
+    m_format = archive_get_le(m_shm + 24, 2);
+    m_epoch = header_epoch(m_shm);
+    m_read_pos = write_pos(m_shm)->load(std::memory_order_acquire);
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed_reader::close()
+  {
+#ifndef _WIN32
+    if (m_shm)
+      munmap(const_cast<char*>(m_shm), m_shm_size);
+#endif
+    m_shm = nullptr;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed_reader::replaced() const
+  {
+#ifdef _WIN32
+    return false;
+#else
+    const int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    const bool r = fstat(fd, &st) == 0 && (uint64_t)st.st_ino != m_inode;
+    ::close(fd);
+    return r;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_feed_reader::rejoin()
+  {
+    if (!m_shm || replaced())
+      return open(m_name);
+    m_epoch = header_epoch(m_shm);
+    m_read_pos = write_pos(m_shm)->load(std::memory_order_acquire);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_feed_reader::ring_read(uint64_t pos, char *data, size_t size) const
+  {
+    const uint64_t offset = pos & (m_ring_size - 1);
+    const size_t first = std::min<uint64_t>(size, m_ring_size - offset);
+    memcpy(data, m_shm + ARCHIVE_FEED_HEADER_SIZE + offset, first);
+    memcpy(data + first, m_shm + ARCHIVE_FEED_HEADER_SIZE, size - first);
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_feed_reader::result archive_feed_reader::next(archive_feed_message &message)
+  {
+    // joining late is the same as an overrun: whatever came before is in the archive
+    if (!m_shm)
+      return open(m_name) ? result::overrun : result::empty;
+
+    const uint64_t w = write_pos(m_shm)->load(std::memory_order_acquire);
+    if (header_epoch(m_shm) != m_epoch)
+      return result::overrun;
+    if (w == m_read_pos)
+    {
+      // a restarted producer with a different ring size replaces the object
+      const uint64_t now = steady_now_ms();
+      if (now - m_checked_ms >= 1000)
+      {
+        m_checked_ms = now;
+        if (replaced())
+          return result::overrun;
+      }
+      return result::empty;
+    }
+    if (w - m_read_pos > m_ring_size)
+      return result::overrun;
+
+    char header[ARCHIVE_FEED_MESSAGE_HEADER_SIZE];
+    ring_read(m_read_pos, header, sizeof(header));
+    const uint64_t size = archive_get_le(header, 4);
+    if (ARCHIVE_FEED_MESSAGE_HEADER_SIZE + size > m_ring_size / 2)
+      return result::overrun;  // overwritten while we read the header
+    message.record.resize(size);
+    if (size > 0)
+      ring_read(m_read_pos + ARCHIVE_FEED_MESSAGE_HEADER_SIZE, &message.record[0], size);
+
+    // the bytes are good only if the producer had not started overwriting them by now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (reserve_pos(m_shm)->load(std::memory_order_relaxed) - m_read_pos > m_ring_size)
+      return result::overrun;
+
+    message.counter = archive_get_le(header + 8, 8);
+    message.sequence = archive_get_le(header + 16, 8);
+    m_read_pos += padded_size(ARCHIVE_FEED_MESSAGE_HEADER_SIZE + size);
+    return result::ok;
+  }
+}
@@ -0,0 +1,195 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_feed.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cryptonote
+{
+  /**
+   * @brief shared memory ring layout, all integers little-endian
+   *
+   * header, ARCHIVE_FEED_HEADER_SIZE bytes:
+   *   u32 magic "MDAF", u16 feed version, u16 header size, u64 ring size,
+   *   u64 epoch (producer start, Unix epoch milliseconds), u16 data format
+   *   (0 tsv, 1 binary), u8[30] reserved,
+   *   at ARCHIVE_FEED_WRITE_POS_OFFSET: u64 write position, u64 reserve position
+   *
+   * ring, ring size bytes (a power of two), messages back to back and
+   * wrapping around, each padded to 8 bytes:
+   *   u32 record size, u32 reserved, u64 feed counter, u64 sequence, record
+   *
+   * Positions count bytes since the ring was created and never wrap.  The
+   * producer raises the reserve position before it copies a message in and
+   * the write position after; a reader has lost the bytes at position p once
+   * reserve position - p exceeds the ring size.
+   */
+  const uint32_t ARCHIVE_FEED_MAGIC = 0x4641444d;  // "MDAF"
+  const uint16_t ARCHIVE_FEED_VERSION = 1;
+  const size_t ARCHIVE_FEED_HEADER_SIZE = 128;
+  const size_t ARCHIVE_FEED_WRITE_POS_OFFSET = 64;
+  const size_t ARCHIVE_FEED_MESSAGE_HEADER_SIZE = 24;
+
+  struct archive_feed_config
+  {
+    bool enabled = false;
+    std::string shm_name;                 //!< POSIX shared memory object, e.g. "/monerod-archive"; empty for none
+    uint64_t shm_bytes = 64 * 1024 * 1024;  //!< ring size, rounded up to a power of two
+    std::string socket_path;              //!< Unix domain socket; empty for none
+    uint64_t client_buffer_bytes = 16 * 1024 * 1024;  //!< most bytes queued for one socket client
+  };
+
+  /**
+   * @brief one published record
+   *
+   * counter increases by one per message from a producer started at epoch,
+   * so a jump means records were missed.  sequence locates the record in the
+   * archive for resyncing, see archive_sequence().
+   */
+  struct archive_feed_message
+  {
+    uint64_t counter = 0;
+    uint64_t sequence = 0;
+    std::string record;
+  };
+
+  /**
+   * @brief live publication of archive records to local consumers
+   *
+   * Fed by the archive writer thread right after each group commit, with
+   * the records as they were written.  Consumers read a shared memory ring
+   * and never block the producer: one that falls a ring behind is overrun
+   * and resyncs from the archive by sequence number.  Clients of the Unix
+   * domain socket get the same messages; one whose buffer is full misses
+   * records and sees a counter jump.
+   *
+   * Not available on Windows.
+   */
+  class archive_feed
+  {
+  public:
+    archive_feed();
+    ~archive_feed();
+
+    bool open(const archive_feed_config &config, uint16_t format);
+    void close();
+
+    void publish(uint64_t sequence, const std::string &record);
+
+    /**
+     * @brief accepts socket clients and sends what they still have queued
+     */
+    void tick();
+
+    uint64_t published() const { return m_counter; }
+    uint64_t client_drops() const { return m_client_drops; }
+
+  private:
+    struct client
+    {
+      int fd;
+      std::string pending;
+      size_t sent;
+    };
+
+    bool open_shm();
+    bool open_socket();
+    void ring_write(uint64_t pos, const char *data, size_t size);
+    void flush_client(client &c);
+
+    archive_feed_config m_config;
+    uint16_t m_format;
+    uint64_t m_counter;
+    uint64_t m_client_drops;
+
+    char *m_shm;
+    size_t m_shm_size;
+    uint64_t m_ring_size;
+    uint64_t m_write_pos;
+
+    int m_listen_fd;
+    std::vector<client> m_clients;
+    std::string m_message;
+  };
+
+  /**
+   * @brief reads the shared memory ring of an archive_feed
+   */
+  class archive_feed_reader
+  {
+  public:
+    enum class result
+    {
+      ok,
+      empty,   //!< nothing new yet
+      overrun  //!< records were lost, the producer restarted or the ring was just opened; call rejoin()
+    };
+
+    archive_feed_reader();
+    ~archive_feed_reader();
+
+    bool open(const std::string &shm_name);
+    void close();
+
+    /**
+     * @brief copies out the next message
+     */
+    result next(archive_feed_message &message);
+
+    /**
+     * @brief continues with the next message the producer publishes
+     *
+     * Remaps the ring if the producer recreated it.
+     */
+    bool rejoin();
+
+    uint64_t epoch() const { return m_epoch; }
+    uint16_t format() const { return m_format; }
+
+  private:
+    void ring_read(uint64_t pos, char *data, size_t size) const;
+    bool replaced() const;
+
+    std::string m_name;
+    const char *m_shm;
+    size_t m_shm_size;
+    uint64_t m_ring_size;
+    uint64_t m_read_pos;
+    uint64_t m_epoch;
+    uint16_t m_format;
+    uint64_t m_inode;
+    uint64_t m_checked_ms;
+  };
+}
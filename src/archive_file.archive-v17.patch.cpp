@@ -0,0 +1,307 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_file.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <boost/filesystem.hpp>
+#include "file_io_utils.h"
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "archive_file.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace
+{
+  uint64_t now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  archive_file::archive_file():
+    m_fd(-1),
+    m_size(0),
+    m_synced_size(0),
+    m_unsynced_records(0),
+    m_last_sync_ms(0),
+    m_last_reopen_check_ms(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_file::~archive_file()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::open(const archive_file_config &config)
+  {
+    close();
+    m_config = config;
+    m_last_sync_ms = now_ms();
+    return reopen();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_file::close()
+  {
+#ifndef _WIN32
+    if (m_fd >= 0)
+    {
+      if (m_unsynced_records > 0 && m_config.fsync_policy != archive_fsync_policy::none)
+        sync();
+      ::close(m_fd);
+    }
+#endif
+    m_fd = -1;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::reopen()
+  {
+#ifdef _WIN32
+    // no persistent descriptor: each write appends through epee
+    boost::system::error_code ec;
+    m_size = boost::filesystem::file_size(m_config.filename, ec);
+    if (ec)
+      m_size = 0;
+    m_fd = 0;
+    return true;
+#else
+    if (m_fd >= 0)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+    m_fd = ::open(m_config.filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+      MERROR("Failed to open archive file " << m_config.filename << ": " << strerror(errno));
+      return false;
+    }
+    struct stat st;
+    m_size = ::fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    // what was there before we opened it is not known to be durable
+    m_synced_size = 0;
+    m_last_reopen_check_ms = now_ms();
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::check_rotated()
+  {
+#ifdef _WIN32
+    return false;
+#else
+    const uint64_t now = now_ms();
+    if (now - m_last_reopen_check_ms < m_config.reopen_check_ms)
+      return false;
+    m_last_reopen_check_ms = now;
+
+    // the path no longer names our descriptor: rotated (renamed) or removed
+    struct stat path_st, fd_st;
+    if (::stat(m_config.filename.c_str(), &path_st) != 0)
+      return true;
+    if (::fstat(m_fd, &fd_st) != 0)
+      return true;
+    return path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::write(const std::string *records, size_t n_records)
+  {
+    if (n_records == 0)
+      return true;
+
+    if (m_fd < 0 || check_rotated())
+    {
+      if (m_fd >= 0)
+        MINFO("Archive file " << m_config.filename << " was rotated, reopening");
+      if (!reopen())
+        return false;
+    }
+
+#ifdef _WIN32
+    std::string buffer;
+    for (size_t i = 0; i < n_records; ++i)
+      buffer += records[i];
+    if (!epee::file_io_utils::append_string_to_file(m_config.filename, buffer))
+    {
+      MERROR("Failed to write archive file " << m_config.filename);
+      truncate(m_size);
+      return false;
+    }
+    m_size += buffer.size();
+#else
+    const uint64_t start_size = m_size;
+    std::vector<struct iovec> iov;
+    iov.reserve(std::min<size_t>(n_records, IOV_MAX));
+    size_t next = 0;
+    while (next < n_records)
+    {
+      iov.clear();
+      for (; next < n_records && iov.size() < IOV_MAX; ++next)
+      {
+        if (records[next].empty())
+          continue;
+        struct iovec v;
+        v.iov_base = const_cast<char*>(records[next].data());
+        v.iov_len = records[next].size();
+        iov.push_back(v);
+      }
+
+      // writev may write less than asked for; carry on from where it stopped
+      size_t first = 0;
+      while (first < iov.size())
+      {
+        const ssize_t written = ::writev(m_fd, iov.data() + first, iov.size() - first);
+        if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          MERROR("Failed to write archive file " << m_config.filename << ": " << strerror(errno));
+          // no torn record: whatever part of the batch got in is cut off again
+          if (m_size != start_size)
+            truncate(start_size);
+          return false;
+        }
+        m_size += written;
+        size_t left = written;
+        while (first < iov.size() && left >= iov[first].iov_len)
+          left -= iov[first++].iov_len;
+        if (left > 0)
+        {
+          iov[first].iov_base = (char*)iov[first].iov_base + left;
+          iov[first].iov_len -= left;
+        }
+      }
+    }
+#endif
+
+    maybe_sync(n_records);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::truncate(uint64_t size)
+  {
+#ifdef _WIN32
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(m_config.filename, size, ec);
+    if (ec)
+    {
+      MERROR("Failed to truncate archive file " << m_config.filename << ": " << ec.message());
+      return false;
+    }
+#else
+    if (m_fd < 0 || ::ftruncate(m_fd, size) != 0)
+    {
+      MERROR("Failed to truncate archive file " << m_config.filename << " to " << size << " bytes: " << strerror(errno));
+      return false;
+    }
+#endif
+    m_size = size;
+    m_synced_size = std::min(m_synced_size, size);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_file::maybe_sync(size_t n_records)
+  {
+    m_unsynced_records += n_records;
+    switch (m_config.fsync_policy)
+    {
+      case archive_fsync_policy::every_record:
+        sync();
+        break;
+      case archive_fsync_policy::every_n_records:
+        if (m_unsynced_records >= m_config.fsync_records)
+          sync();
+        break;
+      case archive_fsync_policy::every_t_ms:
+        tick();
+        break;
+      case archive_fsync_policy::none:
+      default:
+        break;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_file::tick()
+  {
+    if (m_config.fsync_policy == archive_fsync_policy::every_t_ms && m_unsynced_records > 0 &&
+        now_ms() - m_last_sync_ms >= m_config.fsync_interval_ms)
+      sync();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file::sync()
+  {
+    m_unsynced_records = 0;
+    m_last_sync_ms = now_ms();
+#ifdef _WIN32
+    m_synced_size = m_size;
+    return true;
+#else
+    if (m_fd < 0)
+      return false;
+#if defined(__APPLE__)
+    const int r = ::fsync(m_fd);
+#else
+    const int r = ::fdatasync(m_fd);
+#endif
+    if (r != 0)
+    {
+      MERROR("Failed to sync archive file " << m_config.filename << ": " << strerror(errno));
+      return false;
+    }
+    m_synced_size = m_size;
+    return true;
+#endif
+  }
+}
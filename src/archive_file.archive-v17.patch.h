@@ -0,0 +1,128 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_file.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cryptonote
+{
+  /**
+   * @brief when the archive file is flushed to stable storage
+   */
+  enum class archive_fsync_policy
+  {
+    none,             //!< leave it to the OS
+    every_n_records,  //!< fdatasync once fsync_records records have been written since the last sync
+    every_t_ms,       //!< fdatasync once fsync_interval_ms has passed since the last sync
+    every_record      //!< fdatasync after every write
+  };
+
+  struct archive_file_config
+  {
+    std::string filename;
+    archive_fsync_policy fsync_policy = archive_fsync_policy::none;
+    uint64_t fsync_records = 100;
+    uint64_t fsync_interval_ms = 1000;
+    uint64_t reopen_check_ms = 1000;  //!< how often to check whether the file was rotated away
+    uint64_t checkpoint_interval_ms = 1000;  //!< archive only: most often the recovery checkpoint is rewritten; 0 for none
+  };
+
+  /**
+   * @brief long-lived append-only archive file
+   *
+   * Keeps one descriptor open for the life of the writer and appends batches
+   * of records with a single writev() call (group commit).  If the file is
+   * renamed or removed by an external log rotation, the next write after the
+   * rotation check interval reopens the configured filename.  A write that
+   * fails part way is truncated off again, so the file never ends in a torn
+   * record while the writer runs.
+   */
+  class archive_file
+  {
+  public:
+    archive_file();
+    ~archive_file();
+
+    /**
+     * @brief opens (creating if needed) the file for appending
+     *
+     * Failing to open is not fatal: every write retries the open.
+     */
+    bool open(const archive_file_config &config);
+    void close();
+    bool is_open() const { return m_fd >= 0; }
+
+    /**
+     * @brief appends records in order, in as few writev() calls as possible
+     *
+     * @return false if not all bytes could be written; none of them are then left in the file
+     */
+    bool write(const std::string *records, size_t n_records);
+
+    /**
+     * @brief cuts the file back to size bytes, e.g. to drop a torn tail or an unindexed write
+     */
+    bool truncate(uint64_t size);
+
+    /**
+     * @brief applies time-based fsync policy while the writer is idle
+     */
+    void tick();
+
+    /**
+     * @brief flushes written data to stable storage now
+     */
+    bool sync();
+
+    uint64_t size() const { return m_size; }
+
+    /**
+     * @brief size of the file at the last successful flush to stable storage
+     */
+    uint64_t synced_size() const { return m_synced_size; }
+
+  private:
+    bool reopen();
+    bool check_rotated();
+    void maybe_sync(size_t n_records);
+
+    archive_file_config m_config;
+    int m_fd;
+    uint64_t m_size;
+    uint64_t m_synced_size;
+    uint64_t m_unsynced_records;
+    uint64_t m_last_sync_ms;
+    uint64_t m_last_reopen_check_ms;
+  };
+}
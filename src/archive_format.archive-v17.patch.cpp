@@ -0,0 +1,511 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_format.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "archive_alt_delta.h"
+#include "archive_format.h"
+#include "archive_json.h"
+
+namespace
+{
+  // ARCHIVE_BINARY_MAGIC as it appears in the file
+  const char record_magic[4] = { 'M', 'D', 'A', 'R' };
+
+  //-----------------------------------------------------------------------------------------------
+  struct crc32c_table
+  {
+    uint32_t t[256];
+    crc32c_table()
+    {
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+          c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        t[i] = c;
+      }
+    }
+  };
+  //-----------------------------------------------------------------------------------------------
+  void put_u8(std::string &out, uint8_t v)
+  {
+    out.push_back((char)v);
+  }
+  void put_u16(std::string &out, uint16_t v)
+  {
+    cryptonote::archive_put_le(out, v, 2);
+  }
+  void put_u32(std::string &out, uint32_t v)
+  {
+    cryptonote::archive_put_le(out, v, 4);
+  }
+  void put_u64(std::string &out, uint64_t v)
+  {
+    cryptonote::archive_put_le(out, v, 8);
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  uint32_t archive_crc32c(uint32_t crc, const void *data, size_t size)
+  {
+    const uint8_t *p = (const uint8_t*)data;
+    crc = ~crc;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    while (size >= 8)
+    {
+      uint64_t v;
+      memcpy(&v, p, 8);
+      crc = (uint32_t)_mm_crc32_u64(crc, v);
+      p += 8;
+      size -= 8;
+    }
+    while (size--)
+      crc = _mm_crc32_u8(crc, *p++);
+#else
+    static const crc32c_table table;
+    while (size--)
+      crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+#endif
+    return ~crc;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_console_line(const archive_record &record, std::string &out)
+  {
+    bool is_node_synced = (record.current_height >= record.target_height);
+
+    out += "Block Archive";
+    out += (record.is_alt_block ? " ALT " : " MAIN");
+    out += " H=";
+    archive_append_uint(out, record.block_height);
+    out += " MRT=";
+    archive_append_uint(out, record.b.timestamp);
+    out += " NRT=";
+    archive_append_uint(out, record.node_timestamp);
+    out += " n_alt_chains=";
+    archive_append_uint(out, record.alt_chains.size());
+    out += (is_node_synced ? " FULL" : " SYNC");
+    if (record.policy == archive_record_policy::header)
+      out += " HEADER";
+    else if (record.policy == archive_record_policy::sampled)
+      out += " SAMPLED";
+    out += " NCH=";
+    archive_append_uint(out, record.current_height);
+    out += " NTH=";
+    archive_append_uint(out, record.target_height);
+    return out;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_alt_chain_info_json(const archive_record &record, std::string &out)
+  {
+    return archive_alt_chain_info_json(record.chain_height, record.alt_chains, out);
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_alt_chain_info_json(uint64_t chain_height, const std::vector<archive_alt_chain> &chains, std::string &out)
+  {
+    // serialize altchains
+    //  root array start
+    out += "[";
+
+    //  each altchain
+    for (size_t i = 0; i < chains.size(); ++i)
+    {
+      const archive_alt_chain &chain = chains[i];
+      uint64_t start_height = (chain.height - chain.length + 1);
+      uint64_t deep = (chain_height - start_height - 1);
+
+      // n > 1 : add array delimiter
+      if (i > 0)
+        out += ",";
+
+      // serialize chain
+      out += "{\"length\":";
+      archive_append_uint(out, chain.length);
+      out += ",\"height\":";
+      archive_append_uint(out, start_height);
+      out += ",\"deep\":";
+      archive_append_uint(out, deep);
+      out += ",\"diff\":";
+      archive_append_difficulty(out, chain.cumulative_difficulty);
+      out += ",\"hash\":\"";
+      archive_append_hex(out, chain.hash.data, sizeof(chain.hash.data));
+      out += "\"}";
+    }
+
+    //  root array end
+    out += "]";
+    return out;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string &archive_line(const archive_record &record, std::string &out, archive_alt_chain_encoder *alt_chains)
+  {
+    // ## read archive configuration
+    const char output_field_delimiter = '\t';
+    uint64_t archive_version = ARCHIVE_VERSION;
+    const size_t line_start = out.size();
+
+    bool is_node_synced = (record.current_height >= record.target_height);
+
+    // ### make archive line
+    archive_append_uint(out, archive_version); // 1
+    out += output_field_delimiter;
+    archive_append_uint(out, record.node_timestamp); // 2
+    out += output_field_delimiter;
+    out += (record.is_alt_block ? "1" : "0"); // 3
+    out += output_field_delimiter;
+    // ### serialize block
+    if (record.policy == archive_record_policy::header)
+      archive_block_header_json(record.b, record.block_height, record.block_hash, record.n_tx_hashes, out); // 4
+    else if (!archive_block_json(record.b, out) && !archive_block_json_reference(record.b, out)) // 4
+      out += "{}";
+    out += output_field_delimiter;
+    archive_append_uint(out, record.alt_chains.size()); // 5
+    out += output_field_delimiter;
+    if (alt_chains)
+      alt_chains->encode(record, out); // 6
+    else
+      archive_alt_chain_info_json(record, out); // 6
+    out += output_field_delimiter;
+    out += (is_node_synced ? "1" : "0"); // 7
+    out += output_field_delimiter;
+    archive_append_uint(out, record.current_height); // 8
+    out += output_field_delimiter;
+    archive_append_uint(out, record.target_height); // 9
+    out += output_field_delimiter;
+    archive_append_uint(out, record.node_timestamp_steady); // 10
+    out += output_field_delimiter;
+    archive_append_uint(out, record.receive_delay); // 11
+    out += output_field_delimiter;
+    archive_append_uint(out, (uint64_t)record.policy); // 12
+    const uint32_t crc = archive_crc32c(0, out.data() + line_start, out.size() - line_start);
+    out += output_field_delimiter;
+    static const char hex[] = "0123456789abcdef";
+    for (int shift = 28; shift >= 0; shift -= 4)
+      out += hex[(crc >> shift) & 0xf]; // 13
+    out += '\n';
+
+    return out;
+  }
+  //-----------------------------------------------------------------------------------------------
+  size_t archive_line_fields(uint64_t archive_version)
+  {
+    switch (archive_version)
+    {
+      case 11: return 9;
+      case 12: return 11;
+      case 13: return 12;
+      case 14: return 13;
+      default: return 0;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_check_line(const char *begin, const char *end)
+  {
+    // Archive Version is field 1
+    uint64_t archive_version = 0;
+    const char *p = begin;
+    for (; p < end && *p >= '0' && *p <= '9' && archive_version < ARCHIVE_VERSION; ++p)
+      archive_version = archive_version * 10 + (*p - '0');
+    const size_t n_fields = archive_line_fields(archive_version);
+    if (p == begin || p == end || *p != '\t' || n_fields == 0)
+      return false;
+
+    // JSON fields never hold a raw tab
+    const char *last_field = p + 1;
+    size_t n_tabs = 1;
+    while ((p = (const char*)memchr(last_field, '\t', end - last_field)))
+    {
+      last_field = p + 1;
+      ++n_tabs;
+    }
+    if (n_tabs + 1 != n_fields)
+      return false;
+    if (archive_version < ARCHIVE_VERSION_CRC)
+      return true;
+
+    p = last_field;
+    if (end - p != 8)
+      return false;
+    uint32_t crc = 0;
+    for (; p < end; ++p)
+    {
+      const char c = *p;
+      if (c >= '0' && c <= '9')
+        crc = (crc << 4) | (c - '0');
+      else if (c >= 'a' && c <= 'f')
+        crc = (crc << 4) | (c - 'a' + 10);
+      else
+        return false;
+    }
+    return archive_crc32c(0, begin, end - begin - 9) == crc;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_binary_record(const archive_record &record, std::string &out)
+  {
+    const bool header_only = record.policy == archive_record_policy::header;
+    const cryptonote::blobdata blob = header_only ? t_serializable_object_to_blob(static_cast<const block_header&>(record.b)) : block_to_blob(record.b);
+    if (blob.size() > ARCHIVE_BINARY_MAX_BODY_SIZE)
+      return false;
+
+    // body first, so its size and checksum are known for the header
+    std::string body;
+    body.reserve(ARCHIVE_BINARY_FIXED_SIZE + blob.size() + record.alt_chains.size() * ARCHIVE_BINARY_ALT_CHAIN_SIZE);
+
+    uint8_t flags = 0;
+    if (record.is_alt_block)
+      flags |= ARCHIVE_FLAG_ALT_BLOCK;
+    if (record.current_height >= record.target_height)
+      flags |= ARCHIVE_FLAG_NODE_SYNCED;
+    if (record.node_timestamp == 0)
+      flags |= ARCHIVE_FLAG_NRT_UNKNOWN;
+    if (header_only)
+      flags |= ARCHIVE_FLAG_HEADER_ONLY;
+    if (record.policy == archive_record_policy::sampled)
+      flags |= ARCHIVE_FLAG_SAMPLED;
+
+    put_u16(body, ARCHIVE_VERSION);
+    put_u16(body, ARCHIVE_BINARY_FIXED_SIZE);
+    put_u8(body, flags);
+    put_u8(body, 0);
+    put_u16(body, 0);
+    put_u64(body, record.node_timestamp);
+    put_u64(body, record.node_timestamp_steady);
+    put_u64(body, record.receive_delay);
+    put_u64(body, record.block_height);
+    put_u64(body, record.chain_height);
+    put_u64(body, record.current_height);
+    put_u64(body, record.target_height);
+    put_u32(body, blob.size());
+    put_u32(body, record.alt_chains.size());
+    body.append(record.block_hash.data, sizeof(record.block_hash.data));
+    put_u64(body, record.n_tx_hashes);
+    body += blob;
+    for (const archive_alt_chain &chain: record.alt_chains)
+    {
+      put_u64(body, chain.length);
+      put_u64(body, chain.height);
+      put_u64(body, (chain.cumulative_difficulty & 0xffffffffffffffff).convert_to<uint64_t>());
+      put_u64(body, ((chain.cumulative_difficulty >> 64) & 0xffffffffffffffff).convert_to<uint64_t>());
+      body.append(chain.hash.data, sizeof(chain.hash.data));
+    }
+    if (body.size() > ARCHIVE_BINARY_MAX_BODY_SIZE)
+      return false;
+
+    put_u32(out, ARCHIVE_BINARY_MAGIC);
+    put_u16(out, ARCHIVE_BINARY_VERSION);
+    put_u16(out, ARCHIVE_BINARY_HEADER_SIZE);
+    put_u32(out, body.size());
+    put_u32(out, archive_crc32c(0, body.data(), body.size()));
+    out += body;
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_format_record(const archive_record &record, archive_output_format format, std::string &out, archive_alt_chain_encoder *alt_chains)
+  {
+    if (format == archive_output_format::binary)
+      return archive_binary_record(record, out);
+    archive_line(record, out, alt_chains);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_parse_result archive_check_binary_record(const char *data, size_t size, size_t &consumed)
+  {
+    if (size < ARCHIVE_BINARY_HEADER_SIZE)
+      return archive_parse_result::incomplete;
+    if (archive_get_le(data, 4) != ARCHIVE_BINARY_MAGIC)
+      return archive_parse_result::corrupt;
+    const size_t header_size = archive_get_le(data + 6, 2);
+    const uint64_t body_size = archive_get_le(data + 8, 4);
+    if (header_size < ARCHIVE_BINARY_HEADER_SIZE || body_size < ARCHIVE_BINARY_FIXED_SIZE_V1 || body_size > ARCHIVE_BINARY_MAX_BODY_SIZE)
+      return archive_parse_result::corrupt;
+    if (size < header_size + body_size)
+      return archive_parse_result::incomplete;
+    if (archive_crc32c(0, data + header_size, body_size) != archive_get_le(data + 12, 4))
+      return archive_parse_result::corrupt;
+    consumed = header_size + body_size;
+    return archive_parse_result::ok;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_parse_result archive_parse_binary_record(const char *data, size_t size, archive_record &record, size_t &consumed)
+  {
+    if (size < ARCHIVE_BINARY_HEADER_SIZE)
+      return archive_parse_result::incomplete;
+    if (archive_get_le(data, 4) != ARCHIVE_BINARY_MAGIC)
+      return archive_parse_result::corrupt;
+    const size_t header_size = archive_get_le(data + 6, 2);
+    const uint64_t body_size = archive_get_le(data + 8, 4);
+    const uint32_t crc = archive_get_le(data + 12, 4);
+    if (header_size < ARCHIVE_BINARY_HEADER_SIZE || body_size < ARCHIVE_BINARY_FIXED_SIZE_V1 || body_size > ARCHIVE_BINARY_MAX_BODY_SIZE)
+      return archive_parse_result::corrupt;
+    if (size < header_size + body_size)
+      return archive_parse_result::incomplete;
+
+    const char *body = data + header_size;
+    if (archive_crc32c(0, body, body_size) != crc)
+      return archive_parse_result::corrupt;
+
+    const size_t fixed_size = archive_get_le(body + 2, 2);
+    if (fixed_size < ARCHIVE_BINARY_FIXED_SIZE_V1 || fixed_size > body_size)
+      return archive_parse_result::corrupt;
+    const uint8_t flags = body[4];
+    const bool header_only = flags & ARCHIVE_FLAG_HEADER_ONLY;
+    // header-only records need the hash and tx count of the extended fixed part
+    if (header_only && fixed_size < ARCHIVE_BINARY_FIXED_SIZE)
+      return archive_parse_result::corrupt;
+    record.is_alt_block = flags & ARCHIVE_FLAG_ALT_BLOCK;
+    record.policy = header_only ? archive_record_policy::header : (flags & ARCHIVE_FLAG_SAMPLED) ? archive_record_policy::sampled : archive_record_policy::full;
+    record.node_timestamp = archive_get_le(body + 8, 8);
+    record.node_timestamp_steady = archive_get_le(body + 16, 8);
+    record.receive_delay = archive_get_le(body + 24, 8);
+    record.block_height = archive_get_le(body + 32, 8);
+    record.chain_height = archive_get_le(body + 40, 8);
+    record.current_height = archive_get_le(body + 48, 8);
+    record.target_height = archive_get_le(body + 56, 8);
+    const uint64_t blob_size = archive_get_le(body + 64, 4);
+    const uint64_t n_alt_chains = archive_get_le(body + 68, 4);
+    if (fixed_size + blob_size + n_alt_chains * ARCHIVE_BINARY_ALT_CHAIN_SIZE != body_size)
+      return archive_parse_result::corrupt;
+
+    const char *p = body + fixed_size;
+    if (header_only)
+    {
+      memcpy(record.block_hash.data, body + 72, sizeof(record.block_hash.data));
+      record.n_tx_hashes = archive_get_le(body + 104, 8);
+      record.b = block();
+      if (!t_serializable_object_from_blob(static_cast<block_header&>(record.b), cryptonote::blobdata(p, blob_size)))
+        return archive_parse_result::corrupt;
+    }
+    else
+    {
+      if (!parse_and_validate_block_from_blob(cryptonote::blobdata(p, blob_size), record.b, record.block_hash))
+        return archive_parse_result::corrupt;
+      record.n_tx_hashes = record.b.tx_hashes.size();
+    }
+    p += blob_size;
+
+    record.alt_chains.resize(n_alt_chains);
+    for (archive_alt_chain &chain: record.alt_chains)
+    {
+      chain.length = archive_get_le(p, 8);
+      chain.height = archive_get_le(p + 8, 8);
+      chain.cumulative_difficulty = archive_get_le(p + 24, 8);
+      chain.cumulative_difficulty = (chain.cumulative_difficulty << 64) + archive_get_le(p + 16, 8);
+      memcpy(chain.hash.data, p + 32, sizeof(chain.hash.data));
+      p += ARCHIVE_BINARY_ALT_CHAIN_SIZE;
+    }
+
+    consumed = header_size + body_size;
+    return archive_parse_result::ok;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_binary_reader::archive_binary_reader(std::istream &in):
+    m_in(in),
+    m_pos(0),
+    m_offset(0),
+    m_corrupt_records(0),
+    m_skipped_bytes(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_binary_reader::fill()
+  {
+    if (!m_in.good())
+      return false;
+    m_buffer.erase(0, m_pos);
+    m_pos = 0;
+    const size_t old_size = m_buffer.size();
+    const size_t chunk = 1024 * 1024;
+    m_buffer.resize(old_size + chunk);
+    m_in.read(&m_buffer[old_size], chunk);
+    m_buffer.resize(old_size + m_in.gcount());
+    return m_in.gcount() > 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_binary_reader::next(archive_record &record)
+  {
+    bool resyncing = false;
+    while (true)
+    {
+      size_t consumed = 0;
+      const archive_parse_result r = archive_parse_binary_record(m_buffer.data() + m_pos, m_buffer.size() - m_pos, record, consumed);
+      if (r == archive_parse_result::ok)
+      {
+        m_pos += consumed;
+        m_offset += consumed;
+        return true;
+      }
+      if (r == archive_parse_result::incomplete)
+      {
+        if (fill())
+          continue;
+        if (m_pos >= m_buffer.size())
+          return false;
+        // a damaged size field can claim more bytes than are left; resync if
+        // another record follows, else this is a torn record at the end of the input
+        const bool more_records = std::search(m_buffer.begin() + m_pos + 1, m_buffer.end(), record_magic, record_magic + 4) != m_buffer.end();
+        if (!more_records)
+        {
+          if (!resyncing)
+            ++m_corrupt_records;
+          m_skipped_bytes += m_buffer.size() - m_pos;
+          m_offset += m_buffer.size() - m_pos;
+          m_pos = m_buffer.size();
+          return false;
+        }
+      }
+
+      // corrupt: skip ahead to the next magic
+      if (!resyncing)
+      {
+        ++m_corrupt_records;
+        resyncing = true;
+      }
+      ++m_pos;
+      ++m_offset;
+      ++m_skipped_bytes;
+      while (m_pos + 4 <= m_buffer.size() && memcmp(m_buffer.data() + m_pos, record_magic, 4) != 0)
+      {
+        ++m_pos;
+        ++m_offset;
+        ++m_skipped_bytes;
+      }
+    }
+  }
+}
@@ -0,0 +1,237 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_format.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+
+#include "archive_record.h"
+
+namespace cryptonote
+{
+  class archive_alt_chain_encoder;
+
+  /**
+   * @brief archive file formats
+   */
+  enum class archive_output_format
+  {
+    tsv,    //!< tab-delimited text lines with block JSON (see README: Archive File)
+    binary  //!< length-prefixed binary records with the native block blob
+  };
+
+  /**
+   * @brief binary record layout, all integers little-endian
+   *
+   * header, ARCHIVE_BINARY_HEADER_SIZE bytes:
+   *   u32 magic "MDAR", u16 format version, u16 header size,
+   *   u32 body size, u32 CRC32C of the body
+   *
+   * body:
+   *   u16 archive version, u16 fixed part size, u8 flags, u8[3] reserved,
+   *   u64 NRT, u64 NRT monotonic, u64 receive delay, u64 block height,
+   *   u64 mainchain height, u64 NCH, u64 NTH,
+   *   u32 block blob size, u32 n_alt_chains,
+   *   32 byte block hash, u64 n_tx_hashes (not in records of fixed size 72),
+   *   block blob (block_to_blob; the block_header alone for header-only records),
+   *   n_alt_chains x { u64 length, u64 top height, u64 difficulty low,
+   *                    u64 difficulty high, 32 byte top hash }
+   *
+   * Readers skip header and fixed body bytes they do not know, so fields can
+   * be appended to either without breaking older readers.
+   */
+  const uint32_t ARCHIVE_BINARY_MAGIC = 0x5241444d;  // "MDAR"
+  const uint16_t ARCHIVE_BINARY_VERSION = 1;
+  const size_t ARCHIVE_BINARY_HEADER_SIZE = 16;
+  const size_t ARCHIVE_BINARY_FIXED_SIZE = 112;
+  const size_t ARCHIVE_BINARY_FIXED_SIZE_V1 = 72;  //!< before block hash and n_tx_hashes
+  const size_t ARCHIVE_BINARY_ALT_CHAIN_SIZE = 64;
+  const uint32_t ARCHIVE_BINARY_MAX_BODY_SIZE = 64 * 1024 * 1024;
+
+  const uint8_t ARCHIVE_FLAG_ALT_BLOCK = 0x01;
+  const uint8_t ARCHIVE_FLAG_NODE_SYNCED = 0x02;
+  const uint8_t ARCHIVE_FLAG_NRT_UNKNOWN = 0x04;  //!< not received from the network, e.g. backfilled
+  const uint8_t ARCHIVE_FLAG_HEADER_ONLY = 0x08;  //!< archive_record_policy::header
+  const uint8_t ARCHIVE_FLAG_SAMPLED = 0x10;      //!< archive_record_policy::sampled
+
+  /**
+   * @brief archive version written in output field 1
+   *
+   * Bumped with every change of the TSV line layout:
+   * - 11: fields 1 to 9
+   * - 12: NRT Monotonic and Receive Delay, fields 10 and 11
+   * - 13: Record Policy, field 12
+   * - 14: Record CRC, field 13
+   */
+  const uint64_t ARCHIVE_VERSION = 14;
+  const uint64_t ARCHIVE_VERSION_MIN = 11;  //!< oldest version whose layout is known
+  const uint64_t ARCHIVE_VERSION_CRC = 14;  //!< first version with a Record CRC
+
+  /**
+   * @brief appends the n low bytes of v, little-endian
+   */
+  inline void archive_put_le(std::string &out, uint64_t v, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+      out.push_back((char)(v >> (8 * i)));
+  }
+
+  /**
+   * @brief reads an n byte little-endian integer
+   */
+  inline uint64_t archive_get_le(const char *p, size_t n)
+  {
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i)
+      v |= (uint64_t)(uint8_t)p[i] << (8 * i);
+    return v;
+  }
+
+  /**
+   * @brief CRC32C (Castagnoli), as used by iSCSI and ext4
+   */
+  uint32_t archive_crc32c(uint32_t crc, const void *data, size_t size);
+
+  /**
+   * @brief appends the daemon console line for a record
+   *
+   * The functions below write into a caller-owned buffer with no temporary
+   * streams, so a buffer reused across records costs no allocations.
+   *
+   * @return out
+   */
+  std::string &archive_console_line(const archive_record &record, std::string &out);
+
+  /**
+   * @brief appends the Alt Chains Info JSON (output field 6) for a record
+   */
+  std::string &archive_alt_chain_info_json(const archive_record &record, std::string &out);
+
+  /**
+   * @brief appends the Alt Chains Info JSON for chains read at mainchain height chain_height
+   */
+  std::string &archive_alt_chain_info_json(uint64_t chain_height, const std::vector<archive_alt_chain> &chains, std::string &out);
+
+  /**
+   * @brief appends the complete archive file line for a record, including the trailing newline
+   *
+   * The last field, Record CRC (output field 13), is the CRC32C of the
+   * line up to the tab before it, as 8 lowercase hex digits.
+   *
+   * @param alt_chains writes output field 6 delta-encoded if not NULL; it
+   * must see every line of the archive in order
+   */
+  std::string &archive_line(const archive_record &record, std::string &out, archive_alt_chain_encoder *alt_chains = NULL);
+
+  /**
+   * @brief number of output fields in a TSV line of an archive version
+   *
+   * @return 0 for a version outside ARCHIVE_VERSION_MIN..ARCHIVE_VERSION
+   */
+  size_t archive_line_fields(uint64_t archive_version);
+
+  /**
+   * @brief checks an archive line, without its newline, against its version
+   *
+   * The line must have exactly the fields of its Archive Version, and from
+   * ARCHIVE_VERSION_CRC on a matching Record CRC.  Lines of an unknown
+   * version fail.
+   */
+  bool archive_check_line(const char *begin, const char *end);
+
+  /**
+   * @brief appends one binary record to out
+   */
+  bool archive_binary_record(const archive_record &record, std::string &out);
+
+  /**
+   * @brief appends a record in the given format: an archive line or a binary record
+   *
+   * The archive writer and offline tools producing archives share this, so
+   * their output is identical.
+   */
+  bool archive_format_record(const archive_record &record, archive_output_format format, std::string &out, archive_alt_chain_encoder *alt_chains = NULL);
+
+  enum class archive_parse_result
+  {
+    ok,
+    incomplete,  //!< more bytes are needed
+    corrupt      //!< bad magic, size or checksum
+  };
+
+  /**
+   * @brief decodes one binary record from the start of data
+   *
+   * @param consumed receives the record size on success
+   */
+  archive_parse_result archive_parse_binary_record(const char *data, size_t size, archive_record &record, size_t &consumed);
+
+  /**
+   * @brief checks the header and CRC32C of one binary record at the start of data without decoding it
+   *
+   * @param consumed receives the record size on success
+   */
+  archive_parse_result archive_check_binary_record(const char *data, size_t size, size_t &consumed);
+
+  /**
+   * @brief reads binary records from a stream
+   *
+   * Corrupt records are counted and skipped by scanning ahead for the next
+   * record magic.
+   */
+  class archive_binary_reader
+  {
+  public:
+    explicit archive_binary_reader(std::istream &in);
+
+    /**
+     * @return false at the end of the input
+     */
+    bool next(archive_record &record);
+
+    uint64_t offset() const { return m_offset; }
+    uint64_t corrupt_records() const { return m_corrupt_records; }
+    uint64_t skipped_bytes() const { return m_skipped_bytes; }
+
+  private:
+    bool fill();
+
+    std::istream &m_in;
+    std::string m_buffer;
+    size_t m_pos;
+    uint64_t m_offset;
+    uint64_t m_corrupt_records;
+    uint64_t m_skipped_bytes;
+  };
+}
@@ -0,0 +1,214 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_json.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <limits>
+#include <sstream>
+
+#include "serialization/json_archive.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "archive_json.h"
+
+namespace
+{
+  //-----------------------------------------------------------------------------------------------
+  void append_hash(std::string &out, const crypto::hash &h)
+  {
+    out += '"';
+    cryptonote::archive_append_hex(out, h.data, sizeof(h.data));
+    out += '"';
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool append_miner_tx(const cryptonote::transaction &tx, std::string &out)
+  {
+    if (tx.version != 1 && tx.version != 2)
+      return false;
+
+    out += "{\"version\": ";
+    cryptonote::archive_append_uint(out, tx.version);
+    out += ", \"unlock_time\": ";
+    cryptonote::archive_append_uint(out, tx.unlock_time);
+
+    out += ", \"vin\": [ ";
+    for (size_t i = 0; i < tx.vin.size(); ++i)
+    {
+      if (tx.vin[i].type() != typeid(cryptonote::txin_gen))
+        return false;
+      if (i > 0)
+        out += ", ";
+      out += "{\"gen\": {\"height\": ";
+      cryptonote::archive_append_uint(out, boost::get<cryptonote::txin_gen>(tx.vin[i]).height);
+      out += "}}";
+    }
+
+    out += "], \"vout\": [ ";
+    for (size_t i = 0; i < tx.vout.size(); ++i)
+    {
+      if (tx.vout[i].target.type() != typeid(cryptonote::txout_to_key))
+        return false;
+      if (i > 0)
+        out += ", ";
+      out += "{\"amount\": ";
+      cryptonote::archive_append_uint(out, tx.vout[i].amount);
+      out += ", \"target\": {\"key\": \"";
+      const crypto::public_key &key = boost::get<cryptonote::txout_to_key>(tx.vout[i].target).key;
+      cryptonote::archive_append_hex(out, key.data, sizeof(key.data));
+      out += "\"}}";
+    }
+
+    out += "], \"extra\": [ ";
+    for (size_t i = 0; i < tx.extra.size(); ++i)
+    {
+      if (i > 0)
+        out += ", ";
+      cryptonote::archive_append_uint(out, tx.extra[i]);
+    }
+    out += "]";
+
+    if (tx.version == 1)
+    {
+      // gen inputs carry no signatures
+      if (!tx.signatures.empty())
+        return false;
+      out += ", \"signatures\": [ ]";
+    }
+    else
+    {
+      if (tx.vin.empty() || tx.rct_signatures.type != rct::RCTTypeNull)
+        return false;
+      out += ", \"rct_signatures\": {\"type\": 0}";
+    }
+    out += "}";
+    return true;
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  void archive_append_difficulty(std::string &out, const difficulty_type &v)
+  {
+    if (v <= std::numeric_limits<uint64_t>::max())
+    {
+      archive_append_uint(out, v.convert_to<uint64_t>());
+      return;
+    }
+
+    // fixed precision: no allocation
+    char buf[40];
+    char *p = buf + sizeof(buf);
+    difficulty_type d = v;
+    while (d != 0)
+    {
+      *--p = '0' + (d % 10).convert_to<unsigned>();
+      d /= 10;
+    }
+    out.append(p, buf + sizeof(buf) - p);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_append_hex(std::string &out, const void *data, size_t size)
+  {
+    static const char digits[] = "0123456789abcdef";
+    const uint8_t *p = (const uint8_t*)data;
+    const size_t start = out.size();
+    out.resize(start + 2 * size);
+    char *dst = &out[start];
+    for (size_t i = 0; i < size; ++i)
+    {
+      *dst++ = digits[p[i] >> 4];
+      *dst++ = digits[p[i] & 0x0f];
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_block_json(const block &b, std::string &out)
+  {
+    const size_t start = out.size();
+
+    out += "{\"major_version\": ";
+    archive_append_uint(out, b.major_version);
+    out += ", \"minor_version\": ";
+    archive_append_uint(out, b.minor_version);
+    out += ", \"timestamp\": ";
+    archive_append_uint(out, b.timestamp);
+    out += ", \"prev_id\": ";
+    append_hash(out, b.prev_id);
+    out += ", \"nonce\": ";
+    archive_append_uint(out, b.nonce);
+    out += ", \"miner_tx\": ";
+    if (!append_miner_tx(b.miner_tx, out))
+    {
+      out.resize(start);
+      return false;
+    }
+
+    out += ", \"tx_hashes\": [ ";
+    for (size_t i = 0; i < b.tx_hashes.size(); ++i)
+    {
+      if (i > 0)
+        out += ", ";
+      append_hash(out, b.tx_hashes[i]);
+    }
+    out += "]}";
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_block_header_json(const block_header &b, uint64_t height, const crypto::hash &hash, uint64_t n_tx_hashes, std::string &out)
+  {
+    out += "{\"major_version\": ";
+    archive_append_uint(out, b.major_version);
+    out += ", \"minor_version\": ";
+    archive_append_uint(out, b.minor_version);
+    out += ", \"timestamp\": ";
+    archive_append_uint(out, b.timestamp);
+    out += ", \"prev_id\": ";
+    append_hash(out, b.prev_id);
+    out += ", \"nonce\": ";
+    archive_append_uint(out, b.nonce);
+    out += ", \"height\": ";
+    archive_append_uint(out, height);
+    out += ", \"hash\": ";
+    append_hash(out, hash);
+    out += ", \"n_tx_hashes\": ";
+    archive_append_uint(out, n_tx_hashes);
+    out += "}";
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_block_json_reference(const block &b, std::string &out)
+  {
+    std::ostringstream block_json_buf;
+    // note: second argument to json_archive() is bool indent
+    json_archive<true> block_json(block_json_buf, false);
+    if (!::serialization::serialize(block_json, const_cast<block&>(b)))
+      return false;
+    out += block_json_buf.str();
+    return true;
+  }
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_json.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "cryptonote_basic/cryptonote_basic.h"
+#include "cryptonote_basic/difficulty.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief appends the decimal digits of v
+   */
+  inline void archive_append_uint(std::string &out, uint64_t v)
+  {
+    char buf[20];
+    char *p = buf + sizeof(buf);
+    do
+    {
+      *--p = '0' + v % 10;
+      v /= 10;
+    } while (v != 0);
+    out.append(p, buf + sizeof(buf) - p);
+  }
+
+  /**
+   * @brief appends the decimal digits of a cumulative difficulty
+   */
+  void archive_append_difficulty(std::string &out, const difficulty_type &v);
+
+  /**
+   * @brief appends size bytes as lowercase hex, two digits per byte
+   */
+  void archive_append_hex(std::string &out, const void *data, size_t size);
+
+  /**
+   * @brief appends the Block JSON (output field 4) of a block
+   *
+   * Writes the same bytes as json_archive<true> without indentation, but
+   * straight into out, so a reused buffer costs no allocations.  Only the
+   * shapes a valid block can have are handled: a v1 or v2 miner tx with
+   * gen inputs, to-key outputs and no ring signatures.
+   *
+   * @return false if the block has another shape; out is then unchanged
+   */
+  bool archive_block_json(const block &b, std::string &out);
+
+  /**
+   * @brief appends the Block JSON of a header-only record
+   *
+   * The header fields in the same spacing as archive_block_json(), followed
+   * by height, hash and n_tx_hashes in place of miner_tx and tx_hashes.
+   */
+  void archive_block_header_json(const block_header &b, uint64_t height, const crypto::hash &hash, uint64_t n_tx_hashes, std::string &out);
+
+  /**
+   * @brief appends the Block JSON of a block using json_archive
+   *
+   * Reference for archive_block_json() and fallback for blocks it does not
+   * handle.
+   *
+   * @return false if serialization failed; out is then unchanged
+   */
+  bool archive_block_json_reference(const block &b, std::string &out);
+}
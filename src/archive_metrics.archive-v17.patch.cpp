@@ -0,0 +1,274 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_metrics.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "archive_metrics.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace cryptonote
+{
+  archive_histogram::archive_histogram(): m_sum(0)
+  {
+    for (std::atomic<uint64_t> &count: m_counts)
+      count.store(0, std::memory_order_relaxed);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_histogram::bucket_max(size_t bucket)
+  {
+    if (bucket < 2 * SUB_BUCKETS)
+      return bucket;
+    const unsigned e = 4 + (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS;
+    const uint64_t m = SUB_BUCKETS + (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS;
+    // wraps to 2^64 - 1 for the last bucket
+    return ((m + 1) << (e - 3)) - 1;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_histogram::read(snapshot &s) const
+  {
+    s.count = 0;
+    for (size_t i = 0; i < N_BUCKETS; ++i)
+    {
+      s.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+      s.count += s.counts[i];
+    }
+    s.sum = m_sum.load(std::memory_order_relaxed);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_histogram::snapshot::quantile(double q) const
+  {
+    if (count == 0)
+      return 0;
+    const uint64_t rank = std::min<uint64_t>(std::max<uint64_t>((uint64_t)std::ceil(q * count), 1), count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < N_BUCKETS; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+        return bucket_max(i);
+    }
+    return max();
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_histogram::snapshot::max() const
+  {
+    for (size_t i = N_BUCKETS; i > 0; --i)
+      if (counts[i - 1] != 0)
+        return bucket_max(i - 1);
+    return 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_histogram::snapshot::count_below(uint64_t value) const
+  {
+    // powers of two start a bucket, so the buckets below it hold exactly the smaller values
+    const size_t end = bucket(value);
+    uint64_t n = 0;
+    for (size_t i = 0; i < end; ++i)
+      n += counts[i];
+    return n;
+  }
+  //-----------------------------------------------------------------------------------------------
+  const char *archive_stage_name(archive_stage stage)
+  {
+    switch (stage)
+    {
+      case archive_stage::archive_block: return "archive_block";
+      case archive_stage::alt_chain_info: return "alt_chain_info";
+      case archive_stage::serialize: return "serialize";
+      case archive_stage::write: return "write";
+      default: return "unknown";
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_metrics_append_histogram(std::string &out, const std::string &name, const std::string &labels, const archive_histogram::snapshot &s, double seconds_per_unit, unsigned min_exp, unsigned max_exp)
+  {
+    char value[64];
+    const std::string sep = labels.empty() ? "" : ",";
+    for (unsigned e = min_exp; e <= max_exp && e < 64; ++e)
+    {
+      snprintf(value, sizeof(value), "%.9g", std::ldexp(seconds_per_unit, e));
+      out += name + "_bucket{" + labels + sep + "le=\"" + value + "\"} " + std::to_string(s.count_below((uint64_t)1 << e)) + "\n";
+    }
+    out += name + "_bucket{" + labels + sep + "le=\"+Inf\"} " + std::to_string(s.count) + "\n";
+    snprintf(value, sizeof(value), "%.9g", s.sum * seconds_per_unit);
+    out += name + "_sum" + (labels.empty() ? "" : "{" + labels + "}") + " " + value + "\n";
+    out += name + "_count" + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(s.count) + "\n";
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_metrics_server::archive_metrics_server(): m_listen_fd(-1), m_stopping(false)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_metrics_server::~archive_metrics_server()
+  {
+    stop();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_metrics_server::start(const archive_metrics_config &config, std::function<std::string()> render)
+  {
+    stop();
+    m_config = config;
+    m_render = render;
+#ifdef _WIN32
+    MWARNING("Archive metrics server is not available on Windows");
+    return false;
+#else
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_config.port);
+    if (inet_pton(AF_INET, m_config.bind_address.c_str(), &addr.sin_addr) != 1)
+    {
+      MERROR("Invalid archive metrics bind address " << m_config.bind_address);
+      return false;
+    }
+
+    m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    if (m_listen_fd < 0 || setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen_fd, 4) != 0)
+    {
+      MERROR("Failed to listen for archive metrics on " << m_config.bind_address << ":" << m_config.port << ": " << strerror(errno));
+      if (m_listen_fd >= 0)
+        ::close(m_listen_fd);
+      m_listen_fd = -1;
+      return false;
+    }
+
+    m_stopping = false;
+    try
+    {
+      m_thread = boost::thread(&archive_metrics_server::run, this);
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to start archive metrics thread: " << e.what());
+      ::close(m_listen_fd);
+      m_listen_fd = -1;
+      return false;
+    }
+    MINFO("Archive metrics served on http://" << m_config.bind_address << ":" << m_config.port << "/metrics");
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_metrics_server::stop()
+  {
+#ifndef _WIN32
+    m_stopping = true;
+    if (m_thread.joinable())
+      m_thread.join();
+    if (m_listen_fd >= 0)
+      ::close(m_listen_fd);
+    m_listen_fd = -1;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_metrics_server::run()
+  {
+#ifndef _WIN32
+    while (!m_stopping)
+    {
+      struct pollfd pfd = { m_listen_fd, POLLIN, 0 };
+      if (poll(&pfd, 1, 200) <= 0)
+        continue;
+      const int fd = accept(m_listen_fd, NULL, NULL);
+      if (fd < 0)
+        continue;
+      serve(fd);
+      ::close(fd);
+    }
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_metrics_server::serve(int fd)
+  {
+#ifndef _WIN32
+    // a scraper that stalls only holds this thread up to the timeout
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+      const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+        return;
+      request.append(buf, n);
+    }
+
+    std::string response;
+    if (request.compare(0, 4, "GET ") != 0)
+    {
+      response = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else
+    {
+      const std::string body = m_render();
+      response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+      response += body;
+    }
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+      const ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        return;
+      sent += n;
+    }
+#endif
+  }
+}
@@ -0,0 +1,205 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_metrics.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <boost/thread/thread.hpp>
+
+namespace cryptonote
+{
+  /**
+   * @brief steady clock nanoseconds, for timing the archive stages
+   */
+  inline uint64_t archive_metrics_now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief log-linear histogram of non-negative values, recorded lock-free
+   *
+   * HDR-style buckets: values below 16 have a bucket each, and every power
+   * of two above is split into 8, so a bucket is at most 1/8 as wide as its
+   * smallest value.  Recording is a relaxed fetch_add on the bucket and one
+   * on the sum: no lock, no allocation, and any number of threads.
+   */
+  class archive_histogram
+  {
+  public:
+    static const size_t SUB_BUCKETS = 8;
+    static const size_t N_BUCKETS = 2 * SUB_BUCKETS + (64 - 4) * SUB_BUCKETS;
+
+    archive_histogram();
+
+    void record(uint64_t value)
+    {
+      m_counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+      m_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static size_t bucket(uint64_t value)
+    {
+      if (value < 2 * SUB_BUCKETS)
+        return value;
+      const unsigned e = 63 - leading_zeros(value);  // >= 4
+      return 2 * SUB_BUCKETS + (e - 4) * SUB_BUCKETS + ((value >> (e - 3)) - SUB_BUCKETS);
+    }
+
+    /**
+     * @brief largest value that falls into a bucket
+     */
+    static uint64_t bucket_max(size_t bucket);
+
+    /**
+     * @brief counts copied out at one point in time, each consistent on its own
+     */
+    struct snapshot
+    {
+      std::array<uint64_t, N_BUCKETS> counts;
+      uint64_t count;
+      uint64_t sum;
+
+      /**
+       * @return bucket_max() of the bucket holding the nearest-rank quantile q; 0 if empty
+       */
+      uint64_t quantile(double q) const;
+      uint64_t max() const;
+
+      /**
+       * @return samples below value, which must be a power of two
+       */
+      uint64_t count_below(uint64_t value) const;
+    };
+
+    void read(snapshot &s) const;
+
+  private:
+    static unsigned leading_zeros(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+      return __builtin_clzll(value);
+#else
+      unsigned n = 0;
+      for (uint64_t bit = (uint64_t)1 << 63; !(value & bit); bit >>= 1)
+        ++n;
+      return n;
+#endif
+    }
+
+    std::array<std::atomic<uint64_t>, N_BUCKETS> m_counts;
+    std::atomic<uint64_t> m_sum;
+  };
+
+  /**
+   * @brief timed stages of the archive, see archive_metrics
+   */
+  enum class archive_stage : size_t
+  {
+    archive_block,   //!< Blockchain::archive_block(), in the Block Handler
+    alt_chain_info,  //!< Blockchain::archive_alt_chain_info(), in the Block Handler
+    serialize,       //!< formatting one record, on a writer thread
+    write,           //!< one group commit to a sink, on a writer thread
+    count
+  };
+
+  const char *archive_stage_name(archive_stage stage);
+
+  /**
+   * @brief latency histograms of the archive, kept for the life of the daemon
+   *
+   * Stages are in nanoseconds.  NRT skew is NRT minus MRT (the block
+   * timestamp) in milliseconds, split by sign since miners' clocks can be
+   * ahead.  Counters of records, bytes, failures and queue depth are in
+   * archive_writer::stats.
+   */
+  struct archive_metrics
+  {
+    archive_histogram stages[(size_t)archive_stage::count];
+    archive_histogram nrt_skew_ms;        //!< NRT at or after MRT
+    archive_histogram nrt_skew_ahead_ms;  //!< MRT after NRT, by this much
+
+    archive_histogram &stage(archive_stage s) { return stages[(size_t)s]; }
+    const archive_histogram &stage(archive_stage s) const { return stages[(size_t)s]; }
+  };
+
+  /**
+   * @brief appends a histogram in the Prometheus text format
+   *
+   * Cumulative buckets at powers of two from 2^min_exp to 2^max_exp units,
+   * each counting the samples below it, then +Inf, _sum and _count.
+   *
+   * @param labels e.g. stage="write", or empty
+   * @param seconds_per_unit scales values and bounds to seconds
+   */
+  void archive_metrics_append_histogram(std::string &out, const std::string &name, const std::string &labels, const archive_histogram::snapshot &s, double seconds_per_unit, unsigned min_exp, unsigned max_exp);
+
+  struct archive_metrics_config
+  {
+    bool enabled = false;
+    std::string bind_address = "127.0.0.1";
+    uint16_t port = 18095;
+  };
+
+  /**
+   * @brief serves a text page over HTTP for Prometheus to scrape
+   *
+   * One thread accepts one connection at a time, answers any GET with the
+   * page render() returns and closes the connection, so nothing here runs
+   * on the archive's own threads.  Not available on Windows.
+   */
+  class archive_metrics_server
+  {
+  public:
+    archive_metrics_server();
+    ~archive_metrics_server();
+
+    bool start(const archive_metrics_config &config, std::function<std::string()> render);
+    void stop();
+
+  private:
+    void run();
+    void serve(int fd);
+
+    archive_metrics_config m_config;
+    std::function<std::string()> m_render;
+    int m_listen_fd;
+    boost::thread m_thread;
+    std::atomic<bool> m_stopping;
+  };
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_policy.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "archive_record.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief what the Archive Producer records while the node is syncing (NCH < NTH)
+   *
+   * Once the node is synced every record is a full record, whatever the policy.
+   */
+  enum class archive_sync_policy
+  {
+    full,     //!< full records, as when synced
+    header,   //!< header-only records: no miner tx, tx hashes or alt chains
+    sampled   //!< a full record every sample_interval heights, header-only records between
+  };
+
+  struct archive_policy_config
+  {
+    archive_sync_policy syncing = archive_sync_policy::full;
+    uint64_t sample_interval = 100;  //!< heights between full records, for sampled
+  };
+
+  /**
+   * @brief reads a sync policy as given to --archive-sync-policy
+   *
+   * "full", "header" or "sampled".
+   */
+  inline bool archive_parse_sync_policy(const std::string &name, archive_sync_policy &policy)
+  {
+    if (name == "full")
+      policy = archive_sync_policy::full;
+    else if (name == "header")
+      policy = archive_sync_policy::header;
+    else if (name == "sampled")
+      policy = archive_sync_policy::sampled;
+    else
+      return false;
+    return true;
+  }
+
+  /**
+   * @brief picks the record policy for one block
+   *
+   * @param is_node_synced NCH >= NTH
+   * @param height block height
+   */
+  inline archive_record_policy archive_select_policy(const archive_policy_config &config, bool is_node_synced, uint64_t height)
+  {
+    if (is_node_synced)
+      return archive_record_policy::full;
+    switch (config.syncing)
+    {
+      case archive_sync_policy::header:
+        return archive_record_policy::header;
+      case archive_sync_policy::sampled:
+        if (config.sample_interval > 1 && height % config.sample_interval != 0)
+          return archive_record_policy::header;
+        return archive_record_policy::sampled;
+      default:
+        return archive_record_policy::full;
+    }
+  }
+}
@@ -0,0 +1,219 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_queue.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace cryptonote
+{
+  /**
+   * @brief bounded lock-free ring buffer between the Archive Producer and its writer
+   *
+   * Each cell carries a sequence number which tells producers and consumers
+   * whether the cell is free for writing or holds a value ready for reading,
+   * so neither side ever takes a lock.  Any number of threads may push or
+   * pop concurrently; the Archive Producer relies on this to implement the
+   * drop-oldest overflow policy by popping from the producer side.
+   *
+   * The capacity is rounded up to the next power of two.
+   */
+  template<typename T>
+  class archive_queue
+  {
+  public:
+    explicit archive_queue(size_t capacity)
+    {
+      size_t n = 2;
+      while (n < capacity)
+        n <<= 1;
+      m_mask = n - 1;
+      m_cells.reset(new cell[n]);
+      for (size_t i = 0; i < n; ++i)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+      m_enqueue_pos.store(0, std::memory_order_relaxed);
+      m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    archive_queue(const archive_queue&) = delete;
+    archive_queue& operator=(const archive_queue&) = delete;
+
+    /**
+     * @brief moves a value into the queue
+     *
+     * @return false if the queue is full, in which case value is untouched
+     */
+    bool try_push(T &value)
+    {
+      cell *c;
+      size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        c = &m_cells[pos & m_mask];
+        const size_t seq = c->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0)
+        {
+          if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if (dif < 0)
+          return false;
+        else
+          pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+      c->data = std::move(value);
+      c->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief moves the oldest value out of the queue
+     *
+     * @return false if the queue is empty
+     */
+    bool try_pop(T &value)
+    {
+      cell *c;
+      size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        c = &m_cells[pos & m_mask];
+        const size_t seq = c->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0)
+        {
+          if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if (dif < 0)
+          return false;
+        else
+          pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      }
+      value = std::move(c->data);
+      c->data = T();
+      c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief number of queued values; exact only when the queue is quiescent
+     */
+    size_t size() const
+    {
+      const size_t enqueued = m_enqueue_pos.load(std::memory_order_acquire);
+      const size_t dequeued = m_dequeue_pos.load(std::memory_order_acquire);
+      return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+  private:
+    struct cell
+    {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    std::unique_ptr<cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+  };
+  /**
+   * @brief what the Archive Producer does when a sink writer queue is full
+   */
+  enum class archive_overflow_policy
+  {
+    block,        //!< wait for the writer to make room; no record is lost
+    drop_oldest,  //!< discard the oldest queued record
+    drop_newest   //!< discard the incoming record
+  };
+
+  /**
+   * @brief pushes a value, making room by the overflow policy when the queue is full
+   *
+   * Every value discarded, incoming or queued, is counted in dropped, and
+   * the queue depth after the push raises high_water.  Under the block
+   * policy wait() is called until there is room; it returns false to give
+   * up, e.g. when the writer is stopping, and the value is then dropped.
+   *
+   * @return false if the incoming value was dropped
+   */
+  template<typename T, typename Wait>
+  bool archive_queue_push(archive_queue<T> &queue, T &value, archive_overflow_policy policy,
+      std::atomic<uint64_t> &dropped, std::atomic<uint64_t> &high_water, Wait wait)
+  {
+    if (!queue.try_push(value))
+    {
+      switch (policy)
+      {
+        case archive_overflow_policy::drop_newest:
+          ++dropped;
+          return false;
+
+        case archive_overflow_policy::drop_oldest:
+        {
+          T oldest;
+          while (!queue.try_push(value))
+          {
+            if (queue.try_pop(oldest))
+              ++dropped;
+          }
+          break;
+        }
+
+        case archive_overflow_policy::block:
+        default:
+          while (!queue.try_push(value))
+          {
+            if (!wait())
+            {
+              ++dropped;
+              return false;
+            }
+          }
+          break;
+      }
+    }
+
+    const uint64_t depth = queue.size();
+    uint64_t high = high_water.load(std::memory_order_relaxed);
+    while (depth > high && !high_water.compare_exchange_weak(high, depth, std::memory_order_relaxed));
+    return true;
+  }
+}
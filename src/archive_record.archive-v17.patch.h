@@ -0,0 +1,118 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_record.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "crypto/hash.h"
+#include "cryptonote_basic/cryptonote_basic.h"
+#include "cryptonote_basic/difficulty.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief when a block was received from the network
+   *
+   * Taken once, where the protocol handler first decodes the block message,
+   * and carried with the block to the Archive Producer.  The steady clock
+   * companion is immune to wall clock adjustments and is used to measure
+   * how long the block waited inside the daemon before it was archived.
+   */
+  struct archive_receive_time
+  {
+    uint64_t system_ms = 0;  //!< Unix epoch milliseconds; 0 if unknown
+    uint64_t steady_us = 0;  //!< steady clock microseconds
+
+    bool is_set() const { return system_ms != 0; }
+
+    static archive_receive_time now()
+    {
+      archive_receive_time t;
+      t.system_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      t.steady_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+      return t;
+    }
+  };
+
+  /**
+   * @brief one entry of the daemon's alternate blockchain state
+   *
+   * Same data as the RPC command alt_chain_info: the top block of the chain
+   * and the number of alt blocks below it.
+   */
+  struct archive_alt_chain
+  {
+    uint64_t length;                        //!< number of blocks in the chain
+    uint64_t height;                        //!< height of the top block
+    difficulty_type cumulative_difficulty;  //!< cumulative difficulty of the top block
+    crypto::hash hash;                      //!< hash of the top block
+    uint64_t id = 0;                        //!< stable while the chain exists, see archive_alt_chain_cache; not an output field
+  };
+
+  /**
+   * @brief how much of a block a record holds (output field 12)
+   */
+  enum class archive_record_policy : uint8_t
+  {
+    full = 0,     //!< whole block and alt chains
+    header = 1,   //!< block header, height, hash and number of tx hashes only; taken while syncing
+    sampled = 2   //!< full record taken as a sample while syncing
+  };
+
+  /**
+   * @brief everything the Archive Producer captures for one incoming block
+   *
+   * The Block Handler only fills this in; serialization and filesystem
+   * recording happen later on the archive writer thread.
+   */
+  struct archive_record
+  {
+    uint64_t node_timestamp = 0;    //!< NRT, Unix epoch milliseconds
+    uint64_t node_timestamp_steady = 0;  //!< NRT on the steady clock, microseconds
+    uint64_t receive_delay = 0;     //!< microseconds from network receive to the Archive Producer
+    bool is_alt_block = false;
+    uint64_t block_height = 0;      //!< height read from the miner tx
+    crypto::hash block_hash = crypto::null_hash;
+    block b;                        //!< only the block_header part for header-only records
+    uint64_t n_tx_hashes = 0;       //!< b.tx_hashes.size(), kept for header-only records
+    archive_record_policy policy = archive_record_policy::full;
+
+    uint64_t chain_height = 0;      //!< mainchain height when alt chains were read
+    std::vector<archive_alt_chain> alt_chains;
+
+    uint64_t current_height = 0;    //!< NCH
+    uint64_t target_height = 0;     //!< NTH
+  };
+}
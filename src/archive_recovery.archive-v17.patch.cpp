@@ -0,0 +1,254 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_recovery.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "file_io_utils.h"
+#include "misc_log_ex.h"
+#include "archive_recovery.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace
+{
+  const char checkpoint_extension[] = ".ckpt";
+  const size_t read_chunk_size = 1024 * 1024;
+
+  //-----------------------------------------------------------------------------------------------
+  uint64_t file_size(const std::string &filename)
+  {
+    boost::system::error_code ec;
+    const uint64_t size = boost::filesystem::file_size(filename, ec);
+    return ec ? 0 : size;
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t scan_tsv(std::ifstream &in, uint64_t offset, uint64_t &records)
+  {
+    std::string buffer;
+    std::vector<char> chunk(read_chunk_size);
+    uint64_t valid_end = offset;
+    size_t line_start = 0;
+    while (true)
+    {
+      in.read(chunk.data(), chunk.size());
+      const size_t n = in.gcount();
+      if (n == 0)
+        break;
+      buffer.append(chunk.data(), n);
+
+      size_t newline;
+      while ((newline = buffer.find('\n', line_start)) != std::string::npos)
+      {
+        if (!cryptonote::archive_check_line(buffer.data() + line_start, buffer.data() + newline))
+          return valid_end;
+        valid_end += newline + 1 - line_start;
+        ++records;
+        line_start = newline + 1;
+      }
+      // keep only the incomplete line
+      buffer.erase(0, line_start);
+      line_start = 0;
+    }
+    return valid_end;
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t scan_binary(std::ifstream &in, uint64_t offset, uint64_t &records)
+  {
+    std::string buffer;
+    uint64_t valid_end = offset;
+    while (true)
+    {
+      buffer.resize(cryptonote::ARCHIVE_BINARY_HEADER_SIZE);
+      in.read(&buffer[0], buffer.size());
+      if ((size_t)in.gcount() < buffer.size() || cryptonote::archive_get_le(buffer.data(), 4) != cryptonote::ARCHIVE_BINARY_MAGIC)
+        return valid_end;
+      const uint64_t record_size = cryptonote::archive_get_le(buffer.data() + 6, 2) + cryptonote::archive_get_le(buffer.data() + 8, 4);
+      if (record_size < buffer.size() || record_size > cryptonote::ARCHIVE_BINARY_HEADER_SIZE + cryptonote::ARCHIVE_BINARY_MAX_BODY_SIZE)
+        return valid_end;
+      const size_t header_size = buffer.size();
+      buffer.resize(record_size);
+      in.read(&buffer[header_size], record_size - header_size);
+      if ((size_t)in.gcount() < record_size - header_size || !cryptonote::archive_check_record(buffer.data(), buffer.size(), cryptonote::archive_output_format::binary))
+        return valid_end;
+      valid_end += record_size;
+      ++records;
+    }
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  std::string archive_checkpoint_filename(const std::string &base_filename)
+  {
+    const size_t slash = base_filename.find_last_of("/\\");
+    const size_t dot = base_filename.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return base_filename + checkpoint_extension;
+    return base_filename.substr(0, dot) + checkpoint_extension;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_read_checkpoint(const std::string &filename, archive_checkpoint &checkpoint)
+  {
+    std::string data;
+    if (!boost::filesystem::exists(filename) || !epee::file_io_utils::load_file_to_string(filename, data))
+      return false;
+    if (data.size() < ARCHIVE_CHECKPOINT_SIZE || archive_get_le(data.data(), 4) != ARCHIVE_CHECKPOINT_MAGIC ||
+        archive_get_le(data.data() + 6, 2) != ARCHIVE_CHECKPOINT_SIZE ||
+        archive_crc32c(0, data.data(), ARCHIVE_CHECKPOINT_SIZE - 4) != archive_get_le(data.data() + ARCHIVE_CHECKPOINT_SIZE - 4, 4))
+    {
+      MWARNING("Ignoring damaged archive checkpoint " << filename);
+      return false;
+    }
+    checkpoint.segment = archive_get_le(data.data() + 8, 8);
+    checkpoint.offset = archive_get_le(data.data() + 16, 8);
+    checkpoint.records = archive_get_le(data.data() + 24, 8);
+    checkpoint.height = archive_get_le(data.data() + 32, 8);
+    checkpoint.time_ms = archive_get_le(data.data() + 40, 8);
+    checkpoint.tail_crc = archive_get_le(data.data() + 48, 4);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_write_checkpoint(const std::string &filename, const archive_checkpoint &checkpoint)
+  {
+    std::string data;
+    archive_put_le(data, ARCHIVE_CHECKPOINT_MAGIC, 4);
+    archive_put_le(data, ARCHIVE_CHECKPOINT_VERSION, 2);
+    archive_put_le(data, ARCHIVE_CHECKPOINT_SIZE, 2);
+    archive_put_le(data, checkpoint.segment, 8);
+    archive_put_le(data, checkpoint.offset, 8);
+    archive_put_le(data, checkpoint.records, 8);
+    archive_put_le(data, checkpoint.height, 8);
+    archive_put_le(data, checkpoint.time_ms, 8);
+    archive_put_le(data, checkpoint.tail_crc, 4);
+    archive_put_le(data, archive_crc32c(0, data.data(), data.size()), 4);
+
+    const std::string temporary = filename + ".tmp";
+    if (!epee::file_io_utils::save_string_to_file(temporary, data))
+    {
+      MERROR("Failed to write archive checkpoint " << temporary);
+      return false;
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(temporary, filename, ec);
+    if (ec)
+    {
+      MERROR("Failed to replace archive checkpoint " << filename << ": " << ec.message());
+      return false;
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_checkpoint_matches(const std::string &filename, const archive_checkpoint &checkpoint)
+  {
+    if (file_size(filename) < checkpoint.offset)
+      return false;
+    const size_t tail_size = std::min<uint64_t>(ARCHIVE_CHECKPOINT_TAIL_SIZE, checkpoint.offset);
+    char tail[ARCHIVE_CHECKPOINT_TAIL_SIZE];
+    std::ifstream in(filename, std::ios::binary);
+    in.seekg(checkpoint.offset - tail_size);
+    in.read(tail, tail_size);
+    return in && archive_crc32c(0, tail, tail_size) == checkpoint.tail_crc;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_check_record(const char *data, size_t size, archive_output_format format)
+  {
+    if (format == archive_output_format::binary)
+    {
+      size_t consumed = 0;
+      return archive_check_binary_record(data, size, consumed) == archive_parse_result::ok && consumed == size;
+    }
+    return size > 0 && data[size - 1] == '\n' && archive_check_line(data, data + size - 1);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_scan_tail(const std::string &filename, archive_output_format format, uint64_t offset, uint64_t &records)
+  {
+    records = 0;
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
+      return 0;
+    in.seekg(offset);
+    if (!in)
+      return offset;
+    return format == archive_output_format::binary ? scan_binary(in, offset, records) : scan_tsv(in, offset, records);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_tail_start(const std::string &filename, archive_output_format format, uint64_t window)
+  {
+    const uint64_t size = file_size(filename);
+    if (size <= window)
+      return 0;
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
+      return 0;
+
+    if (format == archive_output_format::tsv)
+    {
+      // the first line that starts inside the window, moving the window back over a longer line
+      std::vector<char> chunk(window);
+      for (uint64_t start = size - window; start > 0; start -= std::min(start, window))
+      {
+        in.seekg(start);
+        in.read(chunk.data(), chunk.size());
+        const char *begin = chunk.data();
+        const char *newline = (const char*)memchr(begin, '\n', in.gcount());
+        if (newline)
+          return start + (newline + 1 - begin);
+        in.clear();
+      }
+      return 0;
+    }
+
+    // headers only: a torn tail is within the window, or is found at the header walked into it
+    char header[ARCHIVE_BINARY_HEADER_SIZE];
+    uint64_t pos = 0;
+    while (pos + window < size)
+    {
+      in.seekg(pos);
+      in.read(header, sizeof(header));
+      if ((size_t)in.gcount() < sizeof(header) || archive_get_le(header, 4) != ARCHIVE_BINARY_MAGIC)
+        break;
+      const uint64_t record_size = archive_get_le(header + 6, 2) + archive_get_le(header + 8, 4);
+      if (record_size < sizeof(header) || pos + record_size > size)
+        break;
+      pos += record_size;
+    }
+    return pos;
+  }
+}
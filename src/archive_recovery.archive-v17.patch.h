@@ -0,0 +1,128 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_recovery.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "archive_format.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief checkpoint file layout, all integers little-endian, ARCHIVE_CHECKPOINT_SIZE bytes
+   *
+   *   u32 magic "MDAK", u16 checkpoint version, u16 size, u64 segment number
+   *   (0 without segments), u64 durable offset, u64 records, u64 height of
+   *   the last record, u64 time written (Unix epoch milliseconds),
+   *   u32 tail CRC, u32 CRC32C of the bytes before it
+   *
+   * The tail CRC is the CRC32C of the ARCHIVE_CHECKPOINT_TAIL_SIZE bytes
+   * before the durable offset, or all of them if there are fewer, so a
+   * checkpoint is not applied to a file that was rotated or replaced.
+   */
+  const uint32_t ARCHIVE_CHECKPOINT_MAGIC = 0x4b41444d;  // "MDAK"
+  const uint16_t ARCHIVE_CHECKPOINT_VERSION = 1;
+  const size_t ARCHIVE_CHECKPOINT_SIZE = 56;
+  const size_t ARCHIVE_CHECKPOINT_TAIL_SIZE = 64;
+
+  /**
+   * @brief the end of the archive as last known to be on stable storage
+   *
+   * Written by the archive writer after a flush, so on restart only the
+   * records after offset need to be checked for a torn tail.
+   */
+  struct archive_checkpoint
+  {
+    uint64_t segment = 0;  //!< segment number; 0 without segments
+    uint64_t offset = 0;   //!< data bytes of the (segment) file known to be durable
+    uint64_t records = 0;  //!< records in those bytes: index entries of the segment, or records counted since the file was started
+    uint64_t height = 0;   //!< height of the last of those records
+    uint64_t time_ms = 0;  //!< when the checkpoint was written, Unix epoch milliseconds
+    uint32_t tail_crc = 0;
+  };
+
+  /**
+   * @brief checkpoint filename of an archive
+   *
+   * "/opt/monerodarchive/archive.log" gives "/opt/monerodarchive/archive.ckpt".
+   */
+  std::string archive_checkpoint_filename(const std::string &base_filename);
+
+  /**
+   * @return false if there is no checkpoint or it is damaged
+   */
+  bool archive_read_checkpoint(const std::string &filename, archive_checkpoint &checkpoint);
+
+  /**
+   * @brief replaces the checkpoint
+   *
+   * Written to a temporary file which is renamed over the old one, so a
+   * crash leaves either checkpoint but never a mix.
+   */
+  bool archive_write_checkpoint(const std::string &filename, const archive_checkpoint &checkpoint);
+
+  /**
+   * @brief whether a checkpoint describes the start of this file: it is at least offset bytes long and its tail CRC matches
+   */
+  bool archive_checkpoint_matches(const std::string &filename, const archive_checkpoint &checkpoint);
+
+  /**
+   * @brief checks one complete record: a newline-terminated line matching its Record CRC, or a binary record matching its CRC32C
+   */
+  bool archive_check_record(const char *data, size_t size, archive_output_format format);
+
+  /**
+   * @brief finds where the intact records of an archive file end
+   *
+   * Records from offset on are read and checked; the first incomplete or
+   * damaged one and everything after it is the torn tail.
+   *
+   * @param offset start of a record, e.g. the checkpoint offset
+   * @param records receives the number of intact records from offset on
+   *
+   * @return the size the file should be cut back to
+   */
+  uint64_t archive_scan_tail(const std::string &filename, archive_output_format format, uint64_t offset, uint64_t &records);
+
+  /**
+   * @brief where to start archive_scan_tail() when there is no checkpoint
+   *
+   * TSV lines are found from the end, so only about the last window bytes
+   * are checked.  Binary records can only be found from the start: their
+   * headers are walked without reading the records, up to about window
+   * bytes before the end.
+   */
+  uint64_t archive_tail_start(const std::string &filename, archive_output_format format, uint64_t window = 1024 * 1024);
+}
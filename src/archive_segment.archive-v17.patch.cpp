@@ -0,0 +1,778 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_segment.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+#include "file_io_utils.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "archive_segment.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace
+{
+  const char index_extension[] = ".idx";
+  const char compressed_extension[] = ".zst";
+  const size_t segment_number_digits = 6;
+
+  //-----------------------------------------------------------------------------------------------
+  uint64_t system_now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t steady_now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  //-----------------------------------------------------------------------------------------------
+  // splits "/dir/archive.log" into "/dir/archive" and ".log"
+  void split_extension(const std::string &filename, std::string &stem, std::string &extension)
+  {
+    const size_t slash = filename.find_last_of("/\\");
+    const size_t dot = filename.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+      stem = filename;
+      extension.clear();
+      return;
+    }
+    stem = filename.substr(0, dot);
+    extension = filename.substr(dot);
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string segment_data_filename(const std::string &base_filename, uint64_t number, bool compressed)
+  {
+    std::string stem, extension;
+    split_extension(base_filename, stem, extension);
+    return cryptonote::archive_segment_filename(base_filename, number, compressed ? extension + compressed_extension : "");
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string index_header(uint64_t number, cryptonote::archive_output_format format, bool compressed)
+  {
+    std::string header;
+    cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_MAGIC, 4);
+    cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_VERSION, 2);
+    cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_HEADER_SIZE, 2);
+    cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_ENTRY_SIZE, 2);
+    cryptonote::archive_put_le(header, format == cryptonote::archive_output_format::binary ? 1 : 0, 2);
+    cryptonote::archive_put_le(header, compressed ? 1 : 0, 2);
+    cryptonote::archive_put_le(header, 0, 2);
+    cryptonote::archive_put_le(header, number, 8);
+    return header;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void put_index_entry(std::string &out, const cryptonote::archive_index_entry &entry)
+  {
+    cryptonote::archive_put_le(out, entry.height, 8);
+    cryptonote::archive_put_le(out, entry.nrt, 8);
+    cryptonote::archive_put_le(out, entry.offset, 8);
+    out.append((const char*)entry.hash_prefix, sizeof(entry.hash_prefix));
+    cryptonote::archive_put_le(out, entry.size, 4);
+    cryptonote::archive_put_le(out, entry.is_alt_block ? cryptonote::ARCHIVE_FLAG_ALT_BLOCK : 0, 1);
+    cryptonote::archive_put_le(out, 0, 3);
+    cryptonote::archive_put_le(out, entry.frame_offset, 4);
+    cryptonote::archive_put_le(out, entry.frame_size, 4);
+  }
+}
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  archive_index_entry archive_make_index_entry(const archive_record &record)
+  {
+    archive_index_entry entry;
+    entry.height = record.block_height;
+    entry.nrt = record.node_timestamp;
+    entry.is_alt_block = record.is_alt_block;
+    memcpy(entry.hash_prefix, record.block_hash.data, sizeof(entry.hash_prefix));
+    return entry;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string archive_segment_filename(const std::string &base_filename, uint64_t number, const std::string &extension)
+  {
+    std::string stem, base_extension;
+    split_extension(base_filename, stem, base_extension);
+    std::string digits = std::to_string(number);
+    if (digits.size() < segment_number_digits)
+      digits.insert(0, segment_number_digits - digits.size(), '0');
+    return stem + "." + digits + (extension.empty() ? base_extension : extension);
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::vector<archive_segment_info> archive_list_segments(const std::string &base_filename)
+  {
+    std::string stem, extension;
+    split_extension(base_filename, stem, extension);
+    const boost::filesystem::path stem_path(stem);
+    const std::string prefix = stem_path.filename().string() + ".";
+    boost::filesystem::path directory = stem_path.parent_path();
+    if (directory.empty())
+      directory = ".";
+
+    std::map<uint64_t, archive_segment_info> segments;
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+    {
+      const std::string name = it->path().filename().string();
+      if (name.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      const size_t dot = name.find('.', prefix.size());
+      if (dot == std::string::npos || dot - prefix.size() < segment_number_digits)
+        continue;
+      const std::string digits = name.substr(prefix.size(), dot - prefix.size());
+      if (digits.find_first_not_of("0123456789") != std::string::npos)
+        continue;
+      const std::string suffix = name.substr(dot);
+      const bool compressed = suffix == extension + compressed_extension;
+      if (suffix != extension && suffix != index_extension && !compressed)
+        continue;
+
+      const uint64_t number = std::stoull(digits);
+      archive_segment_info &info = segments[number];
+      if (info.data_filename.empty() || compressed)
+      {
+        info.number = number;
+        info.data_filename = segment_data_filename(base_filename, number, compressed);
+        info.index_filename = archive_segment_filename(base_filename, number, index_extension);
+        info.compressed = compressed;
+      }
+    }
+
+    std::vector<archive_segment_info> result;
+    result.reserve(segments.size());
+    for (const auto &s: segments)
+      result.push_back(s.second);
+    return result;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_segment_writer::archive_segment_writer():
+    m_format(archive_output_format::tsv),
+    m_number(0),
+    m_n_entries(0),
+    m_started_ms(0),
+    m_broken(false),
+    m_last_height(0),
+    m_recovered_bytes(0),
+    m_write_errors(0),
+    m_checkpoint_ms(0),
+    m_frame_started_ms(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_segment_writer::~archive_segment_writer()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::open(const archive_file_config &file, const archive_segment_config &segments, archive_output_format format,
+      const archive_compression_config &compression)
+  {
+    close();
+    m_file_config = file;
+    m_config = segments;
+    m_format = format;
+    m_compression = compression;
+    m_n_entries = 0;
+    m_last_height = 0;
+    m_recovered_bytes = 0;
+    m_checkpoint = archive_checkpoint();
+    m_checkpoint_ms = 0;
+    m_checkpoint_filename = m_file_config.checkpoint_interval_ms != 0 ? archive_checkpoint_filename(m_file_config.filename) : "";
+    m_tail.clear();
+    if (m_compression.enabled)
+    {
+      std::string dictionary;
+      if (!m_config.enabled())
+      {
+        MWARNING("Archive compression needs archive segments, writing uncompressed");
+        m_compression.enabled = false;
+      }
+      else if (!archive_zstd_codec::available())
+      {
+        MWARNING("Built without zstd, writing the archive uncompressed");
+        m_compression.enabled = false;
+      }
+      else if (!m_compression.dictionary_filename.empty() && !epee::file_io_utils::load_file_to_string(m_compression.dictionary_filename, dictionary))
+      {
+        MERROR("Failed to read archive compression dictionary " << m_compression.dictionary_filename << ", writing uncompressed");
+        m_compression.enabled = false;
+      }
+      else if (!m_codec.init(m_compression.level, dictionary))
+      {
+        m_compression.enabled = false;
+      }
+      m_compression.frame_records = std::max<size_t>(1, m_compression.frame_records);
+    }
+    if (!m_config.enabled())
+    {
+      recover_file();
+      return m_data.open(m_file_config);
+    }
+
+    // segment names are ours: an external rotation would leave the index pointing at the wrong file
+    m_file_config.reopen_check_ms = std::numeric_limits<uint64_t>::max();
+    return resume_last_segment();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::close()
+  {
+    // a clean stop leaves a checkpoint at the very end, so the next start has nothing to check
+    flush_frame();
+    if (m_data.is_open() && !m_checkpoint_filename.empty())
+    {
+      m_data.sync();
+      if (m_config.enabled())
+        m_index.sync();
+      maybe_checkpoint(true);
+    }
+    close_segment();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::close_segment()
+  {
+    flush_frame();
+    m_data.close();
+    m_index.close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::resume_last_segment()
+  {
+    const std::vector<archive_segment_info> segments = archive_list_segments(m_file_config.filename);
+    if (segments.empty())
+      return open_segment(1, false);
+
+    const archive_segment_info &last = segments.back();
+    boost::system::error_code ec;
+    const uint64_t data_size = boost::filesystem::file_size(last.data_filename, ec);
+    const uint64_t index_size = ec ? 0 : boost::filesystem::file_size(last.index_filename, ec);
+    archive_index_reader index;
+    // new entries are appended, so an index with entries must be in the current layout; a header-only
+    // index, e.g. from a crash right after rotation, is valid with no entries whatever its layout
+    const bool matches = !ec && index.open(last.index_filename) && index.format() == m_format && index.segment_number() == last.number &&
+        index.compressed() == m_compression.enabled && last.compressed == m_compression.enabled &&
+        (index.size() == 0 || (index.header_size() == ARCHIVE_INDEX_HEADER_SIZE && index.entry_size() == ARCHIVE_INDEX_ENTRY_SIZE)) &&
+        index_size >= index.header_size() + index.size() * index.entry_size();
+    if (!matches)
+    {
+      MWARNING("Archive segment " << last.data_filename << " does not match its index, starting a new segment");
+      return open_segment(last.number + 1, false);
+    }
+
+    const auto entry_end = [this, &index](size_t i) {
+      const archive_index_entry e = index.entry(i);
+      return e.offset + (m_compression.enabled ? e.frame_size : e.size);
+    };
+
+    // the data is written first, so entries past it are from a torn write
+    size_t n_entries = index.size();
+    while (n_entries > 0 && entry_end(n_entries - 1) > data_size)
+      --n_entries;
+
+    // the records after the checkpoint, or all of them, must be intact
+    archive_checkpoint checkpoint;
+    size_t first = 0;
+    if (!m_checkpoint_filename.empty() && archive_read_checkpoint(m_checkpoint_filename, checkpoint) && checkpoint.segment == last.number &&
+        checkpoint.records > 0 && checkpoint.records <= n_entries && entry_end(checkpoint.records - 1) == checkpoint.offset)
+    {
+      first = checkpoint.records;
+      m_checkpoint = checkpoint;
+    }
+    if (!m_compression.enabled && first < n_entries)
+    {
+      std::ifstream in(last.data_filename, std::ios::binary);
+      std::string record;
+      for (size_t i = first; i < n_entries; ++i)
+      {
+        const archive_index_entry e = index.entry(i);
+        record.resize(e.size);
+        in.seekg(e.offset);
+        in.read(&record[0], record.size());
+        if (!in || !archive_check_record(record.data(), record.size(), m_format))
+        {
+          n_entries = i;
+          break;
+        }
+      }
+    }
+
+    const uint64_t valid_size = n_entries > 0 ? entry_end(n_entries - 1) : 0;
+    const uint64_t valid_index_size = ARCHIVE_INDEX_HEADER_SIZE + n_entries * ARCHIVE_INDEX_ENTRY_SIZE;
+    m_started_ms = n_entries > 0 && index.entry(0).nrt != 0 ? index.entry(0).nrt : system_now_ms();
+    m_last_height = n_entries > 0 ? index.entry(n_entries - 1).height : 0;
+    const size_t dropped_entries = index.size() - n_entries;
+    index.close();
+
+    if (n_entries == 0)
+    {
+      // nothing to keep: write the segment again from a header in the current layout
+      if (data_size > 0 || dropped_entries > 0)
+        MWARNING("Archive segment " << last.data_filename << " holds no intact record, cutting off " << data_size
+            << " bytes and " << dropped_entries << " index entries");
+      boost::filesystem::resize_file(last.data_filename, 0, ec);
+      if (!ec)
+        boost::filesystem::resize_file(last.index_filename, 0, ec);
+      if (ec)
+      {
+        MERROR("Failed to cut back archive segment " << last.data_filename << ": " << ec.message() << ", starting a new segment");
+        return open_segment(last.number + 1, false);
+      }
+      m_recovered_bytes = data_size;
+      return open_segment(last.number, false);
+    }
+
+    if (valid_size < data_size || valid_index_size < index_size)
+    {
+      MWARNING("Archive segment " << last.data_filename << " ends in a torn or damaged record, cutting off " << (data_size - valid_size)
+          << " bytes and " << dropped_entries << " index entries");
+      boost::filesystem::resize_file(last.data_filename, valid_size, ec);
+      if (!ec)
+        boost::filesystem::resize_file(last.index_filename, valid_index_size, ec);
+      if (ec)
+      {
+        MERROR("Failed to cut back archive segment " << last.data_filename << ": " << ec.message() << ", starting a new segment");
+        return open_segment(last.number + 1, false);
+      }
+      m_recovered_bytes = data_size - valid_size;
+    }
+
+    if (!open_segment(last.number, true))
+      return false;
+    if (need_new_segment())
+      return open_segment(last.number + 1, false);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::recover_file()
+  {
+    const std::string &filename = m_file_config.filename;
+    boost::system::error_code ec;
+    const uint64_t size = boost::filesystem::file_size(filename, ec);
+    if (ec || size == 0)
+      return;
+
+    archive_checkpoint checkpoint;
+    const bool from_checkpoint = !m_checkpoint_filename.empty() && archive_read_checkpoint(m_checkpoint_filename, checkpoint) &&
+        checkpoint.segment == 0 && archive_checkpoint_matches(filename, checkpoint);
+    uint64_t records = 0;
+    const uint64_t valid_size = archive_scan_tail(filename, m_format, from_checkpoint ? checkpoint.offset : archive_tail_start(filename, m_format), records);
+    if (from_checkpoint)
+    {
+      // sequence numbers carry on from the checkpoint
+      m_checkpoint = checkpoint;
+      m_n_entries = checkpoint.records + records;
+      m_last_height = checkpoint.height;
+    }
+
+    if (valid_size < size)
+    {
+      MWARNING("Archive file " << filename << " ends in a torn or damaged record, cutting off " << (size - valid_size) << " bytes");
+      boost::filesystem::resize_file(filename, valid_size, ec);
+      if (ec)
+        MERROR("Failed to cut back archive file " << filename << ": " << ec.message());
+      else
+        m_recovered_bytes = size - valid_size;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::open_segment(uint64_t number, bool resume)
+  {
+    close_segment();
+    m_number = number;
+    m_broken = false;
+    if (!resume)
+      m_started_ms = system_now_ms();
+
+    archive_file_config data_config = m_file_config;
+    data_config.filename = segment_data_filename(m_file_config.filename, number, m_compression.enabled);
+    archive_file_config index_config = m_file_config;
+    index_config.filename = archive_segment_filename(m_file_config.filename, number, index_extension);
+
+    MINFO((resume ? "Resuming" : "Starting") << " archive segment " << data_config.filename);
+    bool r = m_data.open(data_config);
+    r = m_index.open(index_config) && r;
+    m_n_entries = resume && m_index.size() > ARCHIVE_INDEX_HEADER_SIZE ? (m_index.size() - ARCHIVE_INDEX_HEADER_SIZE) / ARCHIVE_INDEX_ENTRY_SIZE : 0;
+    if (!resume)
+    {
+      const std::string header = index_header(number, m_format, m_compression.enabled);
+      if (!m_index.write(&header, 1))
+      {
+        m_broken = true;
+        return false;
+      }
+    }
+    return r;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::need_new_segment() const
+  {
+    if (m_broken)
+      return true;
+    if (m_config.max_bytes != 0 && m_data.size() >= m_config.max_bytes)
+      return true;
+    if (m_config.max_seconds != 0 && system_now_ms() - m_started_ms >= m_config.max_seconds * 1000)
+      return true;
+    return false;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::start_segment_if_due()
+  {
+    if (!m_config.enabled())
+      return false;
+    if (need_new_segment())
+      open_segment(m_number + 1, false);
+    return m_n_entries == 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::write(const std::string *records, archive_index_entry *entries, size_t n_records)
+  {
+    if (!m_config.enabled())
+    {
+      const uint64_t n_entries = m_n_entries;
+      for (size_t i = 0; i < n_records; ++i)
+      {
+        if (!records[i].empty())
+        {
+          entries[i].sequence = archive_sequence(0, m_n_entries++);
+          m_last_height = entries[i].height;
+        }
+      }
+      // a failed write is cut off again by archive_file
+      if (!m_data.write(records, n_records))
+      {
+        ++m_write_errors;
+        m_n_entries = n_entries;
+        return false;
+      }
+      note_tail(records, n_records);
+      maybe_checkpoint(false);
+      return true;
+    }
+
+    if (need_new_segment())
+      open_segment(m_number + 1, false);
+
+    if (m_compression.enabled)
+    {
+      // a full frame left over from a failed write goes first; no more records are taken until it is written
+      if (m_frame_entries.size() >= m_compression.frame_records && !flush_frame())
+        return false;
+      for (size_t i = 0; i < n_records; ++i)
+      {
+        if (records[i].empty())
+          continue;
+        if (m_frame_entries.empty())
+          m_frame_started_ms = steady_now_ms();
+        entries[i].frame_offset = m_frame.size();
+        entries[i].size = records[i].size();
+        entries[i].sequence = archive_sequence(m_number, m_n_entries++);
+        m_frame += records[i];
+        m_frame_entries.push_back(entries[i]);
+        if (m_frame_entries.size() >= m_compression.frame_records)
+          flush_frame();
+      }
+      if (m_compression.frame_flush_ms == 0)
+        flush_frame();
+      maybe_checkpoint(false);
+      return true;
+    }
+
+    const uint64_t data_size = m_data.size();
+    const uint64_t index_size = m_index.size();
+    const uint64_t n_entries = m_n_entries;
+    uint64_t offset = data_size;
+    m_index_buffer.clear();
+    for (size_t i = 0; i < n_records; ++i)
+    {
+      if (records[i].empty())
+        continue;
+      entries[i].offset = offset;
+      entries[i].size = records[i].size();
+      entries[i].sequence = archive_sequence(m_number, m_n_entries++);
+      offset += records[i].size();
+      m_last_height = entries[i].height;
+      put_index_entry(m_index_buffer, entries[i]);
+    }
+
+    // data first: an index entry never points past the data
+    if (!m_data.write(records, n_records) || !m_index.write(&m_index_buffer, 1))
+    {
+      ++m_write_errors;
+      rollback(data_size, index_size, n_entries);
+      return false;
+    }
+    note_tail(records, n_records);
+    maybe_checkpoint(false);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::rollback(uint64_t data_size, uint64_t index_size, uint64_t n_entries)
+  {
+    // a segment whose files cannot be cut back is left behind
+    m_n_entries = n_entries;
+    if (m_data.size() != data_size && !m_data.truncate(data_size))
+      m_broken = true;
+    if (m_index.size() != index_size && !m_index.truncate(index_size))
+      m_broken = true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::note_tail(const std::string *records, size_t n_records)
+  {
+    for (size_t i = 0; i < n_records; ++i)
+      m_tail += records[i].size() > ARCHIVE_CHECKPOINT_TAIL_SIZE ? records[i].substr(records[i].size() - ARCHIVE_CHECKPOINT_TAIL_SIZE) : records[i];
+    if (m_tail.size() > ARCHIVE_CHECKPOINT_TAIL_SIZE)
+      m_tail.erase(0, m_tail.size() - ARCHIVE_CHECKPOINT_TAIL_SIZE);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::maybe_checkpoint(bool force)
+  {
+    if (m_checkpoint_filename.empty() || m_broken)
+      return;
+
+    // only where everything written is durable, with the index in step
+    const uint64_t offset = m_data.size();
+    if (m_data.synced_size() != offset || (m_config.enabled() && m_index.synced_size() != m_index.size()))
+      return;
+    const uint64_t segment = m_config.enabled() ? m_number : 0;
+    if (offset == m_checkpoint.offset && segment == m_checkpoint.segment)
+      return;
+    const uint64_t now = steady_now_ms();
+    if (!force && now - m_checkpoint_ms < m_file_config.checkpoint_interval_ms)
+      return;
+    const size_t tail_size = std::min<uint64_t>(ARCHIVE_CHECKPOINT_TAIL_SIZE, offset);
+    if (m_tail.size() < tail_size)
+      return;
+
+    archive_checkpoint checkpoint;
+    checkpoint.segment = segment;
+    checkpoint.offset = offset;
+    checkpoint.records = m_n_entries - m_frame_entries.size();
+    checkpoint.height = m_last_height;
+    checkpoint.time_ms = system_now_ms();
+    checkpoint.tail_crc = archive_crc32c(0, m_tail.data() + m_tail.size() - tail_size, tail_size);
+    m_checkpoint_ms = now;
+    if (archive_write_checkpoint(m_checkpoint_filename, checkpoint))
+      m_checkpoint = checkpoint;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_segment_writer::flush_frame()
+  {
+    if (m_frame_entries.empty())
+      return true;
+
+    // the frame goes out whole or not at all; its records are lost if it cannot be compressed,
+    // and the segment with them since its sequence numbers no longer match the index
+    m_compressed.clear();
+    if (!m_codec.compress(m_frame, m_compressed))
+    {
+      ++m_write_errors;
+      m_broken = true;
+      m_frame.clear();
+      m_frame_entries.clear();
+      return false;
+    }
+
+    const uint64_t data_size = m_data.size();
+    const uint64_t index_size = m_index.size();
+    m_index_buffer.clear();
+    for (archive_index_entry &entry: m_frame_entries)
+    {
+      entry.offset = data_size;
+      entry.frame_size = m_compressed.size();
+      put_index_entry(m_index_buffer, entry);
+    }
+    // a frame that cannot be written is kept for the next attempt
+    if (!m_data.write(&m_compressed, 1) || !m_index.write(&m_index_buffer, 1))
+    {
+      ++m_write_errors;
+      rollback(data_size, index_size, m_n_entries);
+      return false;
+    }
+    note_tail(&m_compressed, 1);
+    m_last_height = m_frame_entries.back().height;
+    m_frame.clear();
+    m_frame_entries.clear();
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_segment_writer::tick()
+  {
+    if (!m_frame_entries.empty() && steady_now_ms() - m_frame_started_ms >= m_compression.frame_flush_ms)
+      flush_frame();
+    m_data.tick();
+    if (m_config.enabled())
+      m_index.tick();
+    maybe_checkpoint(false);
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_index_reader::archive_index_reader():
+    m_data(nullptr),
+    m_mapped_size(0),
+    m_entry_size(0),
+    m_header_size(0),
+    m_n_entries(0),
+    m_number(0),
+    m_format(archive_output_format::tsv),
+    m_compressed(false)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_index_reader::~archive_index_reader()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_index_reader::open(const std::string &filename)
+  {
+    close();
+#ifdef _WIN32
+    if (!epee::file_io_utils::load_file_to_string(filename, m_contents))
+      return false;
+    m_data = m_contents.data();
+    const size_t size = m_contents.size();
+#else
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < ARCHIVE_INDEX_HEADER_SIZE)
+    {
+      ::close(fd);
+      return false;
+    }
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    m_data = (const char*)p;
+    m_mapped_size = st.st_size;
+    const size_t size = m_mapped_size;
+#endif
+
+    if (size < ARCHIVE_INDEX_HEADER_SIZE || archive_get_le(m_data, 4) != ARCHIVE_INDEX_MAGIC)
+    {
+      close();
+      return false;
+    }
+    m_header_size = archive_get_le(m_data + 6, 2);
+    m_entry_size = archive_get_le(m_data + 8, 2);
+    if (m_header_size < ARCHIVE_INDEX_HEADER_SIZE || m_header_size > size || m_entry_size < ARCHIVE_INDEX_ENTRY_SIZE_V1)
+    {
+      close();
+      return false;
+    }
+    m_format = archive_get_le(m_data + 10, 2) == 1 ? archive_output_format::binary : archive_output_format::tsv;
+    m_compressed = archive_get_le(m_data + 12, 2) == 1;
+    m_number = archive_get_le(m_data + 16, 8);
+    // a torn trailing entry is ignored
+    m_n_entries = (size - m_header_size) / m_entry_size;
+
+    m_by_height.resize(m_n_entries);
+    for (size_t i = 0; i < m_n_entries; ++i)
+      m_by_height[i] = i;
+    m_by_nrt = m_by_height;
+    // stable: ties stay in offset order
+    std::stable_sort(m_by_height.begin(), m_by_height.end(), [this](uint32_t a, uint32_t b) { return height(a) < height(b); });
+    std::stable_sort(m_by_nrt.begin(), m_by_nrt.end(), [this](uint32_t a, uint32_t b) { return nrt(a) < nrt(b); });
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_index_reader::close()
+  {
+#ifndef _WIN32
+    if (m_mapped_size > 0)
+      ::munmap((void*)m_data, m_mapped_size);
+#endif
+    m_contents.clear();
+    m_data = nullptr;
+    m_mapped_size = 0;
+    m_n_entries = 0;
+    m_by_height.clear();
+    m_by_nrt.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_index_reader::height(uint32_t i) const
+  {
+    return archive_get_le(m_data + m_header_size + i * m_entry_size, 8);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_index_reader::nrt(uint32_t i) const
+  {
+    return archive_get_le(m_data + m_header_size + i * m_entry_size + 8, 8);
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_index_entry archive_index_reader::entry(size_t i) const
+  {
+    const char *p = m_data + m_header_size + i * m_entry_size;
+    archive_index_entry e;
+    e.height = archive_get_le(p, 8);
+    e.nrt = archive_get_le(p + 8, 8);
+    e.offset = archive_get_le(p + 16, 8);
+    memcpy(e.hash_prefix, p + 24, sizeof(e.hash_prefix));
+    e.size = archive_get_le(p + 32, 4);
+    e.is_alt_block = p[36] & ARCHIVE_FLAG_ALT_BLOCK;
+    if (m_entry_size >= ARCHIVE_INDEX_ENTRY_SIZE)
+    {
+      e.frame_offset = archive_get_le(p + 40, 4);
+      e.frame_size = archive_get_le(p + 44, 4);
+    }
+    return e;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_index_reader::find_height(uint64_t from, uint64_t to, std::vector<archive_index_entry> &entries) const
+  {
+    auto it = std::lower_bound(m_by_height.begin(), m_by_height.end(), from, [this](uint32_t i, uint64_t v) { return height(i) < v; });
+    for (; it != m_by_height.end() && height(*it) <= to; ++it)
+      entries.push_back(entry(*it));
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_index_reader::find_nrt(uint64_t from, uint64_t to, std::vector<archive_index_entry> &entries) const
+  {
+    auto it = std::lower_bound(m_by_nrt.begin(), m_by_nrt.end(), from, [this](uint32_t i, uint64_t v) { return nrt(i) < v; });
+    for (; it != m_by_nrt.end() && nrt(*it) <= to; ++it)
+      entries.push_back(entry(*it));
+  }
+}
@@ -0,0 +1,281 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_segment.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "archive_compress.h"
+#include "archive_file.h"
+#include "archive_format.h"
+#include "archive_recovery.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief sidecar index layout, all integers little-endian
+   *
+   * header, ARCHIVE_INDEX_HEADER_SIZE bytes:
+   *   u32 magic "MDAI", u16 index version, u16 header size, u16 entry size,
+   *   u16 data format (0 tsv, 1 binary), u16 compression (0 none, 1 zstd),
+   *   u16 reserved, u64 segment number
+   *
+   * entries, ARCHIVE_INDEX_ENTRY_SIZE bytes each, in data file order:
+   *   u64 block height, u64 NRT, u64 byte offset of the record in the
+   *   segment, u8[8] block hash prefix, u32 record size, u8 flags, u8[3] reserved,
+   *   u32 offset of the record in its frame, u32 frame size
+   *
+   * In a compressed segment the byte offset is that of the zstd frame
+   * holding the record.  Readers accept entries of ARCHIVE_INDEX_ENTRY_SIZE_V1
+   * bytes from older indexes, which have no frame fields.
+   */
+  const uint32_t ARCHIVE_INDEX_MAGIC = 0x4941444d;  // "MDAI"
+  const uint16_t ARCHIVE_INDEX_VERSION = 1;
+  const size_t ARCHIVE_INDEX_HEADER_SIZE = 24;
+  const size_t ARCHIVE_INDEX_ENTRY_SIZE = 48;
+  const size_t ARCHIVE_INDEX_ENTRY_SIZE_V1 = 40;
+
+  struct archive_segment_config
+  {
+    uint64_t max_bytes = 0;    //!< start a new segment once this size is reached; 0 for no limit
+    uint64_t max_seconds = 0;  //!< start a new segment once it is this old; 0 for no limit
+
+    bool enabled() const { return max_bytes != 0 || max_seconds != 0; }
+  };
+
+  struct archive_index_entry
+  {
+    uint64_t height = 0;
+    uint64_t nrt = 0;
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    uint8_t hash_prefix[8] = {};
+    bool is_alt_block = false;
+    uint32_t frame_offset = 0;  //!< compressed segments: offset of the record in the decoded frame
+    uint32_t frame_size = 0;    //!< compressed segments: size of the frame in the segment
+    uint64_t sequence = 0;      //!< archive_sequence() of the record; not stored in the index
+  };
+
+  /**
+   * @brief where a record is in a segmented archive
+   *
+   * Segment number in the high 32 bits, position of the record's entry in
+   * the segment index in the low 32 bits.  Without segments the segment
+   * number is 0 and the position counts records since the writer started.
+   */
+  inline uint64_t archive_sequence(uint64_t segment, uint64_t position)
+  {
+    return (segment << 32) | (position & 0xffffffff);
+  }
+
+  /**
+   * @brief index entry fields taken from the record; offsets are filled in by the segment writer
+   */
+  archive_index_entry archive_make_index_entry(const archive_record &record);
+
+  /**
+   * @brief filename of segment number of a segmented archive
+   *
+   * "/opt/monerodarchive/archive.log", 12, ".idx" gives
+   * "/opt/monerodarchive/archive.000012.idx"; an empty extension keeps the
+   * extension of the base filename.  Compressed segments add ".zst" to it.
+   */
+  std::string archive_segment_filename(const std::string &base_filename, uint64_t number, const std::string &extension = "");
+
+  struct archive_segment_info
+  {
+    uint64_t number;
+    std::string data_filename;
+    std::string index_filename;
+    bool compressed;
+  };
+
+  /**
+   * @brief lists the segments of a segmented archive, oldest first
+   */
+  std::vector<archive_segment_info> archive_list_segments(const std::string &base_filename);
+
+  /**
+   * @brief appends records to numbered archive segments with a sidecar index
+   *
+   * When segmentation is disabled this is the single archive_file of
+   * earlier versions, with no index.  Otherwise records go to
+   * archive.NNNNNN.log with index entries in archive.NNNNNN.idx, and a new
+   * segment is started at a batch boundary once the size or age limit is
+   * reached.
+   *
+   * Whenever everything written has been flushed to stable storage, at
+   * most every checkpoint_interval_ms, the end of the archive is noted in
+   * an archive_checkpoint.  On startup the records after the checkpoint
+   * are checked and a torn tail is cut off: the newest segment loses index
+   * entries past its data and data past its last intact indexed record,
+   * and is then resumed; without segments the file is cut back after its
+   * last intact record.  Without a checkpoint the whole newest segment, or
+   * the end of the file, is checked.
+   *
+   * With compression, records are collected into frames which are
+   * compressed on the writer thread and written whole; index entries of a
+   * frame follow the frame.
+   */
+  class archive_segment_writer
+  {
+  public:
+    archive_segment_writer();
+    ~archive_segment_writer();
+
+    bool open(const archive_file_config &file, const archive_segment_config &segments, archive_output_format format,
+        const archive_compression_config &compression = archive_compression_config());
+    void close();
+
+    /**
+     * @brief appends records and their index entries
+     *
+     * Offsets and sizes of entries are filled in here; empty records are
+     * skipped.  Records go in whole or not at all: after a failed write
+     * none of them are in the archive, and they can be written again.  A
+     * compressed frame that fails to be written is kept and retried.
+     *
+     * @return false if the records were not written
+     */
+    bool write(const std::string *records, archive_index_entry *entries, size_t n_records);
+
+    void tick();
+
+    /**
+     * @brief starts a new segment now if one is due, rather than at the next write()
+     *
+     * @return true if the next write() goes first in its segment
+     */
+    bool start_segment_if_due();
+
+    uint64_t segment_number() const { return m_number; }
+
+    /**
+     * @brief bytes of torn or damaged records cut off the archive when it was opened
+     */
+    uint64_t recovered_bytes() const { return m_recovered_bytes; }
+
+    /**
+     * @brief data or index writes that failed
+     */
+    uint64_t write_errors() const { return m_write_errors; }
+
+  private:
+    bool open_segment(uint64_t number, bool resume);
+    void close_segment();
+    bool flush_frame();
+    bool resume_last_segment();
+    void recover_file();
+    bool need_new_segment() const;
+    void rollback(uint64_t data_size, uint64_t index_size, uint64_t n_entries);
+    void maybe_checkpoint(bool force);
+    void note_tail(const std::string *records, size_t n_records);
+
+    archive_file_config m_file_config;
+    archive_segment_config m_config;
+    archive_output_format m_format;
+    archive_compression_config m_compression;
+    archive_zstd_codec m_codec;
+    archive_file m_data;
+    archive_file m_index;
+    uint64_t m_number;
+    uint64_t m_n_entries;   //!< records in the current segment, including a pending frame
+    uint64_t m_started_ms;  //!< Unix epoch milliseconds
+    bool m_broken;          //!< a failed write left the index out of step with the data
+    std::string m_index_buffer;
+    uint64_t m_last_height;  //!< of the last record written
+    uint64_t m_recovered_bytes;
+    uint64_t m_write_errors;
+
+    std::string m_checkpoint_filename;  //!< empty for no checkpoint
+    archive_checkpoint m_checkpoint;    //!< last one written
+    uint64_t m_checkpoint_ms;           //!< steady clock
+    std::string m_tail;                 //!< last bytes written, for the checkpoint's tail CRC
+
+    std::string m_frame;
+    std::vector<archive_index_entry> m_frame_entries;
+    uint64_t m_frame_started_ms;  //!< steady clock
+    std::string m_compressed;
+  };
+
+  /**
+   * @brief memory-mapped sidecar index of one segment
+   *
+   * Entries are kept in file order; sorted views by height and by NRT are
+   * built when the index is opened so range lookups are binary searches.
+   */
+  class archive_index_reader
+  {
+  public:
+    archive_index_reader();
+    ~archive_index_reader();
+
+    bool open(const std::string &filename);
+    void close();
+
+    size_t size() const { return m_n_entries; }
+    size_t header_size() const { return m_header_size; }
+    size_t entry_size() const { return m_entry_size; }
+    uint64_t segment_number() const { return m_number; }
+    archive_output_format format() const { return m_format; }
+    bool compressed() const { return m_compressed; }
+    archive_index_entry entry(size_t i) const;
+
+    /**
+     * @brief entries with from <= height <= to, by height then offset
+     */
+    void find_height(uint64_t from, uint64_t to, std::vector<archive_index_entry> &entries) const;
+
+    /**
+     * @brief entries with from <= NRT <= to, by NRT then offset
+     */
+    void find_nrt(uint64_t from, uint64_t to, std::vector<archive_index_entry> &entries) const;
+
+  private:
+    uint64_t height(uint32_t i) const;
+    uint64_t nrt(uint32_t i) const;
+
+    const char *m_data;
+    size_t m_mapped_size;
+    std::string m_contents;  //!< used instead of a mapping where mmap is not available
+    size_t m_entry_size;
+    size_t m_header_size;
+    size_t m_n_entries;
+    uint64_t m_number;
+    archive_output_format m_format;
+    bool m_compressed;
+    std::vector<uint32_t> m_by_height;
+    std::vector<uint32_t> m_by_nrt;
+  };
+}
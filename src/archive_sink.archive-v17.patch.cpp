@@ -0,0 +1,291 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_sink.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <chrono>
+
+#include "misc_log_ex.h"
+#include "archive_sink.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace cryptonote
+{
+  //-----------------------------------------------------------------------------------------------
+  bool archive_parse_sink(const std::string &spec, archive_sink_config &sink)
+  {
+    sink = archive_sink_config();
+    if (spec == "null")
+    {
+      sink.type = archive_sink_type::null;
+      return true;
+    }
+
+    const size_t colon = spec.find(':');
+    if (colon == std::string::npos || colon + 1 == spec.size())
+      return false;
+    const std::string kind = spec.substr(0, colon);
+    sink.path = spec.substr(colon + 1);
+    if (kind == "tsv")
+      sink.type = archive_sink_type::file;
+    else if (kind == "binary")
+    {
+      sink.type = archive_sink_type::file;
+      sink.format = archive_output_format::binary;
+    }
+    else if (kind == "socket")
+      sink.type = archive_sink_type::socket;
+    else if (kind == "socket-binary")
+    {
+      sink.type = archive_sink_type::socket;
+      sink.format = archive_output_format::binary;
+    }
+    else
+      return false;
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string archive_sink_name(const archive_sink_config &sink)
+  {
+    const bool binary = sink.format == archive_output_format::binary;
+    switch (sink.type)
+    {
+      case archive_sink_type::file:
+        return (binary ? "binary:" : "tsv:") + sink.path;
+      case archive_sink_type::socket:
+        return (binary ? "socket-binary:" : "socket:") + sink.path;
+      default:
+        return "null";
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_file_sink::archive_file_sink():
+    m_retry_ms(0),
+    m_write_errors(0),
+    m_write_retries(0),
+    m_n_spilled(0),
+    m_spill_dropped(0),
+    m_spill_written(0),
+    m_spill_written_bytes(0),
+    m_spill_bytes(0),
+    m_recovered_bytes(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file_sink::open(const archive_file_config &file, const archive_segment_config &segments, archive_output_format format, const archive_compression_config &compression,
+      const archive_feed_config &feed, const archive_spill_config &spill)
+  {
+    m_spill_config = spill;
+    m_filename = file.filename;
+    bool r = m_file.open(file, segments, format, compression);
+    m_recovered_bytes = m_file.recovered_bytes();
+    r = m_feed.open(feed, format == archive_output_format::binary ? 1 : 0) && r;
+    return r;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_file_sink::close()
+  {
+    if (!m_spilled.empty() && !retry_spilled(true))
+    {
+      MERROR("Archive " << m_filename << " still failing, " << m_spilled.size() << " held records lost");
+      m_spill_dropped += m_spilled.size();
+    }
+    m_spilled.clear();
+    m_spilled_entries.clear();
+    m_spilled_writes.clear();
+    m_spill_bytes = 0;
+    m_file.close();
+    if (m_feed.client_drops() > 0)
+      MWARNING("Archive feed socket clients missed " << m_feed.client_drops() << " records");
+    m_feed.close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_write_result archive_file_sink::write(const std::string *records, archive_index_entry *entries, size_t n_records)
+  {
+    // held records go first so the archive stays in order
+    if (!m_spilled.empty() && !retry_spilled(false))
+      return spill(records, entries, n_records);
+    if (write_file(records, entries, n_records))
+      return archive_write_result::written;
+    if (m_spill_config.max_bytes == 0)
+      return archive_write_result::lost;
+    MWARNING("Failed to write to archive " << m_filename << ", holding records in memory");
+    return spill(records, entries, n_records);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file_sink::write_file(const std::string *records, archive_index_entry *entries, size_t n_records)
+  {
+    const bool r = m_file.write(records, entries, n_records);
+    m_write_errors = m_file.write_errors();
+    if (!r)
+      return false;
+
+    // only written records are published, so a consumer can always find them in the archive
+    for (size_t i = 0; i < n_records; ++i)
+    {
+      if (!records[i].empty())
+        m_feed.publish(entries[i].sequence, records[i]);
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_write_result archive_file_sink::spill(const std::string *records, const archive_index_entry *entries, size_t n_records)
+  {
+    if (m_spill_config.max_bytes == 0)
+      return archive_write_result::lost;
+
+    uint64_t spill_bytes = m_spill_bytes;
+    m_spilled_writes.push_back(m_spilled.size());
+    for (size_t i = 0; i < n_records; ++i)
+    {
+      if (records[i].empty())
+        continue;
+      m_spilled.push_back(records[i]);
+      m_spilled_entries.push_back(entries[i]);
+      spill_bytes += records[i].size();
+      ++m_n_spilled;
+    }
+
+    // whole writes only: the first record of each but the oldest may be all a
+    // writer starting afresh after a held write put in, e.g. an alt chains snapshot
+    size_t n_writes = 0;
+    size_t n_dropped = 0;
+    while (spill_bytes > m_spill_config.max_bytes && n_writes < m_spilled_writes.size())
+    {
+      const size_t end = n_writes + 1 < m_spilled_writes.size() ? m_spilled_writes[n_writes + 1] : m_spilled.size();
+      for (; n_dropped < end; ++n_dropped)
+        spill_bytes -= m_spilled[n_dropped].size();
+      ++n_writes;
+    }
+    if (n_writes > 0)
+    {
+      MWARNING("Archive " << m_filename << " held records exceed " << m_spill_config.max_bytes << " bytes, dropping the " << n_dropped << " oldest");
+      m_spilled.erase(m_spilled.begin(), m_spilled.begin() + n_dropped);
+      m_spilled_entries.erase(m_spilled_entries.begin(), m_spilled_entries.begin() + n_dropped);
+      m_spilled_writes.erase(m_spilled_writes.begin(), m_spilled_writes.begin() + n_writes);
+      for (size_t &start: m_spilled_writes)
+        start -= n_dropped;
+      m_spill_dropped += n_dropped;
+    }
+    m_spill_bytes = spill_bytes;
+    return archive_write_result::held;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file_sink::retry_spilled(bool force)
+  {
+    const uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (!force && now - m_retry_ms < m_spill_config.retry_interval_ms)
+      return false;
+    m_retry_ms = now;
+
+    ++m_write_retries;
+    if (!write_file(m_spilled.data(), m_spilled_entries.data(), m_spilled.size()))
+      return false;
+    MINFO("Archive " << m_filename << " written again, " << m_spilled.size() << " held records caught up");
+    m_spill_written += m_spilled.size();
+    m_spill_written_bytes += m_spill_bytes;
+    m_spilled.clear();
+    m_spilled_entries.clear();
+    m_spilled_writes.clear();
+    m_spill_bytes = 0;
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_file_sink::tick()
+  {
+    if (!m_spilled.empty())
+      retry_spilled(false);
+    m_file.tick();
+    m_feed.tick();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_file_sink::start_segment_if_due()
+  {
+    // held records are written ahead of the next ones, and go on in the current segment
+    if (!m_spilled.empty())
+      return false;
+    return m_file.start_segment_if_due();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_sink_stats archive_file_sink::stats() const
+  {
+    archive_sink_stats s;
+    s.write_errors = m_write_errors;
+    s.write_retries = m_write_retries;
+    s.spilled = m_n_spilled;
+    s.spill_dropped = m_spill_dropped;
+    s.spill_written = m_spill_written;
+    s.spill_written_bytes = m_spill_written_bytes;
+    s.spill_bytes = m_spill_bytes;
+    s.recovered_bytes = m_recovered_bytes;
+    return s;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_socket_sink::archive_socket_sink():
+    m_position(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_socket_sink::open(const std::string &path, archive_output_format format, uint64_t client_buffer_bytes)
+  {
+    archive_feed_config feed;
+    feed.enabled = true;
+    feed.shm_name = "";
+    feed.socket_path = path;
+    feed.client_buffer_bytes = client_buffer_bytes;
+    m_position = 0;
+    return m_feed.open(feed, format == archive_output_format::binary ? 1 : 0);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_socket_sink::close()
+  {
+    if (m_feed.client_drops() > 0)
+      MWARNING("Archive socket sink clients missed " << m_feed.client_drops() << " records");
+    m_feed.close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_write_result archive_socket_sink::write(const std::string *records, archive_index_entry *entries, size_t n_records)
+  {
+    for (size_t i = 0; i < n_records; ++i)
+    {
+      entries[i].sequence = archive_sequence(0, m_position++);
+      if (!records[i].empty())
+        m_feed.publish(entries[i].sequence, records[i]);
+    }
+    return archive_write_result::written;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_socket_sink::tick()
+  {
+    m_feed.tick();
+  }
+}
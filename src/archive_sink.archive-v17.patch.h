@@ -0,0 +1,226 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_sink.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "archive_compress.h"
+#include "archive_feed.h"
+#include "archive_file.h"
+#include "archive_format.h"
+#include "archive_segment.h"
+
+namespace cryptonote
+{
+  enum class archive_sink_type
+  {
+    file,    //!< archive file or segments, see archive_segment_writer
+    socket,  //!< Unix domain socket for local consumers, nothing kept on disk
+    null     //!< discards every record; the producer's cost without any output
+  };
+
+  struct archive_sink_config
+  {
+    archive_sink_type type = archive_sink_type::file;
+    archive_output_format format = archive_output_format::tsv;
+    std::string path;  //!< archive filename or socket path
+  };
+
+  /**
+   * @brief what a file sink does with records it could not write
+   *
+   * They are held in memory, in order, and written again ahead of any new
+   * records once retry_interval_ms has passed.  Beyond max_bytes the oldest
+   * held writes are dropped, each as a whole.
+   */
+  struct archive_spill_config
+  {
+    uint64_t max_bytes = 64 * 1024 * 1024;  //!< 0 to drop records that cannot be written
+    uint64_t retry_interval_ms = 1000;
+  };
+
+  struct archive_sink_stats
+  {
+    uint64_t write_errors = 0;     //!< writes that failed, including retries
+    uint64_t write_retries = 0;    //!< attempts to write held records again
+    uint64_t spilled = 0;          //!< records held in memory after a failed write
+    uint64_t spill_dropped = 0;    //!< held records dropped beyond max_bytes, or still failing on close
+    uint64_t spill_written = 0;    //!< held records written once the sink recovered
+    uint64_t spill_written_bytes = 0;
+    uint64_t spill_bytes = 0;      //!< bytes currently held
+    uint64_t recovered_bytes = 0;  //!< torn tail cut off the archive when it was opened
+  };
+
+  enum class archive_write_result
+  {
+    written,  //!< the records, and any held before them, are in the sink
+    held,     //!< kept to be written later; older held records may have been dropped
+    lost
+  };
+
+  /**
+   * @brief reads a sink as given to --archive-sink
+   *
+   * "tsv:FILE", "binary:FILE", "socket:PATH", "socket-binary:PATH" or "null".
+   *
+   * @return false if spec names no sink
+   */
+  bool archive_parse_sink(const std::string &spec, archive_sink_config &sink);
+
+  /**
+   * @brief the --archive-sink form of a sink, for logging
+   */
+  std::string archive_sink_name(const archive_sink_config &sink);
+
+  /**
+   * @brief where an archive writer puts its records
+   *
+   * Only ever called from the writer thread that owns the sink, except
+   * for stats().  write() gets each group commit already serialized in the
+   * sink's format, and tick() is called whenever the thread is idle.
+   */
+  class archive_sink
+  {
+  public:
+    virtual ~archive_sink() {}
+
+    virtual void close() = 0;
+
+    /**
+     * @brief writes one group commit
+     *
+     * @param records serialized records; an empty one is skipped
+     * @param entries index entries of the records, completed by the sink
+     * @param n_records number of records
+     *
+     * @return held if the records wait to be written after a failure, see archive_file_sink
+     */
+    virtual archive_write_result write(const std::string *records, archive_index_entry *entries, size_t n_records) = 0;
+
+    virtual void tick() {}
+
+    /**
+     * @brief for sinks writing segments, starts a new one now if one is due
+     *
+     * @return true if the records of the next write() begin a segment
+     */
+    virtual bool start_segment_if_due() { return false; }
+
+    /**
+     * @brief safe to call from any thread
+     */
+    virtual archive_sink_stats stats() const { return archive_sink_stats(); }
+  };
+
+  /**
+   * @brief the archive (segment) file, and the live feed of what was written to it
+   *
+   * Records that fail to be written are spilled to memory and retried, see
+   * archive_spill_config; write() only reports them lost when spilling is
+   * disabled.  A held write is only ever dropped whole, so a writer that
+   * starts each write after a held one afresh (e.g. with an alt chains
+   * snapshot) never leaves held records depending on dropped ones.
+   */
+  class archive_file_sink: public archive_sink
+  {
+  public:
+    archive_file_sink();
+
+    /**
+     * @param feed published to after every write; not enabled for all but one file sink
+     */
+    bool open(const archive_file_config &file, const archive_segment_config &segments, archive_output_format format, const archive_compression_config &compression,
+        const archive_feed_config &feed, const archive_spill_config &spill = archive_spill_config());
+    void close() override;
+    archive_write_result write(const std::string *records, archive_index_entry *entries, size_t n_records) override;
+    void tick() override;
+    bool start_segment_if_due() override;
+    archive_sink_stats stats() const override;
+
+  private:
+    bool write_file(const std::string *records, archive_index_entry *entries, size_t n_records);
+    archive_write_result spill(const std::string *records, const archive_index_entry *entries, size_t n_records);
+    bool retry_spilled(bool force);
+
+    archive_segment_writer m_file;
+    archive_feed m_feed;
+    archive_spill_config m_spill_config;
+    std::string m_filename;
+
+    std::vector<std::string> m_spilled;
+    std::vector<archive_index_entry> m_spilled_entries;
+    std::vector<size_t> m_spilled_writes;  //!< where each held write starts in m_spilled
+    uint64_t m_retry_ms;  //!< steady clock, last attempt to write held records
+
+    std::atomic<uint64_t> m_write_errors;
+    std::atomic<uint64_t> m_write_retries;
+    std::atomic<uint64_t> m_n_spilled;
+    std::atomic<uint64_t> m_spill_dropped;
+    std::atomic<uint64_t> m_spill_written;
+    std::atomic<uint64_t> m_spill_written_bytes;
+    std::atomic<uint64_t> m_spill_bytes;
+    std::atomic<uint64_t> m_recovered_bytes;
+  };
+
+  /**
+   * @brief records sent to the clients of a Unix domain socket as archive feed messages
+   *
+   * Nothing is kept, so the sequence number of a message counts records
+   * since the sink was opened rather than locating the record in an archive.
+   * A client whose buffer is full misses records, the sink never waits.
+   */
+  class archive_socket_sink: public archive_sink
+  {
+  public:
+    archive_socket_sink();
+
+    bool open(const std::string &path, archive_output_format format, uint64_t client_buffer_bytes);
+    void close() override;
+    archive_write_result write(const std::string *records, archive_index_entry *entries, size_t n_records) override;
+    void tick() override;
+
+  private:
+    archive_feed m_feed;
+    uint64_t m_position;
+  };
+
+  class archive_null_sink: public archive_sink
+  {
+  public:
+    void close() override {}
+    archive_write_result write(const std::string *records, archive_index_entry *entries, size_t n_records) override { return archive_write_result::written; }
+  };
+}
@@ -0,0 +1,590 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tsv.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cstring>
+
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "archive_tsv.h"
+
+namespace cryptonote
+{
+  namespace
+  {
+    const char *digits_end(const char *p, const char *end)
+    {
+      while (p < end && *p >= '0' && *p <= '9')
+        ++p;
+      return p;
+    }
+
+    int hex_value(char c)
+    {
+      if (c >= '0' && c <= '9') return c - '0';
+      if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+      if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+      return -1;
+    }
+
+    // quoted 64 digit hex string
+    bool parse_hash(const char *p, const char *end, crypto::hash &hash)
+    {
+      if (end - p != 2 * sizeof(hash.data) + 2 || *p != '"')
+        return false;
+      for (size_t i = 0; i < sizeof(hash.data); ++i)
+      {
+        const int hi = hex_value(p[1 + 2 * i]), lo = hex_value(p[2 + 2 * i]);
+        if (hi < 0 || lo < 0)
+          return false;
+        hash.data[i] = (char)(hi << 4 | lo);
+      }
+      return true;
+    }
+
+    // ## JSON scanning: only spans are found, values are not copied
+
+    const char *skip_ws(const char *p, const char *end)
+    {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        ++p;
+      return p;
+    }
+
+    // p at the opening quote; returns past the closing quote, or end
+    const char *skip_string(const char *p, const char *end)
+    {
+      for (++p; p < end; ++p)
+      {
+        if (*p == '\\')
+          ++p;
+        else if (*p == '"')
+          return p + 1;
+      }
+      return end;
+    }
+
+    const char *skip_value(const char *p, const char *end)
+    {
+      if (p >= end)
+        return end;
+      if (*p == '"')
+        return skip_string(p, end);
+      if (*p == '{' || *p == '[')
+      {
+        int depth = 0;
+        while (p < end)
+        {
+          if (*p == '"')
+          {
+            p = skip_string(p, end);
+            continue;
+          }
+          if (*p == '{' || *p == '[')
+            ++depth;
+          else if ((*p == '}' || *p == ']') && --depth == 0)
+            return p + 1;
+          ++p;
+        }
+        return end;
+      }
+      while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ')
+        ++p;
+      return p;
+    }
+
+    bool key_is(const char *key, size_t key_size, const char *name)
+    {
+      return key_size == strlen(name) && memcmp(key, name, key_size) == 0;
+    }
+
+    /**
+     * @brief calls f(key, key_size, value, value_end) for each member of the object at p
+     *
+     * @return past the object, or null if it is malformed or f returns false
+     */
+    template<typename F>
+    const char *for_each_member(const char *p, const char *end, F f)
+    {
+      p = skip_ws(p, end);
+      if (p == end || *p != '{')
+        return nullptr;
+      p = skip_ws(p + 1, end);
+      if (p < end && *p == '}')
+        return p + 1;
+      while (true)
+      {
+        if (p == end || *p != '"')
+          return nullptr;
+        const char *key = p + 1;
+        p = skip_string(p, end);
+        const size_t key_size = p - 1 - key;
+        p = skip_ws(p, end);
+        if (p == end || *p != ':')
+          return nullptr;
+        const char *value = skip_ws(p + 1, end);
+        p = skip_value(value, end);
+        if (!f(key, key_size, value, p))
+          return nullptr;
+        p = skip_ws(p, end);
+        if (p < end && *p == ',')
+          p = skip_ws(p + 1, end);
+        else if (p < end && *p == '}')
+          return p + 1;
+        else
+          return nullptr;
+      }
+    }
+
+    /**
+     * @brief calls f(value, value_end) for each element of the array spanning [p, end)
+     */
+    template<typename F>
+    bool for_each_element(const char *p, const char *end, F f)
+    {
+      p = skip_ws(p, end);
+      if (p == end || *p != '[')
+        return false;
+      p = skip_ws(p + 1, end);
+      while (p < end && *p != ']')
+      {
+        const char *value = p;
+        p = skip_value(p, end);
+        if (!f(value, p))
+          return false;
+        p = skip_ws(p, end);
+        if (p < end && *p == ',')
+          p = skip_ws(p + 1, end);
+      }
+      return p < end;
+    }
+
+    bool parse_hash_array(const char *p, const char *end, std::vector<crypto::hash> &hashes)
+    {
+      hashes.clear();
+      return for_each_element(p, end, [&](const char *value, const char *value_end) {
+        crypto::hash hash;
+        if (!parse_hash(value, value_end, hash))
+          return false;
+        hashes.push_back(hash);
+        return true;
+      });
+    }
+
+    // only the keys and variants json_archive writes for a coinbase; anything else is refused
+    bool parse_miner_tx(const char *p, const char *end, transaction &tx)
+    {
+      tx.set_null();
+      unsigned found = 0;
+      const char *q = for_each_member(p, end, [&](const char *key, size_t key_size, const char *value, const char *value_end)
+      {
+        uint64_t v;
+        if (key_is(key, key_size, "version") && archive_tsv_uint(value, value_end, v))
+        {
+          tx.version = v;
+          found |= 1;
+        }
+        else if (key_is(key, key_size, "unlock_time") && archive_tsv_uint(value, value_end, tx.unlock_time))
+        {
+          found |= 2;
+        }
+        else if (key_is(key, key_size, "vin"))
+        {
+          if (!for_each_element(value, value_end, [&](const char *in, const char *in_end) {
+            bool gen = false;
+            txin_gen txin;
+            const char *r = for_each_member(in, in_end, [&](const char *k, size_t k_size, const char *g, const char *g_end)
+            {
+              gen = key_is(k, k_size, "gen") && for_each_member(g, g_end, [&](const char *hk, size_t hk_size, const char *h, const char *h_end)
+              {
+                uint64_t height;
+                if (!key_is(hk, hk_size, "height") || !archive_tsv_uint(h, h_end, height))
+                  return false;
+                txin.height = height;
+                return true;
+              }) != nullptr;
+              return gen;
+            });
+            if (!r || !gen)
+              return false;
+            tx.vin.push_back(txin);
+            return true;
+          }))
+            return false;
+          found |= 4;
+        }
+        else if (key_is(key, key_size, "vout"))
+        {
+          if (!for_each_element(value, value_end, [&](const char *out, const char *out_end) {
+            tx_out txout;
+            unsigned out_found = 0;
+            const char *r = for_each_member(out, out_end, [&](const char *k, size_t k_size, const char *o, const char *o_end)
+            {
+              if (key_is(k, k_size, "amount") && archive_tsv_uint(o, o_end, txout.amount))
+              {
+                out_found |= 1;
+                return true;
+              }
+              if (!key_is(k, k_size, "target"))
+                return false;
+              return for_each_member(o, o_end, [&](const char *tk, size_t tk_size, const char *t, const char *t_end)
+              {
+                crypto::hash key;
+                if (!key_is(tk, tk_size, "key") || !parse_hash(t, t_end, key))
+                  return false;
+                txout_to_key to_key;
+                memcpy(to_key.key.data, key.data, sizeof(to_key.key.data));
+                txout.target = to_key;
+                out_found |= 2;
+                return true;
+              }) != nullptr;
+            });
+            if (!r || out_found != 3)
+              return false;
+            tx.vout.push_back(txout);
+            return true;
+          }))
+            return false;
+          found |= 8;
+        }
+        else if (key_is(key, key_size, "extra"))
+        {
+          if (!for_each_element(value, value_end, [&](const char *e, const char *e_end) {
+            uint64_t byte;
+            if (!archive_tsv_uint(e, e_end, byte) || byte > 255)
+              return false;
+            tx.extra.push_back((uint8_t)byte);
+            return true;
+          }))
+            return false;
+          found |= 16;
+        }
+        else if (key_is(key, key_size, "rct_signatures"))
+        {
+          // a coinbase has no RingCT signatures, only the type
+          const char *r = for_each_member(value, value_end, [&](const char *k, size_t k_size, const char *t, const char *t_end)
+          {
+            uint64_t type;
+            return key_is(k, k_size, "type") && archive_tsv_uint(t, t_end, type) && type == rct::RCTTypeNull;
+          });
+          if (!r)
+            return false;
+          found |= 32;
+        }
+        else if (key_is(key, key_size, "signatures"))
+        {
+          // v1: one empty array per gen input
+          if (!for_each_element(value, value_end, [](const char *s, const char *s_end) {
+            return s_end - s >= 2 && *s == '[' && *skip_ws(s + 1, s_end) == ']';
+          }))
+            return false;
+        }
+        else
+        {
+          return false;
+        }
+        return true;
+      });
+      if (!q || (found & 31) != 31)
+        return false;
+      // v2 transactions always have the RingCT type
+      return tx.version == 1 || (found & 32);
+    }
+
+    bool parse_uint_array(const char *p, const char *end, std::vector<uint64_t> &values)
+    {
+      values.clear();
+      return for_each_element(p, end, [&](const char *value, const char *value_end) {
+        uint64_t v;
+        if (!archive_tsv_uint(value, value_end, v))
+          return false;
+        values.push_back(v);
+        return true;
+      });
+    }
+
+    bool parse_chain_entries(const char *p, const char *end, std::vector<archive_tsv_alt_chain_entry> &entries)
+    {
+      entries.clear();
+      return for_each_element(p, end, [&](const char *value, const char *value_end) {
+        archive_tsv_alt_chain_entry entry;
+        unsigned found = 0;
+        const char *q = for_each_member(value, value_end, [&](const char *key, size_t key_size, const char *v, const char *v_end)
+        {
+          if (key_is(key, key_size, "id") && archive_tsv_uint(v, v_end, entry.id))
+            found |= 1;
+          else if (key_is(key, key_size, "length") && archive_tsv_uint(v, v_end, entry.length))
+            found |= 2;
+          else if (key_is(key, key_size, "top") && archive_tsv_uint(v, v_end, entry.top_height))
+            found |= 4;
+          else if (key_is(key, key_size, "diff") && v_end > v && digits_end(v, v_end) == v_end)
+          {
+            entry.diff = v;
+            entry.diff_end = v_end;
+            found |= 8;
+          }
+          else if (key_is(key, key_size, "hash") && parse_hash(v, v_end, entry.hash))
+            found |= 16;
+          return true;
+        });
+        if (!q || found != 31)
+          return false;
+        entries.push_back(entry);
+        return true;
+      });
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  const char *archive_tsv_split(const char *p, const char *end, archive_tsv_fields &fields)
+  {
+    fields.n_fields = 0;
+    while (true)
+    {
+      const char *d = archive_tsv_find_delimiter(p, end);
+      if (fields.n_fields < archive_tsv_fields::max_fields)
+      {
+        fields.begin[fields.n_fields] = p;
+        fields.end[fields.n_fields] = d;
+        ++fields.n_fields;
+      }
+      if (d == end)
+        return end;
+      p = d + 1;
+      if (*d == '\n')
+        return p;
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_uint(const char *p, const char *end, uint64_t &v)
+  {
+    if (p == end)
+      return false;
+    v = 0;
+    for (; p < end; ++p)
+    {
+      if (*p < '0' || *p > '9')
+        return false;
+      v = v * 10 + (*p - '0');
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_bool(const char *p, const char *end, bool &v)
+  {
+    if (end - p != 1 || (*p != '0' && *p != '1'))
+      return false;
+    v = *p == '1';
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_parse_block(const char *p, const char *end, archive_tsv_block &block)
+  {
+    unsigned found = 0;
+    const bool ok = for_each_member(p, end, [&](const char *key, size_t key_size, const char *value, const char *value_end)
+    {
+      if (key_is(key, key_size, "major_version") && archive_tsv_uint(value, value_end, block.major_version))
+        found |= 1;
+      else if (key_is(key, key_size, "minor_version") && archive_tsv_uint(value, value_end, block.minor_version))
+        found |= 2;
+      else if (key_is(key, key_size, "timestamp") && archive_tsv_uint(value, value_end, block.timestamp))
+        found |= 4;
+      else if (key_is(key, key_size, "nonce") && archive_tsv_uint(value, value_end, block.nonce))
+        found |= 8;
+      else if (key_is(key, key_size, "prev_id") && parse_hash(value, value_end, block.prev_id))
+        found |= 16;
+      else if (key_is(key, key_size, "miner_tx"))
+      {
+        block.miner_tx = value;
+        block.miner_tx_end = value_end;
+        found |= 32;
+      }
+      else if (key_is(key, key_size, "tx_hashes"))
+      {
+        block.tx_hashes = value;
+        block.tx_hashes_end = value_end;
+        found |= 64;
+      }
+      else if (key_is(key, key_size, "height") && archive_tsv_uint(value, value_end, block.height))
+        found |= 128;
+      else if (key_is(key, key_size, "hash") && parse_hash(value, value_end, block.hash))
+        found |= 256;
+      else if (key_is(key, key_size, "n_tx_hashes") && archive_tsv_uint(value, value_end, block.n_tx_hashes))
+        found |= 512;
+      return true;
+    }) != nullptr;
+    if (!ok)
+      return false;
+
+    // header-only record: height, hash and n_tx_hashes in place of miner_tx and tx_hashes
+    block.header_only = (found == (31 | 128 | 256 | 512));
+    if (block.header_only)
+    {
+      block.miner_tx = block.miner_tx_end = nullptr;
+      block.tx_hashes = block.tx_hashes_end = nullptr;
+      return true;
+    }
+    if ((found & 127) != 127)
+      return false;
+
+    // tx_hashes: array of hex strings
+    block.n_tx_hashes = 0;
+    for (const char *q = block.tx_hashes; q < block.tx_hashes_end; ++q)
+    {
+      if (*q == '"')
+      {
+        q = skip_string(q, block.tx_hashes_end) - 1;
+        ++block.n_tx_hashes;
+      }
+    }
+
+    // height: miner_tx.vin[0].gen.height, the first "height" after "gen"
+    static const char gen_key[] = "\"gen\"";
+    static const char height_key[] = "\"height\"";
+    const char *gen = std::search(block.miner_tx, block.miner_tx_end, gen_key, gen_key + sizeof(gen_key) - 1);
+    const char *height = std::search(gen, block.miner_tx_end, height_key, height_key + sizeof(height_key) - 1);
+    if (height == block.miner_tx_end)
+      return false;
+    p = skip_ws(height + sizeof(height_key) - 1, block.miner_tx_end);
+    if (p == block.miner_tx_end || *p != ':')
+      return false;
+    p = skip_ws(p + 1, block.miner_tx_end);
+    return archive_tsv_uint(p, digits_end(p, block.miner_tx_end), block.height);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_make_block(const archive_tsv_block &parsed, block &b)
+  {
+    if (parsed.header_only)
+      return false;
+    b = block();
+    b.major_version = parsed.major_version;
+    b.minor_version = parsed.minor_version;
+    b.timestamp = parsed.timestamp;
+    b.prev_id = parsed.prev_id;
+    b.nonce = parsed.nonce;
+    return parse_miner_tx(parsed.miner_tx, parsed.miner_tx_end, b.miner_tx) &&
+        parse_hash_array(parsed.tx_hashes, parsed.tx_hashes_end, b.tx_hashes);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_block_hash(const archive_tsv_block &parsed, crypto::hash &hash)
+  {
+    if (parsed.header_only)
+    {
+      hash = parsed.hash;
+      return true;
+    }
+    block b;
+    if (!archive_tsv_make_block(parsed, b))
+      return false;
+    hash = get_block_hash(b);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_parse_alt_chains(const char *p, const char *end, std::vector<archive_tsv_alt_chain> *chains, uint64_t &n_chains)
+  {
+    n_chains = 0;
+    if (chains)
+      chains->clear();
+    p = skip_ws(p, end);
+    if (p == end || *p != '[')
+      return false;
+    p = skip_ws(p + 1, end);
+    while (p < end && *p != ']')
+    {
+      if (!chains)
+      {
+        if (*p != '{')
+          return false;
+        p = skip_value(p, end);
+      }
+      else
+      {
+        archive_tsv_alt_chain chain;
+        unsigned found = 0;
+        p = for_each_member(p, end, [&](const char *key, size_t key_size, const char *value, const char *value_end)
+        {
+          if (key_is(key, key_size, "length") && archive_tsv_uint(value, value_end, chain.length))
+            found |= 1;
+          else if (key_is(key, key_size, "height") && archive_tsv_uint(value, value_end, chain.height))
+            found |= 2;
+          else if (key_is(key, key_size, "deep") && archive_tsv_uint(value, value_end, chain.deep))
+            found |= 4;
+          else if (key_is(key, key_size, "diff") && value_end > value && digits_end(value, value_end) == value_end)
+          {
+            chain.diff = value;
+            chain.diff_end = value_end;
+            found |= 8;
+          }
+          else if (key_is(key, key_size, "hash") && parse_hash(value, value_end, chain.hash))
+            found |= 16;
+          return true;
+        });
+        if (!p || found != 31)
+          return false;
+        chains->push_back(chain);
+      }
+      ++n_chains;
+      p = skip_ws(p, end);
+      if (p < end && *p == ',')
+        p = skip_ws(p + 1, end);
+    }
+    return p < end;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tsv_parse_alt_chain_delta(const char *p, const char *end, archive_tsv_alt_chain_delta &delta)
+  {
+    delta.snapshot = false;
+    delta.has_order = false;
+    delta.added.clear();
+    delta.extended.clear();
+    delta.removed.clear();
+    delta.order.clear();
+    bool has_chain_height = false;
+    p = for_each_member(p, end, [&](const char *key, size_t key_size, const char *value, const char *value_end)
+    {
+      if (key_is(key, key_size, "chain_height"))
+        return has_chain_height = archive_tsv_uint(value, value_end, delta.chain_height);
+      if (key_is(key, key_size, "snapshot"))
+        return delta.snapshot = parse_chain_entries(value, value_end, delta.added);
+      if (key_is(key, key_size, "add"))
+        return parse_chain_entries(value, value_end, delta.added);
+      if (key_is(key, key_size, "extend"))
+        return parse_chain_entries(value, value_end, delta.extended);
+      if (key_is(key, key_size, "remove"))
+        return parse_uint_array(value, value_end, delta.removed);
+      if (key_is(key, key_size, "order"))
+        return delta.has_order = parse_uint_array(value, value_end, delta.order);
+      return true;
+    });
+    if (!p || !has_chain_height)
+      return false;
+    return !delta.snapshot || (delta.extended.empty() && delta.removed.empty() && !delta.has_order);
+  }
+}
@@ -0,0 +1,174 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tsv.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "crypto/hash.h"
+
+namespace cryptonote
+{
+  struct block;
+
+  /**
+   * @brief next tab or newline in [p, end), or end; 16 bytes at a time with SSE2
+   */
+  inline const char *archive_tsv_find_delimiter(const char *p, const char *end)
+  {
+#if defined(__SSE2__)
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16)
+    {
+      const __m128i v = _mm_loadu_si128((const __m128i*)p);
+      const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, newline)));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+#endif
+    while (p < end && *p != '\t' && *p != '\n')
+      ++p;
+    return p;
+  }
+
+  /**
+   * @brief output fields of one archive line, as spans into the line
+   */
+  struct archive_tsv_fields
+  {
+    static const size_t max_fields = 16;
+    const char *begin[max_fields];
+    const char *end[max_fields];
+    size_t n_fields;  //!< at most max_fields; later fields are dropped
+  };
+
+  /**
+   * @brief splits the line starting at p into fields
+   *
+   * @return the start of the next line
+   */
+  const char *archive_tsv_split(const char *p, const char *end, archive_tsv_fields &fields);
+
+  bool archive_tsv_uint(const char *p, const char *end, uint64_t &v);
+  bool archive_tsv_bool(const char *p, const char *end, bool &v);
+
+  /**
+   * @brief Block JSON (output field 4) values read without building a document
+   *
+   * Only the top level keys and the miner tx height are parsed; miner_tx and
+   * tx_hashes are left as spans of the line.  The Block JSON of header-only
+   * records has height, hash and n_tx_hashes in their place.
+   */
+  struct archive_tsv_block
+  {
+    uint64_t major_version, minor_version, timestamp, nonce, height;
+    crypto::hash prev_id;
+    const char *miner_tx, *miner_tx_end;
+    const char *tx_hashes, *tx_hashes_end;
+    uint64_t n_tx_hashes;
+    bool header_only;     //!< header JSON: miner_tx and tx_hashes are null, hash is set
+    crypto::hash hash;    //!< only for header-only records
+  };
+
+  bool archive_tsv_parse_block(const char *p, const char *end, archive_tsv_block &block);
+
+  /**
+   * @brief rebuilds the block of a full record from its Block JSON
+   *
+   * Reads the miner tx shapes a coinbase can have: gen inputs, to_key
+   * outputs and no RingCT signatures.  Fails for header-only records.
+   */
+  bool archive_tsv_make_block(const archive_tsv_block &parsed, block &b);
+
+  /**
+   * @brief hash of the block of a line: read from header-only records, computed from full ones
+   */
+  bool archive_tsv_block_hash(const archive_tsv_block &parsed, crypto::hash &hash);
+
+  /**
+   * @brief one object of the Alt Chains Info JSON (output field 6)
+   */
+  struct archive_tsv_alt_chain
+  {
+    uint64_t length, height, deep;
+    const char *diff, *diff_end;  //!< decimal cumulative difficulty
+    crypto::hash hash;
+  };
+
+  /**
+   * @brief reads the Alt Chains Info JSON array
+   *
+   * @param chains receives the parsed objects; may be null to only count them
+   * @param n_chains receives the number of objects
+   */
+  bool archive_tsv_parse_alt_chains(const char *p, const char *end, std::vector<archive_tsv_alt_chain> *chains, uint64_t &n_chains);
+
+  /**
+   * @brief one chain of a delta-encoded Alt Chains Info, see archive_alt_delta.h
+   */
+  struct archive_tsv_alt_chain_entry
+  {
+    uint64_t id, length, top_height;
+    const char *diff, *diff_end;  //!< decimal cumulative difficulty
+    crypto::hash hash;
+  };
+
+  /**
+   * @brief a delta-encoded Alt Chains Info object, as spans into the line
+   */
+  struct archive_tsv_alt_chain_delta
+  {
+    uint64_t chain_height;
+    bool snapshot;  //!< added holds every chain, in order, and nothing else is set
+    std::vector<archive_tsv_alt_chain_entry> added;
+    std::vector<archive_tsv_alt_chain_entry> extended;
+    std::vector<uint64_t> removed;
+    bool has_order;
+    std::vector<uint64_t> order;  //!< ids in output order, if it is not the previous order with added ids appended
+  };
+
+  /**
+   * @brief reads a delta-encoded Alt Chains Info object
+   *
+   * The caller applies it to the chains of the previous line, see
+   * archive_alt_chain_decoder.
+   */
+  bool archive_tsv_parse_alt_chain_delta(const char *p, const char *end, archive_tsv_alt_chain_delta &delta);
+}
@@ -0,0 +1,307 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tx_arrivals.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+
+#include <boost/thread/lock_guard.hpp>
+
+#include "misc_log_ex.h"
+#include "archive_json.h"
+#include "archive_tx_arrivals.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace cryptonote
+{
+  namespace
+  {
+    uint64_t now_ms()
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    const char *relay_method_name(relay_method relay)
+    {
+      switch (relay)
+      {
+        case relay_method::none: return "none";
+        case relay_method::local: return "local";
+        case relay_method::forward: return "forward";
+        case relay_method::stem: return "stem";
+        case relay_method::fluff: return "fluff";
+        case relay_method::block: return "block";
+        default: return "unknown";
+      }
+    }
+
+    // unique over every recorder, so a thread never reuses a buffer of an earlier start
+    std::atomic<uint64_t> next_generation(1);
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_arrivals::archive_tx_arrivals():
+    m_enabled(false),
+    m_generation(0),
+    m_running(false),
+    m_stopping(false),
+    m_segment_number(0),
+    m_segment_started_ms(0),
+    m_recorded(0),
+    m_written(0),
+    m_dropped(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_arrivals::~archive_tx_arrivals()
+  {
+    stop();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_arrivals::start(const archive_tx_arrivals_config &config)
+  {
+    stop();
+    m_config = config;
+    if (!m_config.enabled)
+      return true;
+
+    m_generation = next_generation++;
+    m_buffers.clear();
+    m_segment_number = 0;
+    m_stopping = false;
+    try
+    {
+      m_thread = boost::thread(&archive_tx_arrivals::run, this);
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to start archive tx arrivals thread: " << e.what());
+      return false;
+    }
+    m_running = true;
+    // after m_generation, which recording threads read once they see this
+    m_enabled.store(true, std::memory_order_release);
+    MINFO("Archive tx arrivals started, " << m_config.file.filename);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_arrivals::stop()
+  {
+    if (!m_running)
+      return;
+
+    m_enabled = false;
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_cond.notify_one();
+    }
+    if (m_thread.joinable())
+      m_thread.join();
+    m_running = false;
+
+    const stats s = get_stats();
+    MINFO("Archive tx arrivals stopped, recorded " << s.recorded << ", written " << s.written << ", dropped " << s.dropped);
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_arrivals::thread_buffer &archive_tx_arrivals::local_buffer()
+  {
+    struct local_slot
+    {
+      uint64_t generation = 0;
+      std::shared_ptr<thread_buffer> buffer;
+    };
+    static thread_local local_slot slot;
+
+    if (slot.generation != m_generation || !slot.buffer)
+    {
+      // once per thread and start; the registry lock is not taken again by this thread
+      slot.buffer = std::make_shared<thread_buffer>();
+      slot.buffer->records.reserve(std::min<size_t>(m_config.max_thread_records, 1024));
+      slot.generation = m_generation;
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_buffers.push_back(slot.buffer);
+    }
+    return *slot.buffer;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_arrivals::record(const crypto::hash &id, uint64_t blob_size, uint64_t weight, uint64_t fee, relay_method relay)
+  {
+    if (!enabled())
+      return;
+
+    tx_arrival arrival;
+    arrival.received = archive_receive_time::now();
+    arrival.id = id;
+    arrival.blob_size = blob_size;
+    arrival.weight = weight;
+    arrival.fee = fee;
+    arrival.relay = relay;
+
+    thread_buffer &buffer = local_buffer();
+    size_t n_records;
+    {
+      boost::lock_guard<boost::mutex> lock(buffer.mutex);
+      n_records = buffer.records.size();
+      if (n_records < m_config.max_thread_records)
+        buffer.records.push_back(arrival);
+    }
+    if (n_records >= m_config.max_thread_records)
+    {
+      ++m_dropped;
+      return;
+    }
+    ++m_recorded;
+    // a flood: flush before the buffer fills rather than at the next interval
+    if (n_records + 1 == m_config.max_thread_records / 2)
+      m_cond.notify_one();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_arrivals::stats archive_tx_arrivals::get_stats() const
+  {
+    stats s;
+    s.recorded = m_recorded;
+    s.written = m_written;
+    s.dropped = m_dropped;
+    return s;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_arrivals::run()
+  {
+    open_segment();
+    while (true)
+    {
+      bool stopping;
+      {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        if (!m_stopping)
+          m_cond.wait_for(lock, boost::chrono::milliseconds(m_config.flush_ms));
+        stopping = m_stopping;
+      }
+      flush();
+      if (stopping)
+        break;
+    }
+    m_file.close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_arrivals::open_segment()
+  {
+    archive_file_config file = m_config.file;
+    if (m_config.segments.enabled())
+    {
+      // every start begins a new segment, so a torn line can only end one
+      if (m_segment_number == 0)
+      {
+        const std::vector<archive_segment_info> segments = archive_list_segments(m_config.file.filename);
+        m_segment_number = segments.empty() ? 0 : segments.back().number;
+      }
+      file.filename = archive_segment_filename(m_config.file.filename, ++m_segment_number);
+    }
+    m_file.close();
+    m_segment_started_ms = now_ms();
+    if (!m_file.open(file))
+    {
+      MERROR("Failed to open archive tx arrivals file " << file.filename);
+      return false;
+    }
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_arrivals::flush()
+  {
+    std::vector<std::shared_ptr<thread_buffer>> buffers;
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      buffers = m_buffers;
+    }
+    for (const std::shared_ptr<thread_buffer> &buffer: buffers)
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(buffer->mutex);
+        buffer->records.swap(buffer->spare);
+      }
+      m_pending.insert(m_pending.end(), buffer->spare.begin(), buffer->spare.end());
+      buffer->spare.clear();
+    }
+    {
+      // buffers of threads that exited, once nothing is left in them
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      buffers.clear();
+      m_buffers.erase(std::remove_if(m_buffers.begin(), m_buffers.end(), [](const std::shared_ptr<thread_buffer> &buffer) {
+        boost::lock_guard<boost::mutex> buffer_lock(buffer->mutex);
+        return buffer.use_count() == 1 && buffer->records.empty();
+      }), m_buffers.end());
+    }
+    if (m_pending.empty())
+      return;
+
+    std::stable_sort(m_pending.begin(), m_pending.end(), [](const tx_arrival &a, const tx_arrival &b) {
+      return a.received.steady_us < b.received.steady_us;
+    });
+    m_lines.clear();
+    for (const tx_arrival &arrival: m_pending)
+      format_line(arrival, m_lines);
+
+    if (m_config.segments.enabled() && m_file.size() > 0
+        && ((m_config.segments.max_bytes != 0 && m_file.size() + m_lines.size() > m_config.segments.max_bytes)
+          || (m_config.segments.max_seconds != 0 && now_ms() - m_segment_started_ms >= m_config.segments.max_seconds * 1000)))
+      open_segment();
+
+    if (m_file.write(&m_lines, 1))
+      m_written += m_pending.size();
+    else
+    {
+      MERROR("Failed to write " << m_pending.size() << " tx arrival lines to " << m_config.file.filename);
+      m_dropped += m_pending.size();
+    }
+    m_pending.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_arrivals::format_line(const tx_arrival &arrival, std::string &line)
+  {
+    const char output_field_delimiter = '\t';
+
+    archive_append_uint(line, arrival.received.system_ms); // 1
+    line += output_field_delimiter;
+    archive_append_hex(line, arrival.id.data, sizeof(arrival.id.data)); // 2
+    line += output_field_delimiter;
+    archive_append_uint(line, arrival.blob_size); // 3
+    line += output_field_delimiter;
+    archive_append_uint(line, arrival.weight); // 4
+    line += output_field_delimiter;
+    archive_append_uint(line, arrival.fee); // 5
+    line += output_field_delimiter;
+    line += relay_method_name(arrival.relay); // 6
+    line += '\n';
+  }
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tx_arrivals.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "crypto/hash.h"
+#include "cryptonote_protocol/enums.h"
+#include "archive_file.h"
+#include "archive_record.h"
+#include "archive_segment.h"
+
+namespace cryptonote
+{
+  struct archive_tx_arrivals_config
+  {
+    bool enabled = false;
+    archive_file_config file;          //!< base filename, one line per tx, see README "Transaction Arrivals"
+    archive_segment_config segments;   //!< a new segment on every start and at these limits; both 0 for one file
+    size_t max_thread_records = 65536; //!< most records one thread holds between flushes; further ones are dropped
+    uint64_t flush_ms = 1000;          //!< how often the records of every thread are written
+  };
+
+  /**
+   * @brief when each tx was accepted into the mempool
+   *
+   * tx_memory_pool::add_tx() records every tx it accepts while holding the
+   * pool lock that the Block Handler also takes, so record() must not wait
+   * on anything shared.  Every thread that records gets a buffer of its
+   * own; its lock is only ever taken by that thread and, for a swap of two
+   * vectors, by the flush thread.  The flush thread collects all buffers
+   * every flush_ms, or sooner once one is half full, and appends their
+   * records to the current segment in one write, ordered by receive time.
+   */
+  class archive_tx_arrivals
+  {
+  public:
+    struct stats
+    {
+      uint64_t recorded;  //!< txs recorded
+      uint64_t written;   //!< lines written
+      uint64_t dropped;   //!< txs not recorded as their thread's buffer was full, or not written
+    };
+
+    archive_tx_arrivals();
+    ~archive_tx_arrivals();
+
+    /**
+     * @brief starts the flush thread, which opens a new segment
+     */
+    bool start(const archive_tx_arrivals_config &config);
+
+    /**
+     * @brief writes what every thread holds and stops the flush thread
+     */
+    void stop();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_acquire); }
+
+    /**
+     * @brief records a tx accepted into the mempool; any thread
+     */
+    void record(const crypto::hash &id, uint64_t blob_size, uint64_t weight, uint64_t fee, relay_method relay);
+
+    stats get_stats() const;
+
+  private:
+    struct tx_arrival
+    {
+      archive_receive_time received;
+      crypto::hash id;
+      uint64_t blob_size;
+      uint64_t weight;
+      uint64_t fee;
+      relay_method relay;
+    };
+
+    struct thread_buffer
+    {
+      boost::mutex mutex;
+      std::vector<tx_arrival> records;  //!< filled by the owning thread
+      std::vector<tx_arrival> spare;    //!< flush thread only; swapped with records to collect them
+    };
+
+    thread_buffer &local_buffer();
+    void run();
+    void flush();
+    bool open_segment();
+    void format_line(const tx_arrival &arrival, std::string &line);
+
+    archive_tx_arrivals_config m_config;
+    std::atomic<bool> m_enabled;
+    uint64_t m_generation;  //!< tells thread buffers of this start from those of an earlier one
+    bool m_running;
+    bool m_stopping;
+    boost::thread m_thread;
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::vector<std::shared_ptr<thread_buffer>> m_buffers;  //!< under m_mutex
+
+    std::vector<tx_arrival> m_pending;
+    std::string m_lines;
+    archive_file m_file;
+    uint64_t m_segment_number;
+    uint64_t m_segment_started_ms;
+
+    std::atomic<uint64_t> m_recorded;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+  };
+}
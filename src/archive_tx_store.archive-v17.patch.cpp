@@ -0,0 +1,812 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tx_store.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "misc_log_ex.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "archive_format.h"
+#include "archive_tx_store.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace
+{
+  // CRYPTONOTE_MAX_TX_SIZE is 1 MB; anything much larger is not an entry
+  const uint64_t max_blob_size = 16 * 1024 * 1024;
+  const uint64_t min_index_slots = 1024;
+  const uint64_t max_index_slots = (uint64_t)1 << 40;
+
+  void put_le(char *p, uint64_t v, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i)
+      p[i] = (char)(v >> (8 * i));
+  }
+
+#ifndef _WIN32
+  bool read_at(int fd, uint64_t offset, void *data, size_t size)
+  {
+    char *p = (char*)data;
+    while (size > 0)
+    {
+      const ssize_t n = pread(fd, p, size, offset);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      offset += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool write_at(int fd, uint64_t offset, const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      const ssize_t n = pwrite(fd, data, size, offset);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      offset += n;
+      size -= n;
+    }
+    return true;
+  }
+#endif
+
+  bool tx_hash(const cryptonote::archive_tx_blob &tx, crypto::hash &id)
+  {
+    cryptonote::transaction t;
+    if (!tx.pruned)
+      return cryptonote::parse_and_validate_tx_from_blob(tx.blob, t, id);
+    if (!cryptonote::parse_and_validate_tx_base_from_blob(tx.blob, t))
+      return false;
+    // v1 txs have no prunable part and are sent whole
+    if (t.version < 2)
+      return cryptonote::parse_and_validate_tx_from_blob(tx.blob, t, id);
+    id = cryptonote::get_pruned_transaction_hash(t, tx.prunable_hash);
+    return true;
+  }
+}
+
+namespace cryptonote
+{
+  std::string archive_tx_index_filename(const std::string &log_filename)
+  {
+    const size_t slash = log_filename.find_last_of("/\\");
+    const size_t dot = log_filename.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      return log_filename + ".idx";
+    return log_filename.substr(0, dot) + ".idx";
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_read_entry(int fd, uint64_t offset, archive_tx_entry &entry, uint64_t &entry_size)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    char header[ARCHIVE_TX_ENTRY_HEADER_SIZE];
+    if (!read_at(fd, offset, header, sizeof(header)))
+      return false;
+    const uint32_t crc = archive_get_le(header, 4);
+    const uint8_t flags = (uint8_t)header[36];
+    const uint64_t blob_size = archive_get_le(header + 40, 4);
+    if (blob_size > max_blob_size || (flags & ~ARCHIVE_TX_FLAG_PRUNED) != 0)
+      return false;
+
+    const size_t prunable_size = (flags & ARCHIVE_TX_FLAG_PRUNED) ? sizeof(crypto::hash) : 0;
+    std::string rest(prunable_size + blob_size, '\0');
+    if (!read_at(fd, offset + sizeof(header), &rest[0], rest.size()))
+      return false;
+    if (archive_crc32c(archive_crc32c(0, header + 4, sizeof(header) - 4), rest.data(), rest.size()) != crc)
+      return false;
+
+    memcpy(entry.id.data, header + 4, sizeof(entry.id.data));
+    entry.pruned = prunable_size != 0;
+    entry.prunable_hash = crypto::null_hash;
+    if (entry.pruned)
+      memcpy(entry.prunable_hash.data, rest.data(), sizeof(entry.prunable_hash.data));
+    entry.blob.assign(rest, prunable_size, std::string::npos);
+    entry_size = sizeof(header) + rest.size();
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_index::archive_tx_index():
+    m_fd(-1),
+    m_data(NULL),
+    m_mapped_size(0),
+    m_slots(0),
+    m_writable(false),
+    m_was_clean(false)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_index::~archive_tx_index()
+  {
+    close(false);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_tx_index::archive_tx_key(const crypto::hash &id)
+  {
+    // tx hashes are uniformly distributed, so their first bytes make a good key
+    const uint64_t key = archive_get_le(id.data, 8);
+    return key == 0 ? 1 : key;
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_tx_index::slot_get(uint64_t slot, size_t field) const
+  {
+    return archive_get_le(m_data + ARCHIVE_TX_INDEX_HEADER_SIZE + slot * ARCHIVE_TX_INDEX_SLOT_SIZE + field, 8);
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_tx_index::entries() const
+  {
+    return m_data ? archive_get_le(m_data + 24, 8) : 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  uint64_t archive_tx_index::log_size() const
+  {
+    return m_data ? archive_get_le(m_data + 32, 8) : 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_index::map(int fd, uint64_t size, bool writable)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    void *p = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      return false;
+    m_data = (char*)p;
+    m_mapped_size = size;
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_index::unmap()
+  {
+#ifndef _WIN32
+    if (m_data)
+      munmap(m_data, m_mapped_size);
+#endif
+    m_data = NULL;
+    m_mapped_size = 0;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_index::open(const std::string &filename, bool writable)
+  {
+    close(false);
+#ifdef _WIN32
+    return false;
+#else
+    const int fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < ARCHIVE_TX_INDEX_HEADER_SIZE || !map(fd, st.st_size, writable))
+    {
+      ::close(fd);
+      return false;
+    }
+    const uint64_t slots = archive_get_le(m_data + 16, 8);
+    if (archive_get_le(m_data, 4) != ARCHIVE_TX_INDEX_MAGIC || archive_get_le(m_data + 4, 2) != ARCHIVE_TX_STORE_VERSION
+        || archive_get_le(m_data + 6, 2) != ARCHIVE_TX_INDEX_HEADER_SIZE || archive_get_le(m_data + 8, 2) != ARCHIVE_TX_INDEX_SLOT_SIZE
+        || slots == 0 || slots > max_index_slots || (slots & (slots - 1)) != 0
+        || (uint64_t)st.st_size != ARCHIVE_TX_INDEX_HEADER_SIZE + slots * ARCHIVE_TX_INDEX_SLOT_SIZE)
+    {
+      unmap();
+      ::close(fd);
+      return false;
+    }
+
+    m_filename = filename;
+    m_fd = fd;
+    m_slots = slots;
+    m_writable = writable;
+    m_was_clean = archive_get_le(m_data + 10, 2) == 1;
+    if (writable)
+    {
+      put_le(m_data + 10, 0, 2);
+      msync(m_data, ARCHIVE_TX_INDEX_HEADER_SIZE, MS_SYNC);
+    }
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_index::create(const std::string &filename, uint64_t slots)
+  {
+    close(false);
+#ifdef _WIN32
+    return false;
+#else
+    uint64_t n_slots = min_index_slots;
+    while (n_slots < slots && n_slots < max_index_slots)
+      n_slots <<= 1;
+
+    // built aside and renamed over, so a reader never maps half an index
+    const std::string tmp_filename = filename + ".tmp";
+    const int fd = ::open(tmp_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      MERROR("Failed to create archive tx index " << tmp_filename << ": " << strerror(errno));
+      return false;
+    }
+    const uint64_t size = ARCHIVE_TX_INDEX_HEADER_SIZE + n_slots * ARCHIVE_TX_INDEX_SLOT_SIZE;
+    if (ftruncate(fd, size) != 0 || !map(fd, size, true))
+    {
+      MERROR("Failed to size archive tx index " << tmp_filename << " to " << size << " bytes: " << strerror(errno));
+      ::close(fd);
+      unlink(tmp_filename.c_str());
+      return false;
+    }
+
+    put_le(m_data, ARCHIVE_TX_INDEX_MAGIC, 4);
+    put_le(m_data + 4, ARCHIVE_TX_STORE_VERSION, 2);
+    put_le(m_data + 6, ARCHIVE_TX_INDEX_HEADER_SIZE, 2);
+    put_le(m_data + 8, ARCHIVE_TX_INDEX_SLOT_SIZE, 2);
+    put_le(m_data + 10, 0, 2);
+    put_le(m_data + 12, 0, 4);
+    put_le(m_data + 16, n_slots, 8);
+    put_le(m_data + 24, 0, 8);
+    put_le(m_data + 32, 0, 8);
+
+    if (rename(tmp_filename.c_str(), filename.c_str()) != 0)
+    {
+      MERROR("Failed to rename archive tx index " << tmp_filename << " to " << filename << ": " << strerror(errno));
+      unmap();
+      ::close(fd);
+      unlink(tmp_filename.c_str());
+      return false;
+    }
+    m_filename = filename;
+    m_fd = fd;
+    m_slots = n_slots;
+    m_writable = true;
+    m_was_clean = false;
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_index::close(bool clean)
+  {
+    if (!m_data)
+      return;
+#ifndef _WIN32
+    if (m_writable)
+    {
+      msync(m_data, m_mapped_size, MS_SYNC);
+      if (clean)
+      {
+        // only once everything else is on disk
+        put_le(m_data + 10, 1, 2);
+        msync(m_data, ARCHIVE_TX_INDEX_HEADER_SIZE, MS_SYNC);
+      }
+    }
+    unmap();
+    ::close(m_fd);
+#endif
+    m_fd = -1;
+    m_slots = 0;
+    m_writable = false;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_index::insert(const crypto::hash &id, uint64_t offset)
+  {
+    if (!m_data || !m_writable)
+      return false;
+    const uint64_t n_entries = entries();
+    if ((n_entries + 1) * 2 > m_slots && !grow())
+      return false;
+
+    const uint64_t key = archive_tx_key(id);
+    const uint64_t mask = m_slots - 1;
+    uint64_t i = key & mask;
+    while (slot_get(i, 0) != 0)
+      i = (i + 1) & mask;
+    // offset first, so a reader that sees the key sees its offset
+    char *slot = m_data + ARCHIVE_TX_INDEX_HEADER_SIZE + i * ARCHIVE_TX_INDEX_SLOT_SIZE;
+    put_le(slot + 8, offset, 8);
+    put_le(slot, key, 8);
+    put_le(m_data + 24, n_entries + 1, 8);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_index::grow()
+  {
+#ifdef _WIN32
+    return false;
+#else
+    if (m_slots >= max_index_slots)
+      return false;
+
+    // keep the old table mapped until every entry was moved over
+    const int old_fd = m_fd;
+    char *const old_data = m_data;
+    const uint64_t old_mapped_size = m_mapped_size;
+    const uint64_t old_slots = m_slots;
+    const std::string filename = m_filename;
+    m_data = NULL;
+    m_mapped_size = 0;
+    if (!create(filename, old_slots * 2))
+    {
+      m_fd = old_fd;
+      m_data = old_data;
+      m_mapped_size = old_mapped_size;
+      m_slots = old_slots;
+      m_filename = filename;
+      m_writable = true;
+      return false;
+    }
+
+    const uint64_t mask = m_slots - 1;
+    for (uint64_t s = 0; s < old_slots; ++s)
+    {
+      const char *old_slot = old_data + ARCHIVE_TX_INDEX_HEADER_SIZE + s * ARCHIVE_TX_INDEX_SLOT_SIZE;
+      const uint64_t key = archive_get_le(old_slot, 8);
+      if (key == 0)
+        continue;
+      uint64_t i = key & mask;
+      while (slot_get(i, 0) != 0)
+        i = (i + 1) & mask;
+      memcpy(m_data + ARCHIVE_TX_INDEX_HEADER_SIZE + i * ARCHIVE_TX_INDEX_SLOT_SIZE, old_slot, ARCHIVE_TX_INDEX_SLOT_SIZE);
+    }
+    memcpy(m_data + 24, old_data + 24, 16);
+
+    munmap(old_data, old_mapped_size);
+    ::close(old_fd);
+    MINFO("Archive tx index grown to " << m_slots << " slots");
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_index::set_log_size(uint64_t size)
+  {
+    if (m_data && m_writable)
+      put_le(m_data + 32, size, 8);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_index::sync()
+  {
+#ifndef _WIN32
+    if (m_data && m_writable)
+      msync(m_data, m_mapped_size, MS_SYNC);
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_store::archive_tx_store():
+    m_enabled(false),
+    m_running(false),
+    m_stopping(false),
+    m_queued_bytes(0),
+    m_log_fd(-1),
+    m_log_size(0),
+    m_received(0),
+    m_stored(0),
+    m_duplicates(0),
+    m_invalid(0),
+    m_dropped(0),
+    m_bytes_stored(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_store::~archive_tx_store()
+  {
+    stop();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store::start(const archive_tx_store_config &config)
+  {
+    stop();
+    m_config = config;
+    if (!m_config.enabled)
+      return true;
+#ifdef _WIN32
+    MERROR("The archive tx store is not available on Windows");
+    return false;
+#else
+    m_stopping = false;
+    try
+    {
+      m_thread = boost::thread(&archive_tx_store::run, this);
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to start archive tx store thread: " << e.what());
+      return false;
+    }
+    m_running = true;
+    m_enabled = true;
+    MINFO("Archive tx store started, " << m_config.filename);
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_store::stop()
+  {
+    if (!m_running)
+      return;
+
+    m_enabled = false;
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_cond.notify_one();
+    }
+    if (m_thread.joinable())
+      m_thread.join();
+    m_running = false;
+
+    const stats s = get_stats();
+    MINFO("Archive tx store stopped, stored " << s.stored << " txs (" << s.bytes_stored << " bytes), duplicates " << s.duplicates
+        << ", invalid " << s.invalid << ", dropped " << s.dropped);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_store::push(std::vector<archive_tx_blob> &txs)
+  {
+    if (txs.empty())
+      return;
+
+    uint64_t bytes = 0;
+    for (const archive_tx_blob &tx: txs)
+      bytes += tx.blob.size();
+    m_received += txs.size();
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      if (enabled() && !m_stopping && m_queued_bytes + bytes <= m_config.max_queued_bytes)
+      {
+        m_queued_bytes += bytes;
+        m_queue.emplace_back(std::move(txs));
+        m_cond.notify_one();
+        txs.clear();
+        return;
+      }
+    }
+    m_dropped += txs.size();
+    txs.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_store::stats archive_tx_store::get_stats() const
+  {
+    stats s;
+    s.received = m_received;
+    s.stored = m_stored;
+    s.duplicates = m_duplicates;
+    s.invalid = m_invalid;
+    s.dropped = m_dropped;
+    s.bytes_stored = m_bytes_stored;
+    {
+      boost::lock_guard<boost::mutex> lock(const_cast<boost::mutex&>(m_mutex));
+      s.queued_bytes = m_queued_bytes;
+    }
+    return s;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_store::run()
+  {
+    if (!recover())
+    {
+      MERROR("Archive tx store " << m_config.filename << " could not be opened, txs are not stored");
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_enabled = false;
+      for (const std::vector<archive_tx_blob> &txs: m_queue)
+        m_dropped += txs.size();
+      m_queue.clear();
+      m_queued_bytes = 0;
+    }
+    else
+    {
+      std::vector<archive_tx_blob> txs;
+      while (true)
+      {
+        {
+          boost::unique_lock<boost::mutex> lock(m_mutex);
+          while (m_queue.empty() && !m_stopping)
+            m_cond.wait(lock);
+          if (m_queue.empty())
+            break;
+          // everything queued goes to the log in one write
+          for (std::vector<archive_tx_blob> &batch: m_queue)
+            for (archive_tx_blob &tx: batch)
+              txs.push_back(std::move(tx));
+          m_queue.clear();
+          m_queued_bytes = 0;
+        }
+        store(txs);
+        txs.clear();
+      }
+    }
+
+#ifndef _WIN32
+    if (m_log_fd >= 0)
+    {
+      const bool synced = fdatasync(m_log_fd) == 0;
+      m_index.close(synced);
+      ::close(m_log_fd);
+      m_log_fd = -1;
+    }
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store::recover()
+  {
+#ifdef _WIN32
+    return false;
+#else
+    const std::string index_filename = archive_tx_index_filename(m_config.filename);
+    m_log_fd = ::open(m_config.filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_log_fd < 0)
+    {
+      MERROR("Failed to open archive tx store " << m_config.filename << ": " << strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(m_log_fd, &st) != 0)
+    {
+      MERROR("Failed to stat archive tx store " << m_config.filename << ": " << strerror(errno));
+      return false;
+    }
+
+    if ((uint64_t)st.st_size < ARCHIVE_TX_LOG_HEADER_SIZE)
+    {
+      // a new store, or one torn before its header was written
+      std::string header;
+      archive_put_le(header, ARCHIVE_TX_LOG_MAGIC, 4);
+      archive_put_le(header, ARCHIVE_TX_STORE_VERSION, 2);
+      archive_put_le(header, ARCHIVE_TX_LOG_HEADER_SIZE, 2);
+      archive_put_le(header, 0, 8);
+      if (ftruncate(m_log_fd, 0) != 0 || !write_at(m_log_fd, 0, header.data(), header.size()))
+      {
+        MERROR("Failed to write archive tx store " << m_config.filename << ": " << strerror(errno));
+        return false;
+      }
+      // an index left from an earlier log would point at entries that are gone
+      if (!m_index.create(index_filename, m_config.initial_slots))
+        return false;
+      m_log_size = ARCHIVE_TX_LOG_HEADER_SIZE;
+      m_index.set_log_size(m_log_size);
+      return true;
+    }
+
+    char header[ARCHIVE_TX_LOG_HEADER_SIZE];
+    if (!read_at(m_log_fd, 0, header, sizeof(header)) || archive_get_le(header, 4) != ARCHIVE_TX_LOG_MAGIC
+        || archive_get_le(header + 4, 2) != ARCHIVE_TX_STORE_VERSION)
+    {
+      MERROR(m_config.filename << " is not an archive tx store");
+      return false;
+    }
+
+    // a clean index covers the log up to its log size; anything else is rebuilt
+    uint64_t from = ARCHIVE_TX_LOG_HEADER_SIZE;
+    if (m_index.open(index_filename, true) && m_index.was_clean()
+        && m_index.log_size() >= ARCHIVE_TX_LOG_HEADER_SIZE && m_index.log_size() <= (uint64_t)st.st_size)
+    {
+      from = m_index.log_size();
+    }
+    else
+    {
+      MWARNING("Archive tx index " << index_filename << " is missing or was not closed cleanly, rebuilding it from " << m_config.filename);
+      if (!m_index.create(index_filename, m_config.initial_slots))
+        return false;
+    }
+    return scan(from, st.st_size);
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store::scan(uint64_t from, uint64_t size)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    uint64_t offset = from;
+    uint64_t n_entries = 0;
+    archive_tx_entry entry;
+    uint64_t entry_size = 0;
+    while (offset < size && archive_tx_read_entry(m_log_fd, offset, entry, entry_size))
+    {
+      // entries added to the index just before a crash are already there
+      if (!m_index.find(entry.id, [offset](uint64_t o) { return o == offset; }) && !m_index.insert(entry.id, offset))
+      {
+        MERROR("Failed to add to archive tx index " << archive_tx_index_filename(m_config.filename));
+        return false;
+      }
+      offset += entry_size;
+      ++n_entries;
+    }
+
+    if (offset < size)
+    {
+      MWARNING("Archive tx store " << m_config.filename << ": cutting off " << size - offset << " bytes of torn or damaged tail at offset " << offset);
+      if (ftruncate(m_log_fd, offset) != 0)
+      {
+        MERROR("Failed to truncate archive tx store " << m_config.filename << ": " << strerror(errno));
+        return false;
+      }
+    }
+    m_log_size = offset;
+    m_index.set_log_size(m_log_size);
+    m_index.sync();
+    if (n_entries > 0)
+      MINFO("Archive tx store: indexed " << n_entries << " txs from offset " << from << ", " << m_index.entries() << " txs stored");
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store::entry_hash_is(uint64_t offset, const crypto::hash &id) const
+  {
+#ifdef _WIN32
+    return false;
+#else
+    crypto::hash entry_id;
+    return read_at(m_log_fd, offset + 4, entry_id.data, sizeof(entry_id.data)) && entry_id == id;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_store::store(std::vector<archive_tx_blob> &txs)
+  {
+#ifndef _WIN32
+    static thread_local std::string buffer;
+    buffer.clear();
+    std::vector<std::pair<crypto::hash, uint64_t>> added;
+    std::unordered_set<crypto::hash> batch_ids;
+
+    for (const archive_tx_blob &tx: txs)
+    {
+      crypto::hash id;
+      if (tx.blob.size() > max_blob_size || !tx_hash(tx, id))
+      {
+        ++m_invalid;
+        continue;
+      }
+      if (batch_ids.count(id) || m_index.find(id, [this, &id](uint64_t offset) { return entry_hash_is(offset, id); }))
+      {
+        ++m_duplicates;
+        continue;
+      }
+      batch_ids.insert(id);
+
+      const size_t start = buffer.size();
+      archive_put_le(buffer, 0, 4);  // CRC, below
+      buffer.append(id.data, sizeof(id.data));
+      archive_put_le(buffer, tx.pruned ? ARCHIVE_TX_FLAG_PRUNED : 0, 1);
+      archive_put_le(buffer, 0, 3);
+      archive_put_le(buffer, tx.blob.size(), 4);
+      if (tx.pruned)
+        buffer.append(tx.prunable_hash.data, sizeof(tx.prunable_hash.data));
+      buffer.append(tx.blob);
+      put_le(&buffer[start], archive_crc32c(0, buffer.data() + start + 4, buffer.size() - start - 4), 4);
+      added.emplace_back(id, m_log_size + start);
+    }
+    if (buffer.empty())
+      return;
+
+    if (!write_at(m_log_fd, m_log_size, buffer.data(), buffer.size()))
+    {
+      MERROR("Failed to write " << added.size() << " txs to archive tx store " << m_config.filename << ": " << strerror(errno));
+      // no torn entry may be left for the next write to follow
+      if (ftruncate(m_log_fd, m_log_size) != 0)
+        MERROR("Failed to truncate archive tx store " << m_config.filename << ": " << strerror(errno));
+      m_dropped += added.size();
+      return;
+    }
+    m_log_size += buffer.size();
+    m_stored += added.size();
+    m_bytes_stored += buffer.size();
+
+    for (const std::pair<crypto::hash, uint64_t> &entry: added)
+    {
+      if (!m_index.insert(entry.first, entry.second))
+      {
+        // the index no longer covers the log; the next start adds the rest from it
+        MERROR("Failed to add to archive tx index " << archive_tx_index_filename(m_config.filename));
+        return;
+      }
+    }
+    m_index.set_log_size(m_log_size);
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_store_reader::archive_tx_store_reader():
+    m_log_fd(-1)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_tx_store_reader::~archive_tx_store_reader()
+  {
+    close();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store_reader::open(const std::string &log_filename)
+  {
+    close();
+#ifdef _WIN32
+    MERROR("The archive tx store is not available on Windows");
+    return false;
+#else
+    m_log_fd = ::open(log_filename.c_str(), O_RDONLY);
+    if (m_log_fd < 0)
+    {
+      MERROR("Failed to open archive tx store " << log_filename << ": " << strerror(errno));
+      return false;
+    }
+    char header[ARCHIVE_TX_LOG_HEADER_SIZE];
+    if (!read_at(m_log_fd, 0, header, sizeof(header)) || archive_get_le(header, 4) != ARCHIVE_TX_LOG_MAGIC)
+    {
+      MERROR(log_filename << " is not an archive tx store");
+      close();
+      return false;
+    }
+    const std::string index_filename = archive_tx_index_filename(log_filename);
+    if (!m_index.open(index_filename, false))
+    {
+      MERROR("Failed to open archive tx index " << index_filename << "; the daemon rebuilds it when the tx store is enabled");
+      close();
+      return false;
+    }
+    return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_tx_store_reader::close()
+  {
+    m_index.close(false);
+#ifndef _WIN32
+    if (m_log_fd >= 0)
+      ::close(m_log_fd);
+#endif
+    m_log_fd = -1;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_tx_store_reader::get(const crypto::hash &id, archive_tx_entry &entry) const
+  {
+    uint64_t entry_size = 0;
+    return m_index.find(id, [this, &id, &entry, &entry_size](uint64_t offset) {
+      return archive_tx_read_entry(m_log_fd, offset, entry, entry_size) && entry.id == id;
+    }) != 0;
+  }
+}
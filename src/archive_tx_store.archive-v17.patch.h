@@ -0,0 +1,324 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_tx_store.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "crypto/hash.h"
+#include "cryptonote_basic/blobdatatype.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief tx store layout, all integers little-endian
+   *
+   * log, append-only:
+   *   header, ARCHIVE_TX_LOG_HEADER_SIZE bytes: u32 magic "MDAT", u16 version,
+   *   u16 header size, u64 reserved
+   *   entries: u32 CRC32C of the rest of the entry, u8[32] tx hash, u8 flags,
+   *   u8[3] reserved, u32 blob size, u8[32] prunable hash if the entry is
+   *   pruned, blob
+   *
+   * index, an open-addressing hash table with linear probing, next to the
+   * log with extension .idx:
+   *   header, ARCHIVE_TX_INDEX_HEADER_SIZE bytes: u32 magic "MDAX", u16 version,
+   *   u16 header size, u16 slot size, u16 clean (1 once closed cleanly),
+   *   u32 reserved, u64 slots (a power of two), u64 entries, u64 log size
+   *   the index covers
+   *   slots, ARCHIVE_TX_INDEX_SLOT_SIZE bytes each: u64 first 8 bytes of the
+   *   tx hash (0 for an empty slot, 1 in place of 0), u64 offset of the
+   *   entry in the log
+   *
+   * The index is never more than half full, so a lookup probes a couple of
+   * slots on average.  Once it would be, it is rebuilt at twice the size.
+   */
+  const uint32_t ARCHIVE_TX_LOG_MAGIC = 0x5441444d;    // "MDAT"
+  const uint32_t ARCHIVE_TX_INDEX_MAGIC = 0x5841444d;  // "MDAX"
+  const uint16_t ARCHIVE_TX_STORE_VERSION = 1;
+  const size_t ARCHIVE_TX_LOG_HEADER_SIZE = 16;
+  const size_t ARCHIVE_TX_ENTRY_HEADER_SIZE = 44;
+  const size_t ARCHIVE_TX_INDEX_HEADER_SIZE = 40;
+  const size_t ARCHIVE_TX_INDEX_SLOT_SIZE = 16;
+  const uint8_t ARCHIVE_TX_FLAG_PRUNED = 0x01;
+
+  struct archive_tx_store_config
+  {
+    bool enabled = false;
+    std::string filename;  //!< log; the index is the same name with extension .idx
+    uint64_t initial_slots = 1 << 20;  //!< index slots of a new store
+    uint64_t max_queued_bytes = 256 * 1024 * 1024;  //!< blobs waiting for the store thread; further batches are dropped
+  };
+
+  /**
+   * @brief a tx as received with its block
+   */
+  struct archive_tx_blob
+  {
+    blobdata blob;
+    bool pruned = false;
+    crypto::hash prunable_hash = crypto::null_hash;  //!< of the pruned part, for pruned blobs
+  };
+
+  /**
+   * @brief tx index filename of a tx store log
+   *
+   * "/opt/monerodarchive/txs.log" gives "/opt/monerodarchive/txs.idx".
+   */
+  std::string archive_tx_index_filename(const std::string &log_filename);
+
+  /**
+   * @brief the hash table of a tx store, mapped into memory
+   *
+   * Not available on Windows.
+   */
+  class archive_tx_index
+  {
+  public:
+    archive_tx_index();
+    ~archive_tx_index();
+
+    /**
+     * @brief maps an existing index
+     *
+     * A writable index is marked not clean until close(true).
+     *
+     * @return false if it is missing or not a valid index
+     */
+    bool open(const std::string &filename, bool writable);
+
+    /**
+     * @brief replaces the file with an empty writable index of at least slots slots
+     */
+    bool create(const std::string &filename, uint64_t slots);
+
+    void close(bool clean);
+    bool is_open() const { return m_data != NULL; }
+
+    /**
+     * @brief whether the index was closed cleanly before this open()
+     */
+    bool was_clean() const { return m_was_clean; }
+
+    uint64_t slots() const { return m_slots; }
+    uint64_t entries() const;
+    uint64_t log_size() const;
+
+    /**
+     * @brief offset of the first entry whose hash prefix matches id and which is_match accepts; 0 if none
+     *
+     * is_match is given the log offset of each candidate, and checks the full hash.
+     */
+    template<typename F>
+    uint64_t find(const crypto::hash &id, F is_match) const
+    {
+      if (!m_data)
+        return 0;
+      const uint64_t key = archive_tx_key(id);
+      const uint64_t mask = m_slots - 1;
+      for (uint64_t i = key & mask; ; i = (i + 1) & mask)
+      {
+        const uint64_t slot_key = slot_get(i, 0);
+        if (slot_key == 0)
+          return 0;
+        if (slot_key == key)
+        {
+          const uint64_t offset = slot_get(i, 8);
+          if (is_match(offset))
+            return offset;
+        }
+      }
+    }
+
+    /**
+     * @brief adds an entry, doubling the table first if it would be more than half full
+     */
+    bool insert(const crypto::hash &id, uint64_t offset);
+
+    /**
+     * @brief records that every log entry before size is in the index
+     */
+    void set_log_size(uint64_t size);
+
+    void sync();
+
+  private:
+    static uint64_t archive_tx_key(const crypto::hash &id);
+    uint64_t slot_get(uint64_t slot, size_t field) const;
+    bool map(int fd, uint64_t size, bool writable);
+    void unmap();
+    bool grow();
+
+    std::string m_filename;
+    int m_fd;
+    char *m_data;
+    uint64_t m_mapped_size;
+    uint64_t m_slots;
+    bool m_writable;
+    bool m_was_clean;
+  };
+
+  /**
+   * @brief deduplicating store of the tx blobs of archived blocks
+   *
+   * Records carry only tx hashes; this keeps each tx blob once, keyed by
+   * hash, so the txs of alt and orphaned blocks can still be read after the
+   * daemon has discarded them.  The Archive Producer copies the blobs of
+   * each block batch and hands them over with push() at the end of the
+   * batch.  A dedicated thread hashes them, skips those already stored and
+   * appends the others to the log in one write, then adds them to the
+   * index.  Nothing touches the filesystem on the Block Handler's thread.
+   *
+   * On start, log entries past what the index covers are added to it and a
+   * torn tail is cut off; an index that was not closed cleanly is rebuilt
+   * from the log.  Not available on Windows.
+   */
+  class archive_tx_store
+  {
+  public:
+    struct stats
+    {
+      uint64_t received;    //!< blobs handed to push()
+      uint64_t stored;      //!< new txs appended to the log
+      uint64_t duplicates;  //!< blobs of txs already stored
+      uint64_t invalid;     //!< blobs that could not be parsed and hashed
+      uint64_t dropped;     //!< blobs dropped as max_queued_bytes were queued, or not written
+      uint64_t bytes_stored;  //!< log bytes appended
+      uint64_t queued_bytes;  //!< blob bytes waiting for the store thread
+    };
+
+    archive_tx_store();
+    ~archive_tx_store();
+
+    /**
+     * @brief starts the store thread, which opens or recovers the store
+     */
+    bool start(const archive_tx_store_config &config);
+
+    /**
+     * @brief stores everything still queued, closes the store cleanly and stops the thread
+     */
+    void stop();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief queues the tx blobs of one block batch for the store thread
+     *
+     * Only moves them into the queue.  If that would hold more than
+     * max_queued_bytes the batch is dropped.  txs is left empty.
+     */
+    void push(std::vector<archive_tx_blob> &txs);
+
+    stats get_stats() const;
+
+  private:
+    void run();
+    bool recover();
+    bool scan(uint64_t from, uint64_t size);
+    void store(std::vector<archive_tx_blob> &txs);
+    bool entry_hash_is(uint64_t offset, const crypto::hash &id) const;
+
+    archive_tx_store_config m_config;
+    std::atomic<bool> m_enabled;
+    bool m_running;
+    bool m_stopping;
+    boost::thread m_thread;
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::deque<std::vector<archive_tx_blob>> m_queue;
+    uint64_t m_queued_bytes;
+
+    int m_log_fd;
+    uint64_t m_log_size;
+    archive_tx_index m_index;
+
+    std::atomic<uint64_t> m_received;
+    std::atomic<uint64_t> m_stored;
+    std::atomic<uint64_t> m_duplicates;
+    std::atomic<uint64_t> m_invalid;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_bytes_stored;
+  };
+
+  struct archive_tx_entry
+  {
+    crypto::hash id;
+    bool pruned = false;
+    crypto::hash prunable_hash = crypto::null_hash;
+    blobdata blob;
+  };
+
+  /**
+   * @brief reads txs from a tx store by hash, e.g. for the tx hashes of an archive record
+   *
+   * Safe while the daemon writes the store; txs stored after open() may
+   * not be found.  Not available on Windows.
+   */
+  class archive_tx_store_reader
+  {
+  public:
+    archive_tx_store_reader();
+    ~archive_tx_store_reader();
+
+    bool open(const std::string &log_filename);
+    void close();
+
+    /**
+     * @brief reads the tx with hash id
+     *
+     * @return false if it is not in the store, or its entry is damaged
+     */
+    bool get(const crypto::hash &id, archive_tx_entry &entry) const;
+
+    uint64_t size() const { return m_index.entries(); }
+
+  private:
+    int m_log_fd;
+    archive_tx_index m_index;
+  };
+
+  /**
+   * @brief reads one log entry at offset
+   *
+   * @return false if it is short, too large or fails its CRC
+   */
+  bool archive_tx_read_entry(int fd, uint64_t offset, archive_tx_entry &entry, uint64_t &entry_size);
+}
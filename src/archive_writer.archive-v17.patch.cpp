@@ -0,0 +1,623 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_writer.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "misc_log_ex.h"
+#include "archive_writer.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace cryptonote
+{
+  /**
+   * @brief one sink, its queue and its writer thread
+   *
+   * Records are queued by reference, so every sink shares one copy.
+   */
+  class archive_writer::sink_writer
+  {
+  public:
+    /**
+     * @param arrivals ticked by this writer thread, and the console line logged and NRT skew recorded by it; NULL for none
+     */
+    sink_writer(const archive_writer_config &config, const archive_sink_config &sink_config, std::unique_ptr<archive_sink> sink, archive_arrivals *arrivals, archive_metrics &metrics);
+    ~sink_writer();
+
+    bool start();
+    void stop();
+
+    bool enqueue(std::shared_ptr<const archive_record> record);
+    void wake();
+
+    void add_stats(archive_writer::stats &s) const;
+    const archive_sink_config &sink_config() const { return m_sink_config; }
+
+  private:
+    void run();
+    void serialize_record(const archive_record &record, std::string &line, archive_index_entry &entry);
+    void write_lines(const std::string *lines, archive_index_entry *entries, size_t n_lines);
+    void report_drops();
+
+    const archive_writer_config &m_config;
+    const archive_sink_config m_sink_config;
+    std::unique_ptr<archive_sink> m_sink;
+    archive_arrivals *m_arrivals;
+    archive_metrics &m_metrics;
+    archive_queue<std::shared_ptr<const archive_record>> m_queue;
+
+    boost::thread m_thread;
+    boost::mutex m_mutex;
+    boost::condition_variable m_work_cond;
+    boost::condition_variable m_space_cond;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_waiting;
+
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_bytes_written;
+    std::atomic<uint64_t> m_write_failures;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_high_water;
+    uint64_t m_dropped_reported;
+    archive_sink_stats m_sink_stats;  //!< kept once the sink is closed
+    std::unique_ptr<archive_alt_chain_encoder> m_alt_chains;  //!< TSV sinks with alt chain deltas enabled
+  };
+  //-----------------------------------------------------------------------------------------------
+  bool archive_parse_overflow_policy(const std::string &name, archive_overflow_policy &policy)
+  {
+    if (name == "block")
+      policy = archive_overflow_policy::block;
+    else if (name == "drop_oldest")
+      policy = archive_overflow_policy::drop_oldest;
+    else if (name == "drop_newest")
+      policy = archive_overflow_policy::drop_newest;
+    else
+      return false;
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_writer::archive_writer():
+    m_stopped(),
+    m_running(false),
+    m_pushed(0),
+    m_batches(0),
+    m_batch_records(0),
+    m_batch_max_records(0),
+    m_batch_held_us(0),
+    m_batch_max_held_us(0)
+  {
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_writer::~archive_writer()
+  {
+    stop();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_writer::start(const archive_writer_config &config)
+  {
+    if (m_running)
+      return true;
+
+    m_config = config;
+    std::vector<archive_sink_config> sinks = m_config.sinks;
+    if (sinks.empty())
+    {
+      archive_sink_config sink;
+      sink.type = archive_sink_type::file;
+      sink.format = m_config.format;
+      sink.path = m_config.file.filename;
+      sinks.push_back(sink);
+    }
+
+    m_arrivals.open(m_config.arrivals);
+    bool r = m_tx_store.start(m_config.tx_store);
+    r = m_tx_arrivals.start(m_config.tx_arrivals) && r;
+    bool feed_taken = false;
+    for (const archive_sink_config &sink_config: sinks)
+    {
+      const bool duplicate = std::any_of(m_sinks.begin(), m_sinks.end(), [&sink_config](const std::unique_ptr<sink_writer> &s) {
+        return s->sink_config().type != archive_sink_type::null && s->sink_config().type == sink_config.type && s->sink_config().path == sink_config.path;
+      });
+      if (duplicate)
+      {
+        MERROR("Archive sink " << archive_sink_name(sink_config) << " given more than once, ignored");
+        continue;
+      }
+
+      std::unique_ptr<archive_sink> sink;
+      bool opened = true;
+      switch (sink_config.type)
+      {
+        case archive_sink_type::file:
+        {
+          archive_file_config file = m_config.file;
+          file.filename = sink_config.path;
+          archive_feed_config feed = m_config.feed;
+          feed.enabled = feed.enabled && !feed_taken;
+          feed_taken = feed_taken || feed.enabled;
+          archive_file_sink *file_sink = new archive_file_sink();
+          sink.reset(file_sink);
+          opened = file_sink->open(file, m_config.segments, sink_config.format, m_config.compression, feed, m_config.spill);
+          break;
+        }
+        case archive_sink_type::socket:
+        {
+          archive_socket_sink *socket_sink = new archive_socket_sink();
+          sink.reset(socket_sink);
+          opened = socket_sink->open(sink_config.path, sink_config.format, m_config.feed.client_buffer_bytes);
+          break;
+        }
+        case archive_sink_type::null:
+        default:
+          sink.reset(new archive_null_sink());
+          break;
+      }
+      if (!opened)
+        MERROR("Failed to open archive sink " << archive_sink_name(sink_config));
+
+      m_sinks.emplace_back(new sink_writer(m_config, sink_config, std::move(sink), m_sinks.empty() ? &m_arrivals : NULL, m_metrics));
+      r = m_sinks.back()->start() && r;
+    }
+    m_running = true;
+
+    // after the sinks exist, as the page reads their counters
+    if (m_config.metrics.enabled)
+      m_metrics_server.start(m_config.metrics, [this]() { return metrics_report(true); });
+    return r;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::stop()
+  {
+    if (!m_running)
+      return;
+
+    m_metrics_server.stop();
+
+    // the others keep draining their queues while one is stopped
+    for (std::unique_ptr<sink_writer> &sink: m_sinks)
+      sink->stop();
+    for (const std::unique_ptr<sink_writer> &sink: m_sinks)
+      sink->add_stats(m_stopped);
+    m_sinks.clear();
+    m_arrivals.close();
+    m_tx_store.stop();
+    m_tx_arrivals.stop();
+    m_running = false;
+
+    const stats s = get_stats();
+
+    if (s.batches > 0)
+      MINFO("Archive block batches: " << s.batches << ", records " << s.batch_records << ", largest " << s.batch_max_records
+          << ", mean held " << s.batch_held_us / s.batches << " us, longest held " << s.batch_max_held_us << " us");
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_writer::push(archive_record &&record)
+  {
+    if (m_sinks.empty())
+      return false;
+
+    const std::shared_ptr<const archive_record> shared = std::make_shared<const archive_record>(std::move(record));
+    bool all_queued = true;
+    for (std::unique_ptr<sink_writer> &sink: m_sinks)
+    {
+      all_queued &= sink->enqueue(shared);
+      sink->wake();
+    }
+    ++m_pushed;
+    return all_queued;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_writer::push_batch(std::vector<archive_record> &records, uint64_t held_us)
+  {
+    if (records.empty())
+      return true;
+    if (m_sinks.empty())
+    {
+      records.clear();
+      return false;
+    }
+
+    bool all_queued = true;
+    for (archive_record &record: records)
+    {
+      const std::shared_ptr<const archive_record> shared = std::make_shared<const archive_record>(std::move(record));
+      for (std::unique_ptr<sink_writer> &sink: m_sinks)
+        all_queued &= sink->enqueue(shared);
+    }
+    for (std::unique_ptr<sink_writer> &sink: m_sinks)
+      sink->wake();
+
+    const uint64_t n_records = records.size();
+    m_pushed += n_records;
+    ++m_batches;
+    m_batch_records += n_records;
+    m_batch_held_us += held_us;
+    uint64_t max_records = m_batch_max_records.load(std::memory_order_relaxed);
+    while (n_records > max_records && !m_batch_max_records.compare_exchange_weak(max_records, n_records, std::memory_order_relaxed));
+    uint64_t max_held_us = m_batch_max_held_us.load(std::memory_order_relaxed);
+    while (held_us > max_held_us && !m_batch_max_held_us.compare_exchange_weak(max_held_us, held_us, std::memory_order_relaxed));
+
+    records.clear();
+    return all_queued;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_writer::stats archive_writer::get_stats() const
+  {
+    // stopped sinks have nothing queued or held, so their gauges are 0
+    stats s = m_stopped;
+    s.pushed = m_pushed;
+    for (const std::unique_ptr<sink_writer> &sink: m_sinks)
+      sink->add_stats(s);
+    s.batches = m_batches;
+    s.batch_records = m_batch_records;
+    s.batch_max_records = m_batch_max_records;
+    s.batch_held_us = m_batch_held_us;
+    s.batch_max_held_us = m_batch_max_held_us;
+    return s;
+  }
+  //-----------------------------------------------------------------------------------------------
+  std::string archive_writer::metrics_report(bool prometheus) const
+  {
+    const stats s = get_stats();
+    archive_histogram::snapshot h;
+    std::string out;
+
+    if (prometheus)
+    {
+      const auto counter = [&out](const char *name, const char *help, const char *type, uint64_t value) {
+        out += std::string("# HELP monerod_archive_") + name + " " + help + "\n";
+        out += std::string("# TYPE monerod_archive_") + name + " " + type + "\n";
+        out += std::string("monerod_archive_") + name + " " + std::to_string(value) + "\n";
+      };
+      counter("records_pushed_total", "Records handed to the archive writer by the Archive Producer", "counter", s.pushed);
+      counter("records_written_total", "Records written, summed over sinks", "counter", s.written);
+      counter("bytes_written_total", "Bytes of the records written as formatted, before compression, summed over sinks", "counter", s.bytes_written);
+      counter("records_dropped_total", "Records discarded by the overflow policy, summed over sinks", "counter", s.dropped);
+      counter("write_failures_total", "Group commits that could not be written, summed over sinks", "counter", s.write_failures);
+      counter("write_retries_total", "Attempts to write records held after a failed write", "counter", s.write_retries);
+      counter("records_spilled_total", "Records held in memory after a failed write", "counter", s.spilled);
+      counter("spill_dropped_total", "Held records dropped beyond the spill limit", "counter", s.spill_dropped);
+      counter("batches_total", "Block batches handed to the archive writer", "counter", s.batches);
+      const archive_tx_store::stats tx = m_tx_store.get_stats();
+      counter("tx_store_stored_total", "Txs appended to the tx store", "counter", tx.stored);
+      counter("tx_store_duplicates_total", "Tx blobs not stored as the tx was stored already", "counter", tx.duplicates);
+      counter("tx_store_dropped_total", "Tx blobs dropped as the tx store queue was full or a write failed", "counter", tx.dropped);
+      counter("tx_store_bytes_total", "Bytes appended to the tx store", "counter", tx.bytes_stored);
+      const archive_tx_arrivals::stats tx_arrivals = m_tx_arrivals.get_stats();
+      counter("tx_arrivals_recorded_total", "Txs accepted into the mempool and recorded", "counter", tx_arrivals.recorded);
+      counter("tx_arrivals_dropped_total", "Mempool tx arrivals dropped as a thread buffer was full or a write failed", "counter", tx_arrivals.dropped);
+      counter("queue_depth", "Records queued in the fullest sink queue", "gauge", s.queue_depth);
+      counter("queue_high_water", "Largest sink queue depth seen", "gauge", s.high_water);
+      counter("spill_bytes", "Bytes held in memory after failed writes", "gauge", s.spill_bytes);
+
+      out += "# HELP monerod_archive_stage_seconds Time spent in each archive stage\n";
+      out += "# TYPE monerod_archive_stage_seconds histogram\n";
+      for (size_t i = 0; i < (size_t)archive_stage::count; ++i)
+      {
+        m_metrics.stages[i].read(h);
+        // 64 ns to 68 s
+        archive_metrics_append_histogram(out, "monerod_archive_stage_seconds", std::string("stage=\"") + archive_stage_name((archive_stage)i) + "\"", h, 1e-9, 6, 36);
+      }
+      out += "# HELP monerod_archive_nrt_skew_seconds NRT minus MRT (block timestamp); direction ahead for blocks timestamped after they were received\n";
+      out += "# TYPE monerod_archive_nrt_skew_seconds histogram\n";
+      // 1 ms to 4.6 h
+      m_metrics.nrt_skew_ms.read(h);
+      archive_metrics_append_histogram(out, "monerod_archive_nrt_skew_seconds", "direction=\"behind\"", h, 1e-3, 0, 24);
+      m_metrics.nrt_skew_ahead_ms.read(h);
+      archive_metrics_append_histogram(out, "monerod_archive_nrt_skew_seconds", "direction=\"ahead\"", h, 1e-3, 0, 24);
+      return out;
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "Archive: pushed %llu, written %llu (%llu bytes), dropped %llu, write failures %llu, queue depth %llu, high water %llu\n",
+        (unsigned long long)s.pushed, (unsigned long long)s.written, (unsigned long long)s.bytes_written, (unsigned long long)s.dropped,
+        (unsigned long long)s.write_failures, (unsigned long long)s.queue_depth, (unsigned long long)s.high_water);
+    out += line;
+    if (m_config.tx_store.enabled)
+    {
+      const archive_tx_store::stats tx = m_tx_store.get_stats();
+      snprintf(line, sizeof(line), "Tx store: stored %llu (%llu bytes), duplicates %llu, invalid %llu, dropped %llu, queued %llu bytes\n",
+          (unsigned long long)tx.stored, (unsigned long long)tx.bytes_stored, (unsigned long long)tx.duplicates, (unsigned long long)tx.invalid,
+          (unsigned long long)tx.dropped, (unsigned long long)tx.queued_bytes);
+      out += line;
+    }
+    if (m_config.tx_arrivals.enabled)
+    {
+      const archive_tx_arrivals::stats tx_arrivals = m_tx_arrivals.get_stats();
+      snprintf(line, sizeof(line), "Tx arrivals: recorded %llu, written %llu, dropped %llu\n",
+          (unsigned long long)tx_arrivals.recorded, (unsigned long long)tx_arrivals.written, (unsigned long long)tx_arrivals.dropped);
+      out += line;
+    }
+    snprintf(line, sizeof(line), "%-16s %12s %12s %12s %12s %12s %12s\n", "stage", "samples", "mean_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+    out += line;
+    const auto row = [&](const char *name, const archive_histogram &histogram) {
+      histogram.read(h);
+      snprintf(line, sizeof(line), "%-16s %12llu %12llu %12llu %12llu %12llu %12llu\n", name, (unsigned long long)h.count,
+          (unsigned long long)(h.count ? h.sum / h.count : 0), (unsigned long long)h.quantile(0.50), (unsigned long long)h.quantile(0.99),
+          (unsigned long long)h.quantile(0.999), (unsigned long long)h.max());
+      out += line;
+    };
+    for (size_t i = 0; i < (size_t)archive_stage::count; ++i)
+      row(archive_stage_name((archive_stage)i), m_metrics.stages[i]);
+    snprintf(line, sizeof(line), "%-16s %12s %12s %12s %12s %12s %12s\n", "NRT - MRT", "samples", "mean_ms", "p50_ms", "p99_ms", "p999_ms", "max_ms");
+    out += line;
+    row("behind", m_metrics.nrt_skew_ms);
+    row("ahead", m_metrics.nrt_skew_ahead_ms);
+    return out;
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_writer::sink_writer::sink_writer(const archive_writer_config &config, const archive_sink_config &sink_config, std::unique_ptr<archive_sink> sink, archive_arrivals *arrivals, archive_metrics &metrics):
+    m_config(config),
+    m_sink_config(sink_config),
+    m_sink(std::move(sink)),
+    m_arrivals(arrivals),
+    m_metrics(metrics),
+    m_queue(config.queue_capacity),
+    m_running(false),
+    m_stopping(false),
+    m_waiting(false),
+    m_written(0),
+    m_bytes_written(0),
+    m_write_failures(0),
+    m_dropped(0),
+    m_high_water(0),
+    m_dropped_reported(0)
+  {
+    if (config.alt_delta.enabled && sink_config.format == archive_output_format::tsv && sink_config.type != archive_sink_type::null)
+      m_alt_chains.reset(new archive_alt_chain_encoder(config.alt_delta.snapshot_interval));
+  }
+  //-----------------------------------------------------------------------------------------------
+  archive_writer::sink_writer::~sink_writer()
+  {
+    stop();
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_writer::sink_writer::start()
+  {
+    m_stopping = false;
+    try
+    {
+      m_thread = boost::thread(&sink_writer::run, this);
+    }
+    catch (const std::exception &e)
+    {
+      MERROR("Failed to start archive writer thread for " << archive_sink_name(m_sink_config) << ": " << e.what());
+      return false;
+    }
+    m_running = true;
+    MINFO("Archive writer started, sink " << archive_sink_name(m_sink_config) << ", queue capacity " << m_queue.capacity());
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::stop()
+  {
+    if (!m_sink)
+      return;
+
+    m_stopping = true;
+    if (m_running)
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_work_cond.notify_one();
+        m_space_cond.notify_all();
+      }
+      if (m_thread.joinable())
+        m_thread.join();
+      m_running = false;
+    }
+    m_sink->close();
+    m_sink_stats = m_sink->stats();
+    m_sink.reset();
+
+    MINFO("Archive writer stopped, sink " << archive_sink_name(m_sink_config) << ", written " << (m_written + m_sink_stats.spill_written) << ", dropped " << m_dropped
+        << ", queue high water " << m_high_water);
+    if (m_sink_stats.write_errors > 0 || m_sink_stats.spilled > 0)
+      MWARNING("Archive sink " << archive_sink_name(m_sink_config) << " write errors " << m_sink_stats.write_errors << ", retries " << m_sink_stats.write_retries
+          << ", records held in memory " << m_sink_stats.spilled << ", of which dropped " << m_sink_stats.spill_dropped);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool archive_writer::sink_writer::enqueue(std::shared_ptr<const archive_record> record)
+  {
+    // the sink, its segment state and m_alt_chains belong to the writer thread,
+    // which may still be draining while we stop: never touch them from here
+    if (!m_running || m_stopping)
+    {
+      ++m_dropped;
+      return false;
+    }
+
+    return archive_queue_push(m_queue, record, m_config.overflow_policy, m_dropped, m_high_water, [this]() {
+      if (m_stopping)
+        return false;
+      // a batch wakes the writer only after its last record, so make room now
+      wake();
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      m_space_cond.wait_for(lock, boost::chrono::milliseconds(10));
+      return true;
+    });
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::wake()
+  {
+    if (!m_running)
+      return;
+
+    // pairs with the fence in run(): either we see the writer waiting, or it sees our record
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiting.load(std::memory_order_relaxed))
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      m_work_cond.notify_one();
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::add_stats(archive_writer::stats &s) const
+  {
+    const archive_sink_stats sink_stats = m_sink ? m_sink->stats() : m_sink_stats;
+    s.written += m_written + sink_stats.spill_written;
+    s.bytes_written += m_bytes_written + sink_stats.spill_written_bytes;
+    s.write_failures += m_write_failures;
+    s.dropped += m_dropped;
+    s.queue_depth = std::max<uint64_t>(s.queue_depth, m_queue.size());
+    s.high_water = std::max<uint64_t>(s.high_water, m_high_water);
+    s.write_errors += sink_stats.write_errors;
+    s.write_retries += sink_stats.write_retries;
+    s.spilled += sink_stats.spilled;
+    s.spill_dropped += sink_stats.spill_dropped;
+    s.spill_bytes += sink_stats.spill_bytes;
+    s.recovered_bytes += sink_stats.recovered_bytes;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::run()
+  {
+    // lines keep their capacity between batches
+    std::vector<std::string> lines(m_config.max_batch);
+    std::vector<archive_index_entry> entries(m_config.max_batch);
+    std::shared_ptr<const archive_record> record;
+    while (true)
+    {
+      // group commit: everything queued, up to max_batch, goes out in one write
+      size_t n_lines = 0;
+      while (n_lines < lines.size() && m_queue.try_pop(record))
+      {
+        // every segment opens with an alt chains snapshot, so it can be read on its own
+        if (n_lines == 0 && m_alt_chains && m_sink->start_segment_if_due())
+          m_alt_chains->reset();
+        serialize_record(*record, lines[n_lines], entries[n_lines]);
+        record.reset();
+        ++n_lines;
+      }
+
+      if (n_lines > 0)
+      {
+        if (m_config.overflow_policy == archive_overflow_policy::block)
+          m_space_cond.notify_all();
+        write_lines(lines.data(), entries.data(), n_lines);
+        report_drops();
+        if (m_arrivals)
+          m_arrivals->tick();
+        continue;
+      }
+
+      if (m_stopping)
+        break;
+
+      m_sink->tick();
+      if (m_arrivals)
+        m_arrivals->tick();
+
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      m_waiting = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_queue.size() == 0 && !m_stopping)
+        m_work_cond.wait_for(lock, boost::chrono::milliseconds(std::min<uint64_t>(500, std::max<uint64_t>(1, m_config.file.fsync_interval_ms))));
+      m_waiting = false;
+    }
+    report_drops();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::serialize_record(const archive_record &record, std::string &line, archive_index_entry &entry)
+  {
+    entry = archive_make_index_entry(record);
+
+    // ## OUTPUT - Daemon console
+    // only formatted if the log category is enabled, and by one sink
+    if (m_arrivals)
+    {
+      static thread_local std::string console_line;
+      console_line.clear();
+      MCLOG_MAGENTA(el::Level::Info, "global", archive_console_line(record, console_line));
+
+      // NRT - MRT, once per record
+      const uint64_t mrt_ms = record.b.timestamp * 1000;
+      if (record.node_timestamp >= mrt_ms)
+        m_metrics.nrt_skew_ms.record(record.node_timestamp - mrt_ms);
+      else
+        m_metrics.nrt_skew_ahead_ms.record(mrt_ms - record.node_timestamp);
+    }
+
+    // ## OUTPUT - Filesystem recording
+    line.clear();
+    if (m_sink_config.type == archive_sink_type::null)
+      return;
+    const uint64_t start_ns = archive_metrics_now_ns();
+    if (!archive_format_record(record, m_sink_config.format, line, m_alt_chains.get()))
+      MERROR("Failed to encode binary archive record for block at height " << record.block_height);
+    m_metrics.stage(archive_stage::serialize).record(archive_metrics_now_ns() - start_ns);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::write_lines(const std::string *lines, archive_index_entry *entries, size_t n_lines)
+  {
+    const uint64_t start_ns = archive_metrics_now_ns();
+    const archive_write_result result = m_sink->write(lines, entries, n_lines);
+    m_metrics.stage(archive_stage::write).record(archive_metrics_now_ns() - start_ns);
+    if (result != archive_write_result::written)
+    {
+      // the lost lines may hold deltas the next ones build on; and held
+      // lines may yet be dropped, a whole write at a time, so the next
+      // write must start with a snapshot too
+      if (m_alt_chains)
+        m_alt_chains->reset();
+    }
+    if (result == archive_write_result::lost)
+      ++m_write_failures;
+    // held lines are counted by the sink, and as written once it writes them
+    if (result != archive_write_result::written)
+      return;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n_lines; ++i)
+      bytes += lines[i].size();
+    m_written += n_lines;
+    m_bytes_written += bytes;
+  }
+  //-----------------------------------------------------------------------------------------------
+  void archive_writer::sink_writer::report_drops()
+  {
+    const uint64_t dropped = m_dropped;
+    if (dropped != m_dropped_reported)
+    {
+      MWARNING("Archive writer queue overflow on sink " << archive_sink_name(m_sink_config) << ": " << (dropped - m_dropped_reported)
+          << " records dropped (" << dropped << " total)");
+      m_dropped_reported = dropped;
+    }
+  }
+}
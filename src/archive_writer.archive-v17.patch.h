@@ -0,0 +1,223 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_core/archive_writer.h
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "archive_alt_delta.h"
+#include "archive_arrivals.h"
+#include "archive_feed.h"
+#include "archive_file.h"
+#include "archive_format.h"
+#include "archive_metrics.h"
+#include "archive_policy.h"
+#include "archive_queue.h"
+#include "archive_record.h"
+#include "archive_segment.h"
+#include "archive_sink.h"
+#include "archive_tx_arrivals.h"
+#include "archive_tx_store.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief reads an overflow policy as given to --archive-overflow-policy
+   *
+   * "block", "drop_oldest" or "drop_newest".
+   */
+  bool archive_parse_overflow_policy(const std::string &name, archive_overflow_policy &policy);
+
+  struct archive_writer_config
+  {
+    archive_file_config file;
+    archive_segment_config segments;
+    archive_compression_config compression;
+    archive_feed_config feed;
+    archive_arrivals_config arrivals;
+    archive_tx_store_config tx_store;  //!< tx blobs of archived blocks, kept once each
+    archive_tx_arrivals_config tx_arrivals;  //!< when txs were accepted into the mempool
+    archive_spill_config spill;  //!< of every file sink
+    archive_alt_delta_config alt_delta;  //!< output field 6 of TSV sinks
+    archive_metrics_config metrics;  //!< Prometheus text page on a local port
+    archive_policy_config policy;  //!< applied by the Archive Producer, not the writer
+    archive_output_format format = archive_output_format::tsv;
+    std::vector<archive_sink_config> sinks;  //!< empty for a single file sink: file in format
+    archive_overflow_policy overflow_policy = archive_overflow_policy::drop_oldest;  //!< of every sink queue; block may stall the Block Handler
+    size_t queue_capacity = 4096;  //!< of every sink queue
+    size_t max_batch = 256;  //!< most records coalesced into one write
+  };
+
+  /**
+   * @brief archive writer threads, one per sink
+   *
+   * The Block Handler hands archive_records to push(), which only shares
+   * them out to a bounded lock-free queue per sink.  Each sink has a
+   * dedicated thread which drains its queue, serializes each record in the
+   * sink's format and hands everything it drained to the sink in one group
+   * commit, so none of that work happens while the blockchain lock is held,
+   * and a slow sink only fills its own queue.  The thread of the first
+   * sink also logs the console line and writes the per-peer block arrivals
+   * once their window closes.  The tx store and the mempool tx
+   * arrivals have a thread of their own each.
+   *
+   * Latency of every stage is kept in archive_metrics, which outlives
+   * restarts of the writer.
+   *
+   * A file sink appends to the archive (segment) file; the first file sink
+   * then publishes what it wrote to the live feed, if enabled.  Records a
+   * file sink fails to write are held in memory and retried, see
+   * archive_spill_config.
+   */
+  class archive_writer
+  {
+  public:
+    /**
+     * @brief counters since the writer was created, over every start() and stop()
+     */
+    struct stats
+    {
+      uint64_t pushed;       //!< records accepted by push()
+      uint64_t written;      //!< records in a sink, summed over sinks; held ones only once written
+      uint64_t bytes_written;  //!< bytes of those records as formatted, before compression
+      uint64_t write_failures;  //!< group commits that could not be written, summed over sinks
+      uint64_t dropped;      //!< records discarded by the overflow policy, summed over sinks
+      uint64_t queue_depth;  //!< records currently queued, in the fullest sink queue
+      uint64_t high_water;   //!< largest queue depth seen in any sink queue
+      uint64_t write_errors;     //!< failed archive writes, summed over file sinks
+      uint64_t write_retries;    //!< attempts to write held records again
+      uint64_t spilled;          //!< records held in memory after a failed write, not written until the sink recovers
+      uint64_t spill_dropped;    //!< held records dropped beyond the spill limit
+      uint64_t spill_bytes;      //!< bytes currently held, summed over file sinks
+      uint64_t recovered_bytes;  //!< torn tails cut off the archives on start
+      uint64_t batches;           //!< block batches handed over by push_batch()
+      uint64_t batch_records;     //!< records in those batches
+      uint64_t batch_max_records; //!< largest batch
+      uint64_t batch_held_us;     //!< sum over batches of the time their first record was held
+      uint64_t batch_max_held_us; //!< longest a batch held its first record
+    };
+
+    archive_writer();
+    ~archive_writer();
+
+    /**
+     * @brief opens the sinks and starts their writer threads
+     *
+     * @return false if a thread could not be started; push() then counts
+     * the records for that sink as dropped
+     */
+    bool start(const archive_writer_config &config);
+
+    /**
+     * @brief writes out everything still queued and stops the writer threads
+     *
+     * The sinks are destroyed, so the caller must keep push() and
+     * push_batch() from running at the same time.
+     */
+    void stop();
+
+    bool running() const { return m_running; }
+
+    /**
+     * @brief queues a record for the writer thread of every sink
+     *
+     * The sinks share one copy of the record.  Never touches the filesystem;
+     * a sink whose writer thread is not running drops the record.
+     *
+     * @return false if the record was dropped by any sink
+     */
+    bool push(archive_record &&record);
+
+    /**
+     * @brief queues the records of one block batch, in order, and wakes each writer once
+     *
+     * The writer threads then write them in as few group commits as
+     * max_batch allows.  records is left empty.
+     *
+     * @param held_us microseconds since the first record of the batch was captured
+     *
+     * @return false if any record was dropped
+     */
+    bool push_batch(std::vector<archive_record> &records, uint64_t held_us);
+
+    stats get_stats() const;
+
+    /**
+     * @brief latency histograms, recorded into by the Archive Producer too
+     */
+    archive_metrics &metrics() { return m_metrics; }
+
+    /**
+     * @brief counters and latency percentiles, for the daemon console
+     * or, with prometheus, in the Prometheus text format
+     */
+    std::string metrics_report(bool prometheus) const;
+
+    /**
+     * @brief per-peer block arrivals, recorded by the protocol handler
+     */
+    archive_arrivals &arrivals() { return m_arrivals; }
+
+    /**
+     * @brief tx blobs of archived blocks, handed over by the Archive Producer
+     */
+    archive_tx_store &tx_store() { return m_tx_store; }
+
+    /**
+     * @brief mempool tx arrivals, recorded by the tx pool
+     */
+    archive_tx_arrivals &tx_arrivals() { return m_tx_arrivals; }
+
+  private:
+    class sink_writer;
+
+    archive_writer_config m_config;
+    std::vector<std::unique_ptr<sink_writer>> m_sinks;
+    stats m_stopped;  //!< sink counters of the sinks of earlier runs
+    archive_arrivals m_arrivals;
+    archive_tx_store m_tx_store;
+    archive_tx_arrivals m_tx_arrivals;
+    archive_metrics m_metrics;
+    archive_metrics_server m_metrics_server;
+    std::atomic<bool> m_running;
+
+    std::atomic<uint64_t> m_pushed;
+    std::atomic<uint64_t> m_batches;
+    std::atomic<uint64_t> m_batch_records;
+    std::atomic<uint64_t> m_batch_max_records;
+    std::atomic<uint64_t> m_batch_held_us;
+    std::atomic<uint64_t> m_batch_max_held_us;
+  };
+}
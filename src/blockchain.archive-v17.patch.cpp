@@ -59,6 +59,16 @@ bool Blockchain::init(BlockchainDB* db, const network_type nettype, bool offline
 
   m_db = db;
 
+  // <MonerodArchive (Writer)>
+  // already running if archive_configure() was called before init(), e.g. by core::init() with the --archive-* options
+  if (m_archive_enabled && !m_archive_writer.running())
+  {
+    const archive_writer_config archive_config = archive_output_config();
+    m_archive_policy = archive_config.policy;
+    m_archive_writer.start(archive_config);
+  }
+  // </MonerodArchive>
+
   m_nettype = test_options != NULL ? FAKECHAIN : nettype;
   m_offline = offline;
   m_fixed_difficulty = fixed_difficulty;
@@ -107,7 +117,7 @@ bool Blockchain::init(BlockchainDB* db, const network_type nettype, bool offline
     generate_genesis_block(bl, get_config(m_nettype).GENESIS_TX, get_config(m_nettype).GENESIS_NONCE);
     db_wtxn_guard wtxn_guard(m_db);
     // <MonerodArchive (IsNodeSynced?3)>
-    add_new_block(bl, bvc, std::make_pair(0, 0));
+    add_new_block(bl, bvc, std::make_pair(0, 0), archive_receive_time());
     // </MonerodArchive>
     CHECK_AND_ASSERT_MES(!bvc.m_verifivation_failed, false, "Failed to add genesis block to blockchain");
   }
@@ -221,6 +231,49 @@ bool Blockchain::init(BlockchainDB* db, const network_type nettype, bool offline
   return true;
 }
 
+//------------------------------------------------------------------
+bool Blockchain::deinit()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  MTRACE("Stopping blockchain read/write activity");
+
+ // stop async service
+  m_async_work_idle.reset();
+  m_async_pool.join_all();
+  m_async_service.stop();
+
+  // <MonerodArchive (Writer)>
+  // write out records still queued before the database goes away
+  m_archive_writer.stop();
+  // </MonerodArchive>
+
+  // as this should be called if handling a SIGSEGV, need to check
+  // if m_db is a NULL pointer (and thus may have caused the illegal
+  // memory operation), otherwise we may cause a loop.
+  try
+  {
+    if (m_db)
+    {
+      m_db->close();
+      MTRACE("Local blockchain read/write activity stopped successfully");
+    }
+  }
+  catch (const std::exception& e)
+  {
+    LOG_ERROR(std::string("Error closing blockchain db: ") + e.what());
+  }
+  catch (...)
+  {
+    LOG_ERROR("There was an issue closing/storing the blockchain, shutting down now to prevent issues!");
+  }
+
+  delete m_hardfork;
+  m_hardfork = NULL;
+  delete m_db;
+  m_db = NULL;
+  return true;
+}
 //------------------------------------------------------------------
 bool Blockchain::reset_and_set_genesis_block(const block& b)
 {
@@ -231,12 +284,15 @@ bool Blockchain::reset_and_set_genesis_block(const block& b)
   invalidate_block_template_cache();
   m_db->reset();
   m_db->drop_alt_blocks();
+  // <MonerodArchive (Alt Chains)>
+  m_archive_alt_chains.clear();
+  // </MonerodArchive>
   m_hardfork->init();
 
   db_wtxn_guard wtxn_guard(m_db);
   block_verification_context bvc = {};
   // <MonerodArchive (IsNodeSynced?4)>
-  add_new_block(b, bvc, std::make_pair(0, 0));
+  add_new_block(b, bvc, std::make_pair(0, 0), archive_receive_time());
   // </MonerodArchive>
   if (!update_next_cumulative_weight_limit())
     return false;
@@ -244,7 +300,7 @@ bool Blockchain::reset_and_set_genesis_block(const block& b)
 }
 
 //------------------------------------------------------------------
-bool Blockchain::add_new_block(const block& bl, block_verification_context& bvc, std::pair<uint64_t,uint64_t> archive_sync_state)
+bool Blockchain::add_new_block(const block& bl, block_verification_context& bvc, std::pair<uint64_t,uint64_t> archive_sync_state, const archive_receive_time& archive_nrt)
 {
   try
   {
@@ -262,174 +318,270 @@ bool Blockchain::add_new_block(const block& bl, block_verification_context& bvc,
     return false;
   }
 
-  // <MonerodArchive (All Blocks)>
-  block& bl_archive = const_cast<block&>(bl);
-  // <MonerodArchive (All Blocks)>
-
   //check that block refers to chain tail
   if(!(bl.prev_id == get_tail_id()))
   {
     // <MonerodArchive (Alt Block)>
-    archive_block(bl_archive, true, archive_sync_state);
+    if (m_archive_enabled)
+      archive_block(bl, true, archive_sync_state, archive_nrt);
     // </MonerodArchive (Alt Block)>
 
     //chain switching or wrong block
     bvc.m_added_to_main_chain = false;
     rtxn_guard.stop();
     bool r = handle_alternative_block(bl, id, bvc);
+    // <MonerodArchive (Batch)>
+    // the alt block may have caused a reorganization
+    m_archive_batch.chain_height_valid = false;
+    // </MonerodArchive>
     m_blocks_txs_check.clear();
     return r;
     //never relay alternative blocks
   }
   // <MonerodArchive (Main Block)>
-  else
+  else if (m_archive_enabled)
   {
-    archive_block(bl_archive, false, archive_sync_state);
+    archive_block(bl, false, archive_sync_state, archive_nrt);
   }
   // </MonerodArchive (Main Block)>
 
   rtxn_guard.stop();
-  return handle_block_to_main_chain(bl, id, bvc);
+  // <MonerodArchive (Batch)>
+  const bool added = handle_block_to_main_chain(bl, id, bvc);
+  if (added && bvc.m_added_to_main_chain)
+    ++m_archive_batch.chain_height;
+  else
+    m_archive_batch.chain_height_valid = false;
+  return added;
+  // </MonerodArchive>
 
   }
   catch (const std::exception &e)
   {
     LOG_ERROR("Exception at [add_new_block], what=" << e.what());
     bvc.m_verifivation_failed = true;
+    // <MonerodArchive (Batch)>
+    m_archive_batch.chain_height_valid = false;
+    // </MonerodArchive>
     return false;
   }
 }
 //------------------------------------------------------------------
+// Blockchain::handle_alternative_block() and
+// Blockchain::switch_to_alternative_blockchain() are long and otherwise
+// unchanged, so only the lines around each change are shown.
+// "// ..." marks unchanged Monero code.
+//------------------------------------------------------------------
+bool Blockchain::switch_to_alternative_blockchain(std::list<block_extended_info>& alt_chain, bool discard_disconnected_chain)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  // <MonerodArchive (Alt Chains)>
+  // the success path below updates the alt chain summary; any other exit
+  // leaves alt blocks in a state it did not track
+  bool archive_alt_chains_updated = false;
+  auto archive_alt_chains_guard = epee::misc_utils::create_scope_leave_handler([&]() {
+    if (!archive_alt_chains_updated)
+      m_archive_alt_chains.invalidate();
+  });
+  // </MonerodArchive>
+
+  // ...
+
+  //removing alt_chain entries from alternative chains container
+  // <MonerodArchive (Alt Chains)>
+  std::vector<crypto::hash> archive_removed_alt_blocks;
+  archive_removed_alt_blocks.reserve(alt_chain.size());
+  // </MonerodArchive>
+  for (const auto &bei: alt_chain)
+  {
+    m_db->remove_alt_block(cryptonote::get_block_hash(bei.bl));
+    // <MonerodArchive (Alt Chains)>
+    archive_removed_alt_blocks.push_back(cryptonote::get_block_hash(bei.bl));
+    // </MonerodArchive>
+  }
+  // <MonerodArchive (Alt Chains)>
+  m_archive_alt_chains.remove_blocks(archive_removed_alt_blocks);
+  archive_alt_chains_updated = true;
+  // </MonerodArchive>
+
+  // ...
+}
+//------------------------------------------------------------------
+bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id, block_verification_context& bvc)
+{
+  // ...
+
+      cryptonote::alt_block_data_t data;
+      data.height = bei.height;
+      data.cumulative_weight = bei.block_cumulative_weight;
+      data.cumulative_difficulty_low = (bei.cumulative_difficulty & 0xffffffffffffffff).convert_to<uint64_t>();
+      data.cumulative_difficulty_high = ((bei.cumulative_difficulty >> 64) & 0xffffffffffffffff).convert_to<uint64_t>();
+      data.already_generated_coins = bei.already_generated_coins;
+      m_db->add_alt_block(id, data, cryptonote::block_to_blob(bei.bl));
+      // <MonerodArchive (Alt Chains)>
+      m_archive_alt_chains.add_block(id, b.prev_id, bei.height, bei.cumulative_difficulty);
+      // </MonerodArchive>
+      alt_chain.push_back(bei);
+
+  // ...
+}
+//------------------------------------------------------------------
+bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete_entry> &blocks_entry, std::vector<block> &blocks)
+{
+  // ...
+
+  m_tx_pool.lock();
+  CRITICAL_REGION_LOCAL1(m_blockchain_lock);
+
+  if(blocks_entry.size() == 0)
+    return false;
+
+  // <MonerodArchive (Batch)>
+  // m_tx_pool stays locked until cleanup_handle_incoming_blocks() ends the batch
+  archive_batch_begin();
+  archive_batch_txs(blocks_entry);
+  // </MonerodArchive>
+
+  // ...
+}
+//------------------------------------------------------------------
+bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
+{
+  // ...
+
+  CRITICAL_REGION_END();
+  // <MonerodArchive (Batch)>
+  // before m_tx_pool is released, so no later block can be archived ahead of the batch
+  archive_batch_end();
+  // </MonerodArchive>
+  m_tx_pool.unlock();
+
+  update_blockchain_pruning();
+
+  return success;
+}
+//------------------------------------------------------------------
 /*
   <MonerodArchive>
  */
-void Blockchain::archive_block(block& b, bool is_alt_block, std::pair<uint64_t,uint64_t> archive_sync_state)
+void Blockchain::archive_block(const block& b, bool is_alt_block, std::pair<uint64_t,uint64_t> archive_sync_state, const archive_receive_time& archive_nrt)
 {
-  // ## read archive configuration
-  std::string filename_archive = archive_output_filename();
-  std::string output_field_delimiter = "\t";
-  uint64_t archive_version = 11;
+  const uint64_t start_ns = archive_metrics_now_ns();
+  archive_record record;
+
+  // ## node_timestamp (NRT)
+  // taken by the protocol handler when the block was received; blocks that did
+  // not come from the network (genesis, tools) are timestamped here instead
+  const archive_receive_time archived = archive_receive_time::now();
+  const archive_receive_time received = archive_nrt.is_set() ? archive_nrt : archived;
+  record.node_timestamp = received.system_ms;
+  record.node_timestamp_steady = received.steady_us;
+  record.receive_delay = archived.steady_us >= received.steady_us ? archived.steady_us - received.steady_us : 0;
 
-  // ## alt_chain_info
-  std::pair<uint64_t,std::string> altchaininfo = archive_alt_chain_info();
-  uint64_t altchaininfo_length = altchaininfo.first;
-  std::string altchaininfo_json = altchaininfo.second;
+  // ## get data from block
+  record.is_alt_block = is_alt_block;
+  // block height: miner_tx => txin_v transaction.vin => txin_v[0] => txin_v.txin_gen => txin_gen.height
+  record.block_height = boost::get<txin_gen>(b.miner_tx.vin[0]).height;
+  // already computed by add_new_block(), so this is the cached hash
+  record.block_hash = get_block_hash(b);
+  record.n_tx_hashes = b.tx_hashes.size();
 
   // ## sync state
-  uint64_t archive_current_height = archive_sync_state.first;
-  uint64_t archive_target_height = archive_sync_state.second;
-  bool is_node_synced = (archive_current_height >= archive_target_height);
+  record.current_height = archive_sync_state.first;
+  record.target_height = archive_sync_state.second;
+
+  // ## policy: header-only records skip copying the miner tx and tx hashes
+  // and reading alt chains, which is most of the Block Handler's archive time
+  const bool is_node_synced = (record.current_height >= record.target_height);
+  record.policy = archive_select_policy(m_archive_policy, is_node_synced, record.block_height);
+  if (record.policy == archive_record_policy::header)
+  {
+    static_cast<block_header&>(record.b) = b;
+  }
+  else
+  {
+    record.b = b;
 
-  // ## get data from block
-  // block height: miner_tx => txin_v transaction.vin => txin_v[0] => txin_v.txin_gen => txin_gen.height
-  size_t block_height = boost::get<txin_gen>(b.miner_tx.vin[0]).height;
-  // block timestamp (MRT)
-  uint64_t block_timestamp = b.timestamp;
-  // node_timestamp (NRT)
-  uint64_t node_timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-
-  // ## OUTPUT - Daemon console
-  std::stringstream patch_log;
-  patch_log << "Block Archive"
-            << (is_alt_block ? " ALT " : " MAIN")
-            << " H=" << block_height
-            << " MRT=" << block_timestamp
-            << " NRT=" << node_timestamp
-            << " n_alt_chains=" << altchaininfo_length
-            << (is_node_synced ? " FULL" : " SYNC")
-            << " NCH=" << archive_current_height
-            << " NTH=" << archive_target_height;
-  MCLOG_MAGENTA(el::Level::Info, "global", patch_log.str());
-
-  // ## OUTPUT - Filesystem recording
-  // ### serialize block
-  std::ostringstream block_json_buf;
-  // note: second argument to json_archive() is bool indent
-  json_archive<true> block_json(block_json_buf, false);
-  bool block_json_success = ::serialization::serialize(block_json, b);
-
-  // ### make archive line
-  std::stringstream archive_line;
-  // note: string << int required for int to string conversion
-  archive_line << "" << archive_version // 1
-               << output_field_delimiter
-               << node_timestamp   // 2
-               << output_field_delimiter
-               << (is_alt_block ? "1" : "0") // 3
-               << output_field_delimiter;
-  archive_line << (block_json_success ? block_json_buf.str() : "{}"); // 4
-  archive_line << output_field_delimiter
-               << altchaininfo_length  // 5
-               << output_field_delimiter
-               << altchaininfo_json  // 6
-               << output_field_delimiter
-               << (is_node_synced ? "1" : "0") // 7
-               << output_field_delimiter
-               << archive_current_height // 8
-               << output_field_delimiter
-               << archive_target_height  // 9
-               << "\n";
-
-  bool save_success = epee::file_io_utils::append_string_to_file(filename_archive, archive_line.str());
+    // ## alt_chain_info
+    archive_alt_chain_info(record);
+  }
+
+  // ## OUTPUT - handed to the archive writer thread, at the end of the block batch if in one
+  if (m_archive_batch.active)
+  {
+    if (m_archive_batch.records.empty())
+      m_archive_batch.first_steady_us = archived.steady_us;
+    m_archive_batch.records.push_back(std::move(record));
+  }
+  else
+  {
+    m_archive_writer.push(std::move(record));
+  }
+
+  // ## metrics: two relaxed atomic adds
+  m_archive_writer.metrics().stage(archive_stage::archive_block).record(archive_metrics_now_ns() - start_ns);
 }
 //-----------------------------------------------------------------------------------------------
-std::pair<uint64_t,std::string> Blockchain::archive_alt_chain_info()
+void Blockchain::archive_alt_chain_info(archive_record& record)
 {
-  // rpc_get_info: read height_without_bootstrap
-  uint64_t height_without_bootstrap;
-  get_tail_id(height_without_bootstrap);
-  ++height_without_bootstrap; // turn top block height into blockchain height
-
-  // rpc_get_alternate_chains
-  std::vector<std::pair<block_extended_info,std::vector<crypto::hash>>> chains = get_alternative_chains();
+  const uint64_t start_ns = archive_metrics_now_ns();
 
-  uint64_t altchains_length = boost::lexical_cast<uint64_t>(chains.size());
-
-  // serialize altchains
-  std::stringstream altchains_json;
-  if(altchains_length > 0)
+  // within a block batch the height and the chains are read once, and again only after they changed
+  if (m_archive_batch.active)
   {
-    //  root array start
-    altchains_json << "[";
-
-    //  each altchain
-    bool firstchain = false;
-    for (const auto &chain: chains)
+    archive_batch_height(record.chain_height);
+    if (!m_archive_alt_chains.is_valid())
+      archive_alt_chain_cache_rebuild();
+    if (!m_archive_batch.alt_chains_valid || m_archive_batch.alt_chains_version != m_archive_alt_chains.version())
     {
-      uint64_t length = chain.second.size();
-      uint64_t start_height = (chain.first.height - length + 1);
-      uint64_t deep = (height_without_bootstrap - start_height - 1);
-      std::string block_hash = epee::string_tools::pod_to_hex(get_block_hash(chain.first.bl));
-
-      // n > 1 : add array delimiter
-      if(!firstchain)
-      {
-        firstchain = true;
-      }
-      else
-      {
-        altchains_json << ",";
-      }
-      // serialize chain
-      altchains_json << "{"
-                     << "\"length\"" << ":" << length << ","
-                     << "\"height\"" << ":" << start_height << ","
-                     << "\"deep\""   << ":" << deep << ","
-                     << "\"diff\""   << ":" << chain.first.cumulative_difficulty << ","
-                     << "\"hash\""   << ":" << "\"" << block_hash << "\""
-                     << "}";
+      m_archive_alt_chains.get_chains(m_archive_batch.alt_chains);
+      m_archive_batch.alt_chains_version = m_archive_alt_chains.version();
+      m_archive_batch.alt_chains_valid = true;
     }
-
-    //  root array end
-    altchains_json << "]";
+    record.alt_chains = m_archive_batch.alt_chains;
   }
   else
   {
-    // root array empty
-    altchains_json << "[]";
+    // rpc_get_info: read height_without_bootstrap
+    uint64_t height_without_bootstrap;
+    get_tail_id(height_without_bootstrap);
+    ++height_without_bootstrap; // turn top block height into blockchain height
+    record.chain_height = height_without_bootstrap;
+
+    // rpc_get_alternate_chains, from the summary kept by the Block Handler
+    if (!m_archive_alt_chains.is_valid())
+      archive_alt_chain_cache_rebuild();
+    m_archive_alt_chains.get_chains(record.alt_chains);
   }
 
-  return std::make_pair(altchains_length, altchains_json.str());
+  m_archive_writer.metrics().stage(archive_stage::alt_chain_info).record(archive_metrics_now_ns() - start_ns);
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_alt_chain_cache_rebuild()
+{
+  // same source as get_alternative_chains(), but only the header fields are kept
+  m_archive_alt_chains.clear();
+  m_db->for_all_alt_blocks([this](const crypto::hash &blkid, const cryptonote::alt_block_data_t &data, const cryptonote::blobdata *blob) {
+    block bl;
+    if (!blob || !cryptonote::parse_and_validate_block_from_blob(*blob, bl))
+    {
+      MERROR("Failed to parse alt block " << blkid << " for the archive");
+      return true;
+    }
+    difficulty_type cumulative_difficulty = data.cumulative_difficulty_high;
+    cumulative_difficulty = (cumulative_difficulty << 64) + data.cumulative_difficulty_low;
+    m_archive_alt_chains.add_block(blkid, bl.prev_id, data.height, cumulative_difficulty);
+    return true;
+  }, true);
+  MDEBUG("Archive alt chain summary rebuilt: " << m_archive_alt_chains.num_blocks() << " alt blocks in " << m_archive_alt_chains.num_chains() << " chains");
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_alt_chain_cache_invalidate()
+{
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  m_archive_alt_chains.invalidate();
 }
 //-----------------------------------------------------------------------------------------------
 std::string Blockchain::archive_output_filename()
@@ -444,6 +596,258 @@ std::string Blockchain::archive_output_filename()
 
   return output_filename;
 }
+//-----------------------------------------------------------------------------------------------
+archive_writer_config Blockchain::archive_output_config()
+{
+  // ## USER INPUT
+  archive_writer_config config;
+  config.file.filename = archive_output_filename();
+
+  // # format
+  // # - tsv:    tab-delimited lines with block JSON, see README "Archive File"
+  // # - binary: length-prefixed records with the block blob, see README "Binary Archive File";
+  // #           written next to the TSV filename with extension .bin
+  config.format = archive_output_format::tsv;
+  if (config.format == archive_output_format::binary)
+    config.file.filename = config.file.filename.substr(0, config.file.filename.rfind(".log")) + ".bin";
+
+  // # alt_delta, see README "Alt Chain Deltas"
+  // # - enabled:           write Alt Chains Info (field 6) of TSV sinks as changes since the previous line
+  // # - snapshot_interval: lines between full snapshots, which also start every segment; 0 for only those
+  config.alt_delta.enabled = false;
+  config.alt_delta.snapshot_interval = 1000;
+
+  // # sinks, see README "Archive Sinks"; replaced by the --archive-sink daemon options if any are given
+  // # - none:               a single file sink, output_filename in format
+  // # - file:               archive (segment) file; the first one also feeds the live feed
+  // # - socket:             Unix domain socket for local consumers, nothing kept
+  // # - null:               discards every record
+  // # - e.g. config.sinks = {{archive_sink_type::file, archive_output_format::binary, "/opt/monerodarchive/archive.bin"}};
+  config.sinks = {};
+
+  // # segments, also set by --archive-segment-bytes and --archive-segment-seconds
+  // # - max_bytes:   start a new segment once it is this large; 0 for no limit
+  // # - max_seconds: start a new segment once it is this old; 0 for no limit
+  // # - both 0:      a single archive file with no index, as in earlier versions, so tail -f archive.log keeps working
+  // # - segments are named like archive.000001.log, each with an index archive.000001.idx; e.g. 1 GiB and 86400
+  config.segments.max_bytes = 0;
+  config.segments.max_seconds = 0;
+
+  // # compression (needs segments and a build with zstd)
+  // # - enabled:             write segments as independent zstd frames, named like archive.000001.log.zst
+  // # - level:               zstd compression level
+  // # - frame_records:       most records in one frame
+  // # - frame_flush_ms:      longest a record waits for its frame to fill; 0 writes a frame at every group commit
+  // # - dictionary_filename: trained dictionary (monerod-archive-dump --train-dictionary); readers need it too
+  config.compression.enabled = false;
+  config.compression.level = 3;
+  config.compression.frame_records = 64;
+  config.compression.frame_flush_ms = 0;
+  config.compression.dictionary_filename = "";
+
+  // # feed (not on Windows), see README "Live Feed"
+  // # - enabled:             publish every record to local consumers as soon as it is written
+  // # - shm_name:            POSIX shared memory ring; empty for none
+  // # - shm_bytes:           ring size; a consumer this far behind is overrun and resyncs from the archive
+  // # - socket_path:         Unix domain socket; empty for none
+  // # - client_buffer_bytes: most bytes queued for one socket client; it misses records beyond that
+  config.feed.enabled = false;
+  config.feed.shm_name = "/monerod-archive";
+  config.feed.shm_bytes = 64 * 1024 * 1024;
+  config.feed.socket_path = "/opt/monerodarchive/archive.sock";
+  config.feed.client_buffer_bytes = 16 * 1024 * 1024;
+
+  // # arrivals, see README "Block Arrivals"
+  // # - enabled:       record each peer's first announcement of every block
+  // # - file.filename: one line per block, written once its window closes
+  // # - window_ms:     how long after the first announcement peers are recorded
+  // # - max_peers:     most peers recorded per block
+  // # - max_blocks:    most blocks tracked at once
+  config.arrivals.enabled = false;
+  config.arrivals.file.filename = "/opt/monerodarchive/arrivals.log";
+  config.arrivals.window_ms = 10000;
+  config.arrivals.max_peers = 256;
+  config.arrivals.max_blocks = 4096;
+
+  // # tx_store (not on Windows), see README "Transaction Store"
+  // # - enabled:          keep the blob of every tx received with a block, once per tx hash
+  // # - filename:         append-only log; the hash index is next to it with extension .idx
+  // # - initial_slots:    index slots of a new store; it doubles as it fills
+  // # - max_queued_bytes: blobs waiting to be stored; batches beyond are dropped
+  config.tx_store.enabled = false;
+  config.tx_store.filename = "/opt/monerodarchive/txs.log";
+  config.tx_store.initial_slots = 1 << 20;
+  config.tx_store.max_queued_bytes = 256 * 1024 * 1024;
+
+  // # tx_arrivals, see README "Transaction Arrivals"
+  // # - enabled:            record every tx accepted into the mempool: NRT, hash, size, weight, fee and relay method
+  // # - file.filename:      base filename; with segments they are named like txpool.000001.log, a new one on every start
+  // # - segments:           start a new segment at this size or age; both 0 for a single file, e.g. 1 GiB and 86400
+  // # - max_thread_records: most txs a thread holds between flushes; more are dropped and counted
+  // # - flush_ms:           how often the held txs are written
+  config.tx_arrivals.enabled = false;
+  config.tx_arrivals.file.filename = "/opt/monerodarchive/txpool.log";
+  config.tx_arrivals.segments.max_bytes = 0;
+  config.tx_arrivals.segments.max_seconds = 0;
+  config.tx_arrivals.max_thread_records = 65536;
+  config.tx_arrivals.flush_ms = 1000;
+
+  // # policy, see README "Sync Policy"
+  // # - syncing:         what is recorded while NCH < NTH; once synced every record is full
+  // #   - full:          full records, as when synced
+  // #   - header:        header-only records: header, height, hash and number of tx hashes
+  // #   - sampled:       a full record every sample_interval heights, header-only records between
+  // # - sample_interval: heights between full records, for sampled
+  config.policy.syncing = archive_sync_policy::full;
+  config.policy.sample_interval = 100;
+
+  // # fsync_policy
+  // # - none:            leave flushing to the OS
+  // # - every_n_records: fdatasync after fsync_records records
+  // # - every_t_ms:      fdatasync at most every fsync_interval_ms milliseconds
+  // # - every_record:    fdatasync after every write
+  config.file.fsync_policy = archive_fsync_policy::none;
+  config.file.fsync_records = 100;
+  config.file.fsync_interval_ms = 1000;
+
+  // # recovery, see README "Crash Recovery"
+  // # - checkpoint_interval_ms:  most often the durable end of the archive is noted in archive.ckpt, after an fdatasync;
+  // #                            with fsync_policy none only on a clean stop.  On start only records after it are checked,
+  // #                            and a torn tail is cut off.  0 for no checkpoint: the newest segment, or the last 1 MiB, is checked
+  // # - spill.max_bytes:         records that fail to be written are held in memory up to this size, oldest dropped beyond; 0 to drop them
+  // # - spill.retry_interval_ms: how often held records are written again
+  config.file.checkpoint_interval_ms = 1000;
+  config.spill.max_bytes = 64 * 1024 * 1024;
+  config.spill.retry_interval_ms = 1000;
+
+  // # overflow_policy, of each sink queue
+  // # - drop_oldest: oldest queued record is discarded; the Block Handler never waits
+  // # - drop_newest: incoming record is discarded; the Block Handler never waits
+  // # - block:       Block Handler waits for the writer when the queue is full; no record is lost,
+  // #                but a stalled disk or socket stalls block processing again
+  config.overflow_policy = archive_overflow_policy::drop_oldest;
+
+  // # queue_capacity
+  // # - records held between the Block Handler and the writer thread of each sink
+  config.queue_capacity = 4096;
+
+  // # metrics (not on Windows), see README "Metrics"
+  // # - enabled:      serve counters and latency histograms in the Prometheus text format on http://bind_address:port/metrics
+  // # - bind_address: keep it local; the page is not authenticated
+  // # - port:         also set by the --archive-metrics-port daemon option
+  config.metrics.enabled = false;
+  config.metrics.bind_address = "127.0.0.1";
+  config.metrics.port = 18095;
+
+  return config;
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_configure(bool enabled, const archive_writer_config& config)
+{
+  // the writer is pushed to under m_blockchain_lock by add_new_block(), and under m_tx_pool
+  // alone by archive_batch_end() and archive_tx_arrival(), so stopping it needs both
+  CRITICAL_REGION_LOCAL(m_tx_pool);
+  CRITICAL_REGION_LOCAL1(m_blockchain_lock);
+  m_archive_writer.stop();
+  m_archive_enabled = enabled;
+  m_archive_policy = config.policy;
+  if (enabled)
+    m_archive_writer.start(config);
+}
+//-----------------------------------------------------------------------------------------------
+archive_writer::stats Blockchain::archive_writer_stats() const
+{
+  return m_archive_writer.get_stats();
+}
+//-----------------------------------------------------------------------------------------------
+std::string Blockchain::archive_metrics_report(bool prometheus) const
+{
+  return m_archive_writer.metrics_report(prometheus);
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_block_arrival(const blobdata& block_blob, const block* b, archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const archive_receive_time& archive_nrt)
+{
+  archive_arrivals& arrivals = m_archive_writer.arrivals();
+  if (!m_archive_enabled || !arrivals.enabled())
+    return;
+
+  // full block notifications are only parsed when arrivals are recorded
+  block lb;
+  if (!b)
+  {
+    if (!parse_and_validate_block_from_blob(block_blob, lb))
+      return;
+    b = &lb;
+  }
+  arrivals.record(get_block_hash(*b), get_block_height(*b), type, connection_id, address, archive_nrt);
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_tx_arrival(const crypto::hash& id, uint64_t blob_size, uint64_t weight, uint64_t fee, relay_method tx_relay)
+{
+  archive_tx_arrivals& tx_arrivals = m_archive_writer.tx_arrivals();
+  if (!m_archive_enabled || !tx_arrivals.enabled())
+    return;
+  // txs returned from popped blocks, or carried in a full block, did not just arrive
+  if (tx_relay == relay_method::block)
+    return;
+  tx_arrivals.record(id, blob_size, weight, fee, tx_relay);
+}
+//-----------------------------------------------------------------------------------------------
+bool Blockchain::archive_batch_height(uint64_t& height)
+{
+  // m_tx_pool is held by the caller, as for the whole batch
+  if (!m_archive_batch.active)
+    return false;
+  if (!m_archive_batch.chain_height_valid)
+  {
+    m_archive_batch.chain_height = m_db->height();
+    m_archive_batch.chain_height_valid = true;
+  }
+  height = m_archive_batch.chain_height;
+  return true;
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_batch_begin()
+{
+  m_archive_batch.active = true;
+  m_archive_batch.records.clear();
+  m_archive_batch.chain_height_valid = false;
+  m_archive_batch.alt_chains_valid = false;
+  m_archive_batch.txs.clear();
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_batch_txs(const std::vector<block_complete_entry>& blocks_entry)
+{
+  if (!m_archive_enabled || !m_archive_writer.tx_store().enabled())
+    return;
+
+  // only copied here; hashing, lookups and writes are on the tx store thread
+  for (const block_complete_entry& entry: blocks_entry)
+  {
+    for (const tx_blob_entry& tx: entry.txs)
+    {
+      m_archive_batch.txs.emplace_back();
+      archive_tx_blob& blob = m_archive_batch.txs.back();
+      blob.blob = tx.blob;
+      blob.pruned = entry.pruned;
+      blob.prunable_hash = tx.prunable_hash;
+    }
+  }
+}
+//-----------------------------------------------------------------------------------------------
+void Blockchain::archive_batch_end()
+{
+  if (!m_archive_batch.active)
+    return;
+  m_archive_batch.active = false;
+  m_archive_writer.tx_store().push(m_archive_batch.txs);
+  if (m_archive_batch.records.empty())
+    return;
+
+  // one hand-off and one writer wake-up per batch; the writer group commits the records in order
+  const uint64_t held_us = archive_receive_time::now().steady_us - m_archive_batch.first_steady_us;
+  m_archive_writer.push_batch(m_archive_batch.records, held_us);
+}
 /*
   </MonerodArchive>
  */
\ No newline at end of file
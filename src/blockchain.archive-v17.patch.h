@@ -31,6 +31,13 @@
 // ** Patched with MonerodArchive v17 by Neptune Research
 // ** SPDX-License-Identifier: BSD-3-Clause
 
+// ## Add to the includes list:
+
+#include "archive_alt_chains.h" // MonerodArchive Dependency #2
+#include "archive_writer.h" // MonerodArchive Dependency #3
+
+// ## Add to class Blockchain, public members:
+
     /*
      * <MonerodArchive>
      */
@@ -44,25 +51,176 @@
      *
      * @param bl_ the block to be added
      * @param bvc metadata about the block addition's success/failure
+     * @param archive_sync_state the pair (NCH,NTH)
+     * @param archive_nrt when the block was received from the network, if known
      *
      * @return true on successful addition to the blockchain, else false
      */
-    bool add_new_block(const block& bl_, block_verification_context& bvc, std::pair<uint64_t,uint64_t> archive_sync_state);
+    bool add_new_block(const block& bl_, block_verification_context& bvc, std::pair<uint64_t,uint64_t> archive_sync_state, const archive_receive_time& archive_nrt);
 
     /**
-     * @copydoc Blockchain::archive_block
+     * @brief captures an incoming block for the archive
+     *
+     * Runs inside the Block Handler with the blockchain lock held, so it only
+     * copies what the archive needs into an archive_record and queues it for
+     * the archive writer thread.
+     *
+     * @param b the incoming block
+     * @param is_alt_block true if the block is bound for the altchain handler
+     * @param archive_sync_state the pair (NCH,NTH)
+     * @param archive_nrt when the block was received from the network, if known
      */
-        void archive_block(block& b, bool is_alt_block, std::pair<uint64_t,uint64_t> archive_sync_state);
+    void archive_block(const block& b, bool is_alt_block, std::pair<uint64_t,uint64_t> archive_sync_state, const archive_receive_time& archive_nrt);
 
     /**
-     * @copydoc Blockchain::archive_alt_chain_info
+     * @brief reads the daemon's alternate blockchain state into a record
+     *
+     * Reads the alt chain summary kept up to date by the Block Handler, so
+     * the cost is one entry per alt chain, with no block copies or hashing.
+     *
+     * @param record receives the alt chains and the current mainchain height
      */
-        std::pair<uint64_t,std::string> archive_alt_chain_info();
+    void archive_alt_chain_info(archive_record& record);
+
+    /**
+     * @brief forces the alt chain summary to be rebuilt from the database
+     *
+     * Call after changing alt blocks outside the Block Handler, e.g. after
+     * BlockchainDB::drop_alt_blocks().
+     */
+    void archive_alt_chain_cache_invalidate();
 
     /**
      * @copydoc Blockchain::archive_output_filename
      */
         std::string archive_output_filename();
+
+    /**
+     * @brief archive writer settings: output file, queue capacity, overflow policy
+     */
+    archive_writer_config archive_output_config();
+
+    /**
+     * @brief turns the Archive Producer on or off and restarts the archive writer
+     *
+     * For tools and benchmarks that must not record to the configured
+     * archive, and for core::init() with the --archive-* options; otherwise
+     * init() uses archive_output_config().  Called before init(), the
+     * genesis block is recorded with these settings too.
+     *
+     * @param enabled false skips archive_block() in add_new_block()
+     * @param config archive writer settings used when enabled
+     */
+    void archive_configure(bool enabled, const archive_writer_config& config);
+
+    /**
+     * @brief archive writer counters: records written, dropped, queue high water
+     */
+    archive_writer::stats archive_writer_stats() const;
+
+    /**
+     * @brief archive counters and latency histograms, see archive_writer::metrics_report()
+     *
+     * @param prometheus the Prometheus text format instead of a console table
+     */
+    std::string archive_metrics_report(bool prometheus) const;
+
+    /**
+     * @brief records a peer's announcement of a block for the block arrivals
+     *
+     * Called by the protocol handler for every announcement, including those
+     * of blocks the Block Handler already has.  Takes no blockchain lock.
+     *
+     * @param block_blob the announced block
+     * @param b the announced block, or NULL to parse block_blob if arrivals are recorded
+     * @param type fluffy or full block notification
+     * @param connection_id the announcing connection
+     * @param address the announcing peer
+     * @param archive_nrt when the announcement was received
+     */
+    void archive_block_arrival(const blobdata& block_blob, const block* b, archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const archive_receive_time& archive_nrt);
+
+    /**
+     * @brief records a tx accepted into the mempool for the tx arrivals
+     *
+     * Called by tx_memory_pool::add_tx() with the pool lock held; only
+     * appends to a buffer of the calling thread.  Txs added with
+     * relay_method::block, returned from a popped block or carried in a
+     * full block notification, are not arrivals and are skipped.
+     *
+     * @param id the tx hash
+     * @param blob_size size of the tx blob in bytes
+     * @param weight tx weight
+     * @param fee tx fee in atomic units
+     * @param tx_relay how the tx reached the pool
+     */
+    void archive_tx_arrival(const crypto::hash& id, uint64_t blob_size, uint64_t weight, uint64_t fee, relay_method tx_relay);
+
+    /**
+     * @brief mainchain height (NCH) tracked for the open block batch
+     *
+     * Read from the database once per batch, and again only after a block
+     * did not simply extend the mainchain.  The caller must hold m_tx_pool,
+     * as add_new_block() does.
+     *
+     * @param height receives the height
+     *
+     * @return false if no block batch is open
+     */
+    bool archive_batch_height(uint64_t& height);
+    /*
+     * </MonerodArchive>
+    */
+
+// ## Add to class Blockchain, private members:
+
+    /*
+     * <MonerodArchive>
+     */
+    archive_writer m_archive_writer;
+    archive_alt_chain_cache m_archive_alt_chains;
+    std::atomic<bool> m_archive_enabled{true};
+    archive_policy_config m_archive_policy;
+
+    /**
+     * @brief archive state of the block batch between prepare_handle_incoming_blocks()
+     * and cleanup_handle_incoming_blocks()
+     *
+     * Guarded by m_tx_pool, which the batch holds throughout.
+     */
+    struct archive_batch
+    {
+      bool active = false;
+      std::vector<archive_record> records;  //!< captured blocks in order, handed to the writer when the batch ends
+      uint64_t first_steady_us = 0;         //!< steady clock when the first record was captured
+      bool chain_height_valid = false;
+      uint64_t chain_height = 0;            //!< mainchain height, advanced as blocks extend the mainchain
+      bool alt_chains_valid = false;
+      uint64_t alt_chains_version = 0;      //!< archive_alt_chain_cache::version() alt_chains was read at
+      std::vector<archive_alt_chain> alt_chains;
+      std::vector<archive_tx_blob> txs;     //!< tx blobs received with the batch's blocks, for the tx store
+    };
+    archive_batch m_archive_batch;
+
+    /**
+     * @brief rebuilds the alt chain summary from the alt blocks in the database
+     */
+    void archive_alt_chain_cache_rebuild();
+
+    /**
+     * @brief starts collecting archive records for a block batch
+     */
+    void archive_batch_begin();
+
+    /**
+     * @brief copies the tx blobs of a block batch for the tx store, if it is enabled
+     */
+    void archive_batch_txs(const std::vector<block_complete_entry> &blocks_entry);
+
+    /**
+     * @brief hands the records of the block batch to the archive writer at once
+     */
+    void archive_batch_end();
     /*
      * </MonerodArchive>
-    */
\ No newline at end of file
+    */
@@ -31,9 +31,108 @@
 // ** Patched with MonerodArchive v17 by Neptune Research
 // ** SPDX-License-Identifier: BSD-3-Clause
 
+  // ## Add to the static arg_descriptors after arg_keep_alt_blocks:
+
+  // <MonerodArchive (Sinks)>
+  static const command_line::arg_descriptor<bool> arg_archive_disable = {
+    "archive-disable"
+  , "Do not record blocks to the archive"
+  , false
+  };
+  static const command_line::arg_descriptor<std::vector<std::string>> arg_archive_sink = {
+    "archive-sink"
+  , "Archive sink, may be repeated: tsv:FILE, binary:FILE, socket:PATH, socket-binary:PATH or null. Replaces the sinks of the archive settings"
+  };
+  static const command_line::arg_descriptor<std::string> arg_archive_overflow_policy = {
+    "archive-overflow-policy"
+  , "What the archive does when a sink queue is full: block, drop_oldest or drop_newest. Overrides the archive settings"
+  , ""
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_archive_queue_capacity = {
+    "archive-queue-capacity"
+  , "Records queued for each archive sink. Overrides the archive settings"
+  , 0
+  };
+  static const command_line::arg_descriptor<std::string> arg_archive_sync_policy = {
+    "archive-sync-policy"
+  , "What the archive records while syncing: full, header or sampled. Overrides the archive settings"
+  , ""
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_archive_sample_interval = {
+    "archive-sample-interval"
+  , "Heights between full archive records while syncing, for --archive-sync-policy sampled. Overrides the archive settings"
+  , 0
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_archive_segment_bytes = {
+    "archive-segment-bytes"
+  , "Split the archive into indexed segments of at most this many bytes. Overrides the archive settings"
+  , 0
+  };
+  static const command_line::arg_descriptor<uint64_t> arg_archive_segment_seconds = {
+    "archive-segment-seconds"
+  , "Split the archive into indexed segments of at most this many seconds. Overrides the archive settings"
+  , 0
+  };
+  static const command_line::arg_descriptor<uint16_t> arg_archive_metrics_port = {
+    "archive-metrics-port"
+  , "Serve archive metrics in the Prometheus text format on this port of 127.0.0.1. Overrides the archive settings"
+  , 0
+  };
+  // </MonerodArchive>
+
+  //-----------------------------------------------------------------------------------------------
+  // core::init_options() and core::init() are long and otherwise unchanged, so only
+  // the lines around the change are shown. "// ..." marks unchanged Monero code.
+  void core::init_options(boost::program_options::options_description& desc)
+  {
+    // ...
+    command_line::add_arg(desc, arg_keep_alt_blocks);
+    // <MonerodArchive (Sinks)>
+    command_line::add_arg(desc, arg_archive_disable);
+    command_line::add_arg(desc, arg_archive_sink);
+    command_line::add_arg(desc, arg_archive_overflow_policy);
+    command_line::add_arg(desc, arg_archive_queue_capacity);
+    command_line::add_arg(desc, arg_archive_sync_policy);
+    command_line::add_arg(desc, arg_archive_sample_interval);
+    command_line::add_arg(desc, arg_archive_segment_bytes);
+    command_line::add_arg(desc, arg_archive_segment_seconds);
+    command_line::add_arg(desc, arg_archive_metrics_port);
+    // </MonerodArchive>
+
+    // ...
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::init(const boost::program_options::variables_map& vm, const cryptonote::test_options *test_options, const GetCheckpointsCallback& get_checkpoints/* = nullptr */)
+  {
+    // ...
+
+    const difficulty_type fixed_difficulty = command_line::get_arg(vm, arg_fixed_difficulty);
+    // <MonerodArchive (Sinks)>
+    // before the Blockchain is initialized, so the genesis block goes to the configured sinks too
+    r = archive_init(vm);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to configure the archive");
+    // </MonerodArchive>
+    r = m_blockchain_storage.init(db.release(), m_nettype, m_offline, regtest ? &regtest_test_options : test_options, fixed_difficulty, get_checkpoints);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to initialize blockchain storage");
+
+    // ...
+
+    if (!keep_alt_blocks && !m_blockchain_storage.get_db().is_read_only())
+    {
+      m_blockchain_storage.get_db().drop_alt_blocks();
+      // <MonerodArchive (Alt Chains)>
+      m_blockchain_storage.archive_alt_chain_cache_invalidate();
+      // </MonerodArchive>
+    }
+
+    // ...
+  }
   //-----------------------------------------------------------------------------------------------
   bool core::handle_block_found(block& b, block_verification_context &bvc)
   {
+    // <MonerodArchive (NRT)>
+    const archive_receive_time archive_nrt = archive_receive_time::now();
+    // </MonerodArchive>
     bvc = {};
     m_miner.pause();
     std::vector<block_complete_entry> blocks;
@@ -54,8 +153,7 @@
       return false;
     }
     // <MonerodArchive (IsNodeSynced?1)>
-    std::pair<uint64_t,uint64_t> archive_sync_state = std::make_pair(get_current_blockchain_height(), get_target_blockchain_height());
-    m_blockchain_storage.add_new_block(b, bvc, archive_sync_state);
+    m_blockchain_storage.add_new_block(b, bvc, archive_sync_state(), archive_nrt);
     // </MonerodArchive>
     cleanup_handle_incoming_blocks(true);
     //anyway - update miner template
@@ -91,10 +189,134 @@
   }
 
   //-----------------------------------------------------------------------------------------------
-  bool core::add_new_block(const block& b, block_verification_context& bvc)
+  bool core::add_new_block(const block& b, block_verification_context& bvc, const archive_receive_time& archive_nrt)
   {
     // <MonerodArchive (IsNodeSynced?2)>
-    std::pair<uint64_t,uint64_t> archive_sync_state = std::make_pair(get_current_blockchain_height(), get_target_blockchain_height());
-    return m_blockchain_storage.add_new_block(b, bvc, archive_sync_state);
+    return m_blockchain_storage.add_new_block(b, bvc, archive_sync_state(), archive_nrt);
+    // </MonerodArchive>
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  std::pair<uint64_t,uint64_t> core::archive_sync_state()
+  {
+    // <MonerodArchive (Batch)>
+    uint64_t height;
+    if (!m_blockchain_storage.archive_batch_height(height))
+      height = get_current_blockchain_height();
+    return std::make_pair(height, get_target_blockchain_height());
     // </MonerodArchive>
-  }
\ No newline at end of file
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  bool core::archive_init(const boost::program_options::variables_map& vm)
+  {
+    // <MonerodArchive (Sinks)>
+    archive_writer_config config = m_blockchain_storage.archive_output_config();
+    const bool enabled = !command_line::get_arg(vm, arg_archive_disable);
+
+    const std::vector<std::string> sinks = command_line::get_arg(vm, arg_archive_sink);
+    if (!sinks.empty())
+    {
+      config.sinks.clear();
+      for (const std::string& spec: sinks)
+      {
+        archive_sink_config sink;
+        if (!archive_parse_sink(spec, sink))
+        {
+          MERROR("Invalid --" << arg_archive_sink.name << " " << spec << ", expected tsv:FILE, binary:FILE, socket:PATH, socket-binary:PATH or null");
+          return false;
+        }
+        config.sinks.push_back(sink);
+      }
+    }
+
+    const std::string overflow_policy = command_line::get_arg(vm, arg_archive_overflow_policy);
+    if (!overflow_policy.empty() && !archive_parse_overflow_policy(overflow_policy, config.overflow_policy))
+    {
+      MERROR("Invalid --" << arg_archive_overflow_policy.name << " " << overflow_policy << ", expected block, drop_oldest or drop_newest");
+      return false;
+    }
+
+    const uint64_t queue_capacity = command_line::get_arg(vm, arg_archive_queue_capacity);
+    if (queue_capacity != 0)
+      config.queue_capacity = queue_capacity;
+
+    const std::string sync_policy = command_line::get_arg(vm, arg_archive_sync_policy);
+    if (!sync_policy.empty() && !archive_parse_sync_policy(sync_policy, config.policy.syncing))
+    {
+      MERROR("Invalid --" << arg_archive_sync_policy.name << " " << sync_policy << ", expected full, header or sampled");
+      return false;
+    }
+
+    const uint64_t sample_interval = command_line::get_arg(vm, arg_archive_sample_interval);
+    if (sample_interval != 0)
+      config.policy.sample_interval = sample_interval;
+
+    const uint64_t segment_bytes = command_line::get_arg(vm, arg_archive_segment_bytes);
+    if (segment_bytes != 0)
+      config.segments.max_bytes = segment_bytes;
+    const uint64_t segment_seconds = command_line::get_arg(vm, arg_archive_segment_seconds);
+    if (segment_seconds != 0)
+      config.segments.max_seconds = segment_seconds;
+
+    const uint16_t metrics_port = command_line::get_arg(vm, arg_archive_metrics_port);
+    if (metrics_port != 0)
+    {
+      config.metrics.enabled = true;
+      config.metrics.port = metrics_port;
+    }
+
+    for (const archive_sink_config& sink: config.sinks)
+      MINFO("Archive sink: " << archive_sink_name(sink));
+    m_blockchain_storage.archive_configure(enabled, config);
+    return true;
+    // </MonerodArchive>
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  void core::archive_block_arrival(const blobdata& block_blob, const block *b, archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const archive_receive_time& archive_nrt)
+  {
+    // <MonerodArchive (Arrivals)>
+    m_blockchain_storage.archive_block_arrival(block_blob, b, type, connection_id, address, archive_nrt);
+    // </MonerodArchive>
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_block(const blobdata& block_blob, const block *b, block_verification_context& bvc, bool update_miner_blocktemplate, const archive_receive_time& archive_nrt)
+  {
+    TRY_ENTRY();
+
+    bvc = {};
+
+    if (!check_incoming_block_size(block_blob))
+    {
+      bvc.m_verifivation_failed = true;
+      return false;
+    }
+
+    if (((size_t)-1) <= 0xffffffff && block_blob.size() >= 0x3fffffff)
+      MWARNING("This block's size is " << block_blob.size() << ", closing on the 32 bit limit");
+
+    CHECK_AND_ASSERT_MES(update_checkpoints_from_json_file(), false, "One or more checkpoints loaded from json conflicted with existing checkpoints.");
+
+    block lb;
+    if (!b)
+    {
+      crypto::hash block_hash;
+      if(!parse_and_validate_block_from_blob(block_blob, lb, block_hash))
+      {
+        LOG_PRINT_L1("Failed to parse and validate new block");
+        bvc.m_verifivation_failed = true;
+        return false;
+      }
+      b = &lb;
+    }
+    // <MonerodArchive (NRT)>
+    add_new_block(*b, bvc, archive_nrt);
+    // </MonerodArchive>
+    if(update_miner_blocktemplate && bvc.m_added_to_main_chain)
+       update_miner_block_template();
+    return true;
+
+    CATCH_ENTRY_L0("core::handle_incoming_block()", false);
+  }
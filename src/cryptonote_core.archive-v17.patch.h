@@ -0,0 +1,118 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+//
+// ** Patched with MonerodArchive v17 by Neptune Research
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+// ## Add to the includes list:
+
+#include "archive_arrivals.h" // MonerodArchive Dependency #1
+#include "archive_record.h" // MonerodArchive Dependency #2
+
+// ## Replace these declarations in class core, and add archive_block_arrival():
+
+     /*
+      * <MonerodArchive>
+      */
+     /**
+      * @brief handles an incoming block
+      *
+      * periodic update to checkpoints is triggered here
+      * Attempts to add the block to the Blockchain and, on success,
+      * optionally updates the miner's block template.
+      *
+      * @param block_blob the block to be added
+      * @param block the block to be added, or NULL
+      * @param bvc return-by-reference metadata context about the block's validity
+      * @param update_miner_blocktemplate whether or not to update the miner's block template
+      * @param archive_nrt when the block was received from the network, if known
+      *
+      * @return false if loading new checkpoints fails, or the block is not
+      * added, otherwise true
+      */
+     bool handle_incoming_block(const blobdata& block_blob, const block *b, block_verification_context& bvc, bool update_miner_blocktemplate = true, const archive_receive_time& archive_nrt = archive_receive_time());
+
+     /**
+      * @brief add a new block to the blockchain
+      *
+      * calls Blockchain::add_new_block
+      *
+      * @param b the block to be added
+      * @param bvc return-by-reference metadata context about the block's validity
+      * @param archive_nrt when the block was received from the network, if known
+      *
+      * @return true if the block was added to the main chain, otherwise false
+      */
+     bool add_new_block(const block& b, block_verification_context& bvc, const archive_receive_time& archive_nrt = archive_receive_time());
+
+     /**
+      * @brief records a peer's announcement of a block for the block arrivals
+      *
+      * calls Blockchain::archive_block_arrival
+      *
+      * @param block_blob the announced block
+      * @param b the announced block, or NULL
+      * @param type fluffy or full block notification
+      * @param connection_id the announcing connection
+      * @param address the announcing peer
+      * @param archive_nrt when the announcement was received
+      */
+     void archive_block_arrival(const blobdata& block_blob, const block *b, archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const archive_receive_time& archive_nrt);
+     /*
+      * </MonerodArchive>
+      */
+
+// ## Add to class core, private members:
+
+     /*
+      * <MonerodArchive>
+      */
+     /**
+      * @brief the pair (NCH,NTH) passed to Blockchain::add_new_block
+      *
+      * Within a block batch NCH is the height the Blockchain tracks for the
+      * batch, so it is not read from the database for every block.
+      */
+     std::pair<uint64_t,uint64_t> archive_sync_state();
+
+     /**
+      * @brief configures the Archive Producer from the --archive-* options
+      *
+      * Starts from Blockchain::archive_output_config(); an option that is
+      * not given leaves its setting as it is there.
+      *
+      * @param vm command line parameters
+      *
+      * @return false if an option is invalid
+      */
+     bool archive_init(const boost::program_options::variables_map& vm);
+     /*
+      * </MonerodArchive>
+      */
@@ -0,0 +1,131 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
+//
+// ** Patched with MonerodArchive v17 by Neptune Research
+// ** File: src/cryptonote_protocol/cryptonote_protocol_handler.inl
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+// These functions are long and otherwise unchanged, so only the lines around
+// each change are shown. "// ..." marks unchanged Monero code.
+
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_new_fluffy_block(int command, NOTIFY_NEW_FLUFFY_BLOCK::request& arg, cryptonote_connection_context& context)
+  {
+    // <MonerodArchive (NRT)>
+    archive_receive_time archive_nrt = archive_receive_time::now();
+    // </MonerodArchive>
+
+    // ...
+
+    block new_block;
+    transaction miner_tx;
+    if(parse_and_validate_block_from_blob(arg.b.block, new_block))
+    {
+      // <MonerodArchive (NRT)>
+      // a block missing txs comes back after NOTIFY_REQUEST_FLUFFY_MISSING_TX;
+      // keep the time of its first message, not the tx round trip
+      archive_nrt = m_archive_first_seen.first_seen(get_block_hash(new_block), archive_nrt);
+      // </MonerodArchive>
+
+      // <MonerodArchive (Arrivals)>
+      // every announcement, before blocks the core already has are dropped
+      m_core.archive_block_arrival(arg.b.block, &new_block, archive_arrival_type::fluffy, context.m_connection_id, context.m_remote_address, archive_nrt);
+      // </MonerodArchive>
+
+    // ...
+
+          block_verification_context bvc = {};
+          // <MonerodArchive (NRT)>
+          m_core.handle_incoming_block(arg.b.block, pblocks.empty() ? NULL : &pblocks[0], bvc, true, archive_nrt); // got block from handle_notify_new_block
+          // </MonerodArchive>
+
+    // ...
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_new_block(int command, NOTIFY_NEW_BLOCK::request& arg, cryptonote_connection_context& context)
+  {
+    // <MonerodArchive (NRT)>
+    const archive_receive_time archive_nrt = archive_receive_time::now();
+    // </MonerodArchive>
+
+    // ...
+
+    if(!is_synchronized()) // can happen if a peer connection goes to normal but another thread still hasn't finished adding queued blocks
+    {
+      LOG_DEBUG_CC(context, "Received new block while syncing, ignored");
+      return 1;
+    }
+
+    // <MonerodArchive (Arrivals)>
+    m_core.archive_block_arrival(arg.b.block, NULL, archive_arrival_type::full, context.m_connection_id, context.m_remote_address, archive_nrt);
+    // </MonerodArchive>
+
+    // ...
+
+    block_verification_context bvc = {};
+    // <MonerodArchive (NRT)>
+    m_core.handle_incoming_block(arg.b.block, pblocks.empty() ? NULL : &pblocks[0], bvc, true, archive_nrt); // got block from handle_notify_new_block
+    // </MonerodArchive>
+
+    // ...
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_response_get_objects(int command, NOTIFY_RESPONSE_GET_OBJECTS::request& arg, cryptonote_connection_context& context)
+  {
+    // <MonerodArchive (NRT)>
+    // blocks wait in m_block_queue before try_add_next_blocks() hands them to
+    // the core, so the receive time travels with each block_complete_entry
+    const archive_receive_time archive_nrt = archive_receive_time::now();
+    for (block_complete_entry &block_entry: arg.blocks)
+      block_entry.archive_nrt = archive_nrt;
+    // </MonerodArchive>
+
+    // ...
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::try_add_next_blocks(cryptonote_connection_context& context)
+  {
+    // ...
+
+            // process block
+
+            TIME_MEASURE_START(block_process_time);
+            block_verification_context bvc = {};
+
+            // <MonerodArchive (NRT)>
+            m_core.handle_incoming_block(block_entry.block, pblocks.empty() ? NULL : &pblocks[blockidx], bvc, false, block_entry.archive_nrt); // <--- process block
+            // </MonerodArchive>
+
+    // ...
+  }
@@ -0,0 +1,163 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Patched with MonerodArchive v17 by Neptune Research
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+// The daemon console command archive_metrics and the RPC it calls,
+// /get_archive_metrics (JSON RPC get_archive_metrics), print
+// Blockchain::archive_metrics_report().  Restricted RPC does not serve it.
+
+// ## File: src/rpc/core_rpc_server_commands_defs.h, namespace cryptonote
+
+  // <MonerodArchive (Metrics)>
+  struct COMMAND_RPC_GET_ARCHIVE_METRICS
+  {
+    struct request_t: public rpc_request_base
+    {
+      bool prometheus;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_request_base)
+        KV_SERIALIZE_OPT(prometheus, false)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+
+    struct response_t: public rpc_response_base
+    {
+      std::string text;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_PARENT(rpc_response_base)
+        KV_SERIALIZE(text)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<response_t> response;
+  };
+  // </MonerodArchive>
+
+// ## File: src/rpc/core_rpc_server.h, class core_rpc_server
+
+    // BEGIN_URI_MAP2(), after MAP_URI_AUTO_JON2_IF("/pop_blocks", ...):
+      // <MonerodArchive (Metrics)>
+      MAP_URI_AUTO_JON2_IF("/get_archive_metrics", on_get_archive_metrics, COMMAND_RPC_GET_ARCHIVE_METRICS, !m_restricted)
+      // </MonerodArchive>
+
+    // BEGIN_JSON_RPC_MAP("/json_rpc"), after MAP_JON_RPC_IF("flush_cache", ...):
+        // <MonerodArchive (Metrics)>
+        MAP_JON_RPC_IF("get_archive_metrics", on_get_archive_metrics, COMMAND_RPC_GET_ARCHIVE_METRICS, !m_restricted)
+        // </MonerodArchive>
+
+    // with the other handlers:
+    // <MonerodArchive (Metrics)>
+    bool on_get_archive_metrics(const COMMAND_RPC_GET_ARCHIVE_METRICS::request& req, COMMAND_RPC_GET_ARCHIVE_METRICS::response& res, const connection_context *ctx = NULL);
+    // </MonerodArchive>
+
+// ## File: src/rpc/core_rpc_server.cpp
+
+  // <MonerodArchive (Metrics)>
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_archive_metrics(const COMMAND_RPC_GET_ARCHIVE_METRICS::request& req, COMMAND_RPC_GET_ARCHIVE_METRICS::response& res, const connection_context *ctx)
+  {
+    RPC_TRACKER(get_archive_metrics);
+    res.text = m_core.get_blockchain_storage().archive_metrics_report(req.prometheus);
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  // </MonerodArchive>
+
+// ## File: src/daemon/command_server.cpp, t_command_server::t_command_server()
+
+    // <MonerodArchive (Metrics)>
+    m_command_lookup.set_handler(
+      "archive_metrics"
+    , std::bind(&t_command_parser_executor::archive_metrics, &m_parser, p::_1)
+    , "archive_metrics [prometheus]"
+    , "Print the archive's counters and latency percentiles, or with prometheus the page served on --archive-metrics-port."
+    );
+    // </MonerodArchive>
+
+// ## File: src/daemon/command_parser_executor.h, class t_command_parser_executor
+
+  // <MonerodArchive (Metrics)>
+  bool archive_metrics(const std::vector<std::string>& args);
+  // </MonerodArchive>
+
+// ## File: src/daemon/command_parser_executor.cpp
+
+// <MonerodArchive (Metrics)>
+bool t_command_parser_executor::archive_metrics(const std::vector<std::string>& args)
+{
+  if (args.size() > 1 || (args.size() == 1 && args[0] != "prometheus"))
+  {
+    std::cout << "Invalid syntax: At most one parameter, prometheus, allowed. For more details, use the help command." << std::endl;
+    return true;
+  }
+  return m_executor.archive_metrics(args.size() == 1);
+}
+// </MonerodArchive>
+
+// ## File: src/daemon/rpc_command_executor.h, class t_rpc_command_executor
+
+  // <MonerodArchive (Metrics)>
+  bool archive_metrics(bool prometheus);
+  // </MonerodArchive>
+
+// ## File: src/daemon/rpc_command_executor.cpp
+
+// <MonerodArchive (Metrics)>
+bool t_rpc_command_executor::archive_metrics(bool prometheus)
+{
+  cryptonote::COMMAND_RPC_GET_ARCHIVE_METRICS::request req;
+  cryptonote::COMMAND_RPC_GET_ARCHIVE_METRICS::response res;
+  std::string fail_message = "Unsuccessful";
+  epee::json_rpc::error error_resp;
+
+  req.prometheus = prometheus;
+
+  if (m_is_rpc)
+  {
+    if (!m_rpc_client->rpc_request(req, res, "/get_archive_metrics", fail_message.c_str()))
+    {
+      return true;
+    }
+  }
+  else
+  {
+    if (!m_rpc_server->on_get_archive_metrics(req, res) || res.status != CORE_RPC_STATUS_OK)
+    {
+      tools::fail_msg_writer() << make_error(fail_message, res.status);
+      return true;
+    }
+  }
+
+  tools::msg_writer() << res.text;
+  return true;
+}
+// </MonerodArchive>
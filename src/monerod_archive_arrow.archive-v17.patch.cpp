@@ -0,0 +1,567 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_arrow.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+
+#include <boost/program_options.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "file_io_utils.h"
+#include "cryptonote_core/archive_alt_delta.h"
+#include "cryptonote_core/archive_compress.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_segment.h"
+#include "cryptonote_core/archive_tsv.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  const char binary_magic[4] = { 'M', 'D', 'A', 'R' };
+
+  bool is_binary(const char *data, size_t size)
+  {
+    return size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+  }
+
+  uint64_t now_us()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief one row of the Arrow table, filled from a TSV line or a binary record
+   */
+  struct arrow_row
+  {
+    struct alt_chain
+    {
+      uint64_t length, height, deep;
+      arrow::Decimal128 diff;
+      crypto::hash hash;
+    };
+
+    uint64_t height, mrt, nrt;
+    bool is_alt_block;
+    uint8_t major_version, minor_version;
+    uint32_t nonce, n_tx_hashes;
+    uint64_t nch, nth, n_alt_chains;
+    std::vector<alt_chain> alt_chains;
+    crypto::hash prev_id;
+    bool has_hash;  //!< only header-only TSV lines carry the block hash
+    crypto::hash hash;
+    uint8_t record_policy;
+  };
+
+  void alt_chains_to_row(uint64_t chain_height, const std::vector<archive_alt_chain> &chains, arrow_row &row)
+  {
+    // as in the Alt Chains Info JSON
+    row.alt_chains.resize(chains.size());
+    for (size_t i = 0; i < chains.size(); ++i)
+    {
+      const archive_alt_chain &chain = chains[i];
+      const uint64_t start_height = chain.height - chain.length + 1;
+      const uint64_t diff_low = (chain.cumulative_difficulty & 0xffffffffffffffff).convert_to<uint64_t>();
+      const uint64_t diff_high = ((chain.cumulative_difficulty >> 64) & 0xffffffffffffffff).convert_to<uint64_t>();
+      row.alt_chains[i] = { chain.length, start_height, chain_height - start_height - 1,
+        arrow::Decimal128((int64_t)diff_high, diff_low), chain.hash };
+    }
+  }
+
+  /**
+   * @return incomplete if the alt chains are delta-encoded against lines not read yet
+   */
+  archive_parse_result row_from_tsv(const archive_tsv_fields &fields, archive_alt_chain_decoder &alt_chains, arrow_row &row)
+  {
+    if (fields.n_fields < 9)
+      return archive_parse_result::corrupt;
+    archive_tsv_block block;
+    uint64_t record_policy = 0;
+    if (!archive_tsv_uint(fields.begin[1], fields.end[1], row.nrt) ||
+        !archive_tsv_bool(fields.begin[2], fields.end[2], row.is_alt_block) ||
+        !archive_tsv_parse_block(fields.begin[3], fields.end[3], block) ||
+        !archive_tsv_uint(fields.begin[4], fields.end[4], row.n_alt_chains) ||
+        !archive_tsv_uint(fields.begin[7], fields.end[7], row.nch) ||
+        !archive_tsv_uint(fields.begin[8], fields.end[8], row.nth))
+      return archive_parse_result::corrupt;
+    if (fields.n_fields >= 12 && !archive_tsv_uint(fields.begin[11], fields.end[11], record_policy))
+      return archive_parse_result::corrupt;
+    const archive_parse_result r = alt_chains.decode(fields.begin[5], fields.end[5], row.n_alt_chains);
+    if (r != archive_parse_result::ok)
+      return r;
+
+    row.height = block.height;
+    row.mrt = block.timestamp;
+    row.major_version = block.major_version;
+    row.minor_version = block.minor_version;
+    row.nonce = block.nonce;
+    row.n_tx_hashes = block.n_tx_hashes;
+    row.prev_id = block.prev_id;
+    row.has_hash = block.header_only;
+    row.hash = block.hash;
+    row.record_policy = record_policy;
+    alt_chains_to_row(alt_chains.chain_height(), alt_chains.chains(), row);
+    return archive_parse_result::ok;
+  }
+
+  void row_from_record(const archive_record &record, arrow_row &row)
+  {
+    row.height = record.block_height;
+    row.mrt = record.b.timestamp;
+    row.nrt = record.node_timestamp;
+    row.is_alt_block = record.is_alt_block;
+    row.major_version = record.b.major_version;
+    row.minor_version = record.b.minor_version;
+    row.nonce = record.b.nonce;
+    row.n_tx_hashes = record.n_tx_hashes;
+    row.nch = record.current_height;
+    row.nth = record.target_height;
+    row.n_alt_chains = record.alt_chains.size();
+    row.prev_id = record.b.prev_id;
+    row.has_hash = true;
+    row.hash = record.block_hash;
+    row.record_policy = (uint8_t)record.policy;
+    alt_chains_to_row(record.chain_height, record.alt_chains, row);
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief appends rows to an Arrow IPC stream file in record batches
+   *
+   * prev_id and hash are dictionary encoded with one dictionary per column
+   * for the whole file; each batch writes only the new values as a delta.
+   * Older Arrow releases reject dictionary deltas in the IPC file format,
+   * so this writes the stream format, which has always taken them.
+   */
+  class archive_arrow_writer
+  {
+  public:
+    archive_arrow_writer(size_t batch_rows):
+      n_rows(0), n_batches(0),
+      m_batch_rows(std::max<size_t>(batch_rows, 1)),
+      m_n_batch_rows(0)
+    {
+      arrow::MemoryPool *pool = arrow::default_memory_pool();
+      const std::shared_ptr<arrow::DataType> hash_type = arrow::fixed_size_binary(sizeof(crypto::hash));
+      const std::shared_ptr<arrow::DataType> alt_chain_type = arrow::struct_({
+        arrow::field("length", arrow::uint64(), false),
+        arrow::field("height", arrow::uint64(), false),
+        arrow::field("deep", arrow::uint64(), false),
+        arrow::field("diff", arrow::decimal128(38, 0), false),
+        arrow::field("hash", hash_type, false)});
+
+      m_schema = arrow::schema({
+        arrow::field("height", arrow::uint64(), false),
+        arrow::field("mrt", arrow::uint64(), false),
+        arrow::field("nrt", arrow::uint64()),
+        arrow::field("is_alt_block", arrow::boolean(), false),
+        arrow::field("major_version", arrow::uint8(), false),
+        arrow::field("minor_version", arrow::uint8(), false),
+        arrow::field("nonce", arrow::uint32(), false),
+        arrow::field("n_tx_hashes", arrow::uint32(), false),
+        arrow::field("nch", arrow::uint64(), false),
+        arrow::field("nth", arrow::uint64(), false),
+        arrow::field("n_alt_chains", arrow::uint64(), false),
+        arrow::field("alt_chains", arrow::list(arrow::field("item", alt_chain_type, false)), false),
+        arrow::field("prev_id", arrow::dictionary(arrow::int32(), hash_type), false),
+        arrow::field("hash", arrow::dictionary(arrow::int32(), hash_type)),
+        arrow::field("record_policy", arrow::uint8(), false)});
+
+      m_alt_chain_length.reset(new arrow::UInt64Builder(pool));
+      m_alt_chain_height.reset(new arrow::UInt64Builder(pool));
+      m_alt_chain_deep.reset(new arrow::UInt64Builder(pool));
+      m_alt_chain_diff.reset(new arrow::Decimal128Builder(arrow::decimal128(38, 0), pool));
+      m_alt_chain_hash.reset(new arrow::FixedSizeBinaryBuilder(hash_type, pool));
+      m_alt_chain.reset(new arrow::StructBuilder(alt_chain_type, pool,
+        { m_alt_chain_length, m_alt_chain_height, m_alt_chain_deep, m_alt_chain_diff, m_alt_chain_hash }));
+      m_alt_chains.reset(new arrow::ListBuilder(pool, m_alt_chain, m_schema->GetFieldByName("alt_chains")->type()));
+      m_prev_id.reset(new arrow::Dictionary32Builder<arrow::FixedSizeBinaryType>(hash_type, pool));
+      m_hash.reset(new arrow::Dictionary32Builder<arrow::FixedSizeBinaryType>(hash_type, pool));
+    }
+
+    arrow::Status open(const std::string &filename)
+    {
+      ARROW_ASSIGN_OR_RAISE(m_file, arrow::io::FileOutputStream::Open(filename));
+      arrow::ipc::IpcWriteOptions options = arrow::ipc::IpcWriteOptions::Defaults();
+      options.emit_dictionary_deltas = true;
+      ARROW_ASSIGN_OR_RAISE(m_writer, arrow::ipc::MakeStreamWriter(m_file, m_schema, options));
+      return arrow::Status::OK();
+    }
+
+    arrow::Status append(const arrow_row &row)
+    {
+      ARROW_RETURN_NOT_OK(m_height.Append(row.height));
+      ARROW_RETURN_NOT_OK(m_mrt.Append(row.mrt));
+      // NRT 0 is unknown (backfilled)
+      ARROW_RETURN_NOT_OK(row.nrt != 0 ? m_nrt.Append(row.nrt) : m_nrt.AppendNull());
+      ARROW_RETURN_NOT_OK(m_is_alt_block.Append(row.is_alt_block));
+      ARROW_RETURN_NOT_OK(m_major_version.Append(row.major_version));
+      ARROW_RETURN_NOT_OK(m_minor_version.Append(row.minor_version));
+      ARROW_RETURN_NOT_OK(m_nonce.Append(row.nonce));
+      ARROW_RETURN_NOT_OK(m_n_tx_hashes.Append(row.n_tx_hashes));
+      ARROW_RETURN_NOT_OK(m_nch.Append(row.nch));
+      ARROW_RETURN_NOT_OK(m_nth.Append(row.nth));
+      ARROW_RETURN_NOT_OK(m_n_alt_chains.Append(row.n_alt_chains));
+
+      ARROW_RETURN_NOT_OK(m_alt_chains->Append());
+      for (const arrow_row::alt_chain &chain: row.alt_chains)
+      {
+        ARROW_RETURN_NOT_OK(m_alt_chain->Append());
+        ARROW_RETURN_NOT_OK(m_alt_chain_length->Append(chain.length));
+        ARROW_RETURN_NOT_OK(m_alt_chain_height->Append(chain.height));
+        ARROW_RETURN_NOT_OK(m_alt_chain_deep->Append(chain.deep));
+        ARROW_RETURN_NOT_OK(m_alt_chain_diff->Append(chain.diff));
+        ARROW_RETURN_NOT_OK(m_alt_chain_hash->Append((const uint8_t*)chain.hash.data));
+      }
+
+      ARROW_RETURN_NOT_OK(m_prev_id->Append((const uint8_t*)row.prev_id.data));
+      ARROW_RETURN_NOT_OK(row.has_hash ? m_hash->Append((const uint8_t*)row.hash.data) : m_hash->AppendNull());
+      ARROW_RETURN_NOT_OK(m_record_policy.Append(row.record_policy));
+
+      ++n_rows;
+      if (++m_n_batch_rows >= m_batch_rows)
+        return write_batch();
+      return arrow::Status::OK();
+    }
+
+    arrow::Status close()
+    {
+      if (m_n_batch_rows > 0)
+        ARROW_RETURN_NOT_OK(write_batch());
+      ARROW_RETURN_NOT_OK(m_writer->Close());
+      return m_file->Close();
+    }
+
+    uint64_t n_rows;
+    uint64_t n_batches;
+
+  private:
+    arrow::Status write_batch()
+    {
+      std::vector<std::shared_ptr<arrow::Array>> columns(m_schema->num_fields());
+      ARROW_RETURN_NOT_OK(m_height.Finish(&columns[0]));
+      ARROW_RETURN_NOT_OK(m_mrt.Finish(&columns[1]));
+      ARROW_RETURN_NOT_OK(m_nrt.Finish(&columns[2]));
+      ARROW_RETURN_NOT_OK(m_is_alt_block.Finish(&columns[3]));
+      ARROW_RETURN_NOT_OK(m_major_version.Finish(&columns[4]));
+      ARROW_RETURN_NOT_OK(m_minor_version.Finish(&columns[5]));
+      ARROW_RETURN_NOT_OK(m_nonce.Finish(&columns[6]));
+      ARROW_RETURN_NOT_OK(m_n_tx_hashes.Finish(&columns[7]));
+      ARROW_RETURN_NOT_OK(m_nch.Finish(&columns[8]));
+      ARROW_RETURN_NOT_OK(m_nth.Finish(&columns[9]));
+      ARROW_RETURN_NOT_OK(m_n_alt_chains.Finish(&columns[10]));
+      ARROW_RETURN_NOT_OK(m_alt_chains->Finish(&columns[11]));
+      // the dictionary builders keep their values, so each batch's dictionary extends the previous one
+      ARROW_RETURN_NOT_OK(m_prev_id->Finish(&columns[12]));
+      ARROW_RETURN_NOT_OK(m_hash->Finish(&columns[13]));
+      ARROW_RETURN_NOT_OK(m_record_policy.Finish(&columns[14]));
+
+      const std::shared_ptr<arrow::RecordBatch> batch = arrow::RecordBatch::Make(m_schema, m_n_batch_rows, columns);
+      ARROW_RETURN_NOT_OK(m_writer->WriteRecordBatch(*batch));
+      m_n_batch_rows = 0;
+      ++n_batches;
+      return arrow::Status::OK();
+    }
+
+    const size_t m_batch_rows;
+    size_t m_n_batch_rows;
+    std::shared_ptr<arrow::Schema> m_schema;
+    std::shared_ptr<arrow::io::FileOutputStream> m_file;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> m_writer;
+
+    arrow::UInt64Builder m_height, m_mrt, m_nrt;
+    arrow::BooleanBuilder m_is_alt_block;
+    arrow::UInt8Builder m_major_version, m_minor_version, m_record_policy;
+    arrow::UInt32Builder m_nonce, m_n_tx_hashes;
+    arrow::UInt64Builder m_nch, m_nth, m_n_alt_chains;
+    std::shared_ptr<arrow::UInt64Builder> m_alt_chain_length, m_alt_chain_height, m_alt_chain_deep;
+    std::shared_ptr<arrow::Decimal128Builder> m_alt_chain_diff;
+    std::shared_ptr<arrow::FixedSizeBinaryBuilder> m_alt_chain_hash;
+    std::shared_ptr<arrow::StructBuilder> m_alt_chain;
+    std::shared_ptr<arrow::ListBuilder> m_alt_chains;
+    std::unique_ptr<arrow::Dictionary32Builder<arrow::FixedSizeBinaryType>> m_prev_id, m_hash;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief reads archive files and segments into an archive_arrow_writer
+   */
+  class archive_arrow_export
+  {
+  public:
+    archive_arrow_export(archive_arrow_writer &writer, archive_zstd_codec &codec):
+      n_bad_records(0), n_bytes(0),
+      m_writer(writer), m_codec(codec)
+    {
+    }
+
+    bool export_file(const std::string &filename, bool compressed)
+    {
+      if (compressed)
+      {
+        std::string contents, frame;
+        if (!epee::file_io_utils::load_file_to_string(filename, contents))
+        {
+          MERROR("Failed to open input file " << filename);
+          return false;
+        }
+        size_t pos = 0;
+        while (pos < contents.size())
+        {
+          const size_t frame_size = archive_zstd_codec::frame_size(contents.data() + pos, contents.size() - pos);
+          if (frame_size == 0 || !m_codec.decompress(contents.data() + pos, frame_size, frame))
+          {
+            MWARNING("Corrupt or truncated frame at offset " << pos << " in " << filename);
+            ++n_bad_records;
+            return true;
+          }
+          std::istringstream in(frame);
+          if (!export_stream(in, filename))
+            return false;
+          pos += frame_size;
+        }
+        n_bytes += contents.size();
+        return true;
+      }
+
+      std::ifstream in(filename, std::ios::in | std::ios::binary);
+      if (!in)
+      {
+        MERROR("Failed to open input file " << filename);
+        return false;
+      }
+      return export_stream(in, filename);
+    }
+
+    uint64_t n_bad_records;
+    uint64_t n_bytes;
+
+  private:
+    bool append(const arrow_row &row)
+    {
+      const arrow::Status status = m_writer.append(row);
+      if (!status.ok())
+        MERROR("Failed to write Arrow batch: " << status.ToString());
+      return status.ok();
+    }
+
+    bool export_stream(std::istream &in, const std::string &filename)
+    {
+      char magic[sizeof(binary_magic)] = {};
+      in.read(magic, sizeof(magic));
+      const size_t magic_size = in.gcount();
+      in.clear();
+      in.seekg(0);
+
+      if (is_binary(magic, magic_size))
+      {
+        archive_binary_reader reader(in);
+        while (reader.next(m_record))
+        {
+          row_from_record(m_record, m_row);
+          if (!append(m_row))
+            return false;
+        }
+        n_bytes += reader.offset();
+        if (reader.corrupt_records() > 0)
+          MWARNING("Skipped " << reader.corrupt_records() << " corrupt records (" << reader.skipped_bytes() << " bytes) in " << filename);
+        n_bad_records += reader.corrupt_records();
+        return true;
+      }
+
+      uint64_t offset = 0;
+      while (std::getline(in, m_line))
+      {
+        const uint64_t line_offset = offset;
+        offset += m_line.size() + 1;
+        if (m_line.empty())
+          continue;
+        archive_tsv_split(m_line.data(), m_line.data() + m_line.size(), m_fields);
+        const archive_parse_result r = row_from_tsv(m_fields, m_alt_chains, m_row);
+        if (r != archive_parse_result::ok)
+        {
+          if (n_bad_records++ < 5)
+          {
+            if (r == archive_parse_result::incomplete)
+              MWARNING("Skipped a line at byte " << line_offset << " of " << filename << ": its alt chains are a delta and no snapshot was read yet");
+            else
+              MWARNING("Skipped a malformed line at byte " << line_offset << " of " << filename);
+          }
+          continue;
+        }
+        if (!append(m_row))
+          return false;
+      }
+      n_bytes += offset;
+      return true;
+    }
+
+    archive_arrow_writer &m_writer;
+    archive_zstd_codec &m_codec;
+    archive_record m_record;
+    arrow_row m_row;
+    std::string m_line;
+    archive_tsv_fields m_fields;
+    archive_alt_chain_decoder m_alt_chains;  //!< across segments, which follow on from each other
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_input_file = {"input-file", "Archive file, or base filename of a segmented archive, to export", "/opt/monerodarchive/archive.log"};
+  const command_line::arg_descriptor<std::string> arg_output_file = {"output-file", "Arrow IPC stream file to write", "archive.arrows"};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<size_t> arg_batch_rows = {"batch-rows", "Rows per Arrow record batch", 65536};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary the archive was compressed with", ""};
+
+  command_line::add_arg(desc_cmd_sett, arg_input_file);
+  command_line::add_arg(desc_cmd_sett, arg_output_file);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_batch_rows);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Exports a TSV or binary archive to a columnar Arrow IPC stream file" << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-arrow.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const std::string input_file = command_line::get_arg(vm, arg_input_file);
+  const std::string output_file = command_line::get_arg(vm, arg_output_file);
+  const std::string dictionary_file = command_line::get_arg(vm, arg_dictionary);
+
+  archive_zstd_codec codec;
+  if (archive_zstd_codec::available())
+  {
+    std::string dictionary;
+    if (!dictionary_file.empty() && !epee::file_io_utils::load_file_to_string(dictionary_file, dictionary))
+    {
+      MERROR("Failed to read dictionary " << dictionary_file);
+      return 1;
+    }
+    if (!codec.init(3, dictionary))
+      return 1;
+  }
+
+  // segments in order, else the single archive file
+  std::vector<std::pair<std::string, bool>> inputs;
+  for (const archive_segment_info &segment: archive_list_segments(input_file))
+    inputs.push_back(std::make_pair(segment.data_filename, segment.compressed));
+  if (inputs.empty())
+    inputs.push_back(std::make_pair(input_file, false));
+
+  archive_arrow_writer writer(command_line::get_arg(vm, arg_batch_rows));
+  arrow::Status status = writer.open(output_file);
+  if (!status.ok())
+  {
+    MERROR("Failed to open output file " << output_file << ": " << status.ToString());
+    return 1;
+  }
+
+  const uint64_t started_us = now_us();
+  archive_arrow_export exporter(writer, codec);
+  for (const std::pair<std::string, bool> &input: inputs)
+  {
+    if (input.second && !archive_zstd_codec::available())
+    {
+      MERROR("Built without zstd, cannot read " << input.first);
+      return 1;
+    }
+    if (!exporter.export_file(input.first, input.second))
+      return 1;
+  }
+
+  status = writer.close();
+  if (!status.ok())
+  {
+    MERROR("Failed to finish output file " << output_file << ": " << status.ToString());
+    return 1;
+  }
+
+  const double seconds = std::max<uint64_t>(now_us() - started_us, 1) / 1e6;
+  MINFO("Exported " << writer.n_rows << " rows in " << writer.n_batches << " batches from " << inputs.size() << " files, "
+    << exporter.n_bytes << " bytes in, " << (uint64_t)(exporter.n_bytes / seconds / 1000000) << " MB/s");
+  if (exporter.n_bad_records > 0)
+  {
+    MWARNING("Skipped " << exporter.n_bad_records << " malformed lines or corrupt records");
+    return 2;
+  }
+  return 0;
+
+  CATCH_ENTRY("Export error", 1);
+}
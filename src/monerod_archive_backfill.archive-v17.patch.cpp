@@ -0,0 +1,468 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_backfill.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_segment.h"
+#include "blockchain_db/blockchain_db.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  uint64_t now_us()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief records of a contiguous height range, serialized by one worker
+   */
+  struct archive_chunk
+  {
+    std::vector<std::string> records;
+    std::vector<archive_index_entry> entries;
+  };
+
+  /**
+   * @brief exports blocks from a read-only database to an archive
+   *
+   * The height range is cut into chunks which worker threads take in
+   * order, each with its own read transaction, and serialize with the same
+   * archive_format_record() as the archive writer.  The calling thread
+   * writes finished chunks in height order; workers stay at most a window
+   * of chunks ahead of it, which bounds memory.
+   */
+  class archive_backfill
+  {
+  public:
+    archive_backfill(BlockchainDB &db, archive_output_format format, uint64_t min_height, uint64_t max_height, uint64_t chunk_blocks, size_t window):
+      n_main_blocks(0), n_alt_blocks(0), n_bytes(0),
+      m_db(db), m_format(format), m_min_height(min_height), m_max_height(max_height),
+      m_chunk_blocks(std::max<uint64_t>(chunk_blocks, 1)), m_window(std::max<size_t>(window, 1)),
+      m_n_chunks(0), m_next_chunk(0), m_next_write(0), m_failed(false)
+    {
+      m_chain_height = m_db.height();
+    }
+
+    /**
+     * @brief alt blocks kept in the database (monerod --keep-alt-blocks) within the height range
+     */
+    void load_alt_blocks()
+    {
+      m_db.for_all_alt_blocks([this](const crypto::hash &blkid, const alt_block_data_t &data, const cryptonote::blobdata *blob) {
+        if (blob && data.height >= m_min_height && data.height <= m_max_height)
+          m_alt_blocks.emplace(data.height, *blob);
+        return true;
+      }, true);
+      MINFO("Found " << m_alt_blocks.size() << " alt blocks in the height range");
+    }
+
+    bool run(size_t n_threads, archive_segment_writer &writer)
+    {
+      if (m_max_height < m_min_height)
+        return true;
+      m_n_chunks = (m_max_height - m_min_height) / m_chunk_blocks + 1;
+
+      boost::thread_group workers;
+      for (size_t i = 0; i < n_threads; ++i)
+        workers.create_thread([this]() { worker(); });
+
+      const uint64_t started_us = now_us();
+      uint64_t reported_us = started_us;
+      while (m_next_write < m_n_chunks)
+      {
+        std::unique_ptr<archive_chunk> chunk;
+        {
+          boost::unique_lock<boost::mutex> lock(m_mutex);
+          while (!m_failed && m_done.find(m_next_write) == m_done.end())
+            m_done_cond.wait(lock);
+          if (m_failed)
+            break;
+          chunk = std::move(m_done[m_next_write]);
+          m_done.erase(m_next_write);
+        }
+
+        if (!chunk->records.empty() && !writer.write(chunk->records.data(), chunk->entries.data(), chunk->records.size()))
+        {
+          MERROR("Failed to write the archive");
+          boost::lock_guard<boost::mutex> lock(m_mutex);
+          m_failed = true;
+          m_space_cond.notify_all();
+          break;
+        }
+        for (size_t i = 0; i < chunk->records.size(); ++i)
+        {
+          n_bytes += chunk->records[i].size();
+          ++(chunk->entries[i].is_alt_block ? n_alt_blocks : n_main_blocks);
+        }
+
+        {
+          boost::lock_guard<boost::mutex> lock(m_mutex);
+          ++m_next_write;
+          m_space_cond.notify_all();
+        }
+
+        const uint64_t t = now_us();
+        if (t - reported_us >= 10000000 || m_next_write == m_n_chunks)
+        {
+          const double seconds = std::max<uint64_t>(t - started_us, 1) / 1e6;
+          const uint64_t height = std::min(m_min_height + m_next_write * m_chunk_blocks, m_max_height + 1);
+          MINFO("Height " << height << " of " << (m_max_height + 1) << ": " << (uint64_t)((n_main_blocks + n_alt_blocks) / seconds)
+            << " records/s, " << (uint64_t)(n_bytes / seconds / 1000000) << " MB/s");
+          reported_us = t;
+        }
+      }
+      workers.join_all();
+      return !m_failed;
+    }
+
+    uint64_t n_main_blocks;
+    uint64_t n_alt_blocks;
+    uint64_t n_bytes;
+
+  private:
+    void worker()
+    {
+      while (true)
+      {
+        uint64_t index;
+        {
+          boost::unique_lock<boost::mutex> lock(m_mutex);
+          while (!m_failed && m_next_chunk < m_n_chunks && m_next_chunk >= m_next_write + m_window)
+            m_space_cond.wait(lock);
+          if (m_failed || m_next_chunk >= m_n_chunks)
+            return;
+          index = m_next_chunk++;
+        }
+
+        std::unique_ptr<archive_chunk> chunk(new archive_chunk());
+        const bool r = build_chunk(index, *chunk);
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if (!r)
+          m_failed = true;
+        else
+          m_done[index] = std::move(chunk);
+        m_done_cond.notify_all();
+        if (!r)
+          m_space_cond.notify_all();
+      }
+    }
+
+    bool build_chunk(uint64_t index, archive_chunk &chunk)
+    {
+      const uint64_t from = m_min_height + index * m_chunk_blocks;
+      const uint64_t to = std::min(from + m_chunk_blocks - 1, m_max_height);
+      archive_record record;
+      try
+      {
+        db_rtxn_guard rtxn_guard(&m_db);
+        for (uint64_t height = from; height <= to; ++height)
+        {
+          if (height < m_chain_height)
+          {
+            if (!add_record(m_db.get_block_blob_from_height(height), false, record, chunk))
+              return false;
+          }
+          // alt blocks follow the mainchain block at their height
+          const auto range = m_alt_blocks.equal_range(height);
+          for (auto it = range.first; it != range.second; ++it)
+          {
+            if (!add_record(it->second, true, record, chunk))
+              return false;
+          }
+        }
+      }
+      catch (const std::exception &e)
+      {
+        MERROR("Failed to read blocks " << from << " to " << to << ": " << e.what());
+        return false;
+      }
+      return true;
+    }
+
+    bool add_record(const cryptonote::blobdata &blob, bool is_alt_block, archive_record &record, archive_chunk &chunk)
+    {
+      record.b = block();
+      if (!parse_and_validate_block_from_blob(blob, record.b, record.block_hash))
+      {
+        MERROR("Failed to parse " << (is_alt_block ? "alt " : "") << "block from the database");
+        return false;
+      }
+      if (record.b.miner_tx.vin.size() != 1 || record.b.miner_tx.vin[0].type() != typeid(txin_gen))
+      {
+        MERROR("Block " << record.block_hash << " has no miner tx input");
+        return false;
+      }
+
+      // NRT unknown: the block was not received by this tool
+      record.node_timestamp = 0;
+      record.node_timestamp_steady = 0;
+      record.receive_delay = 0;
+      record.is_alt_block = is_alt_block;
+      record.block_height = boost::get<txin_gen>(record.b.miner_tx.vin[0]).height;
+      record.n_tx_hashes = record.b.tx_hashes.size();
+      record.policy = archive_record_policy::full;
+
+      // as if archived by a synced node right after the block was added
+      record.chain_height = record.block_height + 1;
+      record.alt_chains.clear();
+      record.current_height = record.block_height + 1;
+      record.target_height = record.block_height + 1;
+
+      chunk.records.emplace_back();
+      if (!archive_format_record(record, m_format, chunk.records.back()))
+      {
+        MERROR("Failed to encode archive record for block " << record.block_hash);
+        return false;
+      }
+      chunk.entries.push_back(archive_make_index_entry(record));
+      return true;
+    }
+
+    BlockchainDB &m_db;
+    const archive_output_format m_format;
+    const uint64_t m_min_height;
+    const uint64_t m_max_height;
+    const uint64_t m_chunk_blocks;
+    const size_t m_window;
+    uint64_t m_chain_height;
+    std::multimap<uint64_t, cryptonote::blobdata> m_alt_blocks;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_done_cond;
+    boost::condition_variable m_space_cond;
+    uint64_t m_n_chunks;
+    uint64_t m_next_chunk;
+    uint64_t m_next_write;
+    bool m_failed;
+    std::map<uint64_t, std::unique_ptr<archive_chunk>> m_done;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_output_file = {"output-file", "Base filename of the archive to write; must not exist yet", "/opt/monerodarchive/archive.log"};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<uint64_t> arg_min_height = {"min-height", "Lowest block height to export", 0};
+  const command_line::arg_descriptor<uint64_t> arg_max_height = {"max-height", "Highest block height to export, the top of the database if 0", 0};
+  const command_line::arg_descriptor<size_t> arg_threads = {"threads", "Worker threads serializing blocks, all cores if 0", 0};
+  const command_line::arg_descriptor<uint64_t> arg_chunk_blocks = {"chunk-blocks", "Blocks a worker serializes at a time", 1000};
+  const command_line::arg_descriptor<bool> arg_no_alt_blocks = {"no-alt-blocks", "Leave out alt blocks kept in the database", false};
+  const command_line::arg_descriptor<bool> arg_binary = {"binary", "Write the binary archive format instead of TSV", false};
+  const command_line::arg_descriptor<uint64_t> arg_segment_bytes = {"segment-bytes", "Start a new segment once it is this large; 0 writes a single archive file with no index", 1024 * 1024 * 1024};
+  const command_line::arg_descriptor<bool> arg_compress = {"compress", "Compress segments with zstd", false};
+  const command_line::arg_descriptor<int> arg_compression_level = {"compression-level", "zstd compression level", 3};
+  const command_line::arg_descriptor<size_t> arg_frame_records = {"frame-records", "Most records in one compressed frame", 64};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary to compress with", ""};
+
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_data_dir);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_testnet_on);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_stagenet_on);
+  command_line::add_arg(desc_cmd_sett, arg_output_file);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_min_height);
+  command_line::add_arg(desc_cmd_sett, arg_max_height);
+  command_line::add_arg(desc_cmd_sett, arg_threads);
+  command_line::add_arg(desc_cmd_sett, arg_chunk_blocks);
+  command_line::add_arg(desc_cmd_sett, arg_no_alt_blocks);
+  command_line::add_arg(desc_cmd_sett, arg_binary);
+  command_line::add_arg(desc_cmd_sett, arg_segment_bytes);
+  command_line::add_arg(desc_cmd_sett, arg_compress);
+  command_line::add_arg(desc_cmd_sett, arg_compression_level);
+  command_line::add_arg(desc_cmd_sett, arg_frame_records);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Exports the blocks of a stopped node's database to a new archive, with NRT unknown." << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-backfill.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const bool opt_testnet = command_line::get_arg(vm, cryptonote::arg_testnet_on);
+  const bool opt_stagenet = command_line::get_arg(vm, cryptonote::arg_stagenet_on);
+  if (opt_testnet && opt_stagenet)
+  {
+    MERROR("Can't specify more than one of --testnet and --stagenet");
+    return 1;
+  }
+
+  archive_file_config file;
+  file.filename = command_line::get_arg(vm, arg_output_file);
+  file.fsync_policy = archive_fsync_policy::none;
+  archive_segment_config segments;
+  segments.max_bytes = command_line::get_arg(vm, arg_segment_bytes);
+  const archive_output_format format = command_line::get_arg(vm, arg_binary) ? archive_output_format::binary : archive_output_format::tsv;
+  archive_compression_config compression;
+  compression.enabled = command_line::get_arg(vm, arg_compress);
+  compression.level = command_line::get_arg(vm, arg_compression_level);
+  compression.frame_records = command_line::get_arg(vm, arg_frame_records);
+  compression.dictionary_filename = command_line::get_arg(vm, arg_dictionary);
+  if (compression.enabled && !segments.enabled())
+  {
+    MERROR("--compress needs --segment-bytes");
+    return 1;
+  }
+
+  // appending to an archive would put history after newer records
+  boost::system::error_code ec;
+  if (boost::filesystem::exists(file.filename, ec) || !archive_list_segments(file.filename).empty())
+  {
+    MERROR("Archive " << file.filename << " already exists; backfill writes a new archive");
+    return 1;
+  }
+
+  const std::string config_folder = command_line::get_arg(vm, cryptonote::arg_data_dir);
+  BlockchainDB *db = new_db();
+  if (db == NULL)
+  {
+    MERROR("Failed to initialize a database");
+    return 1;
+  }
+  const std::string filename = (boost::filesystem::path(config_folder) / db->get_db_name()).string();
+  MINFO("Loading blockchain from folder " << filename << " ...");
+  try
+  {
+    db->open(filename, DBF_RDONLY);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Error opening database: " << e.what());
+    delete db;
+    return 1;
+  }
+
+  const uint64_t db_height = db->height();
+  if (db_height == 0)
+  {
+    MERROR("The database has no blocks");
+    db->close();
+    delete db;
+    return 1;
+  }
+  const uint64_t min_height = command_line::get_arg(vm, arg_min_height);
+  uint64_t max_height = command_line::get_arg(vm, arg_max_height);
+  if (max_height == 0)
+  {
+    // alt chains may reach past the mainchain top
+    max_height = db_height - 1;
+    if (!command_line::get_arg(vm, arg_no_alt_blocks))
+    {
+      db->for_all_alt_blocks([&max_height](const crypto::hash &blkid, const alt_block_data_t &data, const cryptonote::blobdata *blob) {
+        max_height = std::max(max_height, data.height);
+        return true;
+      });
+    }
+  }
+
+  size_t n_threads = command_line::get_arg(vm, arg_threads);
+  if (n_threads == 0)
+    n_threads = std::max<unsigned>(tools::get_max_concurrency(), 1);
+
+  archive_segment_writer writer;
+  if (!writer.open(file, segments, format, compression))
+  {
+    MERROR("Failed to open archive " << file.filename);
+    db->close();
+    delete db;
+    return 1;
+  }
+
+  archive_backfill backfill(*db, format, min_height, max_height, command_line::get_arg(vm, arg_chunk_blocks), 4 * n_threads);
+  if (!command_line::get_arg(vm, arg_no_alt_blocks))
+    backfill.load_alt_blocks();
+
+  MINFO("Exporting heights " << min_height << " to " << max_height << " with " << n_threads << " threads");
+  const uint64_t started_us = now_us();
+  r = backfill.run(n_threads, writer);
+  writer.close();
+  db->close();
+  delete db;
+
+  const double seconds = std::max<uint64_t>(now_us() - started_us, 1) / 1e6;
+  MINFO("Exported " << backfill.n_main_blocks << " blocks and " << backfill.n_alt_blocks << " alt blocks, "
+    << backfill.n_bytes << " bytes in " << (uint64_t)seconds << " s");
+  return r ? 0 : 1;
+
+  CATCH_ENTRY("Backfill error", 1);
+}
@@ -0,0 +1,532 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_bench.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "crypto/crypto.h"
+#include "cryptonote_basic/account.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/blockchain.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/archive_format.h"
+#include "blockchain_db/blockchain_db.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  uint64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  std::vector<size_t> parse_list(const std::string &s)
+  {
+    std::vector<size_t> values;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+      if (!item.empty())
+        values.push_back(std::stoull(item));
+    }
+    return values;
+  }
+
+  // nearest rank
+  uint64_t percentile(const std::vector<uint64_t> &sorted, double q)
+  {
+    if (sorted.empty())
+      return 0;
+    const size_t rank = (size_t)std::ceil(q * sorted.size());
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+  }
+
+  /**
+   * @brief prints one result line per benchmark case, TSV or JSON lines
+   *
+   * Every line carries the Monero and archive format versions so results
+   * from different rebases can be compared by machine.
+   */
+  class reporter
+  {
+  public:
+    explicit reporter(bool json): m_json(json) {}
+
+    void header()
+    {
+      if (m_json)
+        return;
+      std::cout << "# monero " << MONERO_VERSION_FULL << ", archive version " << ARCHIVE_VERSION << ENDL;
+      std::cout << "benchmark\tcase\tsamples\tp50_ns\tp99_ns\tp999_ns\tmax_ns\trecords_per_sec" << ENDL;
+    }
+
+    void report(const std::string &benchmark, const std::string &name, std::vector<uint64_t> &samples)
+    {
+      std::sort(samples.begin(), samples.end());
+      uint64_t total_ns = 0;
+      for (uint64_t ns: samples)
+        total_ns += ns;
+      const double records_per_sec = total_ns > 0 ? samples.size() * 1e9 / total_ns : 0.0;
+
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"" << benchmark << "\",\"case\":\"" << name << "\""
+          << ",\"samples\":" << samples.size()
+          << ",\"p50_ns\":" << percentile(samples, 0.50)
+          << ",\"p99_ns\":" << percentile(samples, 0.99)
+          << ",\"p999_ns\":" << percentile(samples, 0.999)
+          << ",\"max_ns\":" << (samples.empty() ? 0 : samples.back())
+          << ",\"records_per_sec\":" << (uint64_t)records_per_sec
+          << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\""
+          << ",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << benchmark << "\t" << name << "\t" << samples.size()
+          << "\t" << percentile(samples, 0.50)
+          << "\t" << percentile(samples, 0.99)
+          << "\t" << percentile(samples, 0.999)
+          << "\t" << (samples.empty() ? 0 : samples.back())
+          << "\t" << (uint64_t)records_per_sec << ENDL;
+      }
+    }
+
+    /**
+     * @brief what the writer did with the records of one case, from the stats before and after it
+     */
+    void writer_stats(const std::string &benchmark, const std::string &name, const archive_writer::stats &before, const archive_writer::stats &after)
+    {
+      const uint64_t pushed = after.pushed - before.pushed;
+      const uint64_t written = after.written - before.written;
+      const uint64_t dropped = after.dropped - before.dropped;
+      const uint64_t write_failures = after.write_failures - before.write_failures;
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"archive_writer\",\"of\":\"" << benchmark << "\",\"case\":\"" << name << "\""
+          << ",\"pushed\":" << pushed << ",\"written\":" << written << ",\"dropped\":" << dropped << ",\"write_failures\":" << write_failures
+          << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << "# archive writer, " << benchmark << " " << name << ": pushed " << pushed << ", written " << written << ", dropped " << dropped
+          << ", write failures " << write_failures << ENDL;
+      }
+    }
+
+    void writer_stats(const archive_writer::stats &s)
+    {
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"archive_writer\",\"pushed\":" << s.pushed << ",\"written\":" << s.written
+          << ",\"dropped\":" << s.dropped << ",\"write_failures\":" << s.write_failures << ",\"high_water\":" << s.high_water
+          << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << "# archive writer: pushed " << s.pushed << ", written " << s.written << ", dropped " << s.dropped
+          << ", write failures " << s.write_failures << ", queue high water " << s.high_water << ENDL;
+      }
+    }
+
+  private:
+    bool m_json;
+  };
+
+  /**
+   * @brief synthetic block with a v1 miner tx, like the blocks the daemon archives
+   *
+   * Never validated, only hashed and archived, so keys and hashes are random.
+   */
+  block make_block(uint64_t height, const crypto::hash &prev_id, size_t n_tx_hashes, size_t n_outputs)
+  {
+    block b;
+    b.major_version = 1;
+    b.minor_version = 0;
+    b.timestamp = time(NULL);
+    b.prev_id = prev_id;
+    b.nonce = crypto::rand<uint32_t>();
+
+    b.miner_tx.version = 1;
+    b.miner_tx.unlock_time = height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+    txin_gen in;
+    in.height = height;
+    b.miner_tx.vin.push_back(in);
+    for (size_t i = 0; i < n_outputs; ++i)
+    {
+      tx_out out;
+      out.amount = 1000000000;
+      txout_to_key target;
+      target.key = crypto::rand<crypto::public_key>();
+      out.target = target;
+      b.miner_tx.vout.push_back(out);
+    }
+    add_tx_pub_key_to_extra(b.miner_tx, crypto::rand<crypto::public_key>());
+
+    b.tx_hashes.reserve(n_tx_hashes);
+    for (size_t i = 0; i < n_tx_hashes; ++i)
+      b.tx_hashes.push_back(crypto::rand<crypto::hash>());
+    return b;
+  }
+
+  /**
+   * @brief adds alt chains of the given length until the database holds n_chains
+   */
+  void add_alt_chains(BlockchainDB &db, size_t &n_chains, size_t target, size_t length, uint64_t chain_height)
+  {
+    db_wtxn_guard wtxn_guard(&db);
+    for (; n_chains < target; ++n_chains)
+    {
+      crypto::hash prev_id = crypto::rand<crypto::hash>();
+      const uint64_t base_height = chain_height > length ? chain_height - length : 1;
+      for (size_t i = 0; i < length; ++i)
+      {
+        const block b = make_block(base_height + i, prev_id, 0, 1);
+        const crypto::hash id = get_block_hash(b);
+        alt_block_data_t data;
+        data.height = base_height + i;
+        data.cumulative_weight = 0;
+        data.cumulative_difficulty_low = base_height + i + 1;
+        data.cumulative_difficulty_high = 0;
+        data.already_generated_coins = 0;
+        db.add_alt_block(id, data, block_to_blob(b));
+        prev_id = id;
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_data_dir = {"data-dir", "Scratch directory for the FAKECHAIN database and the archive, a new temporary directory if empty", ""};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<bool> arg_json = {"json", "Print results as JSON lines instead of TSV", false};
+  const command_line::arg_descriptor<bool> arg_binary = {"binary", "Archive in the binary format instead of TSV", false};
+  const command_line::arg_descriptor<size_t> arg_iterations = {"iterations", "Samples per archive_block and archive_alt_chain_info case", 10000};
+  const command_line::arg_descriptor<size_t> arg_blocks = {"blocks", "Blocks added through add_new_block with archiving on, and again with it off", 1000};
+  const command_line::arg_descriptor<size_t> arg_round_blocks = {"round-blocks", "add_new_block alternates between archiving on and off every this many blocks", 50};
+  const command_line::arg_descriptor<std::string> arg_tx_hashes = {"tx-hashes", "Comma separated tx_hashes counts of the synthetic blocks", "0,10,100,1000"};
+  const command_line::arg_descriptor<std::string> arg_outputs = {"outputs", "Comma separated miner tx output counts of the synthetic blocks", "1,10,100"};
+  const command_line::arg_descriptor<std::string> arg_alt_chains = {"alt-chains", "Comma separated alt chain counts, ascending", "0,10,100,500"};
+  const command_line::arg_descriptor<size_t> arg_alt_chain_length = {"alt-chain-length", "Blocks in each alt chain", 3};
+
+  command_line::add_arg(desc_cmd_sett, arg_data_dir);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_json);
+  command_line::add_arg(desc_cmd_sett, arg_binary);
+  command_line::add_arg(desc_cmd_sett, arg_iterations);
+  command_line::add_arg(desc_cmd_sett, arg_blocks);
+  command_line::add_arg(desc_cmd_sett, arg_round_blocks);
+  command_line::add_arg(desc_cmd_sett, arg_tx_hashes);
+  command_line::add_arg(desc_cmd_sett, arg_outputs);
+  command_line::add_arg(desc_cmd_sett, arg_alt_chains);
+  command_line::add_arg(desc_cmd_sett, arg_alt_chain_length);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Measures what the Archive Producer costs the daemon: archive_block(), archive_alt_chain_info()" << ENDL;
+    std::cout << "and Blockchain::add_new_block with archiving on and off, on a FAKECHAIN database." << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-bench.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:WARNING").c_str());
+
+  const size_t iterations = std::max<size_t>(command_line::get_arg(vm, arg_iterations), 1);
+  const size_t n_blocks = command_line::get_arg(vm, arg_blocks);
+  const size_t round_blocks = std::max<size_t>(command_line::get_arg(vm, arg_round_blocks), 1);
+  const size_t alt_chain_length = std::max<size_t>(command_line::get_arg(vm, arg_alt_chain_length), 1);
+  std::vector<size_t> tx_hashes_counts, outputs_counts, alt_chains_counts;
+  try
+  {
+    tx_hashes_counts = parse_list(command_line::get_arg(vm, arg_tx_hashes));
+    outputs_counts = parse_list(command_line::get_arg(vm, arg_outputs));
+    alt_chains_counts = parse_list(command_line::get_arg(vm, arg_alt_chains));
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Invalid count list: " << e.what());
+    return 1;
+  }
+  std::sort(alt_chains_counts.begin(), alt_chains_counts.end());
+
+  // ## scratch directory: FAKECHAIN database and archive output
+  boost::filesystem::path data_dir = command_line::get_arg(vm, arg_data_dir);
+  const bool remove_data_dir = data_dir.empty();
+  if (remove_data_dir)
+    data_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("monerod-archive-bench-%%%%-%%%%");
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(data_dir / "lmdb", ec);
+  if (ec)
+  {
+    MERROR("Failed to create " << data_dir.string() << ": " << ec.message());
+    return 1;
+  }
+
+  std::unique_ptr<Blockchain> core_storage;
+  tx_memory_pool m_mempool(*core_storage);
+  core_storage.reset(new Blockchain(m_mempool));
+
+  // the daemon's archive settings, recorded into the scratch directory
+  archive_writer_config archive_config = core_storage->archive_output_config();
+  archive_config.format = command_line::get_arg(vm, arg_binary) ? archive_output_format::binary : archive_output_format::tsv;
+  archive_config.file.filename = (data_dir / (archive_config.format == archive_output_format::binary ? "archive.bin" : "archive.log")).string();
+  archive_config.sinks.clear();
+  // before init(), so the genesis block is not recorded to the daemon's archive
+  core_storage->archive_configure(true, archive_config);
+
+  BlockchainDB *db = new_db();
+  if (db == NULL)
+  {
+    MERROR("Failed to initialize a database");
+    return 1;
+  }
+  try
+  {
+    db->open((data_dir / "lmdb").string(), DBF_FAST);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Error opening database: " << e.what());
+    delete db;
+    return 1;
+  }
+
+  static const std::pair<uint8_t, uint64_t> hard_forks[] = { std::make_pair(1, 0), std::make_pair(0, 0) };
+  const test_options options = { hard_forks, 0 };
+  // fixed difficulty 1: every nonce is a valid proof of work
+  if (!core_storage->init(db, FAKECHAIN, true, &options, 1))
+  {
+    MERROR("Failed to initialize the FAKECHAIN blockchain");
+    return 1;
+  }
+
+  reporter report(command_line::get_arg(vm, arg_json));
+  report.header();
+
+  // reconfiguring drains the writer, and its stats carry over, so each case
+  // is reported once every record it pushed was written or dropped
+  archive_writer::stats writer_before = core_storage->archive_writer_stats();
+  const auto end_case = [&](const std::string &benchmark, const std::string &name, const archive_writer_config &next_config) {
+    core_storage->archive_configure(true, next_config);
+    const archive_writer::stats writer_after = core_storage->archive_writer_stats();
+    report.writer_stats(benchmark, name, writer_before, writer_after);
+    writer_before = writer_after;
+  };
+
+  // ## Blockchain::add_new_block, archiving on versus off
+  // alternating in rounds so database growth and cache warmup hit both equally
+  {
+    account_base miner;
+    miner.generate();
+    std::vector<uint64_t> on_ns, off_ns;
+    on_ns.reserve(n_blocks);
+    off_ns.reserve(n_blocks);
+    for (size_t round = 0; on_ns.size() < n_blocks || off_ns.size() < n_blocks; ++round)
+    {
+      const bool archiving = round % 2 == 0;
+      std::vector<uint64_t> &samples = archiving ? on_ns : off_ns;
+      core_storage->archive_configure(archiving, archive_config);
+      for (size_t i = 0; i < round_blocks && samples.size() < n_blocks; ++i)
+      {
+        block b;
+        difficulty_type difficulty;
+        uint64_t height, expected_reward, seed_height;
+        crypto::hash seed_hash;
+        if (!core_storage->create_block_template(b, miner.get_keys().m_account_address, difficulty, height, expected_reward, blobdata(), seed_height, seed_hash))
+        {
+          MERROR("Failed to create a block template at height " << core_storage->get_current_blockchain_height());
+          return 1;
+        }
+
+        block_verification_context bvc = {};
+        const uint64_t start = now_ns();
+        core_storage->add_new_block(b, bvc, std::make_pair(height, height), archive_receive_time::now());
+        samples.push_back(now_ns() - start);
+        if (!bvc.m_added_to_main_chain)
+        {
+          MERROR("Block at height " << height << " was not added to the main chain");
+          return 1;
+        }
+      }
+    }
+    report.report("add_new_block", "archive=on", on_ns);
+    report.report("add_new_block", "archive=off", off_ns);
+  }
+  end_case("add_new_block", "archive=on", archive_config);
+  const uint64_t chain_height = core_storage->get_current_blockchain_height();
+
+  // ## archive_block, by block shape
+  {
+    const crypto::hash prev_id = core_storage->get_tail_id();
+    std::vector<uint64_t> samples;
+    samples.reserve(iterations);
+    for (size_t tx_hashes: tx_hashes_counts)
+    {
+      for (size_t outputs: outputs_counts)
+      {
+        // distinct blocks, built up front: the hash is cached per block, as in add_new_block
+        const size_t n_distinct = std::min<size_t>(iterations, 256);
+        std::vector<block> blocks;
+        blocks.reserve(n_distinct);
+        for (size_t i = 0; i < n_distinct; ++i)
+          blocks.push_back(make_block(chain_height, prev_id, tx_hashes, outputs));
+        for (block &b: blocks)
+          get_block_hash(b);
+
+        samples.clear();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+          const block &b = blocks[i % blocks.size()];
+          const uint64_t start = now_ns();
+          core_storage->archive_block(b, false, std::make_pair(chain_height, chain_height), archive_receive_time());
+          samples.push_back(now_ns() - start);
+        }
+        const std::string name = "tx_hashes=" + std::to_string(tx_hashes) + ",outputs=" + std::to_string(outputs);
+        report.report("archive_block", name, samples);
+        end_case("archive_block", name, archive_config);
+      }
+    }
+  }
+
+  // ## archive_alt_chain_info and archive_block, by number of alt chains
+  {
+    BlockchainDB &chain_db = core_storage->get_db();
+    const block b = make_block(chain_height, core_storage->get_tail_id(), 10, 1);
+    get_block_hash(b);
+    size_t n_chains = 0;
+    std::vector<uint64_t> samples;
+    samples.reserve(iterations);
+    for (size_t target: alt_chains_counts)
+    {
+      add_alt_chains(chain_db, n_chains, target, alt_chain_length, chain_height);
+      const std::string name = "alt_chains=" + std::to_string(n_chains);
+
+      // first read after a change outside the Block Handler rebuilds the summary from the database
+      std::vector<uint64_t> rebuild(1);
+      core_storage->archive_alt_chain_cache_invalidate();
+      {
+        archive_record record;
+        const uint64_t start = now_ns();
+        core_storage->archive_alt_chain_info(record);
+        rebuild[0] = now_ns() - start;
+        if (record.alt_chains.size() != n_chains)
+          MWARNING("Expected " << n_chains << " alt chains, archive_alt_chain_info() returned " << record.alt_chains.size());
+      }
+      report.report("archive_alt_chain_cache_rebuild", name, rebuild);
+
+      samples.clear();
+      archive_record record;
+      for (size_t i = 0; i < iterations; ++i)
+      {
+        const uint64_t start = now_ns();
+        core_storage->archive_alt_chain_info(record);
+        samples.push_back(now_ns() - start);
+      }
+      report.report("archive_alt_chain_info", name, samples);
+
+      samples.clear();
+      for (size_t i = 0; i < iterations; ++i)
+      {
+        const uint64_t start = now_ns();
+        core_storage->archive_block(b, true, std::make_pair(chain_height, chain_height), archive_receive_time());
+        samples.push_back(now_ns() - start);
+      }
+      report.report("archive_block", name, samples);
+
+      // same block while syncing, header-only records: no alt chains are read
+      archive_writer_config header_config = archive_config;
+      header_config.policy.syncing = archive_sync_policy::header;
+      end_case("archive_block", name, header_config);
+      samples.clear();
+      for (size_t i = 0; i < iterations; ++i)
+      {
+        const uint64_t start = now_ns();
+        core_storage->archive_block(b, true, std::make_pair(chain_height, chain_height + 1), archive_receive_time());
+        samples.push_back(now_ns() - start);
+      }
+      report.report("archive_block", name + ",policy=header", samples);
+      end_case("archive_block", name + ",policy=header", archive_config);
+    }
+  }
+
+  report.writer_stats(core_storage->archive_writer_stats());
+
+  core_storage->deinit();
+  if (remove_data_dir)
+    boost::filesystem::remove_all(data_dir, ec);
+  return 0;
+
+  CATCH_ENTRY("Benchmark error", 1);
+}
@@ -0,0 +1,654 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_dump.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "file_io_utils.h"
+#include "cryptonote_core/archive_compress.h"
+#include "cryptonote_core/archive_feed.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_json.h"
+#include "cryptonote_core/archive_segment.h"
+#include "cryptonote_core/archive_tx_store.h"
+#include "string_tools.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  const char binary_magic[4] = { 'M', 'D', 'A', 'R' };
+
+  bool is_binary(const char *data, size_t size)
+  {
+    return size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+  }
+
+  uint64_t now_us()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  class archive_dump
+  {
+  public:
+    archive_dump(std::ostream &out, archive_zstd_codec &codec):
+      m_out(out), m_codec(codec),
+      min_height(0), max_height(std::numeric_limits<uint64_t>::max()),
+      min_nrt(0), max_nrt(std::numeric_limits<uint64_t>::max()),
+      verify_json(false),
+      n_records(0), n_fallback(0), n_mismatch(0), n_verified(0), n_corrupt(0), n_bytes(0),
+      m_frame_offset(std::numeric_limits<uint64_t>::max())
+    {
+    }
+
+    bool in_range(uint64_t height, uint64_t nrt) const
+    {
+      return height >= min_height && height <= max_height && nrt >= min_nrt && nrt <= max_nrt;
+    }
+
+    //---------------------------------------------------------------------------------------------
+    void output_record(const archive_record &record)
+    {
+      if (!in_range(record.block_height, record.node_timestamp))
+        return;
+
+      m_line.clear();
+      m_out << archive_line(record, m_line);
+      ++n_records;
+
+      // header-only records have no miner tx to compare
+      if (verify_json && record.policy != archive_record_policy::header)
+      {
+        ++n_verified;
+        m_fast_json.clear();
+        m_reference_json.clear();
+        if (!archive_block_json(record.b, m_fast_json))
+          ++n_fallback;
+        else if (!archive_block_json_reference(record.b, m_reference_json) || m_fast_json != m_reference_json)
+        {
+          MERROR("Block JSON mismatch at height " << record.block_height << "\n  fast:      " << m_fast_json << "\n  reference: " << m_reference_json);
+          ++n_mismatch;
+        }
+      }
+    }
+    //---------------------------------------------------------------------------------------------
+    // records stored back to back: binary records are converted, TSV lines copied
+    void output_stored(const char *data, size_t size)
+    {
+      if (!is_binary(data, size))
+      {
+        m_out.write(data, size);
+        n_records += std::count(data, data + size, '\n');
+        return;
+      }
+      while (size > 0)
+      {
+        size_t consumed = 0;
+        if (archive_parse_binary_record(data, size, m_record, consumed) != archive_parse_result::ok)
+        {
+          ++n_corrupt;
+          return;
+        }
+        output_record(m_record);
+        data += consumed;
+        size -= consumed;
+      }
+    }
+    //---------------------------------------------------------------------------------------------
+    bool scan_file(const std::string &filename)
+    {
+      std::ifstream in(filename, std::ios::in | std::ios::binary);
+      if (!in)
+      {
+        MERROR("Failed to open input file " << filename);
+        return false;
+      }
+      char magic[sizeof(binary_magic)] = {};
+      in.read(magic, sizeof(magic));
+      const size_t magic_size = in.gcount();
+      in.clear();
+      in.seekg(0);
+      if (!is_binary(magic, magic_size))
+      {
+        // TSV: nothing to convert
+        m_out << in.rdbuf();
+        return true;
+      }
+
+      archive_binary_reader reader(in);
+      while (reader.next(m_record))
+        output_record(m_record);
+      n_bytes += reader.offset();
+      if (reader.corrupt_records() > 0)
+        MWARNING("Skipped " << reader.corrupt_records() << " corrupt records (" << reader.skipped_bytes() << " bytes) in " << filename);
+      n_corrupt += reader.corrupt_records();
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------
+    bool scan_compressed_file(const std::string &filename, uint64_t *decode_us = nullptr, uint64_t *decoded_bytes = nullptr)
+    {
+      std::string contents;
+      if (!epee::file_io_utils::load_file_to_string(filename, contents))
+      {
+        MERROR("Failed to open input file " << filename);
+        return false;
+      }
+      size_t pos = 0;
+      while (pos < contents.size())
+      {
+        const size_t frame_size = archive_zstd_codec::frame_size(contents.data() + pos, contents.size() - pos);
+        const uint64_t start = now_us();
+        if (frame_size == 0 || !m_codec.decompress(contents.data() + pos, frame_size, m_frame))
+        {
+          MWARNING("Corrupt or truncated frame at offset " << pos << " in " << filename);
+          ++n_corrupt;
+          return true;
+        }
+        n_bytes += frame_size;
+        if (decode_us)
+          *decode_us += now_us() - start;
+        if (decoded_bytes)
+          *decoded_bytes += m_frame.size();
+        else
+          output_stored(m_frame.data(), m_frame.size());
+        pos += frame_size;
+      }
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------
+    // the stored bytes of one record, read through its index entry
+    bool fetch(const archive_segment_info &segment, const archive_index_reader &index, const archive_index_entry &entry, std::string &record)
+    {
+      if (m_in_filename != segment.data_filename)
+      {
+        m_in.close();
+        m_in.clear();
+        m_in.open(segment.data_filename, std::ios::in | std::ios::binary);
+        m_in_filename = segment.data_filename;
+        m_frame_offset = std::numeric_limits<uint64_t>::max();
+      }
+
+      const bool compressed = index.compressed();
+      const uint64_t size = compressed ? entry.frame_size : entry.size;
+      if (!compressed || entry.offset != m_frame_offset)
+      {
+        m_buffer.resize(size);
+        m_in.clear();
+        m_in.seekg(entry.offset);
+        if (!m_in.read(&m_buffer[0], m_buffer.size()))
+          return false;
+        n_bytes += size;
+        if (!compressed)
+        {
+          record.swap(m_buffer);
+          return true;
+        }
+        m_frame_offset = std::numeric_limits<uint64_t>::max();
+        if (!m_codec.decompress(m_buffer.data(), m_buffer.size(), m_frame))
+          return false;
+        m_frame_offset = entry.offset;
+      }
+      if ((uint64_t)entry.frame_offset + entry.size > m_frame.size())
+        return false;
+      record.assign(m_frame, entry.frame_offset, entry.size);
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------
+    void dump_segment(const archive_segment_info &segment, bool by_height, bool by_nrt)
+    {
+      if (segment.compressed && !archive_zstd_codec::available())
+      {
+        MERROR("Built without zstd, cannot read " << segment.data_filename);
+        ++n_corrupt;
+        return;
+      }
+
+      archive_index_reader index;
+      const bool have_index = index.open(segment.index_filename);
+      if (!have_index || (!by_height && !by_nrt))
+      {
+        if (!have_index)
+          MWARNING("No usable index " << segment.index_filename << ", reading the whole segment");
+        if (segment.compressed)
+          scan_compressed_file(segment.data_filename);
+        else
+          scan_file(segment.data_filename);
+        return;
+      }
+
+      // only the records the index points at are read
+      std::vector<archive_index_entry> entries;
+      if (by_height)
+        index.find_height(min_height, max_height, entries);
+      else
+        index.find_nrt(min_nrt, max_nrt, entries);
+      std::string record;
+      for (const archive_index_entry &entry: entries)
+      {
+        if (!in_range(entry.height, entry.nrt))
+          continue;
+        if (!fetch(segment, index, entry, record))
+        {
+          MWARNING("Failed to read the record at offset " << entry.offset << " in " << segment.data_filename);
+          ++n_corrupt;
+          continue;
+        }
+        output_stored(record.data(), record.size());
+      }
+    }
+    //---------------------------------------------------------------------------------------------
+    void segment_stats(const archive_segment_info &segment)
+    {
+      archive_index_reader index;
+      if (!index.open(segment.index_filename))
+      {
+        MWARNING("No usable index " << segment.index_filename);
+        return;
+      }
+      boost::system::error_code ec;
+      const uint64_t stored_bytes = boost::filesystem::file_size(segment.data_filename, ec);
+      uint64_t record_bytes = 0;
+      for (size_t i = 0; i < index.size(); ++i)
+        record_bytes += index.entry(i).size;
+
+      uint64_t decode_us = 0;
+      uint64_t decoded_bytes = 0;
+      if (index.compressed())
+      {
+        scan_compressed_file(segment.data_filename, &decode_us, &decoded_bytes);
+      }
+      else
+      {
+        const uint64_t start = now_us();
+        std::string contents;
+        if (epee::file_io_utils::load_file_to_string(segment.data_filename, contents))
+          decoded_bytes = contents.size();
+        decode_us = now_us() - start;
+      }
+
+      m_out << segment.number
+            << "\t" << (index.format() == archive_output_format::binary ? "binary" : "tsv")
+            << "\t" << (index.compressed() ? "zstd" : "none")
+            << "\t" << index.size()
+            << "\t" << stored_bytes
+            << "\t" << record_bytes
+            << "\t" << std::fixed << std::setprecision(2) << (stored_bytes ? (double)record_bytes / stored_bytes : 0.0)
+            << "\t" << std::fixed << std::setprecision(1) << (decode_us ? decoded_bytes / (double)decode_us : 0.0)
+            << std::endl;
+    }
+    //---------------------------------------------------------------------------------------------
+    void collect_samples(const archive_segment_info &segment, size_t max_samples, std::vector<std::string> &samples)
+    {
+      archive_index_reader index;
+      if (!index.open(segment.index_filename))
+        return;
+      std::string record;
+      for (size_t i = 0; i < index.size() && samples.size() < max_samples; ++i)
+      {
+        if (fetch(segment, index, index.entry(i), record))
+          samples.push_back(record);
+      }
+    }
+
+    //---------------------------------------------------------------------------------------------
+    // records after sequence from, up to but not including sequence to
+    void resync(uint64_t from, uint64_t to)
+    {
+      const uint64_t from_segment = from >> 32;
+      const uint64_t to_segment = to >> 32;
+      if (from_segment == 0 || to_segment == 0)
+      {
+        MWARNING("Missed records from an archive without segments, cannot resync");
+        return;
+      }
+
+      std::string record;
+      uint64_t n_resynced = 0;
+      for (const archive_segment_info &segment: archive_list_segments(archive_filename))
+      {
+        if (segment.number < from_segment || segment.number > to_segment)
+          continue;
+        archive_index_reader index;
+        if (!index.open(segment.index_filename))
+        {
+          MWARNING("No usable index " << segment.index_filename << ", records were lost");
+          continue;
+        }
+        const uint64_t begin = segment.number == from_segment ? (from & 0xffffffff) + 1 : 0;
+        const uint64_t end = segment.number == to_segment ? std::min<uint64_t>(to & 0xffffffff, index.size()) : index.size();
+        for (uint64_t i = begin; i < end; ++i)
+        {
+          if (!fetch(segment, index, index.entry(i), record))
+          {
+            ++n_corrupt;
+            continue;
+          }
+          output_stored(record.data(), record.size());
+          ++n_resynced;
+        }
+      }
+      MINFO("Resynced " << n_resynced << " records from the archive");
+    }
+    //---------------------------------------------------------------------------------------------
+    // live records from the feed; missed ones are read from the archive by sequence number
+    void follow(archive_feed_reader &feed, uint64_t poll_us)
+    {
+      archive_feed_message message;
+      bool have_last = false;
+      bool missed = false;
+      uint64_t last_counter = 0, last_sequence = 0;
+      while (true)
+      {
+        switch (feed.next(message))
+        {
+          case archive_feed_reader::result::ok:
+            if (have_last && (missed || message.counter != last_counter + 1))
+            {
+              MINFO("Feed overrun after sequence " << last_sequence << ", resyncing");
+              resync(last_sequence, message.sequence);
+            }
+            missed = false;
+            output_stored(message.record.data(), message.record.size());
+            m_out.flush();
+            last_counter = message.counter;
+            last_sequence = message.sequence;
+            have_last = true;
+            break;
+
+          case archive_feed_reader::result::overrun:
+            missed = true;
+            feed.rejoin();
+            break;
+
+          case archive_feed_reader::result::empty:
+          default:
+            boost::this_thread::sleep_for(boost::chrono::microseconds(poll_us));
+            break;
+        }
+      }
+    }
+
+    std::ostream &m_out;
+    archive_zstd_codec &m_codec;
+
+    std::string archive_filename;  //!< base filename of the archive, for resyncing
+
+    uint64_t min_height, max_height;
+    uint64_t min_nrt, max_nrt;
+    bool verify_json;
+
+    uint64_t n_records;
+    uint64_t n_fallback;
+    uint64_t n_mismatch;
+    uint64_t n_verified;
+    uint64_t n_corrupt;
+    uint64_t n_bytes;
+
+  private:
+    archive_record m_record;
+    std::string m_line, m_fast_json, m_reference_json;
+    std::string m_buffer, m_frame;
+    std::ifstream m_in;
+    std::string m_in_filename;
+    uint64_t m_frame_offset;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_input_file = {"input-file", "Binary archive file, or base filename of a segmented archive, to read", "/opt/monerodarchive/archive.bin"};
+  const command_line::arg_descriptor<std::string> arg_output_file = {"output-file", "TSV archive file to write, standard output if empty", ""};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<uint64_t> arg_min_height = {"min-height", "Lowest block height to output", 0};
+  const command_line::arg_descriptor<uint64_t> arg_max_height = {"max-height", "Highest block height to output", std::numeric_limits<uint64_t>::max()};
+  const command_line::arg_descriptor<uint64_t> arg_min_nrt = {"min-nrt", "Earliest NRT to output, Unix epoch milliseconds", 0};
+  const command_line::arg_descriptor<uint64_t> arg_max_nrt = {"max-nrt", "Latest NRT to output, Unix epoch milliseconds", std::numeric_limits<uint64_t>::max()};
+  const command_line::arg_descriptor<bool> arg_verify_json = {"verify-json", "Check that the fast Block JSON writer matches json_archive for every record", false};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary the archive was compressed with", ""};
+  const command_line::arg_descriptor<bool> arg_segment_stats = {"segment-stats", "Report record count, compression ratio and decode throughput (MB/s) per segment instead of dumping", false};
+  const command_line::arg_descriptor<std::string> arg_train_dictionary = {"train-dictionary", "Train a zstd dictionary on the archive's records and write it to this file instead of dumping", ""};
+  const command_line::arg_descriptor<size_t> arg_dictionary_size = {"dictionary-size", "Size of the trained dictionary in bytes", 112640};
+  const command_line::arg_descriptor<size_t> arg_train_samples = {"train-samples", "Most records to train the dictionary on", 20000};
+  const command_line::arg_descriptor<bool> arg_follow = {"follow", "Print records from the live feed as they are written, resyncing missed ones from the archive, until stopped", false};
+  const command_line::arg_descriptor<std::string> arg_feed_name = {"feed-name", "Shared memory name of the live feed", "/monerod-archive"};
+  const command_line::arg_descriptor<uint64_t> arg_poll_us = {"poll-us", "How long --follow sleeps when the feed is empty, microseconds", 1000};
+  const command_line::arg_descriptor<std::string> arg_tx_store = {"tx-store", "Transaction store log to read --tx from", "/opt/monerodarchive/txs.log"};
+  const command_line::arg_descriptor<std::vector<std::string>> arg_tx = {"tx", "Print the transaction with this hash from the tx store instead of dumping; may be repeated"};
+
+  command_line::add_arg(desc_cmd_sett, arg_input_file);
+  command_line::add_arg(desc_cmd_sett, arg_output_file);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_min_height);
+  command_line::add_arg(desc_cmd_sett, arg_max_height);
+  command_line::add_arg(desc_cmd_sett, arg_min_nrt);
+  command_line::add_arg(desc_cmd_sett, arg_max_nrt);
+  command_line::add_arg(desc_cmd_sett, arg_verify_json);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_sett, arg_segment_stats);
+  command_line::add_arg(desc_cmd_sett, arg_train_dictionary);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary_size);
+  command_line::add_arg(desc_cmd_sett, arg_train_samples);
+  command_line::add_arg(desc_cmd_sett, arg_follow);
+  command_line::add_arg(desc_cmd_sett, arg_feed_name);
+  command_line::add_arg(desc_cmd_sett, arg_poll_us);
+  command_line::add_arg(desc_cmd_sett, arg_tx_store);
+  command_line::add_arg(desc_cmd_sett, arg_tx);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Converts a monerod-archive binary archive to the TSV archive format." << ENDL;
+    std::cout << "Height and NRT ranges of a segmented archive are read through the segment indexes." << ENDL;
+    std::cout << "With --follow, prints records from the daemon's live feed instead." << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-dump.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const std::string input_file = command_line::get_arg(vm, arg_input_file);
+  const std::string output_file = command_line::get_arg(vm, arg_output_file);
+  const std::string dictionary_file = command_line::get_arg(vm, arg_dictionary);
+  const std::string train_dictionary_file = command_line::get_arg(vm, arg_train_dictionary);
+
+  std::ofstream out_file;
+  if (!output_file.empty())
+  {
+    out_file.open(output_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out_file)
+    {
+      MERROR("Failed to open output file " << output_file);
+      return 1;
+    }
+  }
+  std::ostream &out = output_file.empty() ? std::cout : out_file;
+
+  archive_zstd_codec codec;
+  if (archive_zstd_codec::available())
+  {
+    std::string dictionary;
+    if (!dictionary_file.empty() && !epee::file_io_utils::load_file_to_string(dictionary_file, dictionary))
+    {
+      MERROR("Failed to read dictionary " << dictionary_file);
+      return 1;
+    }
+    if (!codec.init(3, dictionary))
+      return 1;
+  }
+
+  archive_dump dump(out, codec);
+  dump.min_height = command_line::get_arg(vm, arg_min_height);
+  dump.max_height = command_line::get_arg(vm, arg_max_height);
+  dump.min_nrt = command_line::get_arg(vm, arg_min_nrt);
+  dump.max_nrt = command_line::get_arg(vm, arg_max_nrt);
+  dump.verify_json = command_line::get_arg(vm, arg_verify_json);
+  dump.archive_filename = input_file;
+  const bool by_height = !command_line::is_arg_defaulted(vm, arg_min_height) || !command_line::is_arg_defaulted(vm, arg_max_height);
+  const bool by_nrt = !command_line::is_arg_defaulted(vm, arg_min_nrt) || !command_line::is_arg_defaulted(vm, arg_max_nrt);
+
+  if (command_line::get_arg(vm, arg_follow))
+  {
+    archive_feed_reader feed;
+    const std::string feed_name = command_line::get_arg(vm, arg_feed_name);
+    if (!feed.open(feed_name))
+    {
+      MERROR("Failed to open live feed " << feed_name << "; is monerod-archive running with the feed enabled?");
+      return 1;
+    }
+    dump.follow(feed, command_line::get_arg(vm, arg_poll_us));
+    return 0;
+  }
+
+  if (!command_line::is_arg_defaulted(vm, arg_tx))
+  {
+    archive_tx_store_reader tx_store;
+    const std::string tx_store_file = command_line::get_arg(vm, arg_tx_store);
+    if (!tx_store.open(tx_store_file))
+      return 1;
+    // tx_hash, pruned, prunable_hash, blob as hex
+    int r = 0;
+    for (const std::string &id_hex: command_line::get_arg(vm, arg_tx))
+    {
+      crypto::hash id;
+      archive_tx_entry entry;
+      if (!epee::string_tools::hex_to_pod(id_hex, id))
+      {
+        MERROR("Invalid tx hash " << id_hex);
+        return 1;
+      }
+      if (!tx_store.get(id, entry))
+      {
+        MERROR("Tx " << id_hex << " is not in " << tx_store_file);
+        r = 4;
+        continue;
+      }
+      out << epee::string_tools::pod_to_hex(entry.id) << '\t' << (entry.pruned ? 1 : 0) << '\t'
+          << (entry.pruned ? epee::string_tools::pod_to_hex(entry.prunable_hash) : std::string()) << '\t'
+          << epee::string_tools::buff_to_hex_nodelimer(entry.blob) << '\n';
+    }
+    out.flush();
+    return r;
+  }
+
+  const std::vector<archive_segment_info> segments = archive_list_segments(input_file);
+
+  if (!train_dictionary_file.empty())
+  {
+    std::vector<std::string> samples;
+    for (const archive_segment_info &segment: segments)
+      dump.collect_samples(segment, command_line::get_arg(vm, arg_train_samples), samples);
+    std::string dictionary;
+    if (samples.empty() || !archive_train_dictionary(samples, command_line::get_arg(vm, arg_dictionary_size), dictionary))
+    {
+      MERROR("Failed to train a dictionary on " << samples.size() << " records");
+      return 1;
+    }
+    if (!epee::file_io_utils::save_string_to_file(train_dictionary_file, dictionary))
+    {
+      MERROR("Failed to write dictionary " << train_dictionary_file);
+      return 1;
+    }
+    MINFO("Trained a " << dictionary.size() << " byte dictionary on " << samples.size() << " records");
+    return 0;
+  }
+
+  if (command_line::get_arg(vm, arg_segment_stats))
+  {
+    out << "segment\tformat\tcompression\trecords\tstored_bytes\trecord_bytes\tratio\tdecode_mb_per_s" << std::endl;
+    for (const archive_segment_info &segment: segments)
+      dump.segment_stats(segment);
+    return 0;
+  }
+
+  if (segments.empty())
+  {
+    if (!dump.scan_file(input_file))
+      return 1;
+  }
+  for (const archive_segment_info &segment: segments)
+    dump.dump_segment(segment, by_height, by_nrt);
+  out.flush();
+
+  MINFO("Converted " << dump.n_records << " records from " << std::max<size_t>(segments.size(), 1) << " files, " << dump.n_bytes << " bytes read");
+  if (dump.verify_json)
+    MINFO("Block JSON verified: " << (dump.n_verified - dump.n_fallback - dump.n_mismatch) << " match, " << dump.n_mismatch << " mismatch, " << dump.n_fallback << " fall back to json_archive");
+  if (dump.n_corrupt > 0)
+    return 2;
+  if (dump.n_mismatch > 0)
+    return 3;
+  return 0;
+
+  CATCH_ENTRY("Dump error", 1);
+}
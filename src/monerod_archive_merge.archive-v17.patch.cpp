@@ -0,0 +1,635 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_merge.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <boost/program_options.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "file_io_utils.h"
+#include "cryptonote_core/archive_compress.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_json.h"
+#include "cryptonote_core/archive_segment.h"
+#include "cryptonote_core/archive_tsv.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  const char binary_magic[4] = { 'M', 'D', 'A', 'R' };
+
+  bool is_binary(const char *data, size_t size)
+  {
+    return size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+  }
+
+  uint64_t now_us()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * @brief what the merge needs of one record
+   */
+  struct merge_record
+  {
+    uint64_t height;
+    crypto::hash hash;
+    uint64_t nrt;  //!< 0 if unknown
+    bool is_alt_block;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief read-only mapping of a whole file
+   */
+  class mapped_file
+  {
+  public:
+    mapped_file(): m_data(nullptr), m_size(0), m_mapped(false) {}
+    ~mapped_file() { close(); }
+
+    bool open(const std::string &filename)
+    {
+      close();
+#ifdef _WIN32
+      if (!epee::file_io_utils::load_file_to_string(filename, m_contents))
+        return false;
+      m_data = m_contents.data();
+      m_size = m_contents.size();
+      return true;
+#else
+      const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        ::close(fd);
+        return false;
+      }
+      m_size = st.st_size;
+      if (m_size == 0)
+      {
+        ::close(fd);
+        return true;
+      }
+      void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED)
+        return false;
+      ::madvise(p, m_size, MADV_SEQUENTIAL);
+      m_data = (const char*)p;
+      m_mapped = true;
+      return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+      if (m_mapped)
+        ::munmap((void*)m_data, m_size);
+#endif
+      m_mapped = false;
+      m_data = nullptr;
+      m_size = 0;
+      m_contents.clear();
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    const char *m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::string m_contents;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief the records of one node's archive in file order, across its segments
+   *
+   * Files are memory mapped and read in place; compressed segments are
+   * decompressed one frame at a time, so a reader holds at most one frame.
+   */
+  class node_reader
+  {
+  public:
+    node_reader(const std::string &name, const std::vector<std::pair<std::string, bool>> &files, archive_zstd_codec &codec):
+      n_records(0), n_bad_records(0), n_unhashed(0),
+      m_name(name), m_files(files), m_codec(codec), m_next_file(0),
+      m_compressed(false), m_frame_pos(0), m_new_file(false), m_binary(false), m_p(nullptr), m_end(nullptr)
+    {
+    }
+
+    const std::string &name() const { return m_name; }
+
+    /**
+     * @return false at the end of the archive, or if a file could not be read
+     */
+    bool next(merge_record &record)
+    {
+      while (true)
+      {
+        while (m_p == m_end)
+        {
+          if (!next_span())
+            return false;
+        }
+        if (m_binary ? next_binary(record) : next_line(record))
+        {
+          ++n_records;
+          return true;
+        }
+      }
+    }
+
+    uint64_t n_records;
+    uint64_t n_bad_records;
+    uint64_t n_unhashed;  //!< full TSV records whose block could not be rebuilt to hash it
+
+  private:
+    // next frame of a compressed segment, or the next file
+    bool next_span()
+    {
+      if (m_compressed && m_frame_pos < m_file.size())
+      {
+        const size_t frame_size = archive_zstd_codec::frame_size(m_file.data() + m_frame_pos, m_file.size() - m_frame_pos);
+        if (frame_size == 0 || !m_codec.decompress(m_file.data() + m_frame_pos, frame_size, m_frame))
+        {
+          MWARNING("Corrupt or truncated frame at offset " << m_frame_pos << " in " << m_files[m_next_file - 1].first);
+          ++n_bad_records;
+          m_frame_pos = m_file.size();
+          return true;
+        }
+        m_frame_pos += frame_size;
+        set_span(m_frame.data(), m_frame.size());
+        return true;
+      }
+
+      if (m_next_file == m_files.size())
+        return false;
+      const std::pair<std::string, bool> &file = m_files[m_next_file++];
+      if (file.second && !archive_zstd_codec::available())
+      {
+        MERROR("Built without zstd, cannot read " << file.first);
+        return false;
+      }
+      if (!m_file.open(file.first))
+      {
+        MERROR("Failed to open input file " << file.first);
+        return false;
+      }
+      m_compressed = file.second;
+      m_frame_pos = 0;
+      m_new_file = true;
+      if (m_compressed)
+        m_p = m_end = nullptr;
+      else
+        set_span(m_file.data(), m_file.size());
+      return true;
+    }
+
+    void set_span(const char *data, size_t size)
+    {
+      // format from the first record of each file
+      if (m_new_file && size > 0)
+      {
+        m_binary = is_binary(data, size);
+        m_new_file = false;
+      }
+      m_p = data;
+      m_end = data + size;
+    }
+
+    bool next_binary(merge_record &record)
+    {
+      size_t consumed = 0;
+      const archive_parse_result r = archive_parse_binary_record(m_p, m_end - m_p, m_record, consumed);
+      if (r == archive_parse_result::ok)
+      {
+        m_p += consumed;
+        record.height = m_record.block_height;
+        record.hash = m_record.block_hash;
+        record.nrt = m_record.node_timestamp;
+        record.is_alt_block = m_record.is_alt_block;
+        return true;
+      }
+
+      // skip to the next record magic
+      ++n_bad_records;
+      const char *next = r == archive_parse_result::incomplete ? m_end :
+          std::search(m_p + 1, m_end, binary_magic, binary_magic + sizeof(binary_magic));
+      m_p = next;
+      return false;
+    }
+
+    bool next_line(merge_record &record)
+    {
+      const char *line = m_p;
+      m_p = archive_tsv_split(m_p, m_end, m_fields);
+      if (m_fields.n_fields == 1 && m_fields.begin[0] == m_fields.end[0])
+        return false;  // empty line
+
+      const char *line_end = m_p > line && m_p[-1] == '\n' ? m_p - 1 : m_p;
+      archive_tsv_block block;
+      if (m_fields.n_fields < 9 || !archive_check_line(line, line_end) ||
+          !archive_tsv_uint(m_fields.begin[1], m_fields.end[1], record.nrt) ||
+          !archive_tsv_bool(m_fields.begin[2], m_fields.end[2], record.is_alt_block) ||
+          !archive_tsv_parse_block(m_fields.begin[3], m_fields.end[3], block))
+      {
+        if (n_bad_records++ < 5)
+          MWARNING("Skipped a malformed line of node " << m_name);
+        return false;
+      }
+      if (!archive_tsv_block_hash(block, record.hash))
+      {
+        if (n_unhashed++ < 5)
+          MWARNING("Skipped a line of node " << m_name << " at height " << block.height << ": its block could not be rebuilt to hash it");
+        return false;
+      }
+      record.height = block.height;
+      return true;
+    }
+
+    const std::string m_name;
+    const std::vector<std::pair<std::string, bool>> m_files;
+    archive_zstd_codec &m_codec;
+    size_t m_next_file;
+
+    mapped_file m_file;
+    bool m_compressed;
+    size_t m_frame_pos;   //!< of the next frame in a compressed segment
+    std::string m_frame;  //!< decompressed frame
+    bool m_new_file;      //!< its format is not known yet
+    bool m_binary;
+    const char *m_p;
+    const char *m_end;
+
+    archive_tsv_fields m_fields;
+    archive_record m_record;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief k-way merge of node archives by height, joining records on block hash
+   *
+   * Archives are in arrival order, so heights mostly rise but an alt block
+   * or a reorg can go back.  The record with the lowest height is always
+   * taken next, and a height is written once every node has moved more
+   * than window heights past it.  Only that window of blocks is held.
+   */
+  class archive_merge
+  {
+  public:
+    archive_merge(std::vector<std::unique_ptr<node_reader>> &nodes, uint64_t window, std::ostream &out):
+      n_blocks(0), n_late(0), n_duplicates(0),
+      m_nodes(nodes), m_window(window), m_out(out), m_written_below(0)
+    {
+    }
+
+    bool run()
+    {
+      typedef std::pair<uint64_t, size_t> head;  // next height, node
+      std::priority_queue<head, std::vector<head>, std::greater<head>> heads;
+      std::vector<merge_record> next(m_nodes.size());
+      for (size_t i = 0; i < m_nodes.size(); ++i)
+        if (m_nodes[i]->next(next[i]))
+          heads.push(head(next[i].height, i));
+
+      write_header();
+      while (!heads.empty())
+      {
+        const size_t i = heads.top().second;
+        heads.pop();
+        add(i, next[i]);
+        if (m_nodes[i]->next(next[i]))
+          heads.push(head(next[i].height, i));
+
+        if (!heads.empty() && heads.top().first > m_window)
+          write_below(heads.top().first - m_window);
+        if (!m_out)
+        {
+          MERROR("Failed to write the merged output");
+          return false;
+        }
+      }
+      write_below(std::numeric_limits<uint64_t>::max());
+      m_out.write(m_buffer.data(), m_buffer.size());
+      m_out.flush();
+      return (bool)m_out;
+    }
+
+    uint64_t n_blocks;
+    uint64_t n_late;        //!< records for heights already written
+    uint64_t n_duplicates;  //!< records of a block a node had already recorded
+
+  private:
+    struct merged_block
+    {
+      crypto::hash hash;
+      std::vector<uint64_t> nrt;   //!< per node, 0 if unknown or not seen
+      std::vector<uint8_t> seen;   //!< per node: 0 not seen, 1 main, 2 alt
+    };
+
+    void add(size_t node, const merge_record &record)
+    {
+      if (record.height < m_written_below)
+      {
+        ++n_late;
+        return;
+      }
+      std::vector<merged_block> &blocks = m_blocks[record.height];
+      auto b = std::find_if(blocks.begin(), blocks.end(), [&](const merged_block &m) { return m.hash == record.hash; });
+      if (b == blocks.end())
+      {
+        merged_block m;
+        m.hash = record.hash;
+        m.nrt.assign(m_nodes.size(), 0);
+        m.seen.assign(m_nodes.size(), 0);
+        blocks.push_back(std::move(m));
+        b = blocks.end() - 1;
+      }
+      if (b->seen[node] != 0)
+      {
+        // first arrival wins
+        ++n_duplicates;
+        if (record.nrt != 0 && (b->nrt[node] == 0 || record.nrt < b->nrt[node]))
+          b->nrt[node] = record.nrt;
+        return;
+      }
+      b->seen[node] = record.is_alt_block ? 2 : 1;
+      b->nrt[node] = record.nrt;
+    }
+
+    void write_header()
+    {
+      m_buffer += "height\thash\tn_nodes\tfirst_nrt\tlast_nrt\tspread_ms\tfirst_node";
+      for (const std::unique_ptr<node_reader> &node: m_nodes)
+      {
+        m_buffer += "\t" + node->name() + "_nrt";
+        m_buffer += "\t" + node->name() + "_alt";
+      }
+      m_buffer += "\n";
+    }
+
+    // writes and forgets every height below height
+    void write_below(uint64_t height)
+    {
+      while (!m_blocks.empty() && m_blocks.begin()->first < height)
+      {
+        for (const merged_block &b: m_blocks.begin()->second)
+          write_block(m_blocks.begin()->first, b);
+        m_blocks.erase(m_blocks.begin());
+      }
+      m_written_below = std::max(m_written_below, height);
+      if (m_buffer.size() >= 1024 * 1024)
+      {
+        m_out.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+      }
+    }
+
+    void write_block(uint64_t height, const merged_block &b)
+    {
+      uint64_t n_seen = 0, first = 0, last = 0;
+      size_t first_node = 0;
+      for (size_t i = 0; i < m_nodes.size(); ++i)
+      {
+        if (b.seen[i] == 0)
+          continue;
+        ++n_seen;
+        // NRT 0 is unknown, e.g. backfilled
+        if (b.nrt[i] == 0)
+          continue;
+        if (first == 0 || b.nrt[i] < first)
+        {
+          first = b.nrt[i];
+          first_node = i;
+        }
+        last = std::max(last, b.nrt[i]);
+      }
+
+      archive_append_uint(m_buffer, height);
+      m_buffer += '\t';
+      archive_append_hex(m_buffer, b.hash.data, sizeof(b.hash.data));
+      m_buffer += '\t';
+      archive_append_uint(m_buffer, n_seen);
+      m_buffer += '\t';
+      if (first != 0)
+      {
+        archive_append_uint(m_buffer, first);
+        m_buffer += '\t';
+        archive_append_uint(m_buffer, last);
+        m_buffer += '\t';
+        archive_append_uint(m_buffer, last - first);
+        m_buffer += '\t';
+        m_buffer += m_nodes[first_node]->name();
+      }
+      else
+      {
+        m_buffer += "\t\t\t";
+      }
+      for (size_t i = 0; i < m_nodes.size(); ++i)
+      {
+        m_buffer += '\t';
+        if (b.seen[i] == 0)
+        {
+          m_buffer += '\t';
+          continue;
+        }
+        archive_append_uint(m_buffer, b.nrt[i]);
+        m_buffer += '\t';
+        m_buffer += b.seen[i] == 2 ? '1' : '0';
+      }
+      m_buffer += '\n';
+      ++n_blocks;
+    }
+
+    std::vector<std::unique_ptr<node_reader>> &m_nodes;
+    const uint64_t m_window;
+    std::ostream &m_out;
+    std::map<uint64_t, std::vector<merged_block>> m_blocks;  //!< by height, blocks in order of first sight
+    uint64_t m_written_below;
+    std::string m_buffer;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::vector<std::string>> arg_inputs = {"input", "NODE=FILE: archive file, or base filename of a segmented archive, of one node; once per node"};
+  const command_line::arg_descriptor<std::string> arg_output_file = {"output-file", "TSV file to write, standard output if empty", ""};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<uint64_t> arg_window = {"window", "Heights an archive may go back, e.g. for alt blocks and reorgs; blocks are held this long", 100};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary the archives were compressed with", ""};
+
+  command_line::add_arg(desc_cmd_sett, arg_inputs);
+  command_line::add_arg(desc_cmd_sett, arg_output_file);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_window);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  const std::vector<std::string> input_args = command_line::get_arg(vm, arg_inputs);
+  if (command_line::get_arg(vm, command_line::arg_help) || input_args.empty())
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Merges the archives of several nodes by height, joining records on block hash, into one TSV line per block" << ENDL;
+    std::cout << "with each node's NRT and whether it saw the block as an alt block:" << ENDL;
+    std::cout << "  monerod-archive-merge --input eu=/data/eu/archive.log --input us=/data/us/archive.log" << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-merge.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const std::string output_file = command_line::get_arg(vm, arg_output_file);
+  const std::string dictionary_file = command_line::get_arg(vm, arg_dictionary);
+
+  std::ofstream out_file;
+  if (!output_file.empty())
+  {
+    out_file.open(output_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out_file)
+    {
+      MERROR("Failed to open output file " << output_file);
+      return 1;
+    }
+  }
+  std::ostream &out = output_file.empty() ? std::cout : out_file;
+
+  archive_zstd_codec codec;
+  if (archive_zstd_codec::available())
+  {
+    std::string dictionary;
+    if (!dictionary_file.empty() && !epee::file_io_utils::load_file_to_string(dictionary_file, dictionary))
+    {
+      MERROR("Failed to read dictionary " << dictionary_file);
+      return 1;
+    }
+    codec.init(0, dictionary);
+  }
+
+  std::vector<std::unique_ptr<node_reader>> nodes;
+  for (const std::string &input: input_args)
+  {
+    const size_t eq = input.find('=');
+    const std::string name = eq == std::string::npos ? "node" + std::to_string(nodes.size() + 1) : input.substr(0, eq);
+    const std::string input_file = eq == std::string::npos ? input : input.substr(eq + 1);
+
+    // segments in order, else the single archive file
+    std::vector<std::pair<std::string, bool>> files;
+    for (const archive_segment_info &segment: archive_list_segments(input_file))
+      files.push_back(std::make_pair(segment.data_filename, segment.compressed));
+    if (files.empty())
+      files.push_back(std::make_pair(input_file, false));
+    MINFO("Node " << name << ": " << files.size() << " files from " << input_file);
+    nodes.emplace_back(new node_reader(name, files, codec));
+  }
+
+  const uint64_t started_us = now_us();
+  archive_merge merge(nodes, command_line::get_arg(vm, arg_window), out);
+  if (!merge.run())
+    return 1;
+
+  const double seconds = std::max<uint64_t>(now_us() - started_us, 1) / 1e6;
+  uint64_t n_records = 0, n_bad_records = 0, n_unhashed = 0;
+  for (const std::unique_ptr<node_reader> &node: nodes)
+  {
+    MINFO("Node " << node->name() << ": " << node->n_records << " records, " << node->n_bad_records << " malformed or corrupt, " << node->n_unhashed << " not hashed");
+    n_records += node->n_records;
+    n_bad_records += node->n_bad_records;
+    n_unhashed += node->n_unhashed;
+  }
+  MINFO("Merged " << n_records << " records from " << nodes.size() << " nodes into " << merge.n_blocks << " blocks in " << seconds << " s, "
+    << (uint64_t)(n_records / seconds) << " records/s");
+  if (merge.n_duplicates > 0)
+    MINFO(merge.n_duplicates << " records repeat a block their node had already recorded; the earliest NRT is kept");
+  if (merge.n_late > 0)
+    MWARNING(merge.n_late << " records came after their height was written; increase --window");
+  if (n_bad_records > 0 || n_unhashed > 0)
+    return 2;
+  return 0;
+
+  CATCH_ENTRY("Merge error", 1);
+}
@@ -0,0 +1,619 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_pgload.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#include "file_io_utils.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "file_io_utils.h"
+#include "cryptonote_core/archive_alt_delta.h"
+#include "cryptonote_core/archive_compress.h"
+#include "cryptonote_core/archive_json.h"
+#include "cryptonote_core/archive_segment.h"
+#include "cryptonote_core/archive_tsv.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  uint64_t now_us()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  // ## PostgreSQL COPY binary format: big-endian integers, int32 length before every field
+
+  const char pgcopy_signature[11] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0' };
+  const int16_t pgcopy_n_columns = 19;
+
+  void put_be(std::string &out, uint64_t v, size_t n)
+  {
+    for (size_t i = n; i > 0; --i)
+      out.push_back((char)(v >> (8 * (i - 1))));
+  }
+
+  void pg_null(std::string &out) { put_be(out, 0xffffffff, 4); }
+  void pg_int16(std::string &out, uint64_t v) { put_be(out, 2, 4); put_be(out, v, 2); }
+  void pg_int64(std::string &out, uint64_t v) { put_be(out, 8, 4); put_be(out, v, 8); }
+  void pg_bool(std::string &out, bool v) { put_be(out, 1, 4); out.push_back(v ? 1 : 0); }
+  void pg_bytes(std::string &out, const char *p, size_t n) { put_be(out, n, 4); out.append(p, n); }
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief converts one archive line to one COPY tuple, columns as in README "PostgreSQL table"
+   *
+   * Needs output fields 1-9; of the later fields only Record Policy (12) is
+   * a table column, 0 (full) when the line is older.  Delta-encoded alt
+   * chains are written to the table as the array.
+   *
+   * @return incomplete if the alt chains are delta-encoded against lines alt_chains has not seen
+   */
+  archive_parse_result convert_line(const archive_tsv_fields &fields, archive_alt_chain_decoder &alt_chains, std::string &out, uint64_t &alt_chain_mismatches)
+  {
+    if (fields.n_fields < 9)
+      return archive_parse_result::corrupt;
+    uint64_t archive_version, nrt, n_alt_chains, nch, nth, record_policy = 0;
+    bool is_alt_block, is_node_synced;
+    archive_tsv_block block;
+    if (!archive_tsv_uint(fields.begin[0], fields.end[0], archive_version) ||
+        !archive_tsv_uint(fields.begin[1], fields.end[1], nrt) ||
+        !archive_tsv_bool(fields.begin[2], fields.end[2], is_alt_block) ||
+        !archive_tsv_parse_block(fields.begin[3], fields.end[3], block) ||
+        !archive_tsv_uint(fields.begin[4], fields.end[4], n_alt_chains) ||
+        !archive_tsv_bool(fields.begin[6], fields.end[6], is_node_synced) ||
+        !archive_tsv_uint(fields.begin[7], fields.end[7], nch) ||
+        !archive_tsv_uint(fields.begin[8], fields.end[8], nth))
+      return archive_parse_result::corrupt;
+    if (fields.n_fields >= 12 && !archive_tsv_uint(fields.begin[11], fields.end[11], record_policy))
+      return archive_parse_result::corrupt;
+    const archive_parse_result r = alt_chains.decode(fields.begin[5], fields.end[5], n_alt_chains);
+    if (r != archive_parse_result::ok)
+      return r;
+    if (alt_chains.chains().size() != n_alt_chains)
+      ++alt_chain_mismatches;
+
+    put_be(out, pgcopy_n_columns, 2);
+    // block
+    pg_int16(out, block.major_version);
+    pg_int16(out, block.minor_version);
+    pg_int64(out, block.timestamp);
+    pg_bytes(out, block.prev_id.data, sizeof(block.prev_id.data));
+    pg_int64(out, block.nonce);
+    // header-only records: no miner_tx or tx_hashes, but the hash
+    if (block.header_only)
+    {
+      pg_null(out);
+      pg_null(out);
+    }
+    else
+    {
+      pg_bytes(out, block.miner_tx, block.miner_tx_end - block.miner_tx);
+      pg_bytes(out, block.tx_hashes, block.tx_hashes_end - block.tx_hashes);
+    }
+    pg_int64(out, block.height);
+    if (block.header_only)
+    {
+      put_be(out, 2 * sizeof(block.hash.data), 4);
+      archive_append_hex(out, block.hash.data, sizeof(block.hash.data));
+    }
+    else
+    {
+      pg_null(out);  // hash: not in full records
+    }
+    // monerod-archive; NRT 0 is unknown (backfilled)
+    pg_int16(out, archive_version);
+    if (nrt != 0)
+      pg_int64(out, nrt);
+    else
+      pg_null(out);
+    pg_bool(out, is_alt_block);
+    // alt_chain_info
+    pg_int64(out, n_alt_chains);
+    if (alt_chains.delta())
+    {
+      // length filled in once the array is written
+      const size_t length_start = out.size();
+      put_be(out, 0, 4);
+      alt_chains.json(out);
+      const size_t length = out.size() - length_start - 4;
+      for (size_t i = 0; i < 4; ++i)
+        out[length_start + i] = (char)(length >> (24 - 8 * i));
+    }
+    else
+    {
+      pg_bytes(out, fields.begin[5], fields.end[5] - fields.begin[5]);
+    }
+    // sync_state
+    pg_bool(out, is_node_synced);
+    pg_int64(out, nch);
+    pg_int64(out, nth);
+    // archive_db: deltart = ceil(NRT / 1000) - MRT
+    if (nrt != 0)
+      pg_int64(out, (uint64_t)((int64_t)((nrt + 999) / 1000) - (int64_t)block.timestamp));
+    else
+      pg_null(out);
+    pg_int16(out, record_policy);
+    return archive_parse_result::ok;
+  }
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief read-only view of an archive file: mapped, or decompressed for zstd segments
+   */
+  class archive_input
+  {
+  public:
+    archive_input(): m_data(nullptr), m_size(0), m_mapped(false) {}
+    ~archive_input() { close(); }
+
+    bool open(const std::string &filename, bool compressed, archive_zstd_codec &codec)
+    {
+      close();
+      if (compressed)
+      {
+        std::string contents, frame;
+        if (!epee::file_io_utils::load_file_to_string(filename, contents))
+          return false;
+        size_t pos = 0;
+        while (pos < contents.size())
+        {
+          const size_t frame_size = archive_zstd_codec::frame_size(contents.data() + pos, contents.size() - pos);
+          if (frame_size == 0 || !codec.decompress(contents.data() + pos, frame_size, frame))
+          {
+            MWARNING("Corrupt or truncated frame at offset " << pos << " in " << filename);
+            break;
+          }
+          m_contents += frame;
+          pos += frame_size;
+        }
+        m_data = m_contents.data();
+        m_size = m_contents.size();
+        return true;
+      }
+#ifdef _WIN32
+      if (!epee::file_io_utils::load_file_to_string(filename, m_contents))
+        return false;
+      m_data = m_contents.data();
+      m_size = m_contents.size();
+      return true;
+#else
+      const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        ::close(fd);
+        return false;
+      }
+      m_size = st.st_size;
+      if (m_size == 0)
+      {
+        ::close(fd);
+        return true;
+      }
+      void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED)
+        return false;
+      ::madvise(p, m_size, MADV_SEQUENTIAL);
+      m_data = (const char*)p;
+      m_mapped = true;
+      return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+      if (m_mapped)
+        ::munmap((void*)m_data, m_size);
+#endif
+      m_mapped = false;
+      m_data = nullptr;
+      m_size = 0;
+      m_contents.clear();
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    const char *m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::string m_contents;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief converts archive lines to COPY tuples on worker threads
+   *
+   * The input is cut into chunks at newline boundaries.  Workers convert
+   * chunks in any order; the calling thread writes their tuples in input
+   * order, with workers at most a window of chunks ahead of it.
+   */
+  class archive_pgload
+  {
+  public:
+    archive_pgload(std::ostream &out, size_t n_threads, size_t chunk_bytes):
+      n_rows(0), n_bad_lines(0), n_alt_chain_mismatches(0), n_bytes_in(0), n_bytes_out(0),
+      m_out(out), m_n_threads(std::max<size_t>(n_threads, 1)), m_chunk_bytes(std::max<size_t>(chunk_bytes, 4096)),
+      m_data(nullptr), m_next_chunk(0), m_next_write(0), m_failed(false)
+    {
+    }
+
+    bool run(const std::string &name, const char *data, size_t size)
+    {
+      m_name = name;
+      m_data = data;
+      m_chunks.clear();
+      for (size_t begin = 0; begin < size; )
+      {
+        size_t end = std::min(begin + m_chunk_bytes, size);
+        if (end < size)
+        {
+          const char *newline = (const char*)memchr(data + end, '\n', size - end);
+          end = newline ? newline - data + 1 : size;
+        }
+        m_chunks.push_back(std::make_pair(begin, end));
+        begin = end;
+      }
+      m_next_chunk = 0;
+      m_next_write = 0;
+
+      boost::thread_group workers;
+      for (size_t i = 0; i < std::min(m_n_threads, m_chunks.size()); ++i)
+        workers.create_thread([this]() { worker(); });
+
+      while (m_next_write < m_chunks.size())
+      {
+        std::unique_ptr<chunk_result> result;
+        {
+          boost::unique_lock<boost::mutex> lock(m_mutex);
+          while (m_done.find(m_next_write) == m_done.end())
+            m_done_cond.wait(lock);
+          result = std::move(m_done[m_next_write]);
+          m_done.erase(m_next_write);
+        }
+
+        if (!m_failed && !m_out.write(result->tuples.data(), result->tuples.size()))
+        {
+          MERROR("Failed to write the COPY stream");
+          m_failed = true;
+        }
+        n_rows += result->n_rows;
+        n_bad_lines += result->n_bad_lines;
+        n_alt_chain_mismatches += result->n_alt_chain_mismatches;
+        n_bytes_out += result->tuples.size();
+        n_bytes_in += m_chunks[m_next_write].second - m_chunks[m_next_write].first;
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        ++m_next_write;
+        m_space_cond.notify_all();
+      }
+      workers.join_all();
+      return !m_failed;
+    }
+
+    uint64_t n_rows;
+    uint64_t n_bad_lines;
+    uint64_t n_alt_chain_mismatches;
+    uint64_t n_bytes_in;
+    uint64_t n_bytes_out;
+
+  private:
+    struct chunk_result
+    {
+      std::string tuples;
+      uint64_t n_rows = 0;
+      uint64_t n_bad_lines = 0;
+      uint64_t n_alt_chain_mismatches = 0;
+    };
+
+    void worker()
+    {
+      while (true)
+      {
+        size_t index;
+        {
+          boost::unique_lock<boost::mutex> lock(m_mutex);
+          while (m_next_chunk < m_chunks.size() && m_next_chunk >= m_next_write + 2 * m_n_threads)
+            m_space_cond.wait(lock);
+          if (m_next_chunk >= m_chunks.size())
+            return;
+          index = m_next_chunk++;
+        }
+
+        std::unique_ptr<chunk_result> result(new chunk_result());
+        convert_chunk(m_chunks[index].first, m_chunks[index].second, *result);
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_done[index] = std::move(result);
+        m_done_cond.notify_all();
+      }
+    }
+
+    /**
+     * @brief brings alt_chains up to the line at begin, if that one is delta-encoded
+     *
+     * Chunks are converted independently, so one starting between two alt
+     * chain snapshots decodes the lines from the last snapshot before it.
+     */
+    void seek_alt_chains(size_t begin, size_t end, archive_alt_chain_decoder &alt_chains) const
+    {
+      archive_tsv_fields fields;
+      archive_tsv_split(m_data + begin, m_data + end, fields);
+      if (begin == 0 || fields.n_fields < 6 || fields.begin[5] == fields.end[5] || *fields.begin[5] != '{' ||
+          archive_alt_chain_is_snapshot(fields.begin[5], fields.end[5]))
+        return;
+
+      size_t line = begin;
+      do
+      {
+        line -= 1;  // the previous line's newline
+        while (line > 0 && m_data[line - 1] != '\n')
+          --line;
+        archive_tsv_split(m_data + line, m_data + begin, fields);
+      } while (line > 0 && !(fields.n_fields >= 6 && archive_alt_chain_is_snapshot(fields.begin[5], fields.end[5])));
+
+      for (const char *p = m_data + line; p < m_data + begin; )
+      {
+        p = archive_tsv_split(p, m_data + begin, fields);
+        uint64_t n_alt_chains;
+        if (fields.n_fields >= 6 && archive_tsv_uint(fields.begin[4], fields.end[4], n_alt_chains))
+          alt_chains.decode(fields.begin[5], fields.end[5], n_alt_chains);
+      }
+    }
+
+    void convert_chunk(size_t begin, size_t end, chunk_result &result)
+    {
+      // tuples are a little smaller than their lines
+      result.tuples.reserve(end - begin);
+      archive_tsv_fields fields;
+      archive_alt_chain_decoder alt_chains;
+      seek_alt_chains(begin, end, alt_chains);
+      const char *p = m_data + begin;
+      const char *const chunk_end = m_data + end;
+      while (p < chunk_end)
+      {
+        const char *line = p;
+        p = archive_tsv_split(p, chunk_end, fields);
+        if (fields.n_fields == 1 && fields.begin[0] == fields.end[0])
+          continue;  // empty line
+
+        const size_t tuple_start = result.tuples.size();
+        const archive_parse_result r = convert_line(fields, alt_chains, result.tuples, result.n_alt_chain_mismatches);
+        if (r == archive_parse_result::ok)
+        {
+          ++result.n_rows;
+        }
+        else
+        {
+          result.tuples.resize(tuple_start);
+          if (result.n_bad_lines++ < 5)
+          {
+            if (r == archive_parse_result::incomplete)
+              MWARNING("Skipped a line at byte " << (line - m_data) << " of " << m_name << ": its alt chains are a delta with no snapshot before it");
+            else
+              MWARNING("Skipped a malformed line at byte " << (line - m_data) << " of " << m_name);
+          }
+        }
+      }
+    }
+
+    std::ostream &m_out;
+    const size_t m_n_threads;
+    const size_t m_chunk_bytes;
+    std::string m_name;
+    const char *m_data;
+    std::vector<std::pair<size_t, size_t>> m_chunks;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_done_cond;
+    boost::condition_variable m_space_cond;
+    size_t m_next_chunk;
+    size_t m_next_write;
+    bool m_failed;
+    std::map<size_t, std::unique_ptr<chunk_result>> m_done;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_input_file = {"input-file", "TSV archive file, or base filename of a segmented archive, to load", "/opt/monerodarchive/archive.log"};
+  const command_line::arg_descriptor<std::string> arg_output_file = {"output-file", "COPY binary file to write, standard output if empty", ""};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<size_t> arg_threads = {"threads", "Worker threads parsing lines, all cores if 0", 0};
+  const command_line::arg_descriptor<size_t> arg_chunk_bytes = {"chunk-bytes", "Input bytes a worker converts at a time", 32 * 1024 * 1024};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary the archive was compressed with", ""};
+
+  command_line::add_arg(desc_cmd_sett, arg_input_file);
+  command_line::add_arg(desc_cmd_sett, arg_output_file);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_threads);
+  command_line::add_arg(desc_cmd_sett, arg_chunk_bytes);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Converts a TSV archive to a PostgreSQL COPY binary stream for the monerodarchive table:" << ENDL;
+    std::cout << "  COPY monerodarchive FROM STDIN WITH (FORMAT binary)" << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-pgload.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const std::string input_file = command_line::get_arg(vm, arg_input_file);
+  const std::string output_file = command_line::get_arg(vm, arg_output_file);
+  const std::string dictionary_file = command_line::get_arg(vm, arg_dictionary);
+  size_t n_threads = command_line::get_arg(vm, arg_threads);
+  if (n_threads == 0)
+    n_threads = std::max<unsigned>(tools::get_max_concurrency(), 1);
+
+  std::ofstream out_file;
+  if (!output_file.empty())
+  {
+    out_file.open(output_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out_file)
+    {
+      MERROR("Failed to open output file " << output_file);
+      return 1;
+    }
+  }
+  std::ostream &out = output_file.empty() ? std::cout : out_file;
+
+  archive_zstd_codec codec;
+  if (archive_zstd_codec::available())
+  {
+    std::string dictionary;
+    if (!dictionary_file.empty() && !epee::file_io_utils::load_file_to_string(dictionary_file, dictionary))
+    {
+      MERROR("Failed to read dictionary " << dictionary_file);
+      return 1;
+    }
+    codec.init(0, dictionary);
+  }
+
+  // segments in order, else the single archive file
+  std::vector<std::pair<std::string, bool>> inputs;
+  for (const archive_segment_info &segment: archive_list_segments(input_file))
+    inputs.push_back(std::make_pair(segment.data_filename, segment.compressed));
+  if (inputs.empty())
+    inputs.push_back(std::make_pair(input_file, false));
+
+  // ## COPY header
+  std::string header(pgcopy_signature, sizeof(pgcopy_signature));
+  put_be(header, 0, 4);  // flags
+  put_be(header, 0, 4);  // header extension length
+  out.write(header.data(), header.size());
+
+  const uint64_t started_us = now_us();
+  archive_pgload load(out, n_threads, command_line::get_arg(vm, arg_chunk_bytes));
+  for (const std::pair<std::string, bool> &input: inputs)
+  {
+    if (input.second && !archive_zstd_codec::available())
+    {
+      MERROR("Built without zstd, cannot read " << input.first);
+      return 1;
+    }
+    archive_input data;
+    if (!data.open(input.first, input.second, codec))
+    {
+      MERROR("Failed to open input file " << input.first);
+      return 1;
+    }
+    if (data.size() >= 4 && memcmp(data.data(), "MDAR", 4) == 0)
+    {
+      MERROR(input.first << " is a binary archive; convert it with monerod-archive-dump first");
+      return 1;
+    }
+    if (!load.run(input.first, data.data(), data.size()))
+      return 1;
+  }
+
+  // ## COPY trailer
+  std::string trailer;
+  put_be(trailer, 0xffff, 2);
+  out.write(trailer.data(), trailer.size());
+  out.flush();
+
+  const double seconds = std::max<uint64_t>(now_us() - started_us, 1) / 1e6;
+  MINFO("Converted " << load.n_rows << " lines from " << inputs.size() << " files, " << load.n_bytes_in << " bytes in, "
+    << load.n_bytes_out << " bytes out, " << (uint64_t)(load.n_bytes_in / seconds / 1000000) << " MB/s");
+  if (load.n_alt_chain_mismatches > 0)
+    MWARNING(load.n_alt_chain_mismatches << " lines have an n_alt_chains that differs from their Alt Chains Info JSON");
+  if (load.n_bad_lines > 0)
+  {
+    MWARNING("Skipped " << load.n_bad_lines << " malformed lines");
+    return 2;
+  }
+  return 0;
+
+  CATCH_ENTRY("Load error", 1);
+}
@@ -0,0 +1,875 @@
+// Copyright (c) 2018-2021, Neptune Research
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Part of MonerodArchive v17 by Neptune Research
+// ** File: src/blockchain_utilities/monerod_archive_replay.cpp
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "common/command_line.h"
+#include "common/util.h"
+#include "file_io_utils.h"
+#include "cryptonote_basic/account.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/cryptonote_tx_utils.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/archive_compress.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_segment.h"
+#include "cryptonote_core/archive_tsv.h"
+#include "blockchain_db/blockchain_db.h"
+#include "version.h"
+
+#undef MONERO_DEFAULT_LOG_CATEGORY
+#define MONERO_DEFAULT_LOG_CATEGORY "archive"
+
+namespace po = boost::program_options;
+using namespace cryptonote;
+
+namespace
+{
+  const char binary_magic[4] = { 'M', 'D', 'A', 'R' };
+
+  // heights a FAKECHAIN replay remembers blocks for, as parents of later alt blocks
+  const uint64_t rebase_window = 1000;
+
+  bool is_binary(const char *data, size_t size)
+  {
+    return size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+  }
+
+  uint64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // nearest rank
+  uint64_t percentile(const std::vector<uint64_t> &sorted, double q)
+  {
+    if (sorted.empty())
+      return 0;
+    const size_t rank = (size_t)std::ceil(q * sorted.size());
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+  }
+
+  /**
+   * @brief one archived block, as the replay feeds it back
+   */
+  struct replay_record
+  {
+    uint64_t nrt;          //!< 0 if unknown
+    bool is_alt_block;
+    uint64_t height;
+    uint64_t nch, nth;
+    bool full;             //!< b is the whole block, not only its header
+    block b;
+    crypto::hash hash;     //!< of the archived block
+    uint64_t n_outputs;    //!< of the miner tx, 0 if not known
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief read-only mapping of a whole file
+   */
+  class mapped_file
+  {
+  public:
+    mapped_file(): m_data(nullptr), m_size(0), m_mapped(false) {}
+    ~mapped_file() { close(); }
+
+    bool open(const std::string &filename)
+    {
+      close();
+#ifdef _WIN32
+      if (!epee::file_io_utils::load_file_to_string(filename, m_contents))
+        return false;
+      m_data = m_contents.data();
+      m_size = m_contents.size();
+      return true;
+#else
+      const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        ::close(fd);
+        return false;
+      }
+      m_size = st.st_size;
+      if (m_size == 0)
+      {
+        ::close(fd);
+        return true;
+      }
+      void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED)
+        return false;
+      ::madvise(p, m_size, MADV_SEQUENTIAL);
+      m_data = (const char*)p;
+      m_mapped = true;
+      return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+      if (m_mapped)
+        ::munmap((void*)m_data, m_size);
+#endif
+      m_mapped = false;
+      m_data = nullptr;
+      m_size = 0;
+      m_contents.clear();
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    const char *m_data;
+    size_t m_size;
+    bool m_mapped;
+    std::string m_contents;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief the records of an archive in file order, across its segments
+   *
+   * Files are memory mapped and read in place; compressed segments are
+   * decompressed one frame at a time.
+   */
+  class replay_reader
+  {
+  public:
+    replay_reader(const std::vector<std::pair<std::string, bool>> &files, archive_zstd_codec &codec):
+      n_records(0), n_bad_records(0), n_unrebuilt(0),
+      m_files(files), m_codec(codec), m_next_file(0),
+      m_compressed(false), m_frame_pos(0), m_new_file(false), m_binary(false), m_p(nullptr), m_end(nullptr)
+    {
+    }
+
+    /**
+     * @return false at the end of the archive, or if a file could not be read
+     */
+    bool next(replay_record &record)
+    {
+      while (true)
+      {
+        while (m_p == m_end)
+        {
+          if (!next_span())
+            return false;
+        }
+        if (m_binary ? next_binary(record) : next_line(record))
+        {
+          ++n_records;
+          return true;
+        }
+      }
+    }
+
+    uint64_t n_records;
+    uint64_t n_bad_records;
+    uint64_t n_unrebuilt;  //!< full TSV records whose block could not be rebuilt from the Block JSON
+
+  private:
+    // next frame of a compressed segment, or the next file
+    bool next_span()
+    {
+      if (m_compressed && m_frame_pos < m_file.size())
+      {
+        const size_t frame_size = archive_zstd_codec::frame_size(m_file.data() + m_frame_pos, m_file.size() - m_frame_pos);
+        if (frame_size == 0 || !m_codec.decompress(m_file.data() + m_frame_pos, frame_size, m_frame))
+        {
+          MWARNING("Corrupt or truncated frame at offset " << m_frame_pos << " in " << m_files[m_next_file - 1].first);
+          ++n_bad_records;
+          m_frame_pos = m_file.size();
+          return true;
+        }
+        m_frame_pos += frame_size;
+        set_span(m_frame.data(), m_frame.size());
+        return true;
+      }
+
+      if (m_next_file == m_files.size())
+        return false;
+      const std::pair<std::string, bool> &file = m_files[m_next_file++];
+      if (file.second && !archive_zstd_codec::available())
+      {
+        MERROR("Built without zstd, cannot read " << file.first);
+        return false;
+      }
+      if (!m_file.open(file.first))
+      {
+        MERROR("Failed to open input file " << file.first);
+        return false;
+      }
+      m_compressed = file.second;
+      m_frame_pos = 0;
+      m_new_file = true;
+      if (m_compressed)
+        m_p = m_end = nullptr;
+      else
+        set_span(m_file.data(), m_file.size());
+      return true;
+    }
+
+    void set_span(const char *data, size_t size)
+    {
+      // format from the first record of each file
+      if (m_new_file && size > 0)
+      {
+        m_binary = is_binary(data, size);
+        m_new_file = false;
+      }
+      m_p = data;
+      m_end = data + size;
+    }
+
+    bool next_binary(replay_record &record)
+    {
+      size_t consumed = 0;
+      const archive_parse_result r = archive_parse_binary_record(m_p, m_end - m_p, m_record, consumed);
+      if (r == archive_parse_result::ok)
+      {
+        m_p += consumed;
+        record.nrt = m_record.node_timestamp;
+        record.is_alt_block = m_record.is_alt_block;
+        record.height = m_record.block_height;
+        record.nch = m_record.current_height;
+        record.nth = m_record.target_height;
+        record.full = m_record.policy != archive_record_policy::header;
+        record.b = std::move(m_record.b);
+        record.hash = m_record.block_hash;
+        record.n_outputs = record.full ? record.b.miner_tx.vout.size() : 0;
+        return true;
+      }
+
+      // skip to the next record magic
+      ++n_bad_records;
+      const char *next = r == archive_parse_result::incomplete ? m_end :
+          std::search(m_p + 1, m_end, binary_magic, binary_magic + sizeof(binary_magic));
+      m_p = next;
+      return false;
+    }
+
+    bool next_line(replay_record &record)
+    {
+      const char *line = m_p;
+      m_p = archive_tsv_split(m_p, m_end, m_fields);
+      if (m_fields.n_fields == 1 && m_fields.begin[0] == m_fields.end[0])
+        return false;  // empty line
+
+      const char *line_end = m_p > line && m_p[-1] == '\n' ? m_p - 1 : m_p;
+      archive_tsv_block parsed;
+      if (m_fields.n_fields < 9 || !archive_check_line(line, line_end) ||
+          !archive_tsv_uint(m_fields.begin[1], m_fields.end[1], record.nrt) ||
+          !archive_tsv_bool(m_fields.begin[2], m_fields.end[2], record.is_alt_block) ||
+          !archive_tsv_parse_block(m_fields.begin[3], m_fields.end[3], parsed) ||
+          !archive_tsv_uint(m_fields.begin[7], m_fields.end[7], record.nch) ||
+          !archive_tsv_uint(m_fields.begin[8], m_fields.end[8], record.nth))
+      {
+        if (n_bad_records++ < 5)
+          MWARNING("Skipped a malformed line");
+        return false;
+      }
+
+      record.height = parsed.height;
+      record.full = !parsed.header_only;
+      if (record.full)
+      {
+        if (!archive_tsv_make_block(parsed, record.b))
+        {
+          if (n_unrebuilt++ < 5)
+            MWARNING("Skipped a line at height " << parsed.height << ": its block could not be rebuilt from the Block JSON");
+          return false;
+        }
+        record.hash = get_block_hash(record.b);
+        record.n_outputs = record.b.miner_tx.vout.size();
+      }
+      else
+      {
+        record.b = block();
+        record.b.major_version = parsed.major_version;
+        record.b.minor_version = parsed.minor_version;
+        record.b.timestamp = parsed.timestamp;
+        record.b.prev_id = parsed.prev_id;
+        record.b.nonce = parsed.nonce;
+        record.hash = parsed.hash;
+        record.n_outputs = 0;
+      }
+      return true;
+    }
+
+    const std::vector<std::pair<std::string, bool>> m_files;
+    archive_zstd_codec &m_codec;
+    size_t m_next_file;
+
+    mapped_file m_file;
+    bool m_compressed;
+    size_t m_frame_pos;   //!< of the next frame in a compressed segment
+    std::string m_frame;  //!< decompressed frame
+    bool m_new_file;      //!< its format is not known yet
+    bool m_binary;
+    const char *m_p;
+    const char *m_end;
+
+    archive_tsv_fields m_fields;
+    archive_record m_record;
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief moves archived blocks onto a FAKECHAIN, keeping their parent links
+   *
+   * Mainnet blocks can not be verified on a FAKECHAIN, so every record
+   * becomes a block with the archived timestamp and nonce and a fresh miner
+   * tx with as many outputs, on top of the rebased block of its archived
+   * parent.  The chain keeps the archive's shape: its alt blocks, the
+   * heights they fork at and the reorgs they cause.  Blocks carry no other
+   * transactions.
+   */
+  class fakechain_rebase
+  {
+  public:
+    fakechain_rebase(Blockchain &chain): n_unlinked(0), m_chain(chain)
+    {
+      m_miner.generate();
+    }
+
+    /**
+     * @brief builds the FAKECHAIN block of a record
+     *
+     * A record whose parent was never replayed, like the first one, goes
+     * on top of the current tail.
+     */
+    bool rebase(const replay_record &record, block &b)
+    {
+      // a block the archive has again is fed again, as the node was
+      const auto known = m_blocks.find(record.hash);
+      if (known != m_blocks.end())
+      {
+        b = known->second.b;
+        return true;
+      }
+
+      crypto::hash prev_id;
+      uint64_t height, already_generated_coins;
+      const auto parent = m_blocks.find(record.b.prev_id);
+      if (parent != m_blocks.end())
+      {
+        prev_id = parent->second.hash;
+        height = parent->second.height + 1;
+        already_generated_coins = parent->second.already_generated_coins;
+      }
+      else
+      {
+        ++n_unlinked;
+        height = m_chain.get_current_blockchain_height();
+        prev_id = m_chain.get_tail_id();
+        already_generated_coins = m_chain.get_db().get_block_already_generated_coins(height - 1);
+      }
+
+      b = block();
+      b.major_version = 1;
+      b.minor_version = 0;
+      b.timestamp = record.b.timestamp;
+      b.prev_id = prev_id;
+      b.nonce = record.b.nonce;
+      const size_t max_outs = std::max<uint64_t>(record.n_outputs, 1);
+      if (!construct_miner_tx(height, 0, already_generated_coins, 0, 0, m_miner.get_keys().m_account_address, b.miner_tx, blobdata(), max_outs, 1))
+      {
+        MERROR("Failed to construct a miner tx at height " << height);
+        return false;
+      }
+
+      rebased_block &r = m_blocks[record.hash];
+      r.b = b;
+      r.hash = get_block_hash(b);
+      r.height = height;
+      r.already_generated_coins = already_generated_coins + get_outs_money_amount(b.miner_tx);
+      m_order.push_back(std::make_pair(record.height, record.hash));
+      while (!m_order.empty() && m_order.front().first + rebase_window < record.height)
+      {
+        m_blocks.erase(m_order.front().second);
+        m_order.pop_front();
+      }
+      return true;
+    }
+
+    uint64_t n_unlinked;  //!< records whose archived parent was not replayed
+
+  private:
+    struct rebased_block
+    {
+      block b;
+      crypto::hash hash;
+      uint64_t height;
+      uint64_t already_generated_coins;  //!< including this block
+    };
+
+    Blockchain &m_chain;
+    account_base m_miner;
+    std::unordered_map<crypto::hash, rebased_block> m_blocks;      //!< by archived block hash
+    std::deque<std::pair<uint64_t, crypto::hash>> m_order;         //!< archived height and hash, oldest first
+  };
+
+  //-----------------------------------------------------------------------------------------------
+  /**
+   * @brief prints one result line per measured step, TSV or JSON lines
+   */
+  class reporter
+  {
+  public:
+    explicit reporter(bool json): m_json(json) {}
+
+    void header()
+    {
+      if (m_json)
+        return;
+      std::cout << "# monero " << MONERO_VERSION_FULL << ", archive version " << ARCHIVE_VERSION << ENDL;
+      std::cout << "benchmark\tcase\tsamples\tp50_ns\tp99_ns\tp999_ns\tmax_ns\trecords_per_sec" << ENDL;
+    }
+
+    void report(const std::string &benchmark, const std::string &name, std::vector<uint64_t> &samples)
+    {
+      if (samples.empty())
+        return;
+      std::sort(samples.begin(), samples.end());
+      uint64_t total_ns = 0;
+      for (uint64_t ns: samples)
+        total_ns += ns;
+      const double records_per_sec = total_ns > 0 ? samples.size() * 1e9 / total_ns : 0.0;
+
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"" << benchmark << "\",\"case\":\"" << name << "\""
+          << ",\"samples\":" << samples.size()
+          << ",\"p50_ns\":" << percentile(samples, 0.50)
+          << ",\"p99_ns\":" << percentile(samples, 0.99)
+          << ",\"p999_ns\":" << percentile(samples, 0.999)
+          << ",\"max_ns\":" << samples.back()
+          << ",\"records_per_sec\":" << (uint64_t)records_per_sec
+          << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\""
+          << ",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << benchmark << "\t" << name << "\t" << samples.size()
+          << "\t" << percentile(samples, 0.50)
+          << "\t" << percentile(samples, 0.99)
+          << "\t" << percentile(samples, 0.999)
+          << "\t" << samples.back()
+          << "\t" << (uint64_t)records_per_sec << ENDL;
+      }
+    }
+
+    void summary(const std::vector<std::pair<std::string, uint64_t>> &counts, double seconds)
+    {
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"replay\",\"seconds\":" << seconds;
+        for (const auto &c: counts)
+          std::cout << ",\"" << c.first << "\":" << c.second;
+        std::cout << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << "# replay: " << seconds << " s";
+        for (const auto &c: counts)
+          std::cout << ", " << c.first << " " << c.second;
+        std::cout << ENDL;
+      }
+    }
+
+    void writer_stats(const archive_writer::stats &s)
+    {
+      if (m_json)
+      {
+        std::cout << "{\"benchmark\":\"archive_writer\",\"pushed\":" << s.pushed << ",\"written\":" << s.written
+          << ",\"dropped\":" << s.dropped << ",\"write_failures\":" << s.write_failures << ",\"high_water\":" << s.high_water
+          << ",\"monero_version\":\"" << MONERO_VERSION_FULL << "\",\"archive_version\":" << ARCHIVE_VERSION << "}" << ENDL;
+      }
+      else
+      {
+        std::cout << "# archive writer: pushed " << s.pushed << ", written " << s.written << ", dropped " << s.dropped
+          << ", write failures " << s.write_failures << ", queue high water " << s.high_water << ENDL;
+      }
+    }
+
+  private:
+    bool m_json;
+  };
+
+  /**
+   * @brief samples of one archiving setting
+   */
+  struct replay_samples
+  {
+    std::vector<uint64_t> prepare, add_new_block, cleanup, locked;
+  };
+}
+
+int main(int argc, char* argv[])
+{
+  TRY_ENTRY();
+
+  epee::string_tools::set_module_name_and_folder(argv[0]);
+
+  tools::on_startup();
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_input_file = {"input-file", "Archive file, or base filename of a segmented archive, to replay", "/opt/monerodarchive/archive.log"};
+  const command_line::arg_descriptor<std::string> arg_dictionary = {"dictionary", "zstd dictionary the archive was compressed with", ""};
+  const command_line::arg_descriptor<bool> arg_fakechain = {"fakechain", "Replay onto a new FAKECHAIN database instead of the database in --data-dir", false};
+  const command_line::arg_descriptor<std::string> arg_scratch_dir = {"scratch-dir", "Directory for the replay's archive, and the database with --fakechain; a new temporary directory if empty", ""};
+  const command_line::arg_descriptor<std::string> arg_log_level = {"log-level", "0-4 or categories", ""};
+  const command_line::arg_descriptor<bool> arg_json = {"json", "Print results as JSON lines instead of TSV", false};
+  const command_line::arg_descriptor<bool> arg_binary = {"binary", "Archive the replay in the binary format instead of TSV", false};
+  const command_line::arg_descriptor<bool> arg_paced = {"paced", "Wait between blocks for the gaps between their NRTs, instead of replaying as fast as possible", false};
+  const command_line::arg_descriptor<double> arg_speed = {"speed", "With --paced, replay this many times faster than recorded", 1.0};
+  const command_line::arg_descriptor<std::string> arg_archive = {"archive", "Archiving during the replay: on, off, or alternate every --round-blocks blocks", "alternate"};
+  const command_line::arg_descriptor<size_t> arg_round_blocks = {"round-blocks", "Blocks per round with --archive alternate", 50};
+  const command_line::arg_descriptor<uint64_t> arg_max_records = {"max-records", "Stop after this many records, 0 for the whole archive", 0};
+
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_data_dir);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_testnet_on);
+  command_line::add_arg(desc_cmd_sett, cryptonote::arg_stagenet_on);
+  command_line::add_arg(desc_cmd_sett, arg_input_file);
+  command_line::add_arg(desc_cmd_sett, arg_dictionary);
+  command_line::add_arg(desc_cmd_sett, arg_fakechain);
+  command_line::add_arg(desc_cmd_sett, arg_scratch_dir);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_json);
+  command_line::add_arg(desc_cmd_sett, arg_binary);
+  command_line::add_arg(desc_cmd_sett, arg_paced);
+  command_line::add_arg(desc_cmd_sett, arg_speed);
+  command_line::add_arg(desc_cmd_sett, arg_archive);
+  command_line::add_arg(desc_cmd_sett, arg_round_blocks);
+  command_line::add_arg(desc_cmd_sett, arg_max_records);
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << "Replays the blocks of an archive through Blockchain::add_new_block in archive order, and reports" << ENDL;
+    std::cout << "Block Handler throughput, lock hold times and what archiving adds to them." << ENDL;
+    std::cout << "Without --fakechain the database in --data-dir is modified: use a copy." << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  mlog_configure(mlog_get_default_log_path("monerod-archive-replay.log"), true);
+  if (!command_line::is_arg_defaulted(vm, arg_log_level))
+    mlog_set_log(command_line::get_arg(vm, arg_log_level).c_str());
+  else
+    mlog_set_log(std::string(std::to_string(0) + ",archive:INFO").c_str());
+
+  const bool opt_testnet = command_line::get_arg(vm, cryptonote::arg_testnet_on);
+  const bool opt_stagenet = command_line::get_arg(vm, cryptonote::arg_stagenet_on);
+  if (opt_testnet && opt_stagenet)
+  {
+    MERROR("Can't specify more than one of --testnet and --stagenet");
+    return 1;
+  }
+  const bool fakechain = command_line::get_arg(vm, arg_fakechain);
+  const bool paced = command_line::get_arg(vm, arg_paced);
+  const double speed = command_line::get_arg(vm, arg_speed);
+  if (paced && !(speed > 0))
+  {
+    MERROR("--speed must be positive");
+    return 1;
+  }
+  const std::string archive_mode = command_line::get_arg(vm, arg_archive);
+  if (archive_mode != "on" && archive_mode != "off" && archive_mode != "alternate")
+  {
+    MERROR("--archive must be on, off or alternate");
+    return 1;
+  }
+  const size_t round_blocks = std::max<size_t>(command_line::get_arg(vm, arg_round_blocks), 1);
+  const uint64_t max_records = command_line::get_arg(vm, arg_max_records);
+
+  // ## archive to replay
+  const std::string input_file = command_line::get_arg(vm, arg_input_file);
+  std::vector<std::pair<std::string, bool>> files;
+  for (const archive_segment_info &segment: archive_list_segments(input_file))
+    files.push_back(std::make_pair(segment.data_filename, segment.compressed));
+  if (files.empty())
+    files.push_back(std::make_pair(input_file, false));
+
+  archive_zstd_codec codec;
+  if (archive_zstd_codec::available())
+  {
+    const std::string dictionary_file = command_line::get_arg(vm, arg_dictionary);
+    std::string dictionary;
+    if (!dictionary_file.empty() && !epee::file_io_utils::load_file_to_string(dictionary_file, dictionary))
+    {
+      MERROR("Failed to read dictionary " << dictionary_file);
+      return 1;
+    }
+    codec.init(0, dictionary);
+  }
+
+  replay_reader reader(files, codec);
+  replay_record record;
+  bool have_record = reader.next(record);
+  if (!have_record)
+  {
+    MERROR("No records to replay in " << input_file);
+    return 1;
+  }
+
+  // ## scratch directory: the replay's archive, and the FAKECHAIN database
+  boost::filesystem::path scratch_dir = command_line::get_arg(vm, arg_scratch_dir);
+  const bool remove_scratch_dir = scratch_dir.empty();
+  if (remove_scratch_dir)
+    scratch_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("monerod-archive-replay-%%%%-%%%%");
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(scratch_dir / "lmdb", ec);
+  if (ec)
+  {
+    MERROR("Failed to create " << scratch_dir.string() << ": " << ec.message());
+    return 1;
+  }
+
+  std::unique_ptr<Blockchain> core_storage;
+  tx_memory_pool m_mempool(*core_storage);
+  core_storage.reset(new Blockchain(m_mempool));
+
+  // the daemon's archive settings, recorded into the scratch directory
+  archive_writer_config archive_config = core_storage->archive_output_config();
+  archive_config.format = command_line::get_arg(vm, arg_binary) ? archive_output_format::binary : archive_output_format::tsv;
+  archive_config.file.filename = (scratch_dir / (archive_config.format == archive_output_format::binary ? "archive.bin" : "archive.log")).string();
+  archive_config.sinks.clear();
+  core_storage->archive_configure(archive_mode != "off", archive_config);
+
+  BlockchainDB *db = new_db();
+  if (db == NULL)
+  {
+    MERROR("Failed to initialize a database");
+    return 1;
+  }
+  const std::string db_filename = fakechain ? (scratch_dir / "lmdb").string() :
+      (boost::filesystem::path(command_line::get_arg(vm, cryptonote::arg_data_dir)) / db->get_db_name()).string();
+  MINFO("Loading blockchain from folder " << db_filename << " ...");
+  try
+  {
+    db->open(db_filename, DBF_FAST);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Error opening database: " << e.what());
+    delete db;
+    return 1;
+  }
+
+  static const std::pair<uint8_t, uint64_t> hard_forks[] = { std::make_pair(1, 0), std::make_pair(0, 0) };
+  const test_options options = { hard_forks, 0 };
+  const network_type nettype = fakechain ? FAKECHAIN : opt_testnet ? TESTNET : opt_stagenet ? STAGENET : MAINNET;
+  // FAKECHAIN: fixed difficulty 1, every nonce is a valid proof of work
+  if (!core_storage->init(db, nettype, true, fakechain ? &options : NULL, fakechain ? 1 : 0))
+  {
+    MERROR("Failed to initialize the blockchain");
+    return 1;
+  }
+  // popped blocks return their txs to the pool, and every one must stay until its block is replayed
+  m_mempool.init(std::numeric_limits<size_t>::max());
+
+  // ## offline database: back to the mainchain height the first record arrived at
+  if (!fakechain)
+  {
+    const uint64_t start_height = record.nch != 0 ? record.nch : record.height;
+    const uint64_t db_height = core_storage->get_current_blockchain_height();
+    if (db_height < start_height)
+    {
+      MERROR("The database ends at height " << db_height << ", the archive starts at " << start_height);
+      return 1;
+    }
+    MINFO("Popping " << db_height - start_height << " blocks to height " << start_height << " ...");
+    core_storage->pop_blocks(db_height - start_height);
+    core_storage->get_db().drop_alt_blocks();
+    core_storage->archive_alt_chain_cache_invalidate();
+    MINFO("Replaying onto height " << core_storage->get_current_blockchain_height() << ", " << m_mempool.get_transactions_count(true) << " txs in the pool");
+  }
+
+  fakechain_rebase rebase(*core_storage);
+  replay_samples on, off;
+  uint64_t n_main = 0, n_alt = 0, n_reorgs = 0, n_failed = 0, n_orphaned = 0, n_existing = 0, n_skipped = 0, n_mismatched = 0;
+  uint64_t n_replayed = 0;
+  const uint64_t first_nrt = record.nrt;
+  const uint64_t started_ns = now_ns();
+
+  // ## replay, through the same steps as a block received from a peer
+  for (; have_record && (max_records == 0 || reader.n_records <= max_records); have_record = reader.next(record))
+  {
+    block b;
+    if (fakechain)
+    {
+      if (!rebase.rebase(record, b))
+        return 1;
+    }
+    else if (record.full)
+    {
+      b = std::move(record.b);
+    }
+    else
+    {
+      // header-only records hold no miner tx to rebuild the block from
+      ++n_skipped;
+      continue;
+    }
+
+    if (paced && record.nrt >= first_nrt && first_nrt != 0)
+    {
+      const uint64_t due_ns = started_ns + (uint64_t)((record.nrt - first_nrt) * 1e6 / speed);
+      const uint64_t t = now_ns();
+      if (due_ns > t)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - t));
+    }
+
+    const bool archiving = archive_mode == "on" || (archive_mode == "alternate" && (n_replayed / round_blocks) % 2 == 0);
+    if (archive_mode == "alternate" && n_replayed % round_blocks == 0)
+      core_storage->archive_configure(archiving, archive_config);
+    replay_samples &samples = archiving ? on : off;
+
+    std::vector<block_complete_entry> entries(1);
+    entries[0].block = block_to_blob(b);
+    std::vector<block> pblocks;
+    const bool is_alt_block = b.prev_id != core_storage->get_tail_id();
+    const uint64_t chain_height = core_storage->get_current_blockchain_height();
+    block_verification_context bvc = {};
+
+    const archive_receive_time nrt = archive_receive_time::now();
+    const uint64_t t0 = now_ns();
+    if (!core_storage->prepare_handle_incoming_blocks(entries, pblocks))
+    {
+      MERROR("prepare_handle_incoming_blocks failed at record " << reader.n_records);
+      return 1;
+    }
+    const uint64_t t1 = now_ns();
+    core_storage->add_new_block(b, bvc, std::make_pair(fakechain ? chain_height : record.nch, fakechain ? chain_height : record.nth), nrt);
+    const uint64_t t2 = now_ns();
+    core_storage->cleanup_handle_incoming_blocks();
+    const uint64_t t3 = now_ns();
+
+    samples.prepare.push_back(t1 - t0);
+    samples.add_new_block.push_back(t2 - t1);
+    samples.cleanup.push_back(t3 - t2);
+    samples.locked.push_back(t3 - t0);
+    ++n_replayed;
+
+    if (bvc.m_verifivation_failed)
+      ++n_failed;
+    else if (bvc.m_marked_as_orphaned)
+      ++n_orphaned;
+    else if (bvc.m_already_exists)
+      ++n_existing;
+    else if (is_alt_block)
+      ++n_alt;
+    else
+      ++n_main;
+    if (is_alt_block && bvc.m_added_to_main_chain)
+      ++n_reorgs;
+    if (is_alt_block != record.is_alt_block)
+    {
+      if (n_mismatched++ < 5)
+        MWARNING("Record " << reader.n_records << " at height " << record.height << " was " << (record.is_alt_block ? "an alt" : "a main")
+          << " block when archived, and " << (is_alt_block ? "an alt" : "a main") << " block when replayed");
+    }
+    if (bvc.m_verifivation_failed && n_failed <= 5)
+      MWARNING("Record " << reader.n_records << " at height " << record.height << " failed verification");
+  }
+  const double seconds = std::max<uint64_t>(now_ns() - started_ns, 1) / 1e9;
+
+  reporter report(command_line::get_arg(vm, arg_json));
+  report.header();
+  report.report("prepare_handle_incoming_blocks", "archive=on", on.prepare);
+  report.report("prepare_handle_incoming_blocks", "archive=off", off.prepare);
+  report.report("add_new_block", "archive=on", on.add_new_block);
+  report.report("add_new_block", "archive=off", off.add_new_block);
+  report.report("cleanup_handle_incoming_blocks", "archive=on", on.cleanup);
+  report.report("cleanup_handle_incoming_blocks", "archive=off", off.cleanup);
+  // m_tx_pool is held from prepare to the end of cleanup, m_blockchain_lock throughout add_new_block
+  report.report("lock_hold", "archive=on", on.locked);
+  report.report("lock_hold", "archive=off", off.locked);
+  report.summary({
+    {"records", reader.n_records}, {"replayed", n_replayed}, {"blocks_per_sec", (uint64_t)(n_replayed / seconds)},
+    {"main", n_main}, {"alt", n_alt}, {"reorgs", n_reorgs}, {"failed", n_failed}, {"orphaned", n_orphaned},
+    {"already_existing", n_existing}, {"skipped_header_only", n_skipped}, {"mismatched", n_mismatched},
+    {"unlinked", rebase.n_unlinked}, {"malformed", reader.n_bad_records}, {"unrebuilt", reader.n_unrebuilt}}, seconds);
+  report.writer_stats(core_storage->archive_writer_stats());
+
+  core_storage->deinit();
+  if (remove_scratch_dir)
+    boost::filesystem::remove_all(scratch_dir, ec);
+  if (n_failed > 0 || n_mismatched > 0 || reader.n_bad_records > 0)
+    return 2;
+  return 0;
+
+  CATCH_ENTRY("Replay error", 1);
+}
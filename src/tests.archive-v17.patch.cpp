@@ -0,0 +1,1460 @@
+// Copyright (c) 2014-2018, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// ** Patched with MonerodArchive v17 by Neptune Research
+// ** SPDX-License-Identifier: BSD-3-Clause
+
+// The protocol handler is a template, so the test cores it is instantiated
+// with need the same handle_incoming_block() signature as cryptonote::core,
+// and archive_block_arrival().  The Block JSON and Alt Chains Info JSON
+// writers and the whole archive line get golden tests, checked against the
+// stringstream output they replaced, the segment writer a test of resuming
+// a segment whose index is only a header, the writer queue tests of its
+// ordering and overflow policies, the alt chain delta encoder a round trip
+// through the decoder, startup recovery and the file sink's spill to
+// memory tests of torn tails, checkpoints and held records, and binary
+// records, full, header-only and with the old 72 byte fixed part, a round
+// trip back to the same archive line and a resync past a corrupt record.
+// The tx store index gets lookups across grow(), colliding hash prefixes
+// and the reserved keys 0 and 1, and the store a restart after a crash.
+
+// ## File: tests/core_proxy/core_proxy.h, class tests::proxy_core
+
+    // <MonerodArchive (NRT)>
+    bool handle_incoming_block(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true, const cryptonote::archive_receive_time& archive_nrt = cryptonote::archive_receive_time());
+    // </MonerodArchive>
+
+    // <MonerodArchive (Arrivals)>
+    void archive_block_arrival(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const cryptonote::archive_receive_time& archive_nrt) {}
+    // </MonerodArchive>
+
+// ## File: tests/core_proxy/core_proxy.cpp
+
+// <MonerodArchive (NRT)>
+bool tests::proxy_core::handle_incoming_block(const cryptonote::blobdata& block_blob, const cryptonote::block *block_, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate, const cryptonote::archive_receive_time& archive_nrt) {
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/node_server.cpp, class test_core
+
+  // <MonerodArchive (NRT)>
+  bool handle_incoming_block(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true, const cryptonote::archive_receive_time& archive_nrt = cryptonote::archive_receive_time()) { return true; }
+  // </MonerodArchive>
+  // <MonerodArchive (Arrivals)>
+  void archive_block_arrival(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const cryptonote::archive_receive_time& archive_nrt) {}
+  // </MonerodArchive>
+
+// ## File: tests/unit_tests/ban.cpp, class test_core
+
+  // <MonerodArchive (NRT)>
+  bool handle_incoming_block(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true, const cryptonote::archive_receive_time& archive_nrt = cryptonote::archive_receive_time()) { return true; }
+  // </MonerodArchive>
+  // <MonerodArchive (Arrivals)>
+  void archive_block_arrival(const cryptonote::blobdata& block_blob, const cryptonote::block *block, cryptonote::archive_arrival_type type, const boost::uuids::uuid& connection_id, const epee::net_utils::network_address& address, const cryptonote::archive_receive_time& archive_nrt) {}
+  // </MonerodArchive>
+
+// ## File: tests/unit_tests/CMakeLists.txt, unit_tests_sources
+
+  # <MonerodArchive (Block JSON)>
+  archive_json.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Segments)>
+  archive_segment.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Writer)>
+  archive_queue.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Alt Delta)>
+  archive_alt_delta.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Recovery)>
+  archive_recovery.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Binary)>
+  archive_binary.cpp
+  # </MonerodArchive>
+  # <MonerodArchive (Tx Store)>
+  archive_tx_store.cpp
+  # </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_json.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Block JSON)>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "string_tools.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_json.h"
+
+namespace
+{
+  // Block JSON is compared byte for byte: archive consumers parse it as it
+  // is, so a change of spacing or key order breaks them just like a wrong value
+
+  std::string strip_spaces(const std::string &json)
+  {
+    // no key or value of a block holds a space, so this leaves only the structure
+    std::string out;
+    for (char c: json)
+      if (c != ' ' && c != '\n' && c != '\t' && c != '\r')
+        out += c;
+    return out;
+  }
+
+  void check_block_json(const std::string &blob_hex, const std::string &expected)
+  {
+    cryptonote::blobdata blob;
+    ASSERT_TRUE(epee::string_tools::parse_hexstr_to_binbuff(blob_hex, blob));
+    cryptonote::block b;
+    ASSERT_TRUE(cryptonote::parse_and_validate_block_from_blob(blob, b));
+
+    std::string json = "prefix";
+    ASSERT_TRUE(cryptonote::archive_block_json(b, json));
+    EXPECT_EQ("prefix" + expected, json);
+
+    std::string reference;
+    ASSERT_TRUE(cryptonote::archive_block_json_reference(b, reference));
+    EXPECT_EQ(expected, reference);
+
+    // obj_to_json_str() indents, otherwise it must write the same document
+    EXPECT_EQ(strip_spaces(cryptonote::obj_to_json_str(b)), strip_spaces(expected));
+  }
+
+  const char genesis_blob[] =
+    "010000000000000000000000000000000000000000000000000000000000000000000010270000013c01ff0001ffffff"
+    "ffffff03029b2e4c0281c0b02e7c53291a94d1d0cbff8883f8024f5142ee494ffbbd08807121017767aafcde9be00dcf"
+    "d098715ebcf7f410daebc582fda69d24a28e9d0bc890d100";
+
+  const char genesis_json[] =
+    "{\"major_version\": 1, \"minor_version\": 0, \"timestamp\": 0, "
+    "\"prev_id\": \"0000000000000000000000000000000000000000000000000000000000000000\", \"nonce\": 10000, "
+    "\"miner_tx\": {\"version\": 1, \"unlock_time\": 60, \"vin\": [ {\"gen\": {\"height\": 0}}], "
+    "\"vout\": [ {\"amount\": 17592186044415, "
+    "\"target\": {\"key\": \"9b2e4c0281c0b02e7c53291a94d1d0cbff8883f8024f5142ee494ffbbd088071\"}}], "
+    "\"extra\": [ 1, 119, 103, 170, 252, 222, 155, 224, 13, 207, 208, 152, 113, 94, 188, 247, 244, 16, "
+    "218, 235, 197, 130, 253, 166, 157, 36, 162, 142, 157, 11, 200, 144, 209], \"signatures\": [ ]}, "
+    "\"tx_hashes\": [ ]}";
+
+  // Alt Chains Info JSON as Blockchain::archive_alt_chain_info() wrote it
+  // with a stringstream before the archive writer thread
+  std::string alt_chain_info_json_reference(uint64_t chain_height, const std::vector<cryptonote::archive_alt_chain> &chains)
+  {
+    if (chains.empty())
+      return "[]";
+    std::stringstream altchains_json;
+    altchains_json << "[";
+    for (size_t i = 0; i < chains.size(); ++i)
+    {
+      const cryptonote::archive_alt_chain &chain = chains[i];
+      uint64_t start_height = (chain.height - chain.length + 1);
+      uint64_t deep = (chain_height - start_height - 1);
+      if (i > 0)
+        altchains_json << ",";
+      altchains_json << "{"
+                     << "\"length\"" << ":" << chain.length << ","
+                     << "\"height\"" << ":" << start_height << ","
+                     << "\"deep\""   << ":" << deep << ","
+                     << "\"diff\""   << ":" << chain.cumulative_difficulty << ","
+                     << "\"hash\""   << ":" << "\"" << epee::string_tools::pod_to_hex(chain.hash) << "\""
+                     << "}";
+    }
+    altchains_json << "]";
+    return altchains_json.str();
+  }
+
+  cryptonote::archive_alt_chain alt_chain(uint64_t length, uint64_t top, cryptonote::difficulty_type diff, const std::string &hash_hex)
+  {
+    cryptonote::archive_alt_chain c;
+    c.length = length;
+    c.height = top;
+    c.cumulative_difficulty = diff;
+    EXPECT_TRUE(epee::string_tools::hex_to_pod(hash_hex, c.hash));
+    return c;
+  }
+
+  // chains read at mainchain height 3000000, the last one past 64 bit difficulty
+  std::vector<cryptonote::archive_alt_chain> alt_chains()
+  {
+    return {
+      alt_chain(1, 2999999, 123456789012, "1111111111111111111111111111111111111111111111111111111111111111"),
+      alt_chain(3, 2999990, std::numeric_limits<uint64_t>::max(), "2222222222222222222222222222222222222222222222222222222222222222"),
+      alt_chain(2, 2999500, (cryptonote::difficulty_type(1) << 127) + 5, "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef")
+    };
+  }
+
+  const char alt_chains_json[] =
+    "[{\"length\":1,\"height\":2999999,\"deep\":0,\"diff\":123456789012,"
+    "\"hash\":\"1111111111111111111111111111111111111111111111111111111111111111\"},"
+    "{\"length\":3,\"height\":2999988,\"deep\":11,\"diff\":18446744073709551615,"
+    "\"hash\":\"2222222222222222222222222222222222222222222222222222222222222222\"},"
+    "{\"length\":2,\"height\":2999499,\"deep\":500,\"diff\":170141183460469231731687303715884105733,"
+    "\"hash\":\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\"}]";
+}
+
+// genesis block: v1 block, v1 miner tx, no txs
+TEST(archive_json, block_v1_miner_tx_v1)
+{
+  check_block_json(genesis_blob, genesis_json);
+}
+
+// v3 block, pre-RingCT miner tx with denominated outputs and an extra nonce, one tx
+TEST(archive_json, block_v3_miner_tx_v1)
+{
+  check_block_json(
+    "0303c0a5dab705555555555555555555555555555555555555555555555555555555555555555515cd5b0701fc843d01"
+    "ffc0843d0380d0acf30e02111111111111111111111111111111111111111111111111111111111111111180f092cbdd"
+    "080222222222222222222222222222222222222222222222222222222222222222228080a2a9eae80102333333333333"
+    "33333333333333333333333333333333333333333333333333332c014444444444444444444444444444444444444444"
+    "444444444444444444444444020901000000000000000001666666666666666666666666666666666666666666666666"
+    "6666666666666666",
+    "{\"major_version\": 3, \"minor_version\": 3, \"timestamp\": 1459000000, "
+    "\"prev_id\": \"5555555555555555555555555555555555555555555555555555555555555555\", \"nonce\": 123456789, "
+    "\"miner_tx\": {\"version\": 1, \"unlock_time\": 1000060, \"vin\": [ {\"gen\": {\"height\": 1000000}}], "
+    "\"vout\": [ {\"amount\": 4000000000, "
+    "\"target\": {\"key\": \"1111111111111111111111111111111111111111111111111111111111111111\"}}, "
+    "{\"amount\": 300000000000, "
+    "\"target\": {\"key\": \"2222222222222222222222222222222222222222222222222222222222222222\"}}, "
+    "{\"amount\": 8000000000000, "
+    "\"target\": {\"key\": \"3333333333333333333333333333333333333333333333333333333333333333\"}}], "
+    "\"extra\": [ 1, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, "
+    "68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 68, 2, 9, 1, 0, 0, 0, 0, 0, 0, 0, 0], \"signatures\": [ ]}, "
+    "\"tx_hashes\": [ \"6666666666666666666666666666666666666666666666666666666666666666\"]}");
+}
+
+// v12 block, RingCT miner tx, two txs
+TEST(archive_json, block_v12_miner_tx_v2)
+{
+  check_block_json(
+    "0c0c80a0f8fa059999999999999999999999999999999999999999999999999999999999999999ffffffff02fca38601"
+    "01ffc0a3860101cb89ec8ff7230277777777777777777777777777777777777777777777777777777777777777772101"
+    "88888888888888888888888888888888888888888888888888888888888888880002aaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"
+    "bbbb",
+    "{\"major_version\": 12, \"minor_version\": 12, \"timestamp\": 1600000000, "
+    "\"prev_id\": \"9999999999999999999999999999999999999999999999999999999999999999\", \"nonce\": 4294967295, "
+    "\"miner_tx\": {\"version\": 2, \"unlock_time\": 2200060, \"vin\": [ {\"gen\": {\"height\": 2200000}}], "
+    "\"vout\": [ {\"amount\": 1234567890123, "
+    "\"target\": {\"key\": \"7777777777777777777777777777777777777777777777777777777777777777\"}}], "
+    "\"extra\": [ 1, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, "
+    "136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136, 136], "
+    "\"rct_signatures\": {\"type\": 0}}, "
+    "\"tx_hashes\": [ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\", "
+    "\"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\"]}");
+}
+
+TEST(archive_json, unsupported_miner_tx)
+{
+  cryptonote::block b = AUTO_VAL_INIT(b);
+  b.miner_tx.version = 2;
+  b.miner_tx.vin.push_back(cryptonote::txin_gen{1});
+  b.miner_tx.rct_signatures.type = rct::RCTTypeFull;
+
+  std::string json = "prefix";
+  EXPECT_FALSE(cryptonote::archive_block_json(b, json));
+  EXPECT_EQ("prefix", json);
+}
+
+TEST(archive_json, alt_chain_info)
+{
+  const std::vector<cryptonote::archive_alt_chain> chains = alt_chains();
+  std::string json = "prefix";
+  cryptonote::archive_alt_chain_info_json(3000000, chains, json);
+  EXPECT_EQ(std::string("prefix") + alt_chains_json, json);
+  EXPECT_EQ(alt_chains_json, alt_chain_info_json_reference(3000000, chains));
+
+  json.clear();
+  cryptonote::archive_alt_chain_info_json(3000000, {}, json);
+  EXPECT_EQ("[]", json);
+  EXPECT_EQ("[]", alt_chain_info_json_reference(3000000, {}));
+}
+
+TEST(archive_json, archive_line)
+{
+  cryptonote::archive_record record;
+  cryptonote::blobdata blob;
+  ASSERT_TRUE(epee::string_tools::parse_hexstr_to_binbuff(genesis_blob, blob));
+  ASSERT_TRUE(cryptonote::parse_and_validate_block_from_blob(blob, record.b));
+  record.node_timestamp = 1600000000123;
+  record.node_timestamp_steady = 987654321;
+  record.receive_delay = 42;
+  record.block_height = 0;
+  record.block_hash = cryptonote::get_block_hash(record.b);
+  record.n_tx_hashes = 0;
+  record.chain_height = 3000000;
+  record.alt_chains = alt_chains();
+  record.current_height = 3000000;
+  record.target_height = 3000000;
+
+  const std::string expected = std::string("14\t1600000000123\t0\t") + genesis_json + "\t3\t" + alt_chains_json +
+    "\t1\t3000000\t3000000\t987654321\t42\t0\t6cbd766e\n";
+
+  std::string line = "prefix";
+  cryptonote::archive_line(record, line);
+  EXPECT_EQ("prefix" + expected, line);
+  EXPECT_TRUE(cryptonote::archive_check_line(line.data() + 6, line.data() + line.size() - 1));
+
+  // fields 1 to 9 as Blockchain::add_new_block() wrote them with a stringstream,
+  // then the fields added since and the Record CRC over all of them
+  std::stringstream reference;
+  reference << "" << cryptonote::ARCHIVE_VERSION
+            << '\t' << record.node_timestamp
+            << '\t' << (record.is_alt_block ? "1" : "0")
+            << '\t' << genesis_json
+            << '\t' << record.alt_chains.size()
+            << '\t' << alt_chain_info_json_reference(record.chain_height, record.alt_chains)
+            << '\t' << (record.current_height >= record.target_height ? "1" : "0")
+            << '\t' << record.current_height
+            << '\t' << record.target_height
+            << '\t' << record.node_timestamp_steady
+            << '\t' << record.receive_delay
+            << '\t' << (uint64_t)record.policy;
+  const std::string fields = reference.str();
+  char crc[9];
+  snprintf(crc, sizeof(crc), "%08x", cryptonote::archive_crc32c(0, fields.data(), fields.size()));
+  EXPECT_EQ(fields + '\t' + crc + '\n', expected);
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_segment.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Segments)>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/archive_segment.h"
+
+namespace
+{
+  class archive_segment_test: public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+      ASSERT_TRUE(boost::filesystem::create_directory(dir));
+      base = (dir / "archive.log").string();
+    }
+
+    void TearDown() override
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(dir, ec);
+    }
+
+    // an index header as written before rotation had a chance to add entries
+    void write_index_header(size_t entry_size)
+    {
+      std::string header;
+      cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_MAGIC, 4);
+      cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_VERSION, 2);
+      cryptonote::archive_put_le(header, cryptonote::ARCHIVE_INDEX_HEADER_SIZE, 2);
+      cryptonote::archive_put_le(header, entry_size, 2);
+      cryptonote::archive_put_le(header, 0, 2);
+      cryptonote::archive_put_le(header, 0, 2);
+      cryptonote::archive_put_le(header, 0, 2);
+      cryptonote::archive_put_le(header, 1, 8);
+      std::ofstream(cryptonote::archive_segment_filename(base, 1, ".idx"), std::ios::binary) << header;
+    }
+
+    void resume_and_write(const std::string &data)
+    {
+      std::ofstream(cryptonote::archive_segment_filename(base, 1), std::ios::binary) << data;
+
+      cryptonote::archive_file_config file;
+      file.filename = base;
+      cryptonote::archive_segment_config segments;
+      segments.max_bytes = 1024 * 1024;
+      cryptonote::archive_segment_writer writer;
+      ASSERT_TRUE(writer.open(file, segments, cryptonote::archive_output_format::tsv));
+      EXPECT_EQ(1, writer.segment_number());
+
+      std::string record = "14\t1\t0\t{}\t0\t[]\t1\t7\t7\t1\t0\t0\t00000000\n";
+      cryptonote::archive_index_entry entry = {};
+      entry.height = 7;
+      ASSERT_TRUE(writer.write(&record, &entry, 1));
+      writer.close();
+
+      cryptonote::archive_index_reader index;
+      ASSERT_TRUE(index.open(cryptonote::archive_segment_filename(base, 1, ".idx")));
+      ASSERT_EQ(1, index.size());
+      EXPECT_EQ(cryptonote::ARCHIVE_INDEX_ENTRY_SIZE, index.entry_size());
+      EXPECT_EQ(7, index.entry(0).height);
+      EXPECT_EQ(0, index.entry(0).offset);
+      EXPECT_EQ(record.size(), boost::filesystem::file_size(cryptonote::archive_segment_filename(base, 1)));
+    }
+
+    boost::filesystem::path dir;
+    std::string base;
+  };
+}
+
+TEST_F(archive_segment_test, resume_header_only_index)
+{
+  write_index_header(cryptonote::ARCHIVE_INDEX_ENTRY_SIZE);
+  resume_and_write("");
+}
+
+TEST_F(archive_segment_test, resume_header_only_v1_index)
+{
+  // entries are appended in the current layout, so the header must be rewritten
+  write_index_header(cryptonote::ARCHIVE_INDEX_ENTRY_SIZE_V1);
+  resume_and_write("");
+}
+
+TEST_F(archive_segment_test, resume_header_only_index_with_torn_record)
+{
+  write_index_header(cryptonote::ARCHIVE_INDEX_ENTRY_SIZE_V1);
+  resume_and_write("14\t1\t0\t{\"major");
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_queue.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Writer)>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/archive_queue.h"
+
+using cryptonote::archive_overflow_policy;
+using cryptonote::archive_queue;
+
+namespace
+{
+  void fill(archive_queue<int> &queue, int from, int to)
+  {
+    for (int i = from; i < to; ++i)
+      ASSERT_TRUE(queue.try_push(i));
+  }
+
+  std::vector<int> drain(archive_queue<int> &queue)
+  {
+    std::vector<int> values;
+    int v;
+    while (queue.try_pop(v))
+      values.push_back(v);
+    return values;
+  }
+}
+
+TEST(archive_queue, capacity_rounding)
+{
+  EXPECT_EQ(2, archive_queue<int>(0).capacity());
+  EXPECT_EQ(2, archive_queue<int>(1).capacity());
+  EXPECT_EQ(2, archive_queue<int>(2).capacity());
+  EXPECT_EQ(4, archive_queue<int>(3).capacity());
+  EXPECT_EQ(4096, archive_queue<int>(4096).capacity());
+  EXPECT_EQ(8192, archive_queue<int>(4097).capacity());
+
+  archive_queue<int> queue(5);
+  fill(queue, 0, 8);
+  int v = 8;
+  EXPECT_FALSE(queue.try_push(v));
+  EXPECT_EQ(8, v);
+  EXPECT_EQ(8, queue.size());
+}
+
+TEST(archive_queue, wraparound)
+{
+  // many times round the ring, at every fill level, in order
+  archive_queue<int> queue(4);
+  int next_push = 0, next_pop = 0;
+  for (int round = 0; round < 1000; ++round)
+  {
+    const int n = 1 + round % 4;
+    fill(queue, next_push, next_push + n);
+    next_push += n;
+    ASSERT_EQ(n, queue.size());
+    for (int v: drain(queue))
+      ASSERT_EQ(next_pop++, v);
+  }
+  EXPECT_EQ(next_push, next_pop);
+  int v;
+  EXPECT_FALSE(queue.try_pop(v));
+  EXPECT_EQ(0, queue.size());
+}
+
+TEST(archive_queue, multi_producer_stress)
+{
+  const int producers = 4, consumers = 2, per_producer = 100000;
+  archive_queue<int> queue(64);
+  std::vector<std::atomic<int>> seen(producers * per_producer);
+  for (std::atomic<int> &s: seen)
+    s = 0;
+  std::atomic<int> consumed(0);
+  std::atomic<bool> out_of_order(false);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p)
+    threads.emplace_back([&queue, p, per_producer]() {
+      for (int i = 0; i < per_producer; ++i)
+      {
+        int v = p * per_producer + i;
+        while (!queue.try_push(v))
+          std::this_thread::yield();
+      }
+    });
+  for (int c = 0; c < consumers; ++c)
+    threads.emplace_back([&]() {
+      // values of one producer come out of the queue in the order they went in
+      std::vector<int> last(producers, -1);
+      while (consumed < producers * per_producer)
+      {
+        int v;
+        if (!queue.try_pop(v))
+        {
+          std::this_thread::yield();
+          continue;
+        }
+        ++seen[v];
+        if (v % per_producer <= last[v / per_producer])
+          out_of_order = true;
+        last[v / per_producer] = v % per_producer;
+        ++consumed;
+      }
+    });
+  for (std::thread &t: threads)
+    t.join();
+
+  EXPECT_FALSE(out_of_order);
+  for (size_t i = 0; i < seen.size(); ++i)
+    ASSERT_EQ(1, seen[i]) << "value " << i;
+  EXPECT_EQ(0, queue.size());
+}
+
+TEST(archive_queue, drop_newest)
+{
+  archive_queue<int> queue(4);
+  std::atomic<uint64_t> dropped(0), high_water(0);
+  const auto never = []() { return false; };
+  for (int i = 0; i < 6; ++i)
+  {
+    int v = i;
+    EXPECT_EQ(i < 4, cryptonote::archive_queue_push(queue, v, archive_overflow_policy::drop_newest, dropped, high_water, never));
+  }
+  EXPECT_EQ(2, dropped);
+  EXPECT_EQ(4, high_water);
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}), drain(queue));
+}
+
+TEST(archive_queue, drop_oldest)
+{
+  archive_queue<int> queue(4);
+  std::atomic<uint64_t> dropped(0), high_water(0);
+  const auto never = []() { return false; };
+  for (int i = 0; i < 6; ++i)
+  {
+    int v = i;
+    EXPECT_TRUE(cryptonote::archive_queue_push(queue, v, archive_overflow_policy::drop_oldest, dropped, high_water, never));
+  }
+  EXPECT_EQ(2, dropped);
+  EXPECT_EQ(4, high_water);
+  EXPECT_EQ(std::vector<int>({2, 3, 4, 5}), drain(queue));
+}
+
+TEST(archive_queue, drop_oldest_concurrent)
+{
+  // producers popping from their side race the consumer; every value is
+  // consumed, dropped or still queued, exactly once
+  const int producers = 4, per_producer = 50000;
+  archive_queue<int> queue(16);
+  std::atomic<uint64_t> dropped(0), high_water(0);
+  std::atomic<bool> done(false);
+  std::atomic<uint64_t> consumed(0);
+
+  std::thread consumer([&]() {
+    int v;
+    while (!done)
+      if (queue.try_pop(v))
+        ++consumed;
+  });
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p)
+    threads.emplace_back([&, p]() {
+      for (int i = 0; i < per_producer; ++i)
+      {
+        int v = p * per_producer + i;
+        cryptonote::archive_queue_push(queue, v, archive_overflow_policy::drop_oldest, dropped, high_water, []() { return false; });
+      }
+    });
+  for (std::thread &t: threads)
+    t.join();
+  done = true;
+  consumer.join();
+
+  EXPECT_EQ((uint64_t)producers * per_producer, consumed + dropped + drain(queue).size());
+  EXPECT_LE(high_water, queue.capacity());
+}
+
+TEST(archive_queue, block)
+{
+  archive_queue<int> queue(4);
+  std::atomic<uint64_t> dropped(0), high_water(0);
+  fill(queue, 0, 4);
+
+  // the writer makes room while the producer waits
+  int waits = 0;
+  int v = 4;
+  EXPECT_TRUE(cryptonote::archive_queue_push(queue, v, archive_overflow_policy::block, dropped, high_water, [&]() {
+    int popped;
+    if (++waits == 3)
+      EXPECT_TRUE(queue.try_pop(popped));
+    return true;
+  }));
+  EXPECT_EQ(3, waits);
+  EXPECT_EQ(0, dropped);
+  EXPECT_EQ(4, high_water);
+
+  // stopping: the producer gives up and the record is dropped
+  v = 5;
+  EXPECT_FALSE(cryptonote::archive_queue_push(queue, v, archive_overflow_policy::block, dropped, high_water, []() { return false; }));
+  EXPECT_EQ(1, dropped);
+  EXPECT_EQ(std::vector<int>({1, 2, 3, 4}), drain(queue));
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_alt_delta.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Alt Delta)>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/archive_alt_delta.h"
+
+using cryptonote::archive_alt_chain;
+using cryptonote::archive_parse_result;
+using cryptonote::archive_record;
+
+namespace
+{
+  archive_alt_chain chain(uint64_t id, uint64_t length, uint64_t top, cryptonote::difficulty_type diff)
+  {
+    archive_alt_chain c;
+    c.id = id;
+    c.length = length;
+    c.height = top;
+    c.cumulative_difficulty = diff;
+    c.hash = crypto::null_hash;
+    c.hash.data[0] = id;
+    c.hash.data[31] = length;
+    return c;
+  }
+
+  archive_record record(uint64_t chain_height, const std::vector<archive_alt_chain> &chains)
+  {
+    archive_record r;
+    r.chain_height = chain_height;
+    r.alt_chains = chains;
+    return r;
+  }
+
+  std::string encode(cryptonote::archive_alt_chain_encoder &encoder, const archive_record &r)
+  {
+    std::string field;
+    encoder.encode(r, field);
+    return field;
+  }
+
+  archive_parse_result decode(cryptonote::archive_alt_chain_decoder &decoder, const std::string &field, const archive_record &r)
+  {
+    return decoder.decode(field.data(), field.data() + field.size(), r.alt_chains.size());
+  }
+
+  // what a writer without delta encoding writes for r
+  std::string array(const archive_record &r)
+  {
+    std::string json;
+    return cryptonote::archive_alt_chain_info_json(r, json);
+  }
+
+  std::string decoded(const cryptonote::archive_alt_chain_decoder &decoder)
+  {
+    std::string json;
+    return decoder.json(json);
+  }
+
+  bool is_snapshot(const std::string &field)
+  {
+    return cryptonote::archive_alt_chain_is_snapshot(field.data(), field.data() + field.size());
+  }
+
+  // chains coming and going over a few blocks, ids as archive_alt_chain_cache gives them
+  std::vector<archive_record> history()
+  {
+    const cryptonote::difficulty_type big = (cryptonote::difficulty_type(1) << 100) + 12345;
+    std::vector<archive_record> records;
+    records.push_back(record(100, {}));
+    records.push_back(record(101, {chain(1, 1, 100, 1000)}));                                          // add
+    records.push_back(record(101, {chain(1, 1, 100, 1000)}));                                          // unchanged
+    records.push_back(record(102, {chain(1, 2, 101, 2000), chain(2, 1, 101, big)}));                  // extend, add
+    records.push_back(record(102, {chain(2, 1, 101, big), chain(1, 2, 101, 2000)}));                  // order
+    records.push_back(record(103, {chain(2, 2, 102, big + 1), chain(3, 1, 102, 3000)}));              // remove, extend, add
+    records.push_back(record(103, {chain(3, 1, 102, 3000), chain(2, 1, 101, big)}));                  // cut back, order
+    records.push_back(record(104, {}));                                                                // remove all
+    records.push_back(record(104, {chain(4, 3, 103, 4000), chain(5, 1, 104, 5000), chain(6, 1, 104, 6000)}));
+    records.push_back(record(105, {chain(6, 1, 104, 6000), chain(4, 3, 103, 4000)}));                 // remove, order
+    return records;
+  }
+}
+
+TEST(archive_alt_delta, round_trip)
+{
+  cryptonote::archive_alt_chain_encoder encoder(0);
+  cryptonote::archive_alt_chain_decoder decoder;
+  const std::vector<archive_record> records = history();
+  for (size_t i = 0; i < records.size(); ++i)
+  {
+    const std::string field = encode(encoder, records[i]);
+    EXPECT_EQ(i == 0, is_snapshot(field)) << field;
+    ASSERT_EQ(archive_parse_result::ok, decode(decoder, field, records[i])) << field;
+    EXPECT_TRUE(decoder.delta());
+    EXPECT_EQ(array(records[i]), decoded(decoder)) << field;
+  }
+}
+
+TEST(archive_alt_delta, members)
+{
+  const cryptonote::difficulty_type big = (cryptonote::difficulty_type(1) << 100) + 12345;
+  cryptonote::archive_alt_chain_encoder encoder(0);
+  encode(encoder, record(101, {chain(1, 1, 100, 1000), chain(2, 1, 100, 900)}));
+  EXPECT_EQ("{\"chain_height\":101}", encode(encoder, record(101, {chain(1, 1, 100, 1000), chain(2, 1, 100, 900)})));
+  EXPECT_EQ("{\"chain_height\":102,\"remove\":[2],\"add\":[{\"id\":3,\"length\":1,\"top\":101,\"diff\":1267650600228229401496703217721,\"hash\":\"0300000000000000000000000000000000000000000000000000000000000001\"}],"
+      "\"extend\":[{\"id\":1,\"length\":2,\"top\":101,\"diff\":2000,\"hash\":\"0100000000000000000000000000000000000000000000000000000000000002\"}]}",
+      encode(encoder, record(102, {chain(1, 2, 101, 2000), chain(3, 1, 101, big)})));
+  EXPECT_EQ("{\"chain_height\":102,\"order\":[3,1]}", encode(encoder, record(102, {chain(3, 1, 101, big), chain(1, 2, 101, 2000)})));
+}
+
+TEST(archive_alt_delta, header_only_lines)
+{
+  cryptonote::archive_alt_chain_encoder encoder(2);
+  cryptonote::archive_alt_chain_decoder decoder;
+  archive_record full = record(101, {chain(1, 1, 100, 1000)});
+  archive_record header = record(101, {});
+  header.policy = cryptonote::archive_record_policy::header;
+
+  // header-only lines keep the array and leave the chains of the line before in place
+  for (archive_record *r: {&full, &header, &header, &full, &full})
+  {
+    const std::string field = encode(encoder, *r);
+    ASSERT_EQ(archive_parse_result::ok, decode(decoder, field, *r)) << field;
+    EXPECT_EQ(array(*r), decoded(decoder)) << field;
+    EXPECT_EQ(r == &full, decoder.delta()) << field;
+  }
+}
+
+TEST(archive_alt_delta, snapshot_interval)
+{
+  cryptonote::archive_alt_chain_encoder encoder(3);
+  const archive_record r = record(101, {chain(1, 1, 100, 1000)});
+  for (size_t i = 0; i < 10; ++i)
+    EXPECT_EQ(i % 3 == 0, is_snapshot(encode(encoder, r))) << i;
+}
+
+TEST(archive_alt_delta, mid_stream_start)
+{
+  cryptonote::archive_alt_chain_encoder encoder(4);
+  const std::vector<archive_record> records = history();
+  std::vector<std::string> fields;
+  for (const archive_record &r: records)
+    fields.push_back(encode(encoder, r));
+
+  // a reader starting at line 2 has nothing to apply deltas to until the snapshot on line 4
+  cryptonote::archive_alt_chain_decoder decoder;
+  for (size_t i = 2; i < records.size(); ++i)
+  {
+    const archive_parse_result r = decode(decoder, fields[i], records[i]);
+    if (i < 4)
+    {
+      EXPECT_EQ(archive_parse_result::incomplete, r) << fields[i];
+      continue;
+    }
+    ASSERT_EQ(archive_parse_result::ok, r) << fields[i];
+    EXPECT_EQ(array(records[i]), decoded(decoder)) << fields[i];
+  }
+}
+
+TEST(archive_alt_delta, reset_after_lost_lines)
+{
+  cryptonote::archive_alt_chain_encoder encoder(0);
+  cryptonote::archive_alt_chain_decoder decoder;
+  const archive_record before = record(101, {chain(1, 1, 100, 1000)});
+  const archive_record lost = record(102, {chain(1, 1, 100, 1000), chain(2, 1, 101, 2000)});
+  const archive_record after = record(102, {chain(1, 1, 100, 1000), chain(2, 1, 101, 2000)});
+
+  ASSERT_EQ(archive_parse_result::ok, decode(decoder, encode(encoder, before), before));
+
+  // without a reset the next line builds on the lost one, and does not fit
+  cryptonote::archive_alt_chain_encoder unreset = encoder;
+  encode(unreset, lost);
+  cryptonote::archive_alt_chain_decoder unreset_decoder = decoder;
+  EXPECT_EQ(archive_parse_result::corrupt, decode(unreset_decoder, encode(unreset, after), after));
+
+  encode(encoder, lost);
+  encoder.reset();
+  const std::string field = encode(encoder, after);
+  EXPECT_TRUE(is_snapshot(field));
+  ASSERT_EQ(archive_parse_result::ok, decode(decoder, field, after));
+  EXPECT_EQ(array(after), decoded(decoder));
+}
+
+TEST(archive_alt_delta, dropped_held_writes)
+{
+  // the archive writer starts afresh after each write a file sink held, and
+  // the sink drops held writes whole, so whatever is left starts with a snapshot
+  cryptonote::archive_alt_chain_encoder encoder(0);
+  const std::vector<archive_record> records = history();
+  std::vector<std::string> fields;
+  for (size_t i = 0; i < records.size(); ++i)
+  {
+    if (i % 3 == 0)
+      encoder.reset();
+    fields.push_back(encode(encoder, records[i]));
+  }
+
+  cryptonote::archive_alt_chain_decoder decoder;
+  for (size_t i = 3; i < records.size(); ++i)
+  {
+    ASSERT_EQ(archive_parse_result::ok, decode(decoder, fields[i], records[i])) << fields[i];
+    EXPECT_EQ(array(records[i]), decoded(decoder)) << fields[i];
+  }
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_recovery.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Recovery)>
+#include <fstream>
+#include <iterator>
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/archive_recovery.h"
+#include "cryptonote_core/archive_sink.h"
+
+namespace
+{
+  // a line of the current version with a matching Record CRC
+  std::string archive_line(uint64_t height)
+  {
+    std::string line = "14\t" + std::to_string(height) + "\t0\t{}\t0\t[]\t1\t" + std::to_string(height) + "\t" + std::to_string(height) + "\t1\t0\t0";
+    const uint32_t crc = cryptonote::archive_crc32c(0, line.data(), line.size());
+    static const char hex[] = "0123456789abcdef";
+    line += '\t';
+    for (int shift = 28; shift >= 0; shift -= 4)
+      line += hex[(crc >> shift) & 0xf];
+    return line + '\n';
+  }
+
+  class archive_recovery_test: public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+      ASSERT_TRUE(boost::filesystem::create_directory(dir));
+      base = (dir / "archive.log").string();
+    }
+
+    void TearDown() override
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(dir, ec);
+    }
+
+    std::string contents() const
+    {
+      std::ifstream in(base, std::ios::binary);
+      return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // a checkpoint as the writer leaves it after the first n bytes of data
+    void write_checkpoint(const std::string &data, size_t n, uint64_t records, uint64_t height)
+    {
+      cryptonote::archive_checkpoint checkpoint;
+      checkpoint.offset = n;
+      checkpoint.records = records;
+      checkpoint.height = height;
+      const size_t tail_size = std::min<size_t>(cryptonote::ARCHIVE_CHECKPOINT_TAIL_SIZE, n);
+      checkpoint.tail_crc = cryptonote::archive_crc32c(0, data.data() + n - tail_size, tail_size);
+      ASSERT_TRUE(cryptonote::archive_write_checkpoint(cryptonote::archive_checkpoint_filename(base), checkpoint));
+    }
+
+    // opens the archive as the writer does on startup, then appends one record
+    void resume(uint64_t height, cryptonote::archive_index_entry &entry, uint64_t &recovered_bytes)
+    {
+      cryptonote::archive_file_config file;
+      file.filename = base;
+      cryptonote::archive_segment_writer writer;
+      ASSERT_TRUE(writer.open(file, cryptonote::archive_segment_config(), cryptonote::archive_output_format::tsv));
+      recovered_bytes = writer.recovered_bytes();
+      const std::string record = archive_line(height);
+      entry = cryptonote::archive_index_entry();
+      entry.height = height;
+      ASSERT_TRUE(writer.write(&record, &entry, 1));
+      writer.close();
+    }
+
+    boost::filesystem::path dir;
+    std::string base;
+  };
+}
+
+TEST_F(archive_recovery_test, torn_tail_with_bad_crc)
+{
+  const std::string intact = archive_line(1) + archive_line(2) + archive_line(3);
+  std::string damaged = archive_line(4);
+  damaged[damaged.size() - 2] = damaged[damaged.size() - 2] == '0' ? '1' : '0';
+  const std::string torn = archive_line(5).substr(0, 10);
+  std::ofstream(base, std::ios::binary) << intact << damaged << torn;
+
+  uint64_t records;
+  EXPECT_EQ(intact.size(), cryptonote::archive_scan_tail(base, cryptonote::archive_output_format::tsv, 0, records));
+  EXPECT_EQ(3, records);
+
+  // the complete line with a bad Record CRC goes with the torn one after it
+  cryptonote::archive_index_entry entry;
+  uint64_t recovered_bytes;
+  resume(6, entry, recovered_bytes);
+  EXPECT_EQ(damaged.size() + torn.size(), recovered_bytes);
+  EXPECT_EQ(intact + archive_line(6), contents());
+}
+
+TEST_F(archive_recovery_test, checkpoint)
+{
+  const std::string data = archive_line(1) + archive_line(2) + archive_line(3);
+  std::ofstream(base, std::ios::binary) << data << archive_line(4).substr(0, 10);
+  write_checkpoint(data, archive_line(1).size() + archive_line(2).size(), 2, 2);
+
+  // only the records after the checkpoint are checked, and sequence numbers carry on
+  cryptonote::archive_index_entry entry;
+  uint64_t recovered_bytes;
+  resume(4, entry, recovered_bytes);
+  EXPECT_EQ(10, recovered_bytes);
+  EXPECT_EQ(cryptonote::archive_sequence(0, 3), entry.sequence);
+  EXPECT_EQ(data + archive_line(4), contents());
+}
+
+TEST_F(archive_recovery_test, stale_checkpoint)
+{
+  // the checkpoint of a file that was since replaced by a shorter one with other records
+  const std::string old_data = archive_line(100) + archive_line(101) + archive_line(102);
+  write_checkpoint(old_data, old_data.size() - 5, 3, 102);
+  const std::string data = archive_line(1) + archive_line(2);
+  std::ofstream(base, std::ios::binary) << data;
+
+  cryptonote::archive_index_entry entry;
+  uint64_t recovered_bytes;
+  resume(3, entry, recovered_bytes);
+  EXPECT_EQ(0, recovered_bytes);
+  EXPECT_EQ(data + archive_line(3), contents());
+}
+
+TEST_F(archive_recovery_test, mismatched_checkpoint)
+{
+  // same size, but the bytes before the checkpoint offset differ: its offset would cut a line in half
+  const std::string old_data = archive_line(10) + archive_line(11);
+  const std::string data = archive_line(1) + archive_line(2) + archive_line(3) + archive_line(4);
+  write_checkpoint(old_data, old_data.size(), 2, 11);
+  std::ofstream(base, std::ios::binary) << data;
+
+  cryptonote::archive_index_entry entry;
+  uint64_t recovered_bytes;
+  resume(5, entry, recovered_bytes);
+  EXPECT_EQ(0, recovered_bytes);
+  EXPECT_EQ(data + archive_line(5), contents());
+}
+
+TEST_F(archive_recovery_test, spill_then_retry)
+{
+  // the archive directory going away makes every write fail until it is back
+  const boost::filesystem::path archive_dir = dir / "archive";
+  ASSERT_TRUE(boost::filesystem::create_directory(archive_dir));
+  cryptonote::archive_file_config file;
+  file.filename = (archive_dir / "archive.log").string();
+  file.reopen_check_ms = 0;
+  file.checkpoint_interval_ms = 0;
+  cryptonote::archive_spill_config spill;
+  spill.retry_interval_ms = 0;
+  cryptonote::archive_file_sink sink;
+  ASSERT_TRUE(sink.open(file, cryptonote::archive_segment_config(), cryptonote::archive_output_format::tsv, cryptonote::archive_compression_config(),
+      cryptonote::archive_feed_config(), spill));
+
+  std::string records[4];
+  cryptonote::archive_index_entry entries[4];
+  for (int i = 0; i < 4; ++i)
+    records[i] = archive_line(i + 1);
+  ASSERT_TRUE(boost::filesystem::remove_all(archive_dir));
+
+  EXPECT_EQ(cryptonote::archive_write_result::held, sink.write(records, entries, 1));
+  EXPECT_EQ(cryptonote::archive_write_result::held, sink.write(records + 1, entries + 1, 2));
+  cryptonote::archive_sink_stats stats = sink.stats();
+  EXPECT_EQ(3, stats.spilled);
+  EXPECT_EQ(0, stats.spill_written);
+  EXPECT_EQ(records[0].size() + records[1].size() + records[2].size(), stats.spill_bytes);
+
+  // held records go first, in order, and only then count as written
+  ASSERT_TRUE(boost::filesystem::create_directory(archive_dir));
+  EXPECT_EQ(cryptonote::archive_write_result::written, sink.write(records + 3, entries + 3, 1));
+  stats = sink.stats();
+  EXPECT_EQ(3, stats.spill_written);
+  EXPECT_EQ(records[0].size() + records[1].size() + records[2].size(), stats.spill_written_bytes);
+  EXPECT_EQ(0, stats.spill_bytes);
+  EXPECT_EQ(0, stats.spill_dropped);
+  sink.close();
+
+  std::ifstream in(file.filename, std::ios::binary);
+  EXPECT_EQ(records[0] + records[1] + records[2] + records[3], std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+}
+
+TEST_F(archive_recovery_test, spill_drops_whole_writes)
+{
+  const boost::filesystem::path archive_dir = dir / "archive";
+  ASSERT_TRUE(boost::filesystem::create_directory(archive_dir));
+  cryptonote::archive_file_config file;
+  file.filename = (archive_dir / "archive.log").string();
+  file.reopen_check_ms = 0;
+  file.checkpoint_interval_ms = 0;
+  std::string records[4];
+  cryptonote::archive_index_entry entries[4];
+  for (int i = 0; i < 4; ++i)
+    records[i] = archive_line(i + 1);
+  cryptonote::archive_spill_config spill;
+  spill.retry_interval_ms = 0;
+  spill.max_bytes = records[0].size() * 2 + 1;
+  cryptonote::archive_file_sink sink;
+  ASSERT_TRUE(sink.open(file, cryptonote::archive_segment_config(), cryptonote::archive_output_format::tsv, cryptonote::archive_compression_config(),
+      cryptonote::archive_feed_config(), spill));
+  ASSERT_TRUE(boost::filesystem::remove_all(archive_dir));
+
+  // the second write only fits without the first; the third only without the second, whole
+  EXPECT_EQ(cryptonote::archive_write_result::held, sink.write(records, entries, 1));
+  EXPECT_EQ(cryptonote::archive_write_result::held, sink.write(records + 1, entries + 1, 2));
+  EXPECT_EQ(1, sink.stats().spill_dropped);
+  EXPECT_EQ(cryptonote::archive_write_result::held, sink.write(records + 3, entries + 3, 1));
+  EXPECT_EQ(3, sink.stats().spill_dropped);
+
+  ASSERT_TRUE(boost::filesystem::create_directory(archive_dir));
+  sink.close();
+  EXPECT_EQ(1, sink.stats().spill_written);
+  std::ifstream in(file.filename, std::ios::binary);
+  EXPECT_EQ(records[3], std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_binary.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Binary)>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+#include "string_tools.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/archive_format.h"
+
+using cryptonote::archive_parse_result;
+using cryptonote::archive_record;
+
+namespace
+{
+  // a decoded binary record must give the same archive line as the record
+  // it was written from, so monerod-archive-dump output matches a TSV archive
+
+  // v3 block with one tx, as in archive_json.cpp
+  const char block_blob[] =
+    "0303c0a5dab705555555555555555555555555555555555555555555555555555555555555555515cd5b0701fc843d01"
+    "ffc0843d0380d0acf30e02111111111111111111111111111111111111111111111111111111111111111180f092cbdd"
+    "080222222222222222222222222222222222222222222222222222222222222222228080a2a9eae80102333333333333"
+    "33333333333333333333333333333333333333333333333333332c014444444444444444444444444444444444444444"
+    "444444444444444444444444020901000000000000000001666666666666666666666666666666666666666666666666"
+    "6666666666666666";
+
+  cryptonote::archive_alt_chain alt_chain(uint64_t length, uint64_t top, cryptonote::difficulty_type diff, uint8_t hash_byte)
+  {
+    cryptonote::archive_alt_chain c;
+    c.length = length;
+    c.height = top;
+    c.cumulative_difficulty = diff;
+    memset(c.hash.data, hash_byte, sizeof(c.hash.data));
+    return c;
+  }
+
+  archive_record full_record(uint64_t node_timestamp)
+  {
+    archive_record r;
+    cryptonote::blobdata blob;
+    EXPECT_TRUE(epee::string_tools::parse_hexstr_to_binbuff(block_blob, blob));
+    EXPECT_TRUE(cryptonote::parse_and_validate_block_from_blob(blob, r.b, r.block_hash));
+    r.node_timestamp = node_timestamp;
+    r.node_timestamp_steady = 987654321;
+    r.receive_delay = 42;
+    r.is_alt_block = true;
+    r.block_height = 1000000;
+    r.n_tx_hashes = r.b.tx_hashes.size();
+    r.chain_height = 1000005;
+    r.alt_chains = {alt_chain(1, 1000000, 123456789012, 0x11), alt_chain(2, 999990, (cryptonote::difficulty_type(1) << 127) + 5, 0x22)};
+    r.current_height = 1000005;
+    r.target_height = 1000010;
+    return r;
+  }
+
+  archive_record header_record(uint64_t node_timestamp)
+  {
+    const archive_record full = full_record(node_timestamp);
+    archive_record r = full;
+    r.policy = cryptonote::archive_record_policy::header;
+    r.b = cryptonote::block();
+    static_cast<cryptonote::block_header&>(r.b) = full.b;
+    r.alt_chains.clear();
+    return r;
+  }
+
+  std::string tsv(const archive_record &record)
+  {
+    std::string line;
+    cryptonote::archive_line(record, line);
+    return line;
+  }
+
+  std::string binary(const archive_record &record)
+  {
+    std::string data;
+    EXPECT_TRUE(cryptonote::archive_binary_record(record, data));
+    return data;
+  }
+
+  // the same record as written before the block hash and n_tx_hashes were
+  // added to the fixed part
+  std::string binary_v1(const std::string &data)
+  {
+    std::string body = data.substr(cryptonote::ARCHIVE_BINARY_HEADER_SIZE);
+    body.erase(cryptonote::ARCHIVE_BINARY_FIXED_SIZE_V1, cryptonote::ARCHIVE_BINARY_FIXED_SIZE - cryptonote::ARCHIVE_BINARY_FIXED_SIZE_V1);
+    body[2] = cryptonote::ARCHIVE_BINARY_FIXED_SIZE_V1;
+    body[3] = 0;
+    std::string out;
+    cryptonote::archive_put_le(out, cryptonote::ARCHIVE_BINARY_MAGIC, 4);
+    cryptonote::archive_put_le(out, cryptonote::ARCHIVE_BINARY_VERSION, 2);
+    cryptonote::archive_put_le(out, cryptonote::ARCHIVE_BINARY_HEADER_SIZE, 2);
+    cryptonote::archive_put_le(out, body.size(), 4);
+    cryptonote::archive_put_le(out, cryptonote::archive_crc32c(0, body.data(), body.size()), 4);
+    return out + body;
+  }
+
+  void check_round_trip(const archive_record &record, const std::string &data)
+  {
+    archive_record decoded;
+    size_t consumed = 0;
+    ASSERT_EQ(archive_parse_result::ok, cryptonote::archive_parse_binary_record(data.data(), data.size(), decoded, consumed));
+    EXPECT_EQ(data.size(), consumed);
+    EXPECT_EQ(tsv(record), tsv(decoded));
+    EXPECT_EQ(record.block_height, decoded.block_height);
+    EXPECT_EQ(record.block_hash, decoded.block_hash);
+    EXPECT_EQ(record.n_tx_hashes, decoded.n_tx_hashes);
+    EXPECT_EQ(record.chain_height, decoded.chain_height);
+
+    // a record cut short is incomplete, not corrupt
+    EXPECT_EQ(archive_parse_result::incomplete, cryptonote::archive_parse_binary_record(data.data(), data.size() - 1, decoded, consumed));
+  }
+}
+
+TEST(archive_binary, full_round_trip)
+{
+  const archive_record record = full_record(1600000000123);
+  const std::string data = binary(record);
+  EXPECT_EQ(cryptonote::ARCHIVE_BINARY_HEADER_SIZE + cryptonote::ARCHIVE_BINARY_FIXED_SIZE + cryptonote::block_to_blob(record.b).size() +
+      2 * cryptonote::ARCHIVE_BINARY_ALT_CHAIN_SIZE, data.size());
+  check_round_trip(record, data);
+
+  size_t consumed = 0;
+  EXPECT_EQ(archive_parse_result::ok, cryptonote::archive_check_binary_record(data.data(), data.size(), consumed));
+  EXPECT_EQ(data.size(), consumed);
+}
+
+TEST(archive_binary, header_only_round_trip)
+{
+  const archive_record record = header_record(1600000000123);
+  const std::string data = binary(record);
+  EXPECT_EQ(cryptonote::ARCHIVE_FLAG_HEADER_ONLY, data[cryptonote::ARCHIVE_BINARY_HEADER_SIZE + 4] & cryptonote::ARCHIVE_FLAG_HEADER_ONLY);
+  check_round_trip(record, data);
+}
+
+TEST(archive_binary, v1_round_trip)
+{
+  // 72 byte fixed part: the hash and tx count come from the block blob
+  const archive_record record = full_record(1600000000123);
+  const std::string data = binary_v1(binary(record));
+  EXPECT_EQ(binary(record).size() - (cryptonote::ARCHIVE_BINARY_FIXED_SIZE - cryptonote::ARCHIVE_BINARY_FIXED_SIZE_V1), data.size());
+  check_round_trip(record, data);
+
+  // a header-only record has no blob to take them from
+  archive_record decoded;
+  size_t consumed = 0;
+  const std::string header_v1 = binary_v1(binary(header_record(1600000000123)));
+  EXPECT_EQ(archive_parse_result::corrupt, cryptonote::archive_parse_binary_record(header_v1.data(), header_v1.size(), decoded, consumed));
+}
+
+TEST(archive_binary, resync_after_corrupt_record)
+{
+  const archive_record first = full_record(1600000000001);
+  const archive_record second = header_record(1600000000002);
+  const archive_record third = full_record(1600000000003);
+  std::string corrupt = binary(second);
+  corrupt[cryptonote::ARCHIVE_BINARY_HEADER_SIZE + 8] ^= 0x01;  // NRT, covered by the CRC only
+
+  size_t consumed = 0;
+  EXPECT_EQ(archive_parse_result::corrupt, cryptonote::archive_check_binary_record(corrupt.data(), corrupt.size(), consumed));
+
+  const std::string data = binary(first) + corrupt + binary(third);
+  std::istringstream in(data);
+  cryptonote::archive_binary_reader reader(in);
+  archive_record record;
+  ASSERT_TRUE(reader.next(record));
+  EXPECT_EQ(tsv(first), tsv(record));
+  ASSERT_TRUE(reader.next(record));
+  EXPECT_EQ(tsv(third), tsv(record));
+  EXPECT_FALSE(reader.next(record));
+  EXPECT_EQ(1, reader.corrupt_records());
+  EXPECT_EQ(corrupt.size(), reader.skipped_bytes());
+  EXPECT_EQ(data.size(), reader.offset());
+}
+// </MonerodArchive>
+
+// ## File: tests/unit_tests/archive_tx_store.cpp (new file, with the Monero license header)
+
+// <MonerodArchive (Tx Store)>
+#include <fstream>
+#include <map>
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/archive_format.h"
+#include "cryptonote_core/archive_tx_store.h"
+
+namespace
+{
+  // a hash whose index key, its first 8 bytes, is prefix
+  crypto::hash tx_id(uint64_t prefix, uint8_t rest)
+  {
+    crypto::hash id;
+    std::string key;
+    cryptonote::archive_put_le(key, prefix, 8);
+    memcpy(id.data, key.data(), 8);
+    memset(id.data + 8, rest, sizeof(id.data) - 8);
+    return id;
+  }
+
+  // a miner tx blob; unlock_time makes each one distinct
+  cryptonote::archive_tx_blob tx_blob(uint64_t n)
+  {
+    cryptonote::transaction tx;
+    tx.version = 1;
+    tx.unlock_time = n;
+    tx.vin.push_back(cryptonote::txin_gen{(size_t)n});
+    cryptonote::archive_tx_blob blob;
+    blob.blob = cryptonote::tx_to_blob(tx);
+    return blob;
+  }
+
+  class archive_tx_store_test: public ::testing::Test
+  {
+  protected:
+    void SetUp() override
+    {
+      dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+      ASSERT_TRUE(boost::filesystem::create_directory(dir));
+      log = (dir / "txs.log").string();
+      index = cryptonote::archive_tx_index_filename(log);
+    }
+
+    void TearDown() override
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(dir, ec);
+    }
+
+    // the index only holds hash prefixes, so lookups check the full hash here
+    // as archive_tx_store does in the log
+    uint64_t find(const cryptonote::archive_tx_index &idx, const crypto::hash &id) const
+    {
+      return idx.find(id, [this, &id](uint64_t offset) { auto i = offsets.find(offset); return i != offsets.end() && i->second == id; });
+    }
+
+    bool insert(cryptonote::archive_tx_index &idx, const crypto::hash &id, uint64_t offset)
+    {
+      offsets[offset] = id;
+      return idx.insert(id, offset);
+    }
+
+    // stores batches of txs as the daemon does, and stops the store cleanly
+    void store_txs(const std::vector<std::vector<cryptonote::archive_tx_blob>> &batches, cryptonote::archive_tx_store::stats &s)
+    {
+      cryptonote::archive_tx_store_config config;
+      config.enabled = true;
+      config.filename = log;
+      config.initial_slots = 1024;
+      cryptonote::archive_tx_store store;
+      ASSERT_TRUE(store.start(config));
+      for (std::vector<cryptonote::archive_tx_blob> txs: batches)
+        store.push(txs);
+      store.stop();
+      s = store.get_stats();
+    }
+
+    boost::filesystem::path dir;
+    std::string log;
+    std::string index;
+    std::map<uint64_t, crypto::hash> offsets;
+  };
+}
+
+TEST_F(archive_tx_store_test, insert_across_grow)
+{
+  cryptonote::archive_tx_index idx;
+  ASSERT_TRUE(idx.create(index, 1024));
+  EXPECT_EQ(1024, idx.slots());
+
+  // spread over the table and in runs of neighbouring slots, which grow() must all move
+  const uint64_t n = 1500;
+  for (uint64_t i = 0; i < n; ++i)
+    ASSERT_TRUE(insert(idx, tx_id(i % 2 ? i * 0x9e3779b97f4a7c15 : i, i), 16 + i * 100));
+  EXPECT_EQ(4096, idx.slots());
+  EXPECT_EQ(n, idx.entries());
+  for (uint64_t i = 0; i < n; ++i)
+    EXPECT_EQ(16 + i * 100, find(idx, tx_id(i % 2 ? i * 0x9e3779b97f4a7c15 : i, i))) << i;
+  EXPECT_EQ(0, find(idx, tx_id(n, n)));
+
+  idx.set_log_size(16 + n * 100);
+  idx.close(true);
+  ASSERT_TRUE(idx.open(index, false));
+  EXPECT_TRUE(idx.was_clean());
+  EXPECT_EQ(4096, idx.slots());
+  EXPECT_EQ(n, idx.entries());
+  EXPECT_EQ(16 + n * 100, idx.log_size());
+  for (uint64_t i = 0; i < n; ++i)
+    EXPECT_EQ(16 + i * 100, find(idx, tx_id(i % 2 ? i * 0x9e3779b97f4a7c15 : i, i))) << i;
+}
+
+TEST_F(archive_tx_store_test, prefix_collision)
+{
+  cryptonote::archive_tx_index idx;
+  ASSERT_TRUE(idx.create(index, 1024));
+  const crypto::hash a = tx_id(0x0123456789abcdef, 0xaa);
+  const crypto::hash b = tx_id(0x0123456789abcdef, 0xbb);
+  const crypto::hash c = tx_id(0x0123456789abcdef, 0xcc);
+  ASSERT_TRUE(insert(idx, a, 100));
+  ASSERT_TRUE(insert(idx, b, 200));
+  EXPECT_EQ(100, find(idx, a));
+  EXPECT_EQ(200, find(idx, b));
+  EXPECT_EQ(0, find(idx, c));
+
+  // every candidate with the prefix is offered, in probe order
+  std::vector<uint64_t> candidates;
+  idx.find(c, [&candidates](uint64_t offset) { candidates.push_back(offset); return false; });
+  EXPECT_EQ(std::vector<uint64_t>({100, 200}), candidates);
+}
+
+TEST_F(archive_tx_store_test, reserved_keys)
+{
+  // key 0 marks an empty slot, so a hash starting with 8 zero bytes is
+  // stored under key 1 and shares it with hashes that really start with 1
+  cryptonote::archive_tx_index idx;
+  ASSERT_TRUE(idx.create(index, 1024));
+  const crypto::hash zero = tx_id(0, 0x11);
+  const crypto::hash one = tx_id(1, 0x22);
+  const crypto::hash null_hash = crypto::null_hash;
+  EXPECT_EQ(0, find(idx, zero));
+  ASSERT_TRUE(insert(idx, zero, 100));
+  ASSERT_TRUE(insert(idx, one, 200));
+  ASSERT_TRUE(insert(idx, null_hash, 300));
+  EXPECT_EQ(100, find(idx, zero));
+  EXPECT_EQ(200, find(idx, one));
+  EXPECT_EQ(300, find(idx, null_hash));
+  EXPECT_EQ(0, find(idx, tx_id(0, 0x33)));
+  EXPECT_EQ(0, find(idx, tx_id(1, 0x33)));
+  EXPECT_EQ(3, idx.entries());
+}
+
+TEST_F(archive_tx_store_test, reopen_after_unclean_close)
+{
+  std::vector<cryptonote::archive_tx_blob> first, second;
+  for (uint64_t i = 0; i < 10; ++i)
+    first.push_back(tx_blob(i));
+  for (uint64_t i = 5; i < 15; ++i)
+    second.push_back(tx_blob(i));
+  cryptonote::archive_tx_store::stats s;
+  store_txs({first}, s);
+  EXPECT_EQ(10, s.stored);
+  const uint64_t log_size = boost::filesystem::file_size(log);
+
+  // a crash: the index is left not clean, and the log has half an entry at its end
+  {
+    cryptonote::archive_tx_index idx;
+    ASSERT_TRUE(idx.open(index, true));
+    EXPECT_TRUE(idx.was_clean());
+    idx.close(false);
+    ASSERT_TRUE(idx.open(index, false));
+    EXPECT_FALSE(idx.was_clean());
+  }
+  std::ofstream(log, std::ios::binary | std::ios::app) << std::string(cryptonote::ARCHIVE_TX_ENTRY_HEADER_SIZE / 2, '\x5a');
+
+  // the index is rebuilt from the log, so txs already stored are still found as duplicates
+  store_txs({second}, s);
+  EXPECT_EQ(5, s.stored);
+  EXPECT_EQ(5, s.duplicates);
+  EXPECT_EQ(0, s.invalid);
+  EXPECT_EQ(log_size + s.bytes_stored, boost::filesystem::file_size(log));
+
+  cryptonote::archive_tx_store_reader reader;
+  ASSERT_TRUE(reader.open(log));
+  EXPECT_EQ(15, reader.size());
+  for (uint64_t i = 0; i < 15; ++i)
+  {
+    const cryptonote::archive_tx_blob tx = tx_blob(i);
+    cryptonote::transaction t;
+    crypto::hash id;
+    ASSERT_TRUE(cryptonote::parse_and_validate_tx_from_blob(tx.blob, t, id));
+    cryptonote::archive_tx_entry entry;
+    ASSERT_TRUE(reader.get(id, entry)) << i;
+    EXPECT_EQ(id, entry.id);
+    EXPECT_FALSE(entry.pruned);
+    EXPECT_EQ(tx.blob, entry.blob);
+  }
+}
+// </MonerodArchive>